@@ -750,6 +750,7 @@ static void initglobals(void)
   pc_optimize=sOPTIMIZE_DEFAULT;   /* sourcemod: full optimization */
   sc_packstr=TRUE;     /* strings are packed by default */
   sc_compress=FALSE;    /* always disable compact encoding! */
+  sc_imagecompression=1; /* zlib */
   sc_needsemicolon=FALSE;/* semicolon required to terminate expressions? */
   sc_require_newdecls = FALSE;
   sc_dataalign=sizeof(cell);
@@ -1031,6 +1032,11 @@ static void parseoptions(int argc,char **argv,char *oname,char *ename,char *pnam
             about();
         } /* if */
         break;
+      case 'z':
+        sc_imagecompression=*option_value(ptr,argv,argc,&arg) - '0';
+        if (sc_imagecompression<0 || sc_imagecompression>2)
+          about();
+        break;
       case '\\':                /* use \ instead for escape characters */
         sc_ctrlchar='\\';
         break;
@@ -1304,6 +1310,10 @@ static void about(void)
     pc_printf("         -E       treat warnings as errors\n");
     pc_printf("         -X<num>  abstract machine size limit in bytes\n");
     pc_printf("         -XD<num> abstract machine data/stack size limit in bytes\n");
+    pc_printf("         -z<num>  compression of the output file (default=-z%d)\n",sc_imagecompression);
+    pc_printf("             0    none\n");
+    pc_printf("             1    zlib, smallest output\n");
+    pc_printf("             2    LZ4, fastest loading\n");
     pc_printf("         -\\       use '\\' for escape characters\n");
     pc_printf("         -^       use '^' for escape characters\n");
     pc_printf("         -;<+/->  require a semicolon to end each statement (default=%c)\n", sc_needsemicolon ? '+' : '-');
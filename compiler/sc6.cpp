@@ -42,6 +42,7 @@
 #include <smx/smx-v1-opcodes.h>
 #include <zlib/zlib.h>
 #include "smx-builder.h"
+#include "smx-lz4.h"
 #include "memory-buffer.h"
 
 using namespace sp;
@@ -1008,9 +1009,30 @@ void assemble(const char *binfname, void *fin)
   MemoryBuffer buffer;
   assemble_to_buffer(&buffer, fin);
 
+  if (sc_imagecompression == SmxConsts::FILE_COMPRESSION_NONE) {
+    splat_to_binary(binfname, buffer.bytes(), buffer.size());
+    return;
+  }
+
   // Buffer compression logic. 
   sp_file_hdr_t *header = (sp_file_hdr_t *)buffer.bytes();
   size_t region_size = header->imagesize - header->dataoffs;
+
+  if (sc_imagecompression == SmxConsts::FILE_COMPRESSION_LZ4) {
+    uint8_t *lzbuf = (uint8_t *)malloc(Lz4CompressBound(region_size));
+    size_t lzsize = Lz4Compress(buffer.bytes() + header->dataoffs, region_size, lzbuf);
+
+    header->disksize = lzsize + header->dataoffs;
+    header->compression = SmxConsts::FILE_COMPRESSION_LZ4;
+
+    buffer.rewind(header->dataoffs);
+    buffer.write(lzbuf, lzsize);
+    free(lzbuf);
+
+    splat_to_binary(binfname, buffer.bytes(), buffer.size());
+    return;
+  }
+
   size_t zbuf_max = compressBound(region_size);
   Bytef *zbuf = (Bytef *)malloc(zbuf_max);
 
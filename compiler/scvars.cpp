@@ -64,6 +64,7 @@ int sc_packstr= FALSE;  /* strings are packed by default? */
 int sc_asmfile= FALSE;  /* create .ASM file? */
 int sc_listing= FALSE;  /* create .LST file? */
 int sc_compress=TRUE;   /* compress bytecode? */
+int sc_imagecompression=1; /* compression of the output file (zlib) */
 int sc_needsemicolon=TRUE;/* semicolon required to terminate expressions? */
 int sc_dataalign=sizeof(cell);/* data alignment value */
 int sc_alignnext=FALSE; /* must frame of the next function be aligned? */
@@ -20,10 +20,22 @@
 using namespace ke;
 using namespace sp;
 
+// Section contents start on a cell boundary, so a loader can run the code
+// straight out of the file image instead of copying it to aligned memory.
+static const size_t kSectionAlignment = sizeof(uint32_t);
+
 SmxBuilder::SmxBuilder()
 {
 }
 
+static bool
+WritePadding(ISmxBuffer *buf, size_t offset)
+{
+  static const uint8_t zeroes[kSectionAlignment] = {};
+  assert(offset >= buf->pos() && offset - buf->pos() < kSectionAlignment);
+  return buf->write(zeroes, offset - buf->pos());
+}
+
 bool
 SmxBuilder::write(ISmxBuffer *buf)
 {
@@ -42,13 +54,15 @@ SmxBuilder::write(ISmxBuffer *buf)
   header.dataoffs = header.disksize;
 
   size_t current_string_offset = 0;
+  for (size_t i = 0; i < sections_.length(); i++)
+    current_string_offset += sections_[i]->name().length() + 1;
+  header.dataoffs = Align(header.dataoffs + current_string_offset, kSectionAlignment);
+
+  header.disksize = header.dataoffs;
   for (size_t i = 0; i < sections_.length(); i++) {
-    Ref<SmxSection> section = sections_[i];
-    header.disksize += section->length();
-    current_string_offset += section->name().length() + 1;
+    header.disksize = Align(header.disksize, kSectionAlignment);
+    header.disksize += sections_[i]->length();
   }
-  header.disksize += current_string_offset;
-  header.dataoffs += current_string_offset;
 
   header.imagesize = header.disksize;
   header.sections = sections_.length();
@@ -60,18 +74,18 @@ SmxBuilder::write(ISmxBuffer *buf)
     return false;
 
   size_t current_offset = sizeof(header);
-  size_t current_data_offset = header.stringtab + current_string_offset;
+  size_t current_data_offset = header.dataoffs;
   current_string_offset = 0;
   for (size_t i = 0; i < sections_.length(); i++) {
     sp_file_section_t s;
     s.nameoffs = current_string_offset;
-    s.dataoffs = current_data_offset;
+    s.dataoffs = Align(current_data_offset, kSectionAlignment);
     s.size = sections_[i]->length();
     if (!buf->write(&s, sizeof(s)))
       return false;
 
     current_offset += sizeof(s);
-    current_data_offset += s.size;
+    current_data_offset = s.dataoffs + s.size;
     current_string_offset += sections_[i]->name().length() + 1;
   }
   assert(buf->pos() == current_offset);
@@ -87,6 +101,9 @@ SmxBuilder::write(ISmxBuffer *buf)
   assert(buf->pos() == current_offset);
 
   for (size_t i = 0; i < sections_.length(); i++) {
+    current_offset = Align(current_offset, kSectionAlignment);
+    if (!WritePadding(buf, current_offset))
+      return false;
     if (!sections_[i]->write(buf))
       return false;
     current_offset += sections_[i]->length();
@@ -0,0 +1,132 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include <am-utility.h>
+#include "smx-lz4.h"
+
+using namespace ke;
+
+// Limits imposed by the block format. A match is at least four bytes, must
+// start at least twelve bytes before the end of the block, and must leave
+// at least five bytes of literals at the end.
+static const size_t kMinMatch = 4;
+static const size_t kMatchStartLimit = 12;
+static const size_t kLastLiterals = 5;
+static const size_t kMaxOffset = 65535;
+
+static const size_t kHashBits = 16;
+
+static inline uint32_t
+Read32(const uint8_t *p)
+{
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t
+Hash(uint32_t value)
+{
+  return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+static uint8_t *
+WriteLength(uint8_t *out, size_t length)
+{
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = uint8_t(length);
+  return out;
+}
+
+// Writes one sequence: a run of literals, followed by a match unless this is
+// the last sequence in the block.
+static uint8_t *
+WriteSequence(uint8_t *out, const uint8_t *literals, size_t nliterals,
+              size_t offset, size_t match_length)
+{
+  uint8_t *token = out++;
+  *token = uint8_t((nliterals < 15 ? nliterals : 15) << 4);
+  if (nliterals >= 15)
+    out = WriteLength(out, nliterals - 15);
+  memcpy(out, literals, nliterals);
+  out += nliterals;
+
+  if (!match_length)
+    return out;
+
+  *out++ = uint8_t(offset);
+  *out++ = uint8_t(offset >> 8);
+
+  size_t length = match_length - kMinMatch;
+  *token |= uint8_t(length < 15 ? length : 15);
+  if (length >= 15)
+    out = WriteLength(out, length - 15);
+  return out;
+}
+
+size_t
+ke::Lz4CompressBound(size_t size)
+{
+  return size + size / 255 + 16;
+}
+
+size_t
+ke::Lz4Compress(const uint8_t *src, size_t size, uint8_t *dest)
+{
+  const uint8_t *end = src + size;
+  const uint8_t *anchor = src;
+  uint8_t *out = dest;
+
+  if (size > kMatchStartLimit) {
+    AutoArray<uint32_t> table(new uint32_t[size_t(1) << kHashBits]);
+    memset(table, 0, sizeof(uint32_t) << kHashBits);
+
+    const uint8_t *match_start_limit = end - kMatchStartLimit;
+    const uint8_t *match_end_limit = end - kLastLiterals;
+
+    // Greedy matching against the most recent position with the same hash.
+    const uint8_t *ip = src;
+    while (ip < match_start_limit) {
+      uint32_t value = Read32(ip);
+      uint32_t hash = Hash(value);
+      const uint8_t *ref = src + table[hash];
+      table[hash] = uint32_t(ip - src);
+
+      if (ref >= ip || size_t(ip - ref) > kMaxOffset || Read32(ref) != value) {
+        ip++;
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        ip--;
+        ref--;
+      }
+
+      const uint8_t *match_end = ip + kMinMatch;
+      const uint8_t *ref_end = ref + kMinMatch;
+      while (match_end < match_end_limit && *match_end == *ref_end) {
+        match_end++;
+        ref_end++;
+      }
+
+      out = WriteSequence(out, anchor, ip - anchor, ip - ref, match_end - ip);
+      ip = anchor = match_end;
+    }
+  }
+
+  out = WriteSequence(out, anchor, end - anchor, 0, 0);
+  return out - dest;
+}
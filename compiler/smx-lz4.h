@@ -0,0 +1,34 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_spcomp2_smx_lz4_h_
+#define _include_spcomp2_smx_lz4_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ke {
+
+// Encoder for FILE_COMPRESSION_LZ4, which stores the compressed region of an
+// image as a single LZ4 block. It compresses worse than zlib, but decodes
+// several times faster.
+
+// Returns the largest possible output size for |size| input bytes.
+size_t Lz4CompressBound(size_t size);
+
+// Compresses |size| bytes into |dest|, which must hold at least
+// Lz4CompressBound(size) bytes. Returns the number of bytes written.
+size_t Lz4Compress(const uint8_t *src, size_t size, uint8_t *dest);
+
+} // namespace ke
+
+#endif // _include_spcomp2_smx_lz4_h_
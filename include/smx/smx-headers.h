@@ -59,6 +59,7 @@ struct SmxConsts
   // Compression types.
   static const uint8_t FILE_COMPRESSION_NONE = 0;
   static const uint8_t FILE_COMPRESSION_GZ = 1;
+  static const uint8_t FILE_COMPRESSION_LZ4 = 2;
 
   // SourcePawn 1.
   static const uint8_t CODE_VERSION_JIT_1_0 = 9;
@@ -23,8 +23,8 @@
 #include "sp_vm_types.h"
 
 /** SourcePawn Engine API Versions */
-#define SOURCEPAWN_ENGINE2_API_VERSION 0xA
-#define SOURCEPAWN_API_VERSION   0x020A
+#define SOURCEPAWN_ENGINE2_API_VERSION 0x16
+#define SOURCEPAWN_API_VERSION   0x0216
 
 namespace SourceMod {
   struct IdentityToken_t;
@@ -42,6 +42,7 @@ namespace SourcePawn
   class IPluginRuntime;
   class ISourcePawnEngine2;
   class ISourcePawnEnvironment;
+  class INativeTable;
 
   /* Parameter flags */
   #define SM_PARAM_COPYBACK    (1<<0)    /**< Copy an array/reference back after call */
@@ -483,6 +484,88 @@ namespace SourcePawn
      * @brief Return the file or location this plugin was loaded from.
      */
     virtual const char *GetFilename() = 0;
+
+    /**
+     * @brief Update the native binding at the given index, and give the JIT
+     * a typed entry point to call instead of pfn. A fast native is called
+     * directly, with its arguments in registers or on the C stack, and
+     * without the params array, exit frame, or heap and error bookkeeping of
+     * an ordinary native call. In return, it must not call into any plugin,
+     * use the plugin's heap or stack, or fail; it is not given a context.
+     *
+     * pfn must still be provided. It is used by the interpreter, and by the
+     * JIT when the native is ephemeral or optional, or when a call does not
+     * pass exactly the number of arguments in the signature.
+     *
+     * @param index     Native index.
+     * @param pfn       Native function pointer.
+     * @param fast      Fast native signature, or NULL for an ordinary native.
+     * @param flags     Native flags.
+     * @param data      User data pointer.
+     * @return          Error code.
+     */
+    virtual int UpdateFastNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn,
+                                        const sp_fastnative_t *fast, uint32_t flags,
+                                        void *data) = 0;
+
+    /**
+     * @brief Bind the native at the given index directly to a public function,
+     * usually one in another plugin. Calls to the native enter the function
+     * without a host callback in between, and the JIT calls into the VM for
+     * them without a stub. The call still leaves the caller's code and
+     * invokes the function like any other call from C++; it is not inlined.
+     *
+     * The native's arguments are passed to the function as they are, so this
+     * is only correct for natives whose parameters are all passed by value;
+     * references and arrays would point into the wrong plugin's memory. The
+     * function's return value is the native's return value, and an error in
+     * the function is an error in the native's caller.
+     *
+     * If the function's plugin is unloaded, calls to the native throw
+     * SP_ERROR_INVALID_NATIVE. Bind the native as ephemeral or optional if it
+     * must be possible to rebind it afterward.
+     *
+     * @param index     Native index.
+     * @param target    Public function to call.
+     * @param flags     Native flags.
+     * @return          Error code.
+     */
+    virtual int LinkNativeToFunction(uint32_t index, IPluginFunction *target, uint32_t flags) = 0;
+
+    /**
+     * @brief Binds every unbound native in the plugin that has an entry in
+     * the given table. This is one hash lookup per native the plugin
+     * imports, rather than one FindNativeByName() call per native the host
+     * provides. It may be called once for each of several tables.
+     *
+     * Natives with no entry stay unbound. Their indices are stored in the
+     * unbound array, in order, so their names can be looked up with
+     * GetNative() for an error message, or they can be bound some other way.
+     *
+     * @param table       Table of natives.
+     * @param flags       Native flags for every native bound.
+     * @param unbound     Optional array to store the indices of natives that
+     *                    are still unbound afterward.
+     * @param maxunbound  Number of entries the unbound array can hold.
+     * @param numunbound  Optional pointer to store the number of natives that
+     *                    are still unbound afterward. This may be more than
+     *                    maxunbound, in which case the array holds the first
+     *                    maxunbound of them.
+     * @return            Error code.
+     */
+    virtual int BindNatives(INativeTable *table, uint32_t flags, uint32_t *unbound,
+                            uint32_t maxunbound, uint32_t *numunbound) = 0;
+
+    /**
+     * @brief Returns a function by a key from
+     * ISourcePawnEngine2::InternFunctionName(). This is an array lookup,
+     * rather than the name search done by GetFunctionByName().
+     *
+     * @param key       Interned function name key.
+     * @return          IPluginFunction pointer, NULL if the plugin has no
+     *                  public function by that name.
+     */
+    virtual IPluginFunction *GetFunctionByKey(uint32_t key) = 0;
   };
 
   /**
@@ -1301,6 +1384,199 @@ namespace SourcePawn
 
   class ExceptionHandler;
 
+  /**
+   * @brief Execution counters for a single function, used by tiered
+   * execution. See ISourcePawnEngine2::GetFunctionTierInfo().
+   */
+  struct FunctionTierInfo
+  {
+    uint32_t calls;        /**< Number of interpreted calls */
+    uint32_t backedges;    /**< Number of interpreted backward jumps */
+    bool compiled;         /**< True if the function has been JIT compiled */
+  };
+
+  /**
+   * @brief Operations the JIT can emit inline in place of calls to a native.
+   * See ISourcePawnEngine2::RegisterNativeIntrinsic(). Each is listed with
+   * the signature its native must have. Arrays are passed by reference, and
+   * float arrays are vectors of three floats.
+   */
+  enum SP_INTRINSIC
+  {
+    SP_INTRINSIC_NONE = 0,
+    SP_INTRINSIC_ABS,            /**< int(int value) */
+    SP_INTRINSIC_MIN,            /**< int(int a, int b) */
+    SP_INTRINSIC_MAX,            /**< int(int a, int b) */
+    SP_INTRINSIC_CLAMP,          /**< int(int value, int min, int max); min is tested first */
+    SP_INTRINSIC_BIT_TEST,       /**< bool(int value, int bit); bit is taken modulo 32 */
+    SP_INTRINSIC_BIT_COUNT,      /**< int(int value) */
+    SP_INTRINSIC_VECTOR_ADD,     /**< void(const float a[3], const float b[3], float result[3]) */
+    SP_INTRINSIC_VECTOR_SUB,     /**< void(const float a[3], const float b[3], float result[3]) */
+    SP_INTRINSIC_VECTOR_DOT,     /**< float(const float a[3], const float b[3]) */
+    SP_INTRINSIC_VECTOR_LENGTH,  /**< float(const float vec[3], bool squared) */
+    SP_INTRINSIC_STRLEN,         /**< int(const char[] str); length in bytes */
+    SP_INTRINSICS_TOTAL
+  };
+
+  /**
+   * @brief How a forward combines the return values of its functions.
+   */
+  enum SP_FORWARD_TYPE
+  {
+    SP_FORWARD_LAST = 0,   /**< Call every function; the result is the last return value */
+    SP_FORWARD_MAX,        /**< Call every function; the result is the highest return value */
+    SP_FORWARD_STOP        /**< As SP_FORWARD_MAX, but stop once a function returns the stop value or higher */
+  };
+
+  /**
+   * @brief Calls one public function in each of many plugins, with one set of
+   * parameters. This does the same work as pushing the parameters to each
+   * function and executing it, but the per-call setup is done once for the
+   * whole forward.
+   *
+   * Parameters are pushed as for any other call. Arrays and strings are
+   * copied into each plugin's heap before its function is called, and copied
+   * back afterward if requested, so each function sees the changes made by
+   * the ones before it.
+   *
+   * Functions are called in the order they were added. Paused plugins are
+   * skipped. A function that throws an error is skipped as well; the error
+   * is reported as usual, and Execute() returns the first error.
+   *
+   * A forward holds plain references to its plugins; a plugin must be
+   * removed with RemoveRuntime() before it is destroyed. Forwards are
+   * freed with the delete keyword.
+   */
+  class IPluginForward : public ICallable
+  {
+   public:
+    virtual ~IPluginForward()
+    {}
+
+    /**
+     * @brief Adds a public function to the end of the forward.
+     *
+     * @param runtime     Plugin runtime.
+     * @param funcid      Id of a public function in the runtime.
+     * @return            Error code, if any.
+     */
+    virtual int AddFunction(IPluginRuntime *runtime, funcid_t funcid) =0;
+
+    /**
+     * @brief Removes a function from the forward.
+     *
+     * @param runtime     Plugin runtime.
+     * @param funcid      Function id.
+     * @return            True if the function was found.
+     */
+    virtual bool RemoveFunction(IPluginRuntime *runtime, funcid_t funcid) =0;
+
+    /**
+     * @brief Removes every function belonging to a plugin.
+     *
+     * @param runtime     Plugin runtime.
+     */
+    virtual void RemoveRuntime(IPluginRuntime *runtime) =0;
+
+    /**
+     * @brief Returns the number of functions in the forward.
+     */
+    virtual size_t GetFunctionCount() =0;
+
+    /**
+     * @brief Calls each function with the pushed parameters, and resets the
+     * parameter list. Functions added or removed by a function while the
+     * forward is executing may or may not be called.
+     *
+     * @param result      Optional pointer to store the combined result, or 0
+     *                    if no function was called.
+     * @return            Error code of the first function that failed, if any.
+     */
+    virtual int Execute(cell_t *result) =0;
+  };
+
+  /**
+   * @brief A name-indexed table of host natives, for binding to many plugins
+   * with IPluginRuntime::BindNatives(). The table holds plain pointers to
+   * the names it is given, so they must outlive it, as sp_nativeinfo_t
+   * arrays usually do. Tables are freed with the delete keyword.
+   */
+  class INativeTable
+  {
+   public:
+    virtual ~INativeTable()
+    {}
+
+    /**
+     * @brief Adds natives to the table. If a name is already in the table,
+     * the existing entry is kept.
+     *
+     * @param natives     Array of natives. Entries after one with a NULL name
+     *                    are ignored.
+     * @param count       Number of entries in the array.
+     * @return            False if out of memory.
+     */
+    virtual bool AddNatives(const sp_nativeinfo_t *natives, size_t count) =0;
+
+    /**
+     * @brief Finds a native by name.
+     *
+     * @param name        Native name.
+     * @return            Native function, or NULL if not found.
+     */
+    virtual SPVM_NATIVE_FUNC FindNative(const char *name) =0;
+
+    /**
+     * @brief Returns the number of natives in the table.
+     */
+    virtual size_t NumNatives() =0;
+  };
+
+  /**
+   * @brief A set of plugin files being loaded on worker threads. Reading,
+   * decompressing and validating each file happens in the background. The
+   * runtime itself is created by FinishLoading(), on the calling thread, so
+   * it is registered with the environment and has its natives bound as
+   * usual.
+   *
+   * Loaders are freed with the delete keyword, which waits for the workers
+   * to stop. Files that were never finished are discarded.
+   */
+  class IPluginLoader
+  {
+   public:
+    virtual ~IPluginLoader()
+    {}
+
+    /**
+     * @brief Returns the number of files in the loader.
+     */
+    virtual size_t GetFileCount() =0;
+
+    /**
+     * @brief Returns the path of a file, as it was given to the loader.
+     *
+     * @param index       File index.
+     * @return            File path, or NULL if the index is invalid.
+     */
+    virtual const char *GetFilePath(size_t index) =0;
+
+    /**
+     * @brief Waits for a file to be loaded, and creates its runtime. If no
+     * worker has started on the file yet, it is loaded on the calling thread
+     * instead of waiting. Each file can only be finished once.
+     *
+     * Files are loaded roughly in order, so finishing them in order waits
+     * the least.
+     *
+     * @param index       File index.
+     * @param error       Buffer to store an error message (optional).
+     * @param maxlength   Maximum length of the error buffer.
+     * @return            New runtime pointer, or NULL on failure.
+     */
+    virtual IPluginRuntime *FinishLoading(size_t index, char *error, size_t maxlength) =0;
+  };
+
   /** 
    * @brief Outlines the interface a Virtual Machine (JIT) must expose
    */
@@ -1469,6 +1745,195 @@ namespace SourcePawn
      * @brief Returns the environment.
      */
     virtual ISourcePawnEnvironment *Environment() = 0;
+
+    /**
+     * @brief Sets the thresholds for tiered execution. When either threshold
+     * is non-zero and the JIT is enabled, functions start out in the
+     * interpreter and are compiled once they have been called, or have
+     * looped, the given number of times. A threshold of zero disables that
+     * counter. If both are zero (the default), every function is compiled
+     * before it first runs.
+     *
+     * @param calls      Number of calls before a function is compiled.
+     * @param backedges  Number of backward jumps before a function is compiled.
+     */
+    virtual void SetTieringThresholds(uint32_t calls, uint32_t backedges) = 0;
+
+    /**
+     * @brief Returns the thresholds for tiered execution.
+     *
+     * @param calls      Optional pointer to store the call threshold.
+     * @param backedges  Optional pointer to store the backedge threshold.
+     */
+    virtual void GetTieringThresholds(uint32_t *calls, uint32_t *backedges) = 0;
+
+    /**
+     * @brief Returns the tiered execution counters for a function.
+     *
+     * @param function   Function to query.
+     * @param info       Buffer to store the counters.
+     * @return           True on success, false if the function is not a
+     *                   scripted function.
+     */
+    virtual bool GetFunctionTierInfo(IPluginFunction *function, FunctionTierInfo *info) = 0;
+
+    /**
+     * @brief Sets the number of worker threads used to compile plugins in
+     * the background. When non-zero, every function in a plugin is queued
+     * for compilation as soon as the plugin is loaded, and compiled code is
+     * linked in on the main thread as it becomes ready. Functions that are
+     * called before they are ready are compiled on demand, as usual.
+     *
+     * The workers are shared by all plugins. Raising the count starts more
+     * of them when the next plugin runs; lowering it does not stop any.
+     *
+     * This has no effect if the JIT is disabled, or if tiered execution is
+     * enabled. The default is zero, which compiles functions only on demand.
+     *
+     * @param threads    Number of worker threads, or 0 to disable.
+     */
+    virtual void SetBackgroundCompileThreads(uint32_t threads) = 0;
+
+    /**
+     * @brief Returns the number of background compilation threads.
+     *
+     * @return           Number of worker threads per plugin, or 0 if disabled.
+     */
+    virtual uint32_t GetBackgroundCompileThreads() = 0;
+
+    /**
+     * @brief Sets a directory in which to cache JIT output. Compiled code is
+     * saved per plugin, keyed by the hash of its code section, and reused
+     * the next time an identical plugin is loaded by the same build of the
+     * VM. The directory must already exist.
+     *
+     * Cached code is executed as-is, so the directory must not be writable
+     * by anyone who should not be able to run code in this process.
+     *
+     * This only affects plugins loaded after the call. Not every platform
+     * supports caching; where it is unsupported, this has no effect.
+     *
+     * @param path       Directory path, or NULL to disable caching.
+     */
+    virtual void SetCodeCacheDirectory(const char *path) = 0;
+
+    /**
+     * @brief Returns the code cache directory.
+     *
+     * @return           Directory path, or an empty string if disabled.
+     */
+    virtual const char *GetCodeCacheDirectory() = 0;
+
+    /**
+     * @brief Declares that a native computes an intrinsic, so that the JIT
+     * may emit the intrinsic inline instead of calling the native. Inline
+     * code does not enter the native at all, so the native must behave
+     * exactly as the intrinsic is documented, with no side effects.
+     *
+     * Calls are only replaced if the native is bound when the caller is
+     * compiled, is not ephemeral or optional, and is passed the number of
+     * arguments the intrinsic takes. An array argument that is not a valid
+     * address raises SP_ERROR_MEMACCESS. The interpreter always calls the
+     * native.
+     *
+     * This only affects plugins loaded after the call.
+     *
+     * @param name       Native name.
+     * @param intrinsic  Intrinsic, or SP_INTRINSIC_NONE to remove it.
+     * @return           False if the intrinsic is not recognized.
+     */
+    virtual bool RegisterNativeIntrinsic(const char *name, SP_INTRINSIC intrinsic) = 0;
+
+    /**
+     * @brief Creates an empty forward.
+     *
+     * @param type       How return values are combined.
+     * @param stop_value For SP_FORWARD_STOP, the return value at which to
+     *                   stop calling functions. Ignored otherwise.
+     * @return           New forward, or NULL if the type is not recognized.
+     */
+    virtual IPluginForward *CreateForward(SP_FORWARD_TYPE type, cell_t stop_value) = 0;
+
+    /**
+     * @brief Creates an empty native table.
+     *
+     * @return           New native table.
+     */
+    virtual INativeTable *CreateNativeTable() = 0;
+
+    /**
+     * @brief Interns a public function name, for use with
+     * IPluginRuntime::GetFunctionByKey(). Interning the same name again
+     * returns the same key, and keys stay valid for the life of the engine.
+     *
+     * Hosts that call the same public in every plugin should intern its
+     * name once, rather than calling GetFunctionByName() on each plugin.
+     *
+     * @param name       Function name.
+     * @param key        Pointer to store the key.
+     * @return           Error code.
+     */
+    virtual int InternFunctionName(const char *name, uint32_t *key) = 0;
+
+    /**
+     * @brief Sets whether uncompressed plugin files are mapped into memory
+     * when loaded, rather than read into a buffer. The code and tables of a
+     * mapped plugin are used in place. Its data is still copied into each
+     * context, since contexts write to it. Compressed plugins, which spcomp
+     * writes by default, are always read, since they are decompressed into
+     * memory of their own; compile with -z0 to use this.
+     *
+     * A mapped file must not be truncated or rewritten in place while the
+     * plugin is loaded; doing so may crash the process. Replace plugin files
+     * by writing a new file and renaming it over the old one.
+     *
+     * This only affects plugins loaded after the call. Where mapping is
+     * unsupported or fails, files are read as usual. The default is off.
+     *
+     * @param enabled    True to map plugin files, false to read them.
+     */
+    virtual void SetFileMappingEnabled(bool enabled) = 0;
+
+    /**
+     * @brief Returns whether plugin files are mapped into memory.
+     *
+     * @return           True if enabled, false otherwise.
+     */
+    virtual bool IsFileMappingEnabled() = 0;
+
+    /**
+     * @brief Sets whether plugins with identical data sections share them.
+     * The initial data is kept once, in memory, and each plugin maps it
+     * copy-on-write, so only the pages a plugin writes to are duplicated.
+     * This helps when the same plugin is loaded many times, or when plugins
+     * carry large constant tables.
+     *
+     * This only affects plugins loaded after the call. Where sharing is
+     * unsupported, data is copied as usual. The default is off.
+     *
+     * @param enabled    True to share data sections, false to copy them.
+     */
+    virtual void SetSharedDataEnabled(bool enabled) = 0;
+
+    /**
+     * @brief Returns whether identical data sections are shared.
+     *
+     * @return           True if enabled, false otherwise.
+     */
+    virtual bool IsSharedDataEnabled() = 0;
+
+    /**
+     * @brief Starts loading many plugins from disk. Each file is read and
+     * validated as by LoadBinaryFromFile(), but on worker threads, so that
+     * independent files load in parallel; see IPluginLoader.
+     *
+     * @param files     Array of file paths. The paths are copied.
+     * @param count     Number of files.
+     * @param threads   Maximum number of worker threads. If 0, each file is
+     *                  loaded when it is finished.
+     * @return          New loader.
+     */
+    virtual IPluginLoader *LoadBinariesFromFiles(const char * const *files, size_t count, size_t threads) = 0;
   };
 
   // @brief This class is the v3 API for SourcePawn. It provides access to
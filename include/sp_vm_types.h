@@ -152,6 +152,7 @@ typedef struct sp_pubvar_s
 
 #define SP_NTVFLAG_OPTIONAL		(1<<0)	/**< Native is optional */
 #define SP_NTVFLAG_EPHEMERAL		(1<<1)	/**< Native can be unbound */
+#define SP_NTVFLAG_LEAF			(1<<2)	/**< Native never throws, calls into a plugin, or uses the heap */
 
 /** 
  * @brief Information about a native entry in a plugin.
@@ -191,6 +192,29 @@ typedef struct sp_nativeinfo_s
 	SPVM_NATIVE_FUNC func;	/**< Address of native implementation */
 } sp_nativeinfo_t;
 
+/**
+ * @brief Argument and return types in the C signature of a fast native.
+ */
+enum SP_FASTARG
+{
+	SP_FASTARG_CELL = 0,	/**< cell_t, passed by value */
+	SP_FASTARG_FLOAT,	/**< float, passed by value */
+	SP_FASTARG_REF		/**< cell_t *, the physical address of a reference or array argument */
+};
+
+#define SP_FASTNATIVE_MAX_ARGS	4	/**< Maximum number of arguments to a fast native */
+
+/**
+ * @brief The C signature of a fast native; see IPluginRuntime::UpdateFastNativeBinding().
+ */
+typedef struct sp_fastnative_s
+{
+	void *		func;		/**< Address of the native, called with the default C calling convention */
+	uint32_t	ret;		/**< Return type; SP_FASTARG_CELL or SP_FASTARG_FLOAT */
+	uint32_t	nargs;		/**< Number of arguments */
+	uint32_t	args[SP_FASTNATIVE_MAX_ARGS];	/**< Argument types */
+} sp_fastnative_t;
+
 /** 
  * @brief Run-time debug file table
  */
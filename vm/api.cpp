@@ -14,7 +14,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <assert.h>
-#include "x86/jit_x86.h"
+#include "jit.h"
 #include "environment.h"
 #include "api.h"
 #include <zlib/zlib.h>
@@ -39,6 +39,9 @@
 #endif
 #include "code-stubs.h"
 #include "smx-v1-image.h"
+#include "scripted-forward.h"
+#include "native-table.h"
+#include "plugin-loader.h"
 
 using namespace sp;
 using namespace SourcePawn;
@@ -237,49 +240,21 @@ SourcePawnEngine2::LoadPlugin(ICompilation *co, const char *file, int *err)
 IPluginRuntime *
 SourcePawnEngine2::LoadBinaryFromFile(const char *file, char *error, size_t maxlength)
 {
-  FILE *fp = fopen(file, "rb");
-
-  if (!fp) {
-    UTIL_Format(error, maxlength, "file not found");
-    return nullptr;
-  }
-
-  ke::AutoPtr<SmxV1Image> image(new SmxV1Image(fp));
-  fclose(fp);
-
-  if (!image->validate()) {
-    const char *errorMessage = image->errorMessage();
-    if (!errorMessage)
-      errorMessage = "file parse error";
-    UTIL_Format(error, maxlength, "%s", errorMessage);
+  bool map = Environment::get()->IsFileMappingEnabled();
+  SmxV1Image *image = LoadPluginImage(file, map, error, maxlength);
+  if (!image)
     return nullptr;
-  }
-
-  PluginRuntime *pRuntime = new PluginRuntime(image.take());
-  if (!pRuntime->Initialize()) {
-    delete pRuntime;
-
-    UTIL_Format(error, maxlength, "out of memory");
-    return nullptr;
-  }
 
-  size_t len = strlen(file);
-  for (size_t i = len - 1; i < len; i--) {
-    if (file[i] == '/' 
-# if defined WIN32
-      || file[i] == '\\'
-# endif
-    )
-    {
-      pRuntime->SetNames(file, &file[i + 1]);
-      break;
-    }
-  }
-
-  if (!pRuntime->Name())
-    pRuntime->SetNames(file, file);
+  return CreatePluginRuntime(image, file, error, maxlength);
+}
 
-  return pRuntime;
+IPluginLoader *
+SourcePawnEngine2::LoadBinariesFromFiles(const char * const *files, size_t count, size_t threads)
+{
+  bool map = Environment::get()->IsFileMappingEnabled();
+  PluginLoader *loader = new PluginLoader(files, count, map);
+  loader->Start(threads);
+  return loader;
 }
 
 SPVM_NATIVE_FUNC
@@ -301,7 +276,7 @@ SourcePawnEngine2::DestroyFakeNative(SPVM_NATIVE_FUNC func)
 const char *
 SourcePawnEngine2::GetEngineName()
 {
-  return "SourcePawn 1.8, jit-x86";
+  return "SourcePawn 1.8, jit-" SP_JIT_ARCH_NAME;
 }
 
 const char *
@@ -412,3 +387,117 @@ SourcePawnEngine2::Environment()
 {
   return Environment::get();
 }
+
+void
+SourcePawnEngine2::SetTieringThresholds(uint32_t calls, uint32_t backedges)
+{
+  Environment::get()->SetTieringThresholds(calls, backedges);
+}
+
+void
+SourcePawnEngine2::GetTieringThresholds(uint32_t *calls, uint32_t *backedges)
+{
+  if (calls)
+    *calls = Environment::get()->tier_up_calls();
+  if (backedges)
+    *backedges = Environment::get()->tier_up_backedges();
+}
+
+bool
+SourcePawnEngine2::GetFunctionTierInfo(IPluginFunction *function, FunctionTierInfo *info)
+{
+  ScriptedInvoker *invoker = static_cast<ScriptedInvoker *>(function);
+  if (!invoker->Public())
+    return false;
+
+  PluginRuntime *rt = static_cast<PluginRuntime *>(invoker->GetParentRuntime());
+  cell_t code_offs = invoker->Public()->code_offs;
+
+  info->calls = 0;
+  info->backedges = 0;
+  if (InterpretedFunction *fn = rt->GetInterpretedFunctionByOffset(code_offs)) {
+    info->calls = fn->calls();
+    info->backedges = fn->backedges();
+  }
+  info->compiled = !!rt->GetJittedFunctionByOffset(code_offs);
+  return true;
+}
+
+void
+SourcePawnEngine2::SetBackgroundCompileThreads(uint32_t threads)
+{
+  Environment::get()->SetBackgroundCompileThreads(threads);
+}
+
+uint32_t
+SourcePawnEngine2::GetBackgroundCompileThreads()
+{
+  return Environment::get()->background_compile_threads();
+}
+
+void
+SourcePawnEngine2::SetCodeCacheDirectory(const char *path)
+{
+  Environment::get()->SetCodeCacheDirectory(path);
+}
+
+const char *
+SourcePawnEngine2::GetCodeCacheDirectory()
+{
+  return Environment::get()->code_cache_dir();
+}
+
+bool
+SourcePawnEngine2::RegisterNativeIntrinsic(const char *name, SP_INTRINSIC intrinsic)
+{
+  return Environment::get()->RegisterNativeIntrinsic(name, intrinsic);
+}
+
+IPluginForward *
+SourcePawnEngine2::CreateForward(SP_FORWARD_TYPE type, cell_t stop_value)
+{
+  switch (type) {
+    case SP_FORWARD_LAST:
+    case SP_FORWARD_MAX:
+    case SP_FORWARD_STOP:
+      return new ScriptedForward(type, stop_value);
+    default:
+      return nullptr;
+  }
+}
+
+INativeTable *
+SourcePawnEngine2::CreateNativeTable()
+{
+  return new NativeTable();
+}
+
+int
+SourcePawnEngine2::InternFunctionName(const char *name, uint32_t *key)
+{
+  return Environment::get()->InternFunctionName(name, key);
+}
+
+void
+SourcePawnEngine2::SetFileMappingEnabled(bool enabled)
+{
+  Environment::get()->SetFileMappingEnabled(enabled);
+}
+
+bool
+SourcePawnEngine2::IsFileMappingEnabled()
+{
+  return Environment::get()->IsFileMappingEnabled();
+}
+
+void
+SourcePawnEngine2::SetSharedDataEnabled(bool enabled)
+{
+  Environment::get()->SetSharedDataEnabled(enabled);
+}
+
+bool
+SourcePawnEngine2::IsSharedDataEnabled()
+{
+  return Environment::get()->IsSharedDataEnabled();
+}
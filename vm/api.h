@@ -68,7 +68,23 @@ class SourcePawnEngine2 : public ISourcePawnEngine2
   void DisableProfiling() KE_OVERRIDE;
   void SetProfilingTool(IProfilingTool *tool) KE_OVERRIDE;
   IPluginRuntime *LoadBinaryFromFile(const char *file, char *error, size_t maxlength) KE_OVERRIDE;
+  IPluginLoader *LoadBinariesFromFiles(const char * const *files, size_t count, size_t threads) KE_OVERRIDE;
   ISourcePawnEnvironment *Environment() KE_OVERRIDE;
+  void SetTieringThresholds(uint32_t calls, uint32_t backedges) KE_OVERRIDE;
+  void GetTieringThresholds(uint32_t *calls, uint32_t *backedges) KE_OVERRIDE;
+  bool GetFunctionTierInfo(IPluginFunction *function, FunctionTierInfo *info) KE_OVERRIDE;
+  void SetBackgroundCompileThreads(uint32_t threads) KE_OVERRIDE;
+  uint32_t GetBackgroundCompileThreads() KE_OVERRIDE;
+  void SetCodeCacheDirectory(const char *path) KE_OVERRIDE;
+  const char *GetCodeCacheDirectory() KE_OVERRIDE;
+  bool RegisterNativeIntrinsic(const char *name, SP_INTRINSIC intrinsic) KE_OVERRIDE;
+  IPluginForward *CreateForward(SP_FORWARD_TYPE type, cell_t stop_value) KE_OVERRIDE;
+  INativeTable *CreateNativeTable() KE_OVERRIDE;
+  int InternFunctionName(const char *name, uint32_t *key) KE_OVERRIDE;
+  void SetFileMappingEnabled(bool enabled) KE_OVERRIDE;
+  bool IsFileMappingEnabled() KE_OVERRIDE;
+  void SetSharedDataEnabled(bool enabled) KE_OVERRIDE;
+  bool IsSharedDataEnabled() KE_OVERRIDE;
 };
 
 extern size_t UTIL_Format(char *buffer, size_t maxlength, const char *fmt, ...);
@@ -150,11 +150,17 @@ class Assembler
   bool outOfMemory_;
 };
 
+// An address outside of the code being assembled. Such addresses usually
+// differ from one process to the next, so code that embeds them can only be
+// reused elsewhere if it knows how to find them again. |reloc| is an opaque
+// tag, chosen by the JIT, that names the address for this purpose; zero
+// means it has no name.
 class ExternalAddress
 {
  public:
-  explicit ExternalAddress(void *p)
-    : p_(p)
+  explicit ExternalAddress(void *p, uint32_t reloc = 0)
+    : p_(p),
+      reloc_(reloc)
   {
   }
 
@@ -164,9 +170,21 @@ class ExternalAddress
   uintptr_t value() const {
     return uintptr_t(p_);
   }
+  uint32_t reloc() const {
+    return reloc_;
+  }
 
  private:
   void *p_;
+  uint32_t reloc_;
+};
+
+// Where an ExternalAddress was embedded in assembled code. |offset| is the
+// position just past the embedded address.
+struct ExternalRef
+{
+  uint32_t offset;
+  uint32_t reloc;
 };
 
 // A label is a lightweight object to assist in managing relative jumps. It
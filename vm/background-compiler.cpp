@@ -0,0 +1,240 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "background-compiler.h"
+#include "code-cache.h"
+#include "environment.h"
+#include "function-analysis.h"
+#include "jit.h"
+#include "opcodes.h"
+#include "plugin-runtime.h"
+
+using namespace sp;
+
+BackgroundCompiler::BackgroundCompiler(PluginRuntime *rt)
+ : env_(Environment::get()),
+   rt_(rt),
+   pool_(nullptr),
+   next_function_(0),
+   completed_(0),
+   active_(0)
+{
+}
+
+BackgroundCompiler::~BackgroundCompiler()
+{
+  if (pool_)
+    pool_->Remove(this);
+  for (size_t i = 0; i < finished_.length(); i++)
+    delete finished_[i];
+}
+
+bool
+BackgroundCompiler::Initialize()
+{
+  // Walk the code section one instruction at a time, noting where each
+  // function begins. If anything does not decode, stop there: whatever is
+  // left will be compiled, and its error reported, on first use.
+  const cell_t *code_start = reinterpret_cast<const cell_t *>(rt_->code().bytes);
+  const cell_t *code_end = code_start + rt_->code().length / sizeof(cell_t);
+  for (const cell_t *cip = code_start; cip < code_end;) {
+    if (*cip == OP_ENDPROC) {
+      cip++;
+      continue;
+    }
+    if (*cip == OP_PROC) {
+      // Cached functions are cheap enough to load on demand.
+      cell_t pcode_offset = cell_t(cip - code_start) * sizeof(cell_t);
+      CodeCache *cache = rt_->code_cache();
+      if (!cache || !cache->Find(pcode_offset))
+        functions_.append(pcode_offset);
+    }
+
+    size_t count;
+    if (FunctionAnalysis::OperandCount(cip, code_end, &count) != SP_ERROR_NONE)
+      break;
+    if (count >= size_t(code_end - cip))
+      break;
+    cip += count + 1;
+  }
+  return functions_.length() > 0;
+}
+
+bool
+BackgroundCompiler::Link()
+{
+  if (!pool_) {
+    BackgroundCompilerPool *pool = env_->compile_pool();
+    if (!pool->Enqueue(this))
+      return true;
+    pool_ = pool;
+    return false;
+  }
+
+  ke::Vector<Compiler *> finished;
+  bool done;
+  {
+    ke::AutoLock lock(pool_->lock());
+    for (size_t i = 0; i < finished_.length(); i++)
+      finished.append(finished_[i]);
+    finished_.clear();
+    done = (completed_ == functions_.length());
+  }
+
+  for (size_t i = 0; i < finished.length(); i++) {
+    ke::AutoPtr<Compiler> cc(finished[i]);
+
+    // The main thread may have needed this function before it was ready,
+    // and compiled it itself.
+    if (rt_->GetJittedFunctionByOffset(cc->pcode_offset()))
+      continue;
+
+    int err;
+    CompiledFunction *fn = cc->link(&err);
+    if (!fn)
+      continue;
+
+    {
+      // The watchdog timer looks at this list on another thread.
+      ke::AutoLock lock(env_->lock());
+      rt_->AddJittedFunction(fn);
+    }
+
+    uint8_t *code = reinterpret_cast<uint8_t *>(fn->GetEntryAddress());
+    const ke::Vector<CallThunk *> &thunks = cc->callThunks();
+    for (size_t j = 0; j < thunks.length(); j++) {
+      CallSite site;
+      site.pc = code + thunks[j]->return_pc;
+      site.pcode_offset = thunks[j]->pcode_offset;
+      call_sites_.append(site);
+    }
+  }
+
+  if (finished.length() || done)
+    patchCallSites();
+  return done;
+}
+
+// Point calls straight at any targets that have been linked, so they never
+// have to go through CompileFromThunk.
+void
+BackgroundCompiler::patchCallSites()
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < call_sites_.length(); i++) {
+    const CallSite &site = call_sites_[i];
+    if (CompiledFunction *callee = rt_->GetJittedFunctionByOffset(site.pcode_offset))
+      PatchCallThunk(site.pc, callee);
+    else
+      call_sites_[kept++] = site;
+  }
+  while (call_sites_.length() > kept)
+    call_sites_.pop();
+}
+
+BackgroundCompilerPool::BackgroundCompilerPool(Environment *env)
+ : env_(env),
+   shutdown_(false)
+{
+}
+
+BackgroundCompilerPool::~BackgroundCompilerPool()
+{
+  {
+    ke::AutoLock lock(&cv_);
+    assert(queues_.empty());
+    shutdown_ = true;
+    cv_.NotifyAll();
+  }
+
+  for (size_t i = 0; i < threads_.length(); i++) {
+    threads_[i]->Join();
+    delete threads_[i];
+  }
+}
+
+bool
+BackgroundCompilerPool::Enqueue(BackgroundCompiler *bc)
+{
+  assert(bc->functions_.length() > 0);
+
+  // The thread count may have been raised since the last plugin started.
+  while (threads_.length() < env_->background_compile_threads()) {
+    ke::Thread *thread = new ke::Thread(this, "SP Compiler");
+    if (!thread->Succeeded()) {
+      delete thread;
+      break;
+    }
+    threads_.append(thread);
+  }
+  if (threads_.empty())
+    return false;
+
+  ke::AutoLock lock(&cv_);
+  queues_.append(bc);
+  cv_.NotifyAll();
+  return true;
+}
+
+void
+BackgroundCompilerPool::Remove(BackgroundCompiler *bc)
+{
+  ke::AutoLock lock(&cv_);
+  for (size_t i = 0; i < queues_.length(); i++) {
+    if (queues_[i] == bc) {
+      queues_.remove(i);
+      break;
+    }
+  }
+
+  // Workers still hold the runtime of any function they took.
+  while (bc->active_)
+    cv_.Wait();
+}
+
+void
+BackgroundCompilerPool::Run()
+{
+  for (;;) {
+    BackgroundCompiler *bc;
+    cell_t pcode_offset;
+    {
+      ke::AutoLock lock(&cv_);
+      while (!shutdown_ && queues_.empty())
+        cv_.Wait();
+      if (shutdown_)
+        return;
+
+      bc = queues_[0];
+      pcode_offset = bc->functions_[bc->next_function_++];
+      if (bc->next_function_ == bc->functions_.length())
+        queues_.remove(0);
+      bc->active_++;
+    }
+
+    // Functions that fail to assemble are dropped; they will fail again on
+    // the main thread, which reports the error.
+    int err;
+    Compiler *cc = new Compiler(bc->rt_, pcode_offset, true);
+    if (!cc->assemble(&err)) {
+      delete cc;
+      cc = nullptr;
+    }
+
+    ke::AutoLock lock(&cv_);
+    if (cc)
+      bc->finished_.append(cc);
+    bc->completed_++;
+    if (--bc->active_ == 0)
+      cv_.NotifyAll();
+  }
+}
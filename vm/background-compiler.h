@@ -0,0 +1,116 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_background_compiler_h_
+#define _include_sourcepawn_vm_background_compiler_h_
+
+#include <sp_vm_types.h>
+#include <am-vector.h>
+#include <am-thread-utils.h>
+
+namespace sp {
+
+class BackgroundCompilerPool;
+class Compiler;
+class Environment;
+class PluginRuntime;
+
+// Compiles every function in a plugin on worker threads, so the first call to
+// each one does not have to stop and compile it on the main thread. Each
+// plugin is one queue in the environment's BackgroundCompilerPool.
+//
+// Workers only assemble code. Everything that touches shared state - code
+// memory, the runtime's function map, and patching calls between functions -
+// happens on the main thread in Link(), under the environment lock.
+//
+// Functions are not queued until the plugin first runs. By then its natives
+// have been bound, so compiled code can call them directly (or replace them
+// with inline float operations) just as if it were compiled on demand.
+class BackgroundCompiler
+{
+  friend class BackgroundCompilerPool;
+
+ public:
+  explicit BackgroundCompiler(PluginRuntime *rt);
+  ~BackgroundCompiler();
+
+  // Find every function in the code section. Returns false if there is
+  // nothing to compile.
+  bool Initialize();
+
+  // Called on the main thread before the plugin runs. The first call queues
+  // the plugin's functions; every call links in whatever has been finished.
+  // Returns true once there is nothing left to link.
+  bool Link();
+
+ private:
+  // A call through a thunk whose target was not linked yet.
+  struct CallSite {
+    uint8_t *pc;
+    cell_t pcode_offset;
+  };
+
+  void patchCallSites();
+
+ private:
+  Environment *env_;
+  PluginRuntime *rt_;
+  BackgroundCompilerPool *pool_;
+  ke::Vector<cell_t> functions_;
+  ke::Vector<CallSite> call_sites_;
+
+  // Protected by the pool lock.
+  size_t next_function_;
+  size_t completed_;
+  size_t active_;
+  ke::Vector<Compiler *> finished_;
+};
+
+// Worker threads shared by every plugin's BackgroundCompiler, so the number
+// of threads does not grow with the number of plugins. Workers take functions
+// from the oldest queue first, so a plugin that started running earlier is
+// finished earlier.
+class BackgroundCompilerPool : public ke::IRunnable
+{
+ public:
+  explicit BackgroundCompilerPool(Environment *env);
+  ~BackgroundCompilerPool();
+
+  // Queue a compiler's functions, starting workers as needed, up to the
+  // environment's background compile thread count. Returns false if there
+  // are no workers to compile them.
+  bool Enqueue(BackgroundCompiler *bc);
+
+  // Drop a compiler's queue, and wait for any of its functions that workers
+  // are still compiling.
+  void Remove(BackgroundCompiler *bc);
+
+  ke::ConditionVariable *lock() {
+    return &cv_;
+  }
+
+  // ke::IRunnable
+  void Run() KE_OVERRIDE;
+
+ private:
+  Environment *env_;
+  ke::Vector<ke::Thread *> threads_;
+  ke::ConditionVariable cv_;
+
+  // Protected by cv_.
+  ke::Vector<BackgroundCompiler *> queues_;
+  bool shutdown_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_background_compiler_h_
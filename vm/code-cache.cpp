@@ -0,0 +1,341 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <stdio.h>
+#include <string.h>
+#include "code-cache.h"
+#include "api.h"
+#include "file-utils.h"
+#include "plugin-context.h"
+#include "plugin-runtime.h"
+
+using namespace sp;
+
+// Bump this whenever the file layout changes.
+static const uint32_t kCacheMagic = 0x434a5053; // "SPJC"
+static const uint32_t kCacheVersion = 3;
+
+namespace {
+
+// Cache files are only meant to be read by the machine that wrote them, so
+// everything is in native byte order. Each array is preceded by its length,
+// and padded so that everything stays 4-byte aligned.
+class CacheWriter
+{
+ public:
+  explicit CacheWriter(ke::Vector<uint8_t> &out)
+   : out_(out)
+  {}
+
+  void write(uint32_t value) {
+    writeBytes(&value, sizeof(value));
+  }
+  void writeBytes(const void *bytes, size_t length) {
+    size_t pos = out_.length();
+    if (!out_.resize(pos + length))
+      return;
+    memcpy(out_.buffer() + pos, bytes, length);
+  }
+  template <typename T>
+  void writeArray(const ke::Vector<T> &vec) {
+    write(uint32_t(vec.length()));
+    writeBytes(vec.buffer(), vec.length() * sizeof(T));
+    while (out_.length() % sizeof(uint32_t))
+      out_.append(0);
+  }
+
+ private:
+  ke::Vector<uint8_t> &out_;
+};
+
+class CacheReader
+{
+ public:
+  CacheReader(const uint8_t *bytes, size_t length, size_t pos)
+   : bytes_(bytes),
+     length_(length),
+     pos_(pos)
+  {}
+
+  bool read(uint32_t *value) {
+    if (length_ - pos_ < sizeof(uint32_t))
+      return false;
+    memcpy(value, bytes_ + pos_, sizeof(uint32_t));
+    pos_ += sizeof(uint32_t);
+    return true;
+  }
+  template <typename T>
+  bool readArray(CachedArray<T> *array) {
+    uint32_t length;
+    if (!read(&length))
+      return false;
+    if ((length_ - pos_) / sizeof(T) < length)
+      return false;
+    array->elements = reinterpret_cast<const T *>(bytes_ + pos_);
+    array->length = length;
+    pos_ += ke::Align(length * sizeof(T), sizeof(uint32_t));
+    return pos_ <= length_;
+  }
+  size_t pos() const {
+    return pos_;
+  }
+
+ private:
+  const uint8_t *bytes_;
+  size_t length_;
+  size_t pos_;
+};
+
+} // anonymous namespace
+
+CodeCache::CodeCache(PluginRuntime *rt, const char *dir, const char *build_id)
+ : rt_(rt),
+   build_id_(build_id),
+   dirty_(false)
+{
+  char name[33];
+  const unsigned char *hash = rt_->GetCodeHash();
+  for (size_t i = 0; i < 16; i++)
+    UTIL_Format(&name[i * 2], 3, "%02x", hash[i]);
+
+  char path[512];
+  UTIL_Format(path, sizeof(path), "%s/%s.spjit", dir, name);
+  path_ = path;
+
+  map_.init(32);
+}
+
+CodeCache::~CodeCache()
+{
+  clear();
+}
+
+void
+CodeCache::clear()
+{
+  for (size_t i = 0; i < functions_.length(); i++)
+    delete functions_[i];
+  functions_.clear();
+  for (size_t i = 0; i < records_.length(); i++)
+    delete [] records_[i];
+  records_.clear();
+  map_.clear();
+  file_ = nullptr;
+}
+
+void
+CodeCache::Load()
+{
+  FILE *fp = fopen(path_.chars(), "rb");
+  if (!fp)
+    return;
+
+  file_ = new FileReader(fp);
+  fclose(fp);
+
+  // A file that is stale or damaged in any way is thrown out, and will be
+  // replaced with fresh output on the next Save().
+  if (!readFile(file_->buffer(), file_->length())) {
+    clear();
+    dirty_ = true;
+  }
+}
+
+void
+CodeCache::writeHeader(ke::Vector<uint8_t> &out)
+{
+  CacheWriter writer(out);
+  writer.write(kCacheMagic);
+  writer.write(kCacheVersion);
+  writer.write(uint32_t(build_id_.length()));
+  writer.writeBytes(build_id_.chars(), build_id_.length());
+  while (out.length() % sizeof(uint32_t))
+    out.append(0);
+  writer.writeBytes(rt_->GetCodeHash(), 16);
+  writer.write(uint32_t(rt_->code().length));
+  writer.write(uint32_t(rt_->GetBaseContext()->DataSize()));
+  writer.write(uint32_t(rt_->GetBaseContext()->HeapSize()));
+  writer.write(uint32_t(rt_->image()->NumNatives()));
+}
+
+bool
+CodeCache::readFile(const uint8_t *bytes, size_t length)
+{
+  // Rather than parse the header, build the one we would write and compare.
+  ke::Vector<uint8_t> header;
+  writeHeader(header);
+  if (length < header.length() || memcmp(bytes, header.buffer(), header.length()) != 0)
+    return false;
+
+  CacheReader reader(bytes, length, header.length());
+
+  uint32_t nfunctions;
+  if (!reader.read(&nfunctions))
+    return false;
+
+  size_t pos = reader.pos();
+  for (uint32_t i = 0; i < nfunctions; i++) {
+    ke::AutoPtr<CachedFunction> fn(new CachedFunction);
+    if (!readFunction(bytes, length, &pos, fn))
+      return false;
+
+    FunctionMap::Insert p = map_.findForAdd(fn->pcode_offset);
+    if (p.found())
+      return false;
+    map_.add(p, fn->pcode_offset, fn);
+    functions_.append(fn.take());
+  }
+
+  return pos == length;
+}
+
+bool
+CodeCache::readFunction(const uint8_t *bytes, size_t length, size_t *pos, CachedFunction *fn)
+{
+  CacheReader reader(bytes, length, *pos);
+
+  uint32_t pcode_offset;
+  if (!reader.read(&pcode_offset))
+    return false;
+  fn->pcode_offset = pcode_offset;
+  if (!reader.readArray(&fn->code) ||
+      !reader.readArray(&fn->local_refs) ||
+      !reader.readArray(&fn->external_refs) ||
+      !reader.readArray(&fn->edges) ||
+      !reader.readArray(&fn->cip_map) ||
+      !reader.readArray(&fn->natives))
+  {
+    return false;
+  }
+  fn->record = bytes + *pos;
+  fn->record_length = reader.pos() - *pos;
+  *pos = reader.pos();
+
+  // Make sure nothing points outside the function's code.
+  if (pcode_offset % sizeof(cell_t) != 0 || pcode_offset >= rt_->code().length)
+    return false;
+  size_t ncode = fn->code.length;
+  for (size_t i = 0; i < fn->local_refs.length; i++) {
+    if (fn->local_refs[i] < sizeof(intptr_t) || fn->local_refs[i] > ncode)
+      return false;
+  }
+  for (size_t i = 0; i < fn->external_refs.length; i++) {
+    const ExternalRef &ref = fn->external_refs[i];
+    if (ref.offset < sizeof(intptr_t) || ref.offset > ncode)
+      return false;
+  }
+  for (size_t i = 0; i < fn->edges.length; i++) {
+    if (fn->edges[i].offset < sizeof(int32_t) || fn->edges[i].offset > ncode)
+      return false;
+  }
+  for (size_t i = 0; i < fn->cip_map.length; i++) {
+    if (fn->cip_map[i].pcoffs > ncode)
+      return false;
+  }
+  for (size_t i = 0; i < fn->natives.length; i++) {
+    if (fn->natives[i].index >= rt_->image()->NumNatives())
+      return false;
+  }
+  return true;
+}
+
+void
+CodeCache::Save()
+{
+  if (!dirty_)
+    return;
+
+  ke::Vector<uint8_t> out;
+  writeHeader(out);
+
+  CacheWriter writer(out);
+  writer.write(uint32_t(functions_.length()));
+  for (size_t i = 0; i < functions_.length(); i++)
+    writer.writeBytes(functions_[i]->record, functions_[i]->record_length);
+
+  // Write to a temporary file first, so another process never sees a
+  // partial file.
+  char tmp_path[512];
+  UTIL_Format(tmp_path, sizeof(tmp_path), "%s.tmp", path_.chars());
+
+  FILE *fp = fopen(tmp_path, "wb");
+  if (!fp)
+    return;
+  bool ok = fwrite(out.buffer(), 1, out.length(), fp) == out.length();
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok) {
+    remove(tmp_path);
+    return;
+  }
+
+#if defined(_WIN32)
+  remove(path_.chars());
+#endif
+  if (rename(tmp_path, path_.chars()) != 0) {
+    remove(tmp_path);
+    return;
+  }
+  dirty_ = false;
+}
+
+const CachedFunction *
+CodeCache::Find(cell_t pcode_offset)
+{
+  FunctionMap::Result r = map_.find(pcode_offset);
+  if (!r.found())
+    return nullptr;
+  return r->value;
+}
+
+void
+CodeCache::Add(const CodeCacheEntry &entry)
+{
+  ke::Vector<uint8_t> out;
+  CacheWriter writer(out);
+  writer.write(uint32_t(entry.pcode_offset));
+  writer.writeArray(entry.code);
+  writer.writeArray(entry.local_refs);
+  writer.writeArray(entry.external_refs);
+  writer.writeArray(entry.edges);
+  writer.writeArray(entry.cip_map);
+  writer.writeArray(entry.natives);
+
+  uint8_t *record = new uint8_t[out.length()];
+  memcpy(record, out.buffer(), out.length());
+  if (!records_.append(record)) {
+    delete [] record;
+    return;
+  }
+
+  size_t pos = 0;
+  ke::AutoPtr<CachedFunction> fn(new CachedFunction);
+  if (!readFunction(record, out.length(), &pos, fn))
+    return;
+  dirty_ = true;
+
+  // A cached copy that could not be used is replaced.
+  FunctionMap::Insert p = map_.findForAdd(fn->pcode_offset);
+  if (p.found()) {
+    for (size_t i = 0; i < functions_.length(); i++) {
+      if (functions_[i] == p->value) {
+        delete functions_[i];
+        functions_[i] = fn.take();
+        p->value = functions_[i];
+        break;
+      }
+    }
+    return;
+  }
+  map_.add(p, fn->pcode_offset, fn);
+  functions_.append(fn.take());
+}
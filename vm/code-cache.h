@@ -0,0 +1,207 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_code_cache_h_
+#define _include_sourcepawn_vm_code_cache_h_
+
+#include <sp_vm_types.h>
+#include <am-string.h>
+#include <am-vector.h>
+#include <am-hashmap.h>
+#include <assert.h>
+#include "assembler.h"
+#include "compiled-function.h"
+#include "file-utils.h"
+
+namespace sp {
+
+class PluginRuntime;
+
+// Relocation tags for ExternalAddress. The top byte is a RelocKind, and the
+// rest is a payload whose meaning depends on the kind.
+enum class RelocKind : uint32_t
+{
+  // The address is not known to the code cache.
+  None,
+
+  // Payload is a JitHelper.
+  Helper,
+
+  // The PluginRuntime that owns the code.
+  Runtime,
+
+  // Payload is a native index. This is the address of the bound native;
+  // code that uses it assumes the binding will not change.
+  NativeFunction,
+
+  // Payload is a native index. This is the address of the slot holding the
+  // native's function pointer.
+  NativeSlot,
+
+  // Payload is a native index. This is the address of the native's fast
+  // entry point; code that uses it assumes the binding will not change.
+  FastNative,
+
+  // Payload is a native index. This is the address of the native's entry,
+  // which InvokeLinkedNative() takes; code that uses it assumes the native
+  // stays linked.
+  LinkedFunction
+};
+
+// Addresses, owned by the VM itself, that the JIT embeds in code.
+enum class JitHelper : uint32_t
+{
+  ExitFrame,
+  ExceptionCode,
+  ReturnStub,
+  GenerateFullArray,
+  CompileFromThunk,
+  ReportError,
+  ReportTimeout,
+  FindEntryFp,
+  RoundToCeil,
+  InvokeLinkedNative
+};
+
+static inline uint32_t
+MakeReloc(RelocKind kind, uint32_t payload = 0)
+{
+  assert(payload <= 0xffffff);
+  return (uint32_t(kind) << 24) | payload;
+}
+static inline uint32_t
+MakeReloc(JitHelper helper)
+{
+  return MakeReloc(RelocKind::Helper, uint32_t(helper));
+}
+static inline RelocKind
+RelocKindOf(uint32_t reloc)
+{
+  return RelocKind(reloc >> 24);
+}
+static inline uint32_t
+RelocPayloadOf(uint32_t reloc)
+{
+  return reloc & 0xffffff;
+}
+
+// A native that compiled code depends on, with the key of its binding when
+// the code was compiled (see PluginRuntime::GetNativeBindingKey()).
+struct AssumedNative
+{
+  uint32_t index;
+  uint32_t binding;
+};
+
+// The JIT's output for one function, before it was copied to executable
+// memory. Internal and external references are as noted by the assembler.
+struct CodeCacheEntry
+{
+  cell_t pcode_offset;
+  ke::Vector<uint8_t> code;
+  ke::Vector<uint32_t> local_refs;
+  ke::Vector<ExternalRef> external_refs;
+  ke::Vector<LoopEdge> edges;
+  ke::Vector<CipMapEntry> cip_map;
+
+  // Natives whose binding the code depends on, either because it calls them
+  // directly or because it replaced them with inline code. The code can
+  // only be reused if each of these is still bound the same way, and not
+  // ephemeral or optional.
+  ke::Vector<AssumedNative> natives;
+};
+
+// A CodeCacheEntry as stored in the cache. The arrays point directly into
+// the cache file, so loading a file does not copy any code.
+template <typename T>
+struct CachedArray
+{
+  const T *elements;
+  size_t length;
+
+  const T &operator[](size_t index) const {
+    assert(index < length);
+    return elements[index];
+  }
+};
+
+struct CachedFunction
+{
+  cell_t pcode_offset;
+  CachedArray<uint8_t> code;
+  CachedArray<uint32_t> local_refs;
+  CachedArray<ExternalRef> external_refs;
+  CachedArray<LoopEdge> edges;
+  CachedArray<CipMapEntry> cip_map;
+  CachedArray<AssumedNative> natives;
+
+  // The serialized form of the function.
+  const uint8_t *record;
+  size_t record_length;
+};
+
+// A persistent cache of compiled code for one plugin. Cache files live in a
+// directory chosen by the host, and are named by the MD5 of the plugin's code
+// section. Each file also records the JIT build that produced it, and the
+// parts of the plugin's layout that compiled code depends on; if any of
+// these differ, the file is ignored and rewritten.
+class CodeCache
+{
+ public:
+  CodeCache(PluginRuntime *rt, const char *dir, const char *build_id);
+  ~CodeCache();
+
+  // Read the cache file, if there is one.
+  void Load();
+
+  // Write the cache file, if anything was added since it was loaded.
+  void Save();
+
+  // Returns null if the function is not in the cache.
+  const CachedFunction *Find(cell_t pcode_offset);
+
+  // Add a function, replacing any existing copy.
+  void Add(const CodeCacheEntry &entry);
+
+ private:
+  bool readFile(const uint8_t *bytes, size_t length);
+  bool readFunction(const uint8_t *bytes, size_t length, size_t *pos, CachedFunction *fn);
+  void writeHeader(ke::Vector<uint8_t> &out);
+  void clear();
+
+ private:
+  struct FunctionPolicy {
+    static inline uint32_t hash(cell_t value) {
+      return ke::HashInteger<4>(value);
+    }
+    static inline bool matches(cell_t a, cell_t b) {
+      return a == b;
+    }
+  };
+  typedef ke::HashMap<cell_t, CachedFunction *, FunctionPolicy> FunctionMap;
+
+  PluginRuntime *rt_;
+  ke::AString path_;
+  ke::AString build_id_;
+  FunctionMap map_;
+  ke::Vector<CachedFunction *> functions_;
+
+  // Storage for the records that functions_ point into: the file that was
+  // loaded, and one buffer for each function added since.
+  ke::AutoPtr<FileReader> file_;
+  ke::Vector<uint8_t *> records_;
+  bool dirty_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_code_cache_h_
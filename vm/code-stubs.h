@@ -24,6 +24,10 @@ class Environment;
 
 typedef int (*InvokeStubFn)(PluginContext *cx, void *code, cell_t *rval);
 
+// An entry trampoline pushes its parameters onto the plugin stack itself and
+// calls one compiled function directly. See CompileEntryTrampoline().
+typedef int (*EntryTrampolineFn)(PluginContext *cx, const cell_t *params, cell_t *rval);
+
 class CodeStubs
 {
  public:
@@ -42,6 +46,12 @@ class CodeStubs
   }
   void *LegacyNativeStub();
 
+  // Generate an entry point for calling |code| with exactly |argc| cells.
+  // It replaces the C++ loop that pushes parameters, and the indirect call
+  // through InvokeStub(). Its frame is laid out the same as the invoke stub's,
+  // so that ReturnStub() can unwind either one.
+  CodeChunk CompileEntryTrampoline(void *code, unsigned int argc);
+
  private:
   bool InitializeFeatureDetection();
   bool CompileInvokeStub();
@@ -0,0 +1,65 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#if defined(_WIN32)
+# include <Windows.h>
+#else
+# include <unistd.h>
+# include <sys/mman.h>
+#endif
+#include <am-utility.h>
+#include "context-memory.h"
+
+using namespace sp;
+
+size_t
+sp::GetPageSize()
+{
+  static size_t page_size = 0;
+  if (!page_size) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    page_size = info.dwPageSize;
+#else
+    page_size = sysconf(_SC_PAGESIZE);
+#endif
+  }
+  return page_size;
+}
+
+uint8_t *
+sp::AllocateContextMemory(size_t length)
+{
+  size_t bytes = ke::Align(length, GetPageSize());
+
+#if defined(_WIN32)
+  // Committed pages are not backed by memory until they are touched.
+  return reinterpret_cast<uint8_t *>(
+    VirtualAlloc(nullptr, bytes, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE));
+#else
+  void *address = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (address == MAP_FAILED)
+    return nullptr;
+  return reinterpret_cast<uint8_t *>(address);
+#endif
+}
+
+void
+sp::FreeContextMemory(uint8_t *memory, size_t length)
+{
+#if defined(_WIN32)
+  VirtualFree(memory, 0, MEM_RELEASE);
+#else
+  munmap(memory, ke::Align(length, GetPageSize()));
+#endif
+}
@@ -0,0 +1,35 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_context_memory_h_
+#define _include_sourcepawn_vm_context_memory_h_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace sp {
+
+// Returns the size of a virtual memory page.
+size_t GetPageSize();
+
+// Maps |length| bytes of zeroed, page-aligned, read-write memory for a
+// context's data, heap, stack and heap tracker. Pages are only committed when
+// they are first touched, so a plugin with a large "#pragma dynamic" costs
+// only what it uses. Returns null on failure.
+uint8_t *AllocateContextMemory(size_t length);
+
+// Unmaps memory returned by AllocateContextMemory().
+void FreeContextMemory(uint8_t *memory, size_t length);
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_context_memory_h_
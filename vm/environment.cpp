@@ -11,12 +11,15 @@
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 //
 #include "environment.h"
-#include "x86/jit_x86.h"
+#include "jit.h"
 #include "watchdog_timer.h"
 #include "api.h"
+#include "background-compiler.h"
 #include "code-stubs.h"
+#include "shared-data.h"
 #include "watchdog_timer.h"
 #include <stdarg.h>
+#include <string.h>
 
 using namespace sp;
 using namespace SourcePawn;
@@ -28,6 +31,11 @@ Environment::Environment()
    exception_code_(SP_ERROR_NONE),
    profiler_(nullptr),
    jit_enabled_(true),
+   tier_up_calls_(0),
+   tier_up_backedges_(0),
+   background_compile_threads_(0),
+   file_mapping_enabled_(false),
+   shared_data_enabled_(false),
    profiling_enabled_(false),
    top_(nullptr)
 {
@@ -69,6 +77,9 @@ Environment::Initialize()
   watchdog_timer_ = new WatchdogTimer(this);
   code_alloc_ = new CodeAllocator();
 
+  if (!function_keys_.init(32))
+    return false;
+
   // Safe to initialize code now that we have the code cache.
   if (!code_stubs_->Initialize())
     return false;
@@ -80,6 +91,7 @@ void
 Environment::Shutdown()
 {
   watchdog_timer_->Shutdown();
+  compile_pool_ = nullptr;
   code_stubs_ = nullptr;
   code_alloc_ = nullptr;
 
@@ -99,12 +111,86 @@ Environment::DisableProfiling()
   profiling_enabled_ = false;
 }
 
+BackgroundCompilerPool *
+Environment::compile_pool()
+{
+  if (!compile_pool_)
+    compile_pool_ = new BackgroundCompilerPool(this);
+  return compile_pool_;
+}
+
 bool
 Environment::InstallWatchdogTimer(int timeout_ms)
 {
   return watchdog_timer_->Initialize(timeout_ms);
 }
 
+bool
+Environment::RegisterNativeIntrinsic(const char *name, SP_INTRINSIC intrinsic)
+{
+  if (unsigned(intrinsic) >= SP_INTRINSICS_TOTAL)
+    return false;
+
+  for (size_t i = 0; i < intrinsics_.length(); i++) {
+    if (strcmp(intrinsics_[i].name.chars(), name) != 0)
+      continue;
+    if (intrinsic == SP_INTRINSIC_NONE)
+      intrinsics_.remove(i);
+    else
+      intrinsics_[i].intrinsic = intrinsic;
+    return true;
+  }
+
+  if (intrinsic == SP_INTRINSIC_NONE)
+    return true;
+
+  NativeIntrinsic entry;
+  entry.name = name;
+  entry.intrinsic = intrinsic;
+  return intrinsics_.append(ke::Move(entry));
+}
+
+SP_INTRINSIC
+Environment::FindNativeIntrinsic(const char *name) const
+{
+  for (size_t i = 0; i < intrinsics_.length(); i++) {
+    if (strcmp(intrinsics_[i].name.chars(), name) == 0)
+      return intrinsics_[i].intrinsic;
+  }
+  return SP_INTRINSIC_NONE;
+}
+
+int
+Environment::InternFunctionName(const char *name, uint32_t *key)
+{
+  FunctionKeyMap::Insert p = function_keys_.findForAdd(name);
+  if (p.found()) {
+    *key = p->value;
+    return SP_ERROR_NONE;
+  }
+
+  uint32_t index = uint32_t(function_names_.length());
+  if (!function_names_.append(ke::AString(name)))
+    return SP_ERROR_OUT_OF_MEMORY;
+  if (!function_keys_.add(p, function_names_.back().chars(), index)) {
+    function_names_.pop();
+    return SP_ERROR_OUT_OF_MEMORY;
+  }
+
+  *key = index;
+  return SP_ERROR_NONE;
+}
+
+bool
+Environment::FindFunctionKey(const char *name, uint32_t *key)
+{
+  FunctionKeyMap::Result r = function_keys_.find(name);
+  if (!r.found())
+    return false;
+  *key = r->value;
+  return true;
+}
+
 ISourcePawnEngine *
 Environment::APIv1()
 {
@@ -180,6 +266,37 @@ Environment::DeregisterRuntime(PluginRuntime *rt)
 {
   mutex_.AssertCurrentThreadOwns();
   runtimes_.remove(rt);
+
+  // Cut any natives that other plugins linked to this plugin's functions.
+  for (ke::InlineList<PluginRuntime>::iterator iter = runtimes_.begin(); iter != runtimes_.end(); iter++)
+    (*iter)->UnlinkNatives(rt);
+}
+
+SharedData *
+Environment::FindSharedData(const uint8_t *bytes, size_t length)
+{
+  for (size_t i = 0; i < shared_data_.length(); i++) {
+    if (shared_data_[i]->Matches(bytes, length))
+      return shared_data_[i];
+  }
+  return nullptr;
+}
+
+void
+Environment::RegisterSharedData(SharedData *data)
+{
+  shared_data_.append(data);
+}
+
+void
+Environment::DeregisterSharedData(SharedData *data)
+{
+  for (size_t i = 0; i < shared_data_.length(); i++) {
+    if (shared_data_[i] == data) {
+      shared_data_.remove(i);
+      return;
+    }
+  }
 }
 
 static inline void
@@ -237,6 +354,18 @@ Environment::Invoke(PluginRuntime *runtime, CompiledFunction *fn, cell_t *result
   return exception_code_;
 }
 
+int
+Environment::Invoke(PluginRuntime *runtime, EntryTrampolineFn entry, const cell_t *params,
+                    cell_t *result)
+{
+  // Must be in an invoke frame.
+  assert(top_ && top_->cx() == runtime->GetBaseContext());
+
+  entry(runtime->GetBaseContext(), params, result);
+
+  return exception_code_;
+}
+
 void
 Environment::ReportError(int code)
 {
@@ -16,8 +16,12 @@
 #include <sp_vm_api.h>
 #include <am-utility.h> // Replace with am-cxx later.
 #include <am-inlinelist.h>
+#include <am-hashmap.h>
+#include <am-string.h>
+#include <am-vector.h>
 #include <am-thread-utils.h>
 #include "code-allocator.h"
+#include "code-stubs.h"
 #include "plugin-runtime.h"
 #include "stack-frames.h"
 
@@ -25,8 +29,10 @@ namespace sp {
 
 using namespace SourcePawn;
 
+class BackgroundCompilerPool;
 class PluginRuntime;
 class CodeStubs;
+class SharedData;
 class WatchdogTimer;
 
 // An Environment encapsulates everything that's needed to load and run
@@ -77,12 +83,19 @@ class Environment : public ISourcePawnEnvironment
   // Runtime management.
   void RegisterRuntime(PluginRuntime *rt);
   void DeregisterRuntime(PluginRuntime *rt);
+
+  // Data sections that contexts map copy-on-write; see SharedData.
+  SharedData *FindSharedData(const uint8_t *bytes, size_t length);
+  void RegisterSharedData(SharedData *data);
+  void DeregisterSharedData(SharedData *data);
   void PatchAllJumpsForTimeout();
   void UnpatchAllJumpsFromTimeout();
   ke::Mutex *lock() {
     return &mutex_;
   }
   int Invoke(PluginRuntime *runtime, CompiledFunction *fn, cell_t *result);
+  int Invoke(PluginRuntime *runtime, EntryTrampolineFn entry, const cell_t *params,
+             cell_t *result);
 
   // Helpers.
   void SetProfiler(IProfilingTool *profiler) {
@@ -98,10 +111,81 @@ class Environment : public ISourcePawnEnvironment
   void DisableProfiling();
 
   void SetJitEnabled(bool enabled) {
+    jit_enabled_ = enabled;
   }
   bool IsJitEnabled() const {
     return jit_enabled_;
   }
+
+  // Tiered execution: when either threshold is non-zero, functions are
+  // interpreted until they reach it, and then JIT compiled. A zero threshold
+  // never triggers compilation.
+  void SetTieringThresholds(uint32_t calls, uint32_t backedges) {
+    tier_up_calls_ = calls;
+    tier_up_backedges_ = backedges;
+  }
+  uint32_t tier_up_calls() const {
+    return tier_up_calls_;
+  }
+  uint32_t tier_up_backedges() const {
+    return tier_up_backedges_;
+  }
+  bool IsTieringEnabled() const {
+    return jit_enabled_ && (tier_up_calls_ || tier_up_backedges_);
+  }
+
+  // Number of worker threads, shared by all plugins, that compile newly
+  // loaded plugins, or 0 to only compile on demand.
+  void SetBackgroundCompileThreads(uint32_t threads) {
+    background_compile_threads_ = threads;
+  }
+  uint32_t background_compile_threads() const {
+    return background_compile_threads_;
+  }
+
+  // Worker threads for background compilation, created on first use. Only
+  // the main thread may call this.
+  BackgroundCompilerPool *compile_pool();
+
+  // Directory for cached JIT output, or empty if code is not cached.
+  void SetCodeCacheDirectory(const char *path) {
+    code_cache_dir_ = path ? path : "";
+  }
+  const char *code_cache_dir() const {
+    return code_cache_dir_.chars();
+  }
+
+  // Whether uncompressed plugin files are mapped rather than read when loaded.
+  void SetFileMappingEnabled(bool enabled) {
+    file_mapping_enabled_ = enabled;
+  }
+  bool IsFileMappingEnabled() const {
+    return file_mapping_enabled_;
+  }
+
+  // Whether contexts share identical data sections copy-on-write.
+  void SetSharedDataEnabled(bool enabled) {
+    shared_data_enabled_ = enabled;
+  }
+  bool IsSharedDataEnabled() const {
+    return shared_data_enabled_;
+  }
+
+  // Natives that the host has declared to compute an intrinsic, by name.
+  bool RegisterNativeIntrinsic(const char *name, SP_INTRINSIC intrinsic);
+  SP_INTRINSIC FindNativeIntrinsic(const char *name) const;
+
+  // Public function names that the host has interned. Keys are indexes into
+  // the name list, so they never change once handed out.
+  int InternFunctionName(const char *name, uint32_t *key);
+  bool FindFunctionKey(const char *name, uint32_t *key);
+  size_t NumFunctionKeys() const {
+    return function_names_.length();
+  }
+  const char *GetFunctionKeyName(uint32_t key) const {
+    return function_names_[key].chars();
+  }
+
   void SetDebugger(IDebugListener *debugger) {
     debugger_ = debugger;
   }
@@ -140,6 +224,11 @@ class Environment : public ISourcePawnEnvironment
   intptr_t* exit_fp() const {
     return exit_fp_;
   }
+  // The interpreter builds its frames in C++ memory, so it links exit
+  // frames directly rather than through addressOfExit().
+  void setExitFp(intptr_t *fp) {
+    exit_fp_ = fp;
+  }
 
  public:
   static inline size_t offsetOfTopFrame() {
@@ -172,10 +261,38 @@ class Environment : public ISourcePawnEnvironment
 
   IProfilingTool *profiler_;
   bool jit_enabled_;
+  uint32_t tier_up_calls_;
+  uint32_t tier_up_backedges_;
+  uint32_t background_compile_threads_;
+  ke::AutoPtr<BackgroundCompilerPool> compile_pool_;
+  ke::AString code_cache_dir_;
+  bool file_mapping_enabled_;
+  bool shared_data_enabled_;
   bool profiling_enabled_;
 
+  struct NativeIntrinsic {
+    ke::AString name;
+    SP_INTRINSIC intrinsic;
+  };
+  ke::Vector<NativeIntrinsic> intrinsics_;
+
+  struct FunctionKeyPolicy {
+    static inline uint32_t hash(const char *key) {
+      return ke::HashCharSequence(key, strlen(key));
+    }
+    static inline bool matches(const char *a, const char *b) {
+      return strcmp(a, b) == 0;
+    }
+  };
+  typedef ke::HashMap<const char *, uint32_t, FunctionKeyPolicy> FunctionKeyMap;
+
+  // Map keys point into the strings in function_names_.
+  ke::Vector<ke::AString> function_names_;
+  FunctionKeyMap function_keys_;
+
   ke::AutoPtr<CodeAllocator> code_alloc_;
   ke::InlineList<PluginRuntime> runtimes_;
+  ke::Vector<SharedData *> shared_data_;
 
   uintptr_t frame_id_;
 
@@ -10,6 +10,12 @@
 #include <stdint.h>
 #include <smx/smx-headers.h>
 #include "file-utils.h"
+#if defined(_WIN32)
+# include <Windows.h>
+# include <io.h>
+#else
+# include <sys/mman.h>
+#endif
 
 using namespace sp;
 
@@ -26,8 +32,10 @@ sp::DetectFileType(FILE *fp)
   return FileType::UNKNOWN;
 }
 
-FileReader::FileReader(FILE *fp)
- : length_(0)
+FileReader::FileReader(FILE *fp, bool map)
+ : length_(0),
+   bytes_(nullptr),
+   mapping_(nullptr)
 {
   if (fseek(fp, 0, SEEK_END) != 0)
     return;
@@ -37,16 +45,75 @@ FileReader::FileReader(FILE *fp)
   if (fseek(fp, 0, SEEK_SET) != 0)
     return;
 
+  if (map && size && mapFile(fp, size))
+    return;
+
   ke::AutoArray<uint8_t> bytes(new uint8_t[size]);
   if (!bytes || fread(bytes, sizeof(uint8_t), size, fp) != (size_t)size)
     return;
 
-  buffer_ = bytes.take();
-  length_ = size;
+  setBuffer(bytes, size);
 }
 
 FileReader::FileReader(ke::AutoArray<uint8_t> &buffer, size_t length)
- : buffer_(buffer.take()),
-   length_(length)
+ : length_(0),
+   bytes_(nullptr),
+   mapping_(nullptr)
+{
+  setBuffer(buffer, length);
+}
+
+FileReader::~FileReader()
+{
+  unmapFile();
+}
+
+void
+FileReader::setBuffer(ke::AutoArray<uint8_t> &buffer, size_t length, size_t offset)
+{
+  unmapFile();
+  buffer_ = buffer.take();
+  bytes_ = buffer_ + offset;
+  length_ = length;
+}
+
+bool
+FileReader::mapFile(FILE *fp, size_t size)
+{
+#if defined(_WIN32)
+  HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+  HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!map)
+    return false;
+
+  // The view keeps the mapping object alive.
+  void *view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, size);
+  CloseHandle(map);
+  if (!view)
+    return false;
+#else
+  void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  if (view == MAP_FAILED)
+    return false;
+#endif
+
+  mapping_ = view;
+  bytes_ = reinterpret_cast<const uint8_t *>(view);
+  length_ = size;
+  return true;
+}
+
+void
+FileReader::unmapFile()
 {
+  if (!mapping_)
+    return;
+
+#if defined(_WIN32)
+  UnmapViewOfFile(mapping_);
+#else
+  munmap(mapping_, length_);
+#endif
+  mapping_ = nullptr;
+  bytes_ = nullptr;
 }
@@ -24,22 +24,42 @@ enum class FileType {
 
 FileType DetectFileType(FILE *fp);
 
+// Holds the contents of a file. If |map| is true, the file is mapped
+// read-only where possible rather than read into memory, so its pages are
+// shared with the OS file cache and only loaded when touched.
 class FileReader
 {
  public:
-  FileReader(FILE *fp);
+  FileReader(FILE *fp, bool map = false);
   FileReader(ke::AutoArray<uint8_t> &buffer, size_t length);
+  ~FileReader();
 
   const uint8_t *buffer() const {
-    return buffer_;
+    return bytes_;
   }
   size_t length() const {
     return length_;
   }
+  bool isMapped() const {
+    return !!mapping_;
+  }
+
+ protected:
+  // Replace the contents, for example with a decompressed copy, which starts
+  // |offset| bytes into |buffer|.
+  void setBuffer(ke::AutoArray<uint8_t> &buffer, size_t length, size_t offset = 0);
+
+ private:
+  bool mapFile(FILE *fp, size_t size);
+  void unmapFile();
 
  protected:
-  ke::AutoArray<uint8_t> buffer_;
   size_t length_;
+
+ private:
+  ke::AutoArray<uint8_t> buffer_;
+  const uint8_t *bytes_;
+  void *mapping_;
 };
 
 } // namespace sp
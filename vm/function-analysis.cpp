@@ -0,0 +1,557 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include "function-analysis.h"
+#include "opcodes.h"
+#include "plugin-runtime.h"
+
+using namespace sp;
+
+FunctionAnalysis::FunctionAnalysis(PluginRuntime *rt, cell_t pcode_offs)
+ : pcode_start_(pcode_offs),
+   code_start_(reinterpret_cast<const cell_t *>(rt->code().bytes + pcode_offs)),
+   code_end_(reinterpret_cast<const cell_t *>(rt->code().bytes + rt->code().length)),
+   ncells_(0),
+   nblocks_(0)
+{
+}
+
+int
+FunctionAnalysis::analyze()
+{
+  // Find the extent of the function: it ends at the next PROC or ENDPROC.
+  const cell_t *cip = code_start_ + 1;
+  while (cip < code_end_) {
+    if (*cip == OP_PROC || *cip == OP_ENDPROC)
+      break;
+
+    size_t count;
+    if (int err = OperandCount(cip, code_end_, &count))
+      return err;
+    if (count >= size_t(code_end_ - cip))
+      return SP_ERROR_INVALID_INSTRUCTION;
+    cip += count + 1;
+  }
+
+  ncells_ = cip - code_start_;
+  flags_ = new uint8_t[ncells_];
+  memset(flags_, 0, ncells_ * sizeof(uint8_t));
+
+  // Now that the extent is known, mark where each instruction begins, so
+  // jump targets can be checked against it.
+  for (cip = code_start_; cip < end();) {
+    size_t count;
+    OperandCount(cip, code_end_, &count);
+    flags_[cip - code_start_] |= kOpStart;
+    cip += count + 1;
+  }
+
+  // Mark jump targets. Every target starts a basic block, as does every
+  // instruction that follows a branch or a return.
+  flags_[0] |= kBlockStart;
+  for (cip = code_start_; cip < end();) {
+    size_t count;
+    OperandCount(cip, code_end_, &count);
+
+    const cell_t *next = cip + count + 1;
+    bool ends_block = false;
+    switch (*cip) {
+      case OP_JUMP:
+      case OP_JZER:
+      case OP_JNZ:
+      case OP_JEQ:
+      case OP_JNEQ:
+      case OP_JSLESS:
+      case OP_JSLEQ:
+      case OP_JSGRTR:
+      case OP_JSGEQ:
+        if (int err = addJumpTarget(cip[1]))
+          return err;
+        ends_block = true;
+        break;
+
+      case OP_SWITCH:
+      {
+        // The operand must name a case table inside this function; its
+        // entries are marked when the table itself is reached.
+        size_t index;
+        if (!findOp(cip[1], &index) || code_start_[index] != OP_CASETBL)
+          return SP_ERROR_INSTRUCTION_PARAM;
+        ends_block = true;
+        break;
+      }
+
+      case OP_CASETBL:
+      {
+        ucell_t ncases = cip[1];
+        if (int err = addJumpTarget(cip[2]))
+          return err;
+        for (ucell_t i = 0; i < ncases; i++) {
+          if (int err = addJumpTarget(cip[4 + i * 2]))
+            return err;
+        }
+        ends_block = true;
+        break;
+      }
+
+      case OP_RETN:
+      case OP_HALT:
+        ends_block = true;
+        break;
+
+      default:
+        break;
+    }
+
+    if (ends_block && next < end())
+      flags_[next - code_start_] |= kBlockStart;
+    cip = next;
+  }
+
+  for (size_t i = 0; i < ncells_; i++) {
+    if (flags_[i] & kBlockStart)
+      nblocks_++;
+  }
+  return SP_ERROR_NONE;
+}
+
+// Marks an instruction that no path reaches, such as one after a jump.
+static const int32_t kUnreachedDepth = -2;
+
+// Depths beyond this are not tracked; they would overflow the stack anyway.
+static const int64_t kMaxStackDepth = 0x1000000;
+
+void
+FunctionAnalysis::analyzeStackDepths()
+{
+  depths_ = new int32_t[ncells_];
+  for (size_t i = 0; i < ncells_; i++)
+    depths_[i] = kUnreachedDepth;
+  depths_[0] = 0;
+
+  // A jump target takes its depth from every jump to it, including jumps
+  // further down, so sweep until nothing changes. Each target can only go
+  // from unreached, to a depth, to unknown, so this ends quickly.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    // PROC leaves the stack pointer equal to the frame pointer.
+    int32_t depth = 0;
+    const cell_t *prev = nullptr;
+    for (const cell_t *cip = code_start_ + 1; cip < end();) {
+      size_t index = cip - code_start_;
+      if (isJumpTarget(index)) {
+        if (depth != kUnreachedDepth && mergeStackDepth(index, depth))
+          changed = true;
+        depth = depths_[index];
+
+        // Whatever came before in the code is not necessarily what ran.
+        prev = nullptr;
+      } else {
+        depths_[index] = depth;
+      }
+
+      size_t count;
+      OperandCount(cip, code_end_, &count);
+
+      switch (*cip) {
+        case OP_JUMP:
+        case OP_JZER:
+        case OP_JNZ:
+        case OP_JEQ:
+        case OP_JNEQ:
+        case OP_JSLESS:
+        case OP_JSLEQ:
+        case OP_JSGRTR:
+        case OP_JSGEQ:
+        {
+          size_t target;
+          if (depth != kUnreachedDepth && findOp(cip[1], &target) &&
+              mergeStackDepth(target, depth))
+          {
+            changed = true;
+          }
+          if (*cip == OP_JUMP)
+            depth = kUnreachedDepth;
+          break;
+        }
+
+        case OP_SWITCH:
+        {
+          size_t table;
+          if (depth != kUnreachedDepth && findOp(cip[1], &table)) {
+            const cell_t *tbl = code_start_ + table;
+            ucell_t ncases = tbl[1];
+            size_t target;
+            if (findOp(tbl[2], &target) && mergeStackDepth(target, depth))
+              changed = true;
+            for (ucell_t i = 0; i < ncases; i++) {
+              if (findOp(tbl[4 + i * 2], &target) && mergeStackDepth(target, depth))
+                changed = true;
+            }
+          }
+          depth = kUnreachedDepth;
+          break;
+        }
+
+        case OP_CASETBL:
+        case OP_RETN:
+        case OP_HALT:
+          depth = kUnreachedDepth;
+          break;
+
+        default:
+          if (depth >= 0)
+            depth = stackEffect(cip, prev, depth);
+          break;
+      }
+
+      prev = cip;
+      cip += count + 1;
+    }
+  }
+}
+
+bool
+FunctionAnalysis::mergeStackDepth(size_t index, int32_t depth)
+{
+  if (depths_[index] == kUnreachedDepth) {
+    depths_[index] = depth;
+    return true;
+  }
+  if (depths_[index] != depth && depths_[index] != kUnknownDepth) {
+    depths_[index] = kUnknownDepth;
+    return true;
+  }
+  return false;
+}
+
+// Returns the depth after the instruction at |cip|, which does not branch.
+// |prev| is the instruction that ran before it, if that is known.
+int32_t
+FunctionAnalysis::stackEffect(const cell_t *cip, const cell_t *prev, int32_t depth) const
+{
+  int64_t delta = 0;
+  switch (*cip) {
+    case OP_PUSH_PRI:
+    case OP_PUSH_ALT:
+    case OP_PUSH_C:
+    case OP_PUSH_S:
+    case OP_PUSH_ADR:
+    case OP_PUSH:
+      delta = 4;
+      break;
+
+    case OP_PUSH2_C:
+    case OP_PUSH3_C:
+    case OP_PUSH4_C:
+    case OP_PUSH5_C:
+    case OP_PUSH2:
+    case OP_PUSH3:
+    case OP_PUSH4:
+    case OP_PUSH5:
+    case OP_PUSH2_S:
+    case OP_PUSH3_S:
+    case OP_PUSH4_S:
+    case OP_PUSH5_S:
+    case OP_PUSH2_ADR:
+    case OP_PUSH3_ADR:
+    case OP_PUSH4_ADR:
+    case OP_PUSH5_ADR:
+    {
+      size_t count;
+      OperandCount(cip, code_end_, &count);
+      delta = int64_t(count) * 4;
+      break;
+    }
+
+    case OP_POP_PRI:
+    case OP_POP_ALT:
+    case OP_FABS:
+    case OP_FLOAT:
+    case OP_RND_TO_NEAREST:
+    case OP_RND_TO_FLOOR:
+    case OP_RND_TO_CEIL:
+    case OP_RND_TO_ZERO:
+    case OP_FLOAT_NOT:
+      delta = -4;
+      break;
+
+    case OP_FLOATADD:
+    case OP_FLOATSUB:
+    case OP_FLOATMUL:
+    case OP_FLOATDIV:
+    case OP_FLOATCMP:
+    case OP_FLOAT_GT:
+    case OP_FLOAT_GE:
+    case OP_FLOAT_LT:
+    case OP_FLOAT_LE:
+    case OP_FLOAT_EQ:
+    case OP_FLOAT_NE:
+      delta = -8;
+      break;
+
+    case OP_STACK:
+      delta = -int64_t(cip[1]);
+      break;
+
+    case OP_SYSREQ_N:
+      delta = -int64_t(ucell_t(cip[2])) * 4;
+      break;
+
+    case OP_GENARRAY:
+    case OP_GENARRAY_Z:
+      delta = -(int64_t(cip[1]) - 1) * 4;
+      break;
+
+    case OP_CALL:
+    {
+      // The callee pops its arguments and their count. The count is only
+      // known if it was pushed as a constant right before the call.
+      if (!prev)
+        return kUnknownDepth;
+      size_t count;
+      switch (*prev) {
+        case OP_PUSH_C:
+        case OP_PUSH2_C:
+        case OP_PUSH3_C:
+        case OP_PUSH4_C:
+        case OP_PUSH5_C:
+          OperandCount(prev, code_end_, &count);
+          delta = -(int64_t(prev[count]) + 1) * 4;
+          break;
+        default:
+          return kUnknownDepth;
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+
+  int64_t result = int64_t(depth) + delta;
+  if (result < 0 || result > kMaxStackDepth)
+    return kUnknownDepth;
+  return int32_t(result);
+}
+
+bool
+FunctionAnalysis::findOp(cell_t offset, size_t *index) const
+{
+  if (offset % sizeof(cell_t) != 0 || ucell_t(offset) <= ucell_t(pcode_start_))
+    return false;
+
+  size_t i = (ucell_t(offset) - ucell_t(pcode_start_)) / sizeof(cell_t);
+  if (i >= ncells_ || !isOpStart(i))
+    return false;
+
+  *index = i;
+  return true;
+}
+
+int
+FunctionAnalysis::addJumpTarget(cell_t offset)
+{
+  size_t index;
+  if (!findOp(offset, &index))
+    return SP_ERROR_INSTRUCTION_PARAM;
+  flags_[index] |= kJumpTarget | kBlockStart;
+  return SP_ERROR_NONE;
+}
+
+int
+FunctionAnalysis::OperandCount(const cell_t *cip, const cell_t *code_end, size_t *count)
+{
+  switch (*cip) {
+    case OP_MOVE_PRI:
+    case OP_MOVE_ALT:
+    case OP_XCHG:
+    case OP_PUSH_PRI:
+    case OP_PUSH_ALT:
+    case OP_ZERO_PRI:
+    case OP_ZERO_ALT:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SUB_ALT:
+    case OP_PROC:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SSHR:
+    case OP_SMUL:
+    case OP_NOT:
+    case OP_NEG:
+    case OP_XOR:
+    case OP_OR:
+    case OP_AND:
+    case OP_INVERT:
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ:
+    case OP_INC_PRI:
+    case OP_INC_ALT:
+    case OP_INC_I:
+    case OP_DEC_PRI:
+    case OP_DEC_ALT:
+    case OP_DEC_I:
+    case OP_IDXADDR:
+    case OP_POP_PRI:
+    case OP_POP_ALT:
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT:
+    case OP_LIDX:
+    case OP_LOAD_I:
+    case OP_STOR_I:
+    case OP_SDIV:
+    case OP_SDIV_ALT:
+    case OP_RETN:
+    case OP_STRADJUST_PRI:
+    case OP_FABS:
+    case OP_FLOAT:
+    case OP_FLOATADD:
+    case OP_FLOATSUB:
+    case OP_FLOATMUL:
+    case OP_FLOATDIV:
+    case OP_RND_TO_NEAREST:
+    case OP_RND_TO_FLOOR:
+    case OP_RND_TO_CEIL:
+    case OP_RND_TO_ZERO:
+    case OP_FLOATCMP:
+    case OP_FLOAT_GT:
+    case OP_FLOAT_GE:
+    case OP_FLOAT_LT:
+    case OP_FLOAT_LE:
+    case OP_FLOAT_EQ:
+    case OP_FLOAT_NE:
+    case OP_FLOAT_NOT:
+    case OP_TRACKER_POP_SETHEAP:
+    case OP_BREAK:
+    case OP_NOP:
+      *count = 0;
+      return SP_ERROR_NONE;
+
+    case OP_ZERO:
+    case OP_ZERO_S:
+    case OP_PUSH_C:
+    case OP_PUSH_ADR:
+    case OP_PUSH_S:
+    case OP_PUSH:
+    case OP_IDXADDR_B:
+    case OP_SHL_C_PRI:
+    case OP_SHL_C_ALT:
+    case OP_SHR_C_PRI:
+    case OP_SHR_C_ALT:
+    case OP_ADD_C:
+    case OP_SMUL_C:
+    case OP_EQ_C_PRI:
+    case OP_EQ_C_ALT:
+    case OP_INC:
+    case OP_INC_S:
+    case OP_DEC:
+    case OP_DEC_S:
+    case OP_LOAD_PRI:
+    case OP_LOAD_ALT:
+    case OP_LOAD_S_PRI:
+    case OP_LOAD_S_ALT:
+    case OP_LREF_S_PRI:
+    case OP_LREF_S_ALT:
+    case OP_CONST_PRI:
+    case OP_CONST_ALT:
+    case OP_ADDR_PRI:
+    case OP_ADDR_ALT:
+    case OP_STOR_PRI:
+    case OP_STOR_ALT:
+    case OP_STOR_S_PRI:
+    case OP_STOR_S_ALT:
+    case OP_SREF_S_PRI:
+    case OP_SREF_S_ALT:
+    case OP_LIDX_B:
+    case OP_LODB_I:
+    case OP_STRB_I:
+    case OP_MOVS:
+    case OP_FILL:
+    case OP_STACK:
+    case OP_HEAP:
+    case OP_JUMP:
+    case OP_JZER:
+    case OP_JNZ:
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ:
+    case OP_TRACKER_PUSH_C:
+    case OP_HALT:
+    case OP_BOUNDS:
+    case OP_GENARRAY:
+    case OP_GENARRAY_Z:
+    case OP_CALL:
+    case OP_SYSREQ_C:
+    case OP_SWITCH:
+      *count = 1;
+      return SP_ERROR_NONE;
+
+    case OP_LOAD_BOTH:
+    case OP_LOAD_S_BOTH:
+    case OP_CONST:
+    case OP_CONST_S:
+    case OP_SYSREQ_N:
+      *count = 2;
+      return SP_ERROR_NONE;
+
+    case OP_PUSH2_C:
+    case OP_PUSH3_C:
+    case OP_PUSH4_C:
+    case OP_PUSH5_C:
+      *count = ((*cip - OP_PUSH2_C) / 4) + 2;
+      return SP_ERROR_NONE;
+    case OP_PUSH2:
+    case OP_PUSH3:
+    case OP_PUSH4:
+    case OP_PUSH5:
+      *count = ((*cip - OP_PUSH2) / 4) + 2;
+      return SP_ERROR_NONE;
+    case OP_PUSH2_S:
+    case OP_PUSH3_S:
+    case OP_PUSH4_S:
+    case OP_PUSH5_S:
+      *count = ((*cip - OP_PUSH2_S) / 4) + 2;
+      return SP_ERROR_NONE;
+    case OP_PUSH2_ADR:
+    case OP_PUSH3_ADR:
+    case OP_PUSH4_ADR:
+    case OP_PUSH5_ADR:
+      *count = ((*cip - OP_PUSH2_ADR) / 4) + 2;
+      return SP_ERROR_NONE;
+
+    case OP_CASETBL:
+    {
+      // Two cells per case, and one extra cell for the default address.
+      if (cip + 1 >= code_end)
+        return SP_ERROR_INVALID_INSTRUCTION;
+      ucell_t ncases = cip[1];
+      if (ncases > size_t(code_end - cip) / 2)
+        return SP_ERROR_INVALID_INSTRUCTION;
+      *count = (ncases * 2) + 2;
+      return SP_ERROR_NONE;
+    }
+
+    default:
+      return SP_ERROR_INVALID_INSTRUCTION;
+  }
+}
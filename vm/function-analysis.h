@@ -0,0 +1,105 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_function_analysis_h_
+#define _include_sourcepawn_vm_function_analysis_h_
+
+#include <sp_vm_types.h>
+#include <am-utility.h>
+
+namespace sp {
+
+class PluginRuntime;
+
+// A pre-pass over the pcode of a single function, shared by the JIT and the
+// interpreter. It finds where the function ends, where each instruction
+// begins, which instructions are jump targets, and where each basic block
+// begins. Jump and switch targets are validated against the function itself
+// rather than the whole code section.
+//
+// Positions are cell indexes relative to the function's PROC.
+class FunctionAnalysis
+{
+ public:
+  FunctionAnalysis(PluginRuntime *rt, cell_t pcode_offs);
+
+  // Returns an SP_ERROR_* code.
+  int analyze();
+
+  const cell_t *start() const {
+    return code_start_;
+  }
+  const cell_t *end() const {
+    return code_start_ + ncells_;
+  }
+
+  // Number of cells in the function, including its PROC.
+  size_t ncells() const {
+    return ncells_;
+  }
+  size_t nblocks() const {
+    return nblocks_;
+  }
+
+  bool isOpStart(size_t index) const {
+    return !!(flags_[index] & kOpStart);
+  }
+  bool isJumpTarget(size_t index) const {
+    return !!(flags_[index] & kJumpTarget);
+  }
+  bool isBlockStart(size_t index) const {
+    return !!(flags_[index] & kBlockStart);
+  }
+
+  // Work out how many bytes each instruction finds on the stack below the
+  // frame pointer, for the JIT's register allocation. This must be called
+  // after analyze().
+  void analyzeStackDepths();
+
+  // Returns the stack depth on entry to the instruction at |index|, or
+  // kUnknownDepth if it can differ between paths, or could not be worked out
+  // (for example, after a call whose argument count is not a constant).
+  static const int32_t kUnknownDepth = -1;
+  int32_t stackDepth(size_t index) const {
+    return depths_[index];
+  }
+
+  // Map a code offset to the index of the instruction it names. This fails
+  // for anything that is misaligned, outside the function, not the start of
+  // an instruction, or the function's PROC.
+  bool findOp(cell_t offset, size_t *index) const;
+
+  // Number of operand cells that follow the instruction at |cip|.
+  static int OperandCount(const cell_t *cip, const cell_t *code_end, size_t *count);
+
+ private:
+  int addJumpTarget(cell_t offset);
+  bool mergeStackDepth(size_t index, int32_t depth);
+  int32_t stackEffect(const cell_t *cip, const cell_t *prev, int32_t depth) const;
+
+ private:
+  static const uint8_t kOpStart = 0x1;
+  static const uint8_t kJumpTarget = 0x2;
+  static const uint8_t kBlockStart = 0x4;
+
+  cell_t pcode_start_;
+  const cell_t *code_start_;
+  const cell_t *code_end_;
+  size_t ncells_;
+  size_t nblocks_;
+  ke::AutoArray<uint8_t> flags_;
+  ke::AutoArray<int32_t> depths_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_function_analysis_h_
@@ -0,0 +1,1503 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <math.h>
+#include <string.h>
+#include <sp_typeutil.h>
+#include "interpreter.h"
+#include "compiled-function.h"
+#include "environment.h"
+#include "function-analysis.h"
+#include "jit.h"
+#include "opcodes.h"
+#include "plugin-context.h"
+#include "plugin-runtime.h"
+#include "stack-frames.h"
+#include "watchdog_timer.h"
+
+using namespace sp;
+
+// Compilers that support labels-as-values get direct-threaded dispatch: each
+// slot holds the address of its handler, and every handler ends with its own
+// indirect jump. Everything else falls back to a switch over opcode numbers.
+#if defined(__GNUC__)
+# define SP_INTERP_THREADED
+#endif
+
+// Handlers that do not correspond to an SMX opcode.
+enum InterpOpcode
+{
+  // A call whose target has been predecoded; the operand is the
+  // InterpretedFunction pointer rather than a pcode offset.
+  OP_CALL_DIRECT = OPCODES_LAST,
+
+  // A call whose target has been tiered up; the operand is the
+  // CompiledFunction pointer.
+  OP_CALL_JIT,
+
+  INTERP_OPCODES_TOTAL
+};
+
+#define INTERP_OPCODE_LIST(_)     \
+  _(MOVE_PRI)                     \
+  _(MOVE_ALT)                     \
+  _(XCHG)                         \
+  _(ZERO)                         \
+  _(ZERO_S)                       \
+  _(PUSH_PRI)                     \
+  _(PUSH_ALT)                     \
+  _(PUSH_C)                       \
+  _(PUSH2_C)                      \
+  _(PUSH3_C)                      \
+  _(PUSH4_C)                      \
+  _(PUSH5_C)                      \
+  _(PUSH_ADR)                     \
+  _(PUSH2_ADR)                    \
+  _(PUSH3_ADR)                    \
+  _(PUSH4_ADR)                    \
+  _(PUSH5_ADR)                    \
+  _(PUSH_S)                       \
+  _(PUSH2_S)                      \
+  _(PUSH3_S)                      \
+  _(PUSH4_S)                      \
+  _(PUSH5_S)                      \
+  _(PUSH)                         \
+  _(PUSH2)                        \
+  _(PUSH3)                        \
+  _(PUSH4)                        \
+  _(PUSH5)                        \
+  _(ZERO_PRI)                     \
+  _(ZERO_ALT)                     \
+  _(ADD)                          \
+  _(SUB)                          \
+  _(SUB_ALT)                      \
+  _(PROC)                         \
+  _(IDXADDR_B)                    \
+  _(SHL)                          \
+  _(SHR)                          \
+  _(SSHR)                         \
+  _(SHL_C_PRI)                    \
+  _(SHL_C_ALT)                    \
+  _(SHR_C_PRI)                    \
+  _(SHR_C_ALT)                    \
+  _(SMUL)                         \
+  _(NOT)                          \
+  _(NEG)                          \
+  _(XOR)                          \
+  _(OR)                           \
+  _(AND)                          \
+  _(INVERT)                       \
+  _(ADD_C)                        \
+  _(SMUL_C)                       \
+  _(EQ)                           \
+  _(NEQ)                          \
+  _(SLESS)                        \
+  _(SLEQ)                         \
+  _(SGRTR)                        \
+  _(SGEQ)                         \
+  _(EQ_C_PRI)                     \
+  _(EQ_C_ALT)                     \
+  _(INC_PRI)                      \
+  _(INC_ALT)                      \
+  _(INC)                          \
+  _(INC_S)                        \
+  _(INC_I)                        \
+  _(DEC_PRI)                      \
+  _(DEC_ALT)                      \
+  _(DEC)                          \
+  _(DEC_S)                        \
+  _(DEC_I)                        \
+  _(LOAD_PRI)                     \
+  _(LOAD_ALT)                     \
+  _(LOAD_BOTH)                    \
+  _(LOAD_S_PRI)                   \
+  _(LOAD_S_ALT)                   \
+  _(LOAD_S_BOTH)                  \
+  _(LREF_S_PRI)                   \
+  _(LREF_S_ALT)                   \
+  _(CONST_PRI)                    \
+  _(CONST_ALT)                    \
+  _(ADDR_PRI)                     \
+  _(ADDR_ALT)                     \
+  _(STOR_PRI)                     \
+  _(STOR_ALT)                     \
+  _(STOR_S_PRI)                   \
+  _(STOR_S_ALT)                   \
+  _(IDXADDR)                      \
+  _(SREF_S_PRI)                   \
+  _(SREF_S_ALT)                   \
+  _(POP_PRI)                      \
+  _(POP_ALT)                      \
+  _(SWAP_PRI)                     \
+  _(SWAP_ALT)                     \
+  _(LIDX)                         \
+  _(LIDX_B)                       \
+  _(CONST)                        \
+  _(CONST_S)                      \
+  _(LOAD_I)                       \
+  _(STOR_I)                       \
+  _(SDIV)                         \
+  _(SDIV_ALT)                     \
+  _(LODB_I)                       \
+  _(STRB_I)                       \
+  _(RETN)                         \
+  _(MOVS)                         \
+  _(FILL)                         \
+  _(STRADJUST_PRI)                \
+  _(FABS)                         \
+  _(FLOAT)                        \
+  _(FLOATADD)                     \
+  _(FLOATSUB)                     \
+  _(FLOATMUL)                     \
+  _(FLOATDIV)                     \
+  _(RND_TO_NEAREST)               \
+  _(RND_TO_FLOOR)                 \
+  _(RND_TO_CEIL)                  \
+  _(RND_TO_ZERO)                  \
+  _(FLOATCMP)                     \
+  _(FLOAT_GT)                     \
+  _(FLOAT_GE)                     \
+  _(FLOAT_LT)                     \
+  _(FLOAT_LE)                     \
+  _(FLOAT_EQ)                     \
+  _(FLOAT_NE)                     \
+  _(FLOAT_NOT)                    \
+  _(STACK)                        \
+  _(HEAP)                         \
+  _(JUMP)                         \
+  _(JZER)                         \
+  _(JNZ)                          \
+  _(JEQ)                          \
+  _(JNEQ)                         \
+  _(JSLESS)                       \
+  _(JSLEQ)                        \
+  _(JSGRTR)                       \
+  _(JSGEQ)                        \
+  _(TRACKER_PUSH_C)               \
+  _(TRACKER_POP_SETHEAP)          \
+  _(BREAK)                        \
+  _(HALT)                         \
+  _(BOUNDS)                       \
+  _(GENARRAY)                     \
+  _(GENARRAY_Z)                   \
+  _(CALL)                         \
+  _(CALL_DIRECT)                  \
+  _(CALL_JIT)                     \
+  _(SYSREQ_C)                     \
+  _(SYSREQ_N)                     \
+  _(SWITCH)                       \
+  _(CASETBL)                      \
+  _(NOP)
+
+#if defined(SP_INTERP_THREADED)
+static intptr_t sDispatchTable[INTERP_OPCODES_TOTAL];
+static bool sDispatchTableReady = false;
+#endif
+
+static inline intptr_t
+Handler(int op)
+{
+#if defined(SP_INTERP_THREADED)
+  assert(sDispatchTableReady);
+  return sDispatchTable[op];
+#else
+  return op;
+#endif
+}
+
+InterpretedFunction::InterpretedFunction(cell_t pcode_offs, FixedArray<intptr_t> *code)
+ : code_offset_(pcode_offs),
+   code_(code),
+   calls_(0),
+   backedges_(0),
+   compiled_(nullptr),
+   tier_up_failed_(false)
+{
+}
+
+InterpretedFunction::~InterpretedFunction()
+{
+}
+
+ucell_t
+InterpretedFunction::FindCipByPc(void *pc)
+{
+  intptr_t *slot = reinterpret_cast<intptr_t *>(pc);
+  if (slot < code_->buffer() || slot >= code_->buffer() + code_->length())
+    return kInvalidCip;
+
+  return code_offset_ + ucell_t(slot - code_->buffer()) * sizeof(cell_t);
+}
+
+namespace {
+
+// Everything that stays constant for one invocation of the interpreter.
+struct InterpState
+{
+  Environment *env;
+  PluginContext *cx;
+  PluginRuntime *rt;
+  uint8_t *dat;
+  cell_t *sp;
+  cell_t *hp;
+  cell_t *frm;
+  bool tiering;
+};
+
+// A scripted frame, laid out exactly like the JIT's so FrameIterator can walk
+// a mix of interpreted and native frames, plus the function it belongs to.
+struct InterpFrame
+{
+  FrameLayout layout;
+  InterpretedFunction *fn;
+};
+
+// Calls between interpreted functions stay in one Execute() loop, so their
+// frames live here rather than on the C++ stack, and script recursion is only
+// limited by the plugin's own stack, as it is in the JIT. FrameIterator
+// follows pointers into these frames, so they are allocated in chunks that
+// never move. The first chunk is inline, so most invocations never allocate.
+class FrameStack
+{
+  static const size_t kChunkSize = 16;
+
+ public:
+  FrameStack()
+   : depth_(0)
+  {}
+  ~FrameStack() {
+    for (size_t i = 0; i < chunks_.length(); i++)
+      delete[] chunks_[i];
+  }
+
+  InterpFrame *push() {
+    if (depth_ < kChunkSize)
+      return &inline_[depth_++];
+
+    size_t chunk = depth_ / kChunkSize - 1;
+    if (chunk == chunks_.length()) {
+      InterpFrame *frames = new InterpFrame[kChunkSize];
+      if (!frames)
+        return nullptr;
+      if (!chunks_.append(frames)) {
+        delete[] frames;
+        return nullptr;
+      }
+    }
+    return &chunks_[chunk][depth_++ % kChunkSize];
+  }
+  void pop() {
+    assert(depth_ > 0);
+    depth_--;
+  }
+  InterpFrame *top() {
+    assert(depth_ > 0);
+    size_t index = depth_ - 1;
+    if (index < kChunkSize)
+      return &inline_[index];
+    return &chunks_[index / kChunkSize - 1][index % kChunkSize];
+  }
+  size_t depth() const {
+    return depth_;
+  }
+
+ private:
+  InterpFrame inline_[kChunkSize];
+  ke::Vector<InterpFrame *> chunks_;
+  size_t depth_;
+};
+
+} // anonymous namespace
+
+// Returns the frame pointer for |frame|.
+static inline intptr_t *
+EnterFrame(InterpFrame *frame, InterpretedFunction *fn, intptr_t *prev_fp, void *return_address)
+{
+  frame->fn = fn;
+  frame->layout.function_id = fn->GetCodeOffset();
+  frame->layout.frame_type = intptr_t(FrameType::Interpreted);
+  frame->layout.prev_fp = prev_fp;
+  frame->layout.return_address = return_address;
+  fn->OnCall();
+  return reinterpret_cast<intptr_t *>(&frame->layout.prev_fp);
+}
+
+static inline void
+EnterExitFrame(const InterpState &st, FrameLayout *exit, ExitFrameType type,
+               uintptr_t payload, intptr_t *fp, intptr_t *pc)
+{
+  exit->function_id = EncodeExitFrameId(type, payload);
+  exit->frame_type = intptr_t(FrameType::Exit);
+  exit->prev_fp = fp;
+  exit->return_address = pc;
+  st.env->setExitFp(reinterpret_cast<intptr_t *>(&exit->prev_fp));
+}
+
+// Returns false if the native threw an error, in which case it has already
+// been reported.
+static inline bool
+InvokeNative(const InterpState &st, NativeEntry *native, intptr_t *fp, intptr_t *pc,
+             cell_t *stk, cell_t *result)
+{
+  FrameLayout exit;
+  EnterExitFrame(st, &exit, ExitFrameType::Native, native - st.rt->NativeAt(0), fp, pc);
+
+  // Like the JIT, an unbound native is reported from inside its own frame.
+  if (!native->legacy_fn) {
+    FrameLayout helper;
+    EnterExitFrame(st, &helper, ExitFrameType::Helper, 0,
+                   reinterpret_cast<intptr_t *>(&exit.prev_fp), pc);
+    st.env->ReportError(SP_ERROR_INVALID_NATIVE);
+    return false;
+  }
+
+  // Natives get a dat-relative view of the stack, and any heap they
+  // allocate is released once they return.
+  cell_t save_hp = *st.hp;
+  *st.sp = cell_t(reinterpret_cast<uint8_t *>(stk) - st.dat);
+  *result = native->legacy_fn(st.cx, stk);
+  *st.hp = save_hp;
+
+  return !st.env->hasPendingException();
+}
+
+// Call a function that has been tiered up. The JIT is entered through a new
+// InvokeFrame, and the interpreter's frames are linked in with a helper exit
+// frame, so stack traces cross the tier boundary. The InvokeFrame is marked as
+// a tier-up, so FrameIterator hides both frames. Returns false if the callee
+// threw an error, in which case it has already been reported.
+static inline bool
+InvokeCompiled(const InterpState &st, CompiledFunction *code, intptr_t *fp, intptr_t *pc,
+               cell_t **stkp, cell_t *result)
+{
+  FrameLayout exit;
+  EnterExitFrame(st, &exit, ExitFrameType::Helper, 0, fp, pc);
+
+  // The invoke stub picks up its stack from the context, and stores it back
+  // once the callee has popped its arguments.
+  *st.sp = cell_t(reinterpret_cast<uint8_t *>(*stkp) - st.dat);
+
+  int err;
+  {
+    InvokeFrame ivk(st.cx, code->GetCodeOffset(), true);
+    err = st.env->Invoke(st.rt, code, result);
+  }
+
+  *stkp = reinterpret_cast<cell_t *>(st.dat + *st.sp);
+  return err == SP_ERROR_NONE;
+}
+
+static bool
+Execute(const InterpState &st, InterpretedFunction *fn, intptr_t *prev_fp,
+        void *return_address, cell_t **stkp, cell_t *rval)
+{
+#if defined(SP_INTERP_THREADED)
+  // Label addresses are only visible inside this function, so the predecoder
+  // calls us once without a function to publish them.
+  if (!fn) {
+    for (size_t i = 0; i < INTERP_OPCODES_TOTAL; i++)
+      sDispatchTable[i] = intptr_t(&&op_invalid);
+# define _(op) sDispatchTable[OP_##op] = intptr_t(&&op_##op);
+    INTERP_OPCODE_LIST(_)
+# undef _
+    sDispatchTableReady = true;
+    return true;
+  }
+
+# define CASE(op)         op_##op:
+# define DISPATCH()       goto *reinterpret_cast<void *>(*pc)
+#else
+# define CASE(op)         case OP_##op:
+# define DISPATCH()       goto dispatch
+#endif
+
+#define NEXT(n)           do { pc += (n); DISPATCH(); } while (0)
+#define THROW(code)       do { err = (code); goto report_error; } while (0)
+#define DAT(offs)         (*reinterpret_cast<cell_t *>(dat + (offs)))
+#define FRM(offs)         (*reinterpret_cast<cell_t *>(reinterpret_cast<uint8_t *>(frm) + (offs)))
+#define CHECK_ADDRESS(addr)                                       \
+  do {                                                            \
+    if (!cx->checkAddress(stk, (addr)))                           \
+      THROW(SP_ERROR_MEMACCESS);                                  \
+  } while (0)
+#define JUMP_TO(slot)                                             \
+  do {                                                            \
+    intptr_t *target = reinterpret_cast<intptr_t *>(slot);        \
+    if (target <= pc) {                                           \
+      fn->OnBackedge();                                           \
+      if (!st.env->watchdog()->HandleInterrupt())                 \
+        THROW(SP_ERROR_TIMEOUT);                                  \
+    }                                                             \
+    pc = target;                                                  \
+    DISPATCH();                                                   \
+  } while (0)
+#define PUSH_N(n, value)                                          \
+  do {                                                            \
+    for (intptr_t i = 1; i <= (n); i++)                           \
+      stk[-i] = (value);                                          \
+    stk -= (n);                                                   \
+    NEXT((n) + 1);                                                \
+  } while (0)
+
+  // The first frame is inline, so this cannot fail.
+  FrameStack frames;
+  intptr_t *fp = EnterFrame(frames.push(), fn, prev_fp, return_address);
+
+  PluginContext * const cx = st.cx;
+  uint8_t * const dat = st.dat;
+  intptr_t *pc = fn->GetEntry();
+  cell_t *stk = *stkp;
+  cell_t *frm = nullptr;
+  cell_t pri = 0;
+  cell_t alt = 0;
+  int err;
+
+  DISPATCH();
+
+#if !defined(SP_INTERP_THREADED)
+ dispatch:
+  switch (*pc) {
+#endif
+
+  CASE(MOVE_PRI)
+    pri = alt;
+    NEXT(1);
+
+  CASE(MOVE_ALT)
+    alt = pri;
+    NEXT(1);
+
+  CASE(XCHG)
+  {
+    cell_t tmp = pri;
+    pri = alt;
+    alt = tmp;
+    NEXT(1);
+  }
+
+  CASE(ZERO)
+    DAT(pc[1]) = 0;
+    NEXT(2);
+
+  CASE(ZERO_S)
+    FRM(pc[1]) = 0;
+    NEXT(2);
+
+  CASE(PUSH_PRI)
+    *--stk = pri;
+    NEXT(1);
+
+  CASE(PUSH_ALT)
+    *--stk = alt;
+    NEXT(1);
+
+  CASE(PUSH_C)
+    PUSH_N(1, cell_t(pc[i]));
+  CASE(PUSH2_C)
+    PUSH_N(2, cell_t(pc[i]));
+  CASE(PUSH3_C)
+    PUSH_N(3, cell_t(pc[i]));
+  CASE(PUSH4_C)
+    PUSH_N(4, cell_t(pc[i]));
+  CASE(PUSH5_C)
+    PUSH_N(5, cell_t(pc[i]));
+
+  CASE(PUSH_ADR)
+    PUSH_N(1, *st.frm + cell_t(pc[i]));
+  CASE(PUSH2_ADR)
+    PUSH_N(2, *st.frm + cell_t(pc[i]));
+  CASE(PUSH3_ADR)
+    PUSH_N(3, *st.frm + cell_t(pc[i]));
+  CASE(PUSH4_ADR)
+    PUSH_N(4, *st.frm + cell_t(pc[i]));
+  CASE(PUSH5_ADR)
+    PUSH_N(5, *st.frm + cell_t(pc[i]));
+
+  CASE(PUSH_S)
+    PUSH_N(1, FRM(pc[i]));
+  CASE(PUSH2_S)
+    PUSH_N(2, FRM(pc[i]));
+  CASE(PUSH3_S)
+    PUSH_N(3, FRM(pc[i]));
+  CASE(PUSH4_S)
+    PUSH_N(4, FRM(pc[i]));
+  CASE(PUSH5_S)
+    PUSH_N(5, FRM(pc[i]));
+
+  CASE(PUSH)
+    PUSH_N(1, DAT(pc[i]));
+  CASE(PUSH2)
+    PUSH_N(2, DAT(pc[i]));
+  CASE(PUSH3)
+    PUSH_N(3, DAT(pc[i]));
+  CASE(PUSH4)
+    PUSH_N(4, DAT(pc[i]));
+  CASE(PUSH5)
+    PUSH_N(5, DAT(pc[i]));
+
+  CASE(ZERO_PRI)
+    pri = 0;
+    NEXT(1);
+
+  CASE(ZERO_ALT)
+    alt = 0;
+    NEXT(1);
+
+  CASE(ADD)
+    pri = cell_t(ucell_t(pri) + ucell_t(alt));
+    NEXT(1);
+
+  CASE(SUB)
+    pri = cell_t(ucell_t(pri) - ucell_t(alt));
+    NEXT(1);
+
+  CASE(SUB_ALT)
+    pri = cell_t(ucell_t(alt) - ucell_t(pri));
+    NEXT(1);
+
+  CASE(PROC)
+    // Push the old frame, plus an unused slot for the non-existant CIP.
+    stk[-1] = *st.frm;
+    stk -= 2;
+    frm = stk;
+    *st.frm = cell_t(reinterpret_cast<uint8_t *>(frm) - dat);
+
+    // Calls only push, so check here that recursion has not run the stack
+    // into the heap.
+    if (reinterpret_cast<uint8_t *>(stk) < dat + *st.hp + STACK_MARGIN)
+      THROW(SP_ERROR_STACKLOW);
+    NEXT(1);
+
+  CASE(IDXADDR_B)
+    pri = cell_t((ucell_t(pri) << (pc[1] & 31)) + ucell_t(alt));
+    NEXT(2);
+
+  CASE(SHL)
+    pri = cell_t(ucell_t(pri) << (alt & 31));
+    NEXT(1);
+
+  CASE(SHR)
+    pri = cell_t(ucell_t(pri) >> (alt & 31));
+    NEXT(1);
+
+  CASE(SSHR)
+    pri >>= (alt & 31);
+    NEXT(1);
+
+  CASE(SHL_C_PRI)
+    pri = cell_t(ucell_t(pri) << (pc[1] & 31));
+    NEXT(2);
+
+  CASE(SHL_C_ALT)
+    alt = cell_t(ucell_t(alt) << (pc[1] & 31));
+    NEXT(2);
+
+  CASE(SHR_C_PRI)
+    pri = cell_t(ucell_t(pri) >> (pc[1] & 31));
+    NEXT(2);
+
+  CASE(SHR_C_ALT)
+    alt = cell_t(ucell_t(alt) >> (pc[1] & 31));
+    NEXT(2);
+
+  CASE(SMUL)
+    pri = cell_t(ucell_t(pri) * ucell_t(alt));
+    NEXT(1);
+
+  CASE(NOT)
+    pri = !pri;
+    NEXT(1);
+
+  CASE(NEG)
+    pri = cell_t(-ucell_t(pri));
+    NEXT(1);
+
+  CASE(XOR)
+    pri ^= alt;
+    NEXT(1);
+
+  CASE(OR)
+    pri |= alt;
+    NEXT(1);
+
+  CASE(AND)
+    pri &= alt;
+    NEXT(1);
+
+  CASE(INVERT)
+    pri = ~pri;
+    NEXT(1);
+
+  CASE(ADD_C)
+    pri = cell_t(ucell_t(pri) + ucell_t(pc[1]));
+    NEXT(2);
+
+  CASE(SMUL_C)
+    pri = cell_t(ucell_t(pri) * ucell_t(pc[1]));
+    NEXT(2);
+
+  CASE(EQ)
+    pri = (pri == alt);
+    NEXT(1);
+
+  CASE(NEQ)
+    pri = (pri != alt);
+    NEXT(1);
+
+  CASE(SLESS)
+    pri = (pri < alt);
+    NEXT(1);
+
+  CASE(SLEQ)
+    pri = (pri <= alt);
+    NEXT(1);
+
+  CASE(SGRTR)
+    pri = (pri > alt);
+    NEXT(1);
+
+  CASE(SGEQ)
+    pri = (pri >= alt);
+    NEXT(1);
+
+  CASE(EQ_C_PRI)
+    pri = (pri == cell_t(pc[1]));
+    NEXT(2);
+
+  CASE(EQ_C_ALT)
+    pri = (alt == cell_t(pc[1]));
+    NEXT(2);
+
+  CASE(INC_PRI)
+    pri = cell_t(ucell_t(pri) + 1);
+    NEXT(1);
+
+  CASE(INC_ALT)
+    alt = cell_t(ucell_t(alt) + 1);
+    NEXT(1);
+
+  CASE(INC)
+    DAT(pc[1])++;
+    NEXT(2);
+
+  CASE(INC_S)
+    FRM(pc[1])++;
+    NEXT(2);
+
+  CASE(INC_I)
+    DAT(ucell_t(pri))++;
+    NEXT(1);
+
+  CASE(DEC_PRI)
+    pri = cell_t(ucell_t(pri) - 1);
+    NEXT(1);
+
+  CASE(DEC_ALT)
+    alt = cell_t(ucell_t(alt) - 1);
+    NEXT(1);
+
+  CASE(DEC)
+    DAT(pc[1])--;
+    NEXT(2);
+
+  CASE(DEC_S)
+    FRM(pc[1])--;
+    NEXT(2);
+
+  CASE(DEC_I)
+    DAT(ucell_t(pri))--;
+    NEXT(1);
+
+  CASE(LOAD_PRI)
+    pri = DAT(pc[1]);
+    NEXT(2);
+
+  CASE(LOAD_ALT)
+    alt = DAT(pc[1]);
+    NEXT(2);
+
+  CASE(LOAD_BOTH)
+    pri = DAT(pc[1]);
+    alt = DAT(pc[2]);
+    NEXT(3);
+
+  CASE(LOAD_S_PRI)
+    pri = FRM(pc[1]);
+    NEXT(2);
+
+  CASE(LOAD_S_ALT)
+    alt = FRM(pc[1]);
+    NEXT(2);
+
+  CASE(LOAD_S_BOTH)
+    pri = FRM(pc[1]);
+    alt = FRM(pc[2]);
+    NEXT(3);
+
+  CASE(LREF_S_PRI)
+    pri = DAT(ucell_t(FRM(pc[1])));
+    NEXT(2);
+
+  CASE(LREF_S_ALT)
+    alt = DAT(ucell_t(FRM(pc[1])));
+    NEXT(2);
+
+  CASE(CONST_PRI)
+    pri = cell_t(pc[1]);
+    NEXT(2);
+
+  CASE(CONST_ALT)
+    alt = cell_t(pc[1]);
+    NEXT(2);
+
+  CASE(ADDR_PRI)
+    pri = *st.frm + cell_t(pc[1]);
+    NEXT(2);
+
+  CASE(ADDR_ALT)
+    alt = *st.frm + cell_t(pc[1]);
+    NEXT(2);
+
+  CASE(STOR_PRI)
+    DAT(pc[1]) = pri;
+    NEXT(2);
+
+  CASE(STOR_ALT)
+    DAT(pc[1]) = alt;
+    NEXT(2);
+
+  CASE(STOR_S_PRI)
+    FRM(pc[1]) = pri;
+    NEXT(2);
+
+  CASE(STOR_S_ALT)
+    FRM(pc[1]) = alt;
+    NEXT(2);
+
+  CASE(IDXADDR)
+    pri = cell_t(ucell_t(alt) + ucell_t(pri) * sizeof(cell_t));
+    NEXT(1);
+
+  CASE(SREF_S_PRI)
+    DAT(ucell_t(FRM(pc[1]))) = pri;
+    NEXT(2);
+
+  CASE(SREF_S_ALT)
+    DAT(ucell_t(FRM(pc[1]))) = alt;
+    NEXT(2);
+
+  CASE(POP_PRI)
+    pri = *stk++;
+    NEXT(1);
+
+  CASE(POP_ALT)
+    alt = *stk++;
+    NEXT(1);
+
+  CASE(SWAP_PRI)
+  {
+    cell_t tmp = stk[0];
+    stk[0] = pri;
+    pri = tmp;
+    NEXT(1);
+  }
+
+  CASE(SWAP_ALT)
+  {
+    cell_t tmp = stk[0];
+    stk[0] = alt;
+    alt = tmp;
+    NEXT(1);
+  }
+
+  CASE(LIDX)
+    pri = DAT(ucell_t(alt) + ucell_t(pri) * sizeof(cell_t));
+    NEXT(1);
+
+  CASE(LIDX_B)
+    pri = cell_t((ucell_t(pri) << (pc[1] & 31)) + ucell_t(alt));
+    CHECK_ADDRESS(pri);
+    pri = DAT(ucell_t(pri));
+    NEXT(2);
+
+  CASE(CONST)
+    DAT(pc[1]) = cell_t(pc[2]);
+    NEXT(3);
+
+  CASE(CONST_S)
+    FRM(pc[1]) = cell_t(pc[2]);
+    NEXT(3);
+
+  CASE(LOAD_I)
+    CHECK_ADDRESS(pri);
+    pri = DAT(ucell_t(pri));
+    NEXT(1);
+
+  CASE(STOR_I)
+    CHECK_ADDRESS(alt);
+    DAT(ucell_t(alt)) = pri;
+    NEXT(1);
+
+  CASE(SDIV)
+  {
+    if (alt == 0)
+      THROW(SP_ERROR_DIVIDE_BY_ZERO);
+    if (alt == -1 && pri == cell_t(0x80000000))
+      THROW(SP_ERROR_INTEGER_OVERFLOW);
+    cell_t quotient = pri / alt;
+    alt = pri % alt;
+    pri = quotient;
+    NEXT(1);
+  }
+
+  CASE(SDIV_ALT)
+  {
+    if (pri == 0)
+      THROW(SP_ERROR_DIVIDE_BY_ZERO);
+    if (pri == -1 && alt == cell_t(0x80000000))
+      THROW(SP_ERROR_INTEGER_OVERFLOW);
+    cell_t quotient = alt / pri;
+    alt = alt % pri;
+    pri = quotient;
+    NEXT(1);
+  }
+
+  CASE(LODB_I)
+    // The operand was predecoded into a mask.
+    CHECK_ADDRESS(pri);
+    pri = DAT(ucell_t(pri)) & cell_t(pc[1]);
+    NEXT(2);
+
+  CASE(STRB_I)
+    CHECK_ADDRESS(alt);
+    if (pc[1] == 1)
+      *reinterpret_cast<uint8_t *>(dat + ucell_t(alt)) = uint8_t(pri);
+    else if (pc[1] == 2)
+      *reinterpret_cast<uint16_t *>(dat + ucell_t(alt)) = uint16_t(pri);
+    else if (pc[1] == 4)
+      DAT(ucell_t(alt)) = pri;
+    NEXT(2);
+
+  CASE(RETN)
+    // Restore the old frame pointer, then remove parameters.
+    *st.frm = stk[1];
+    stk += 2;
+    stk += stk[0] + 1;
+
+    if (frames.depth() == 1) {
+      *stkp = stk;
+      *rval = pri;
+      return true;
+    }
+
+    // Resume the interpreted caller just past its call.
+    pc = reinterpret_cast<intptr_t *>(frames.top()->layout.return_address);
+    frames.pop();
+    fn = frames.top()->fn;
+    fp = reinterpret_cast<intptr_t *>(&frames.top()->layout.prev_fp);
+    frm = reinterpret_cast<cell_t *>(dat + *st.frm);
+    NEXT(2);
+
+  CASE(MOVS)
+    memmove(dat + ucell_t(alt), dat + ucell_t(pri), size_t(pc[1]));
+    NEXT(2);
+
+  CASE(FILL)
+  {
+    cell_t *dest = reinterpret_cast<cell_t *>(dat + ucell_t(alt));
+    for (ucell_t i = 0; i < ucell_t(pc[1]) / sizeof(cell_t); i++)
+      dest[i] = pri;
+    NEXT(2);
+  }
+
+  CASE(STRADJUST_PRI)
+    pri = (pri + 4) >> 2;
+    NEXT(1);
+
+  CASE(FABS)
+    pri = stk[0] & 0x7fffffff;
+    stk++;
+    NEXT(1);
+
+  CASE(FLOAT)
+    pri = sp_ftoc(float(stk[0]));
+    stk++;
+    NEXT(1);
+
+  CASE(FLOATADD)
+    pri = sp_ftoc(sp_ctof(stk[0]) + sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOATSUB)
+    pri = sp_ftoc(sp_ctof(stk[0]) - sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOATMUL)
+    pri = sp_ftoc(sp_ctof(stk[0]) * sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOATDIV)
+    pri = sp_ftoc(sp_ctof(stk[0]) / sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(RND_TO_NEAREST)
+    // Like the JIT, this uses the default rounding mode (round-half-even).
+    pri = cell_t(lrintf(sp_ctof(stk[0])));
+    stk++;
+    NEXT(1);
+
+  CASE(RND_TO_FLOOR)
+    pri = cell_t(floorf(sp_ctof(stk[0])));
+    stk++;
+    NEXT(1);
+
+  CASE(RND_TO_CEIL)
+    pri = cell_t(ceilf(sp_ctof(stk[0])));
+    stk++;
+    NEXT(1);
+
+  CASE(RND_TO_ZERO)
+    pri = cell_t(sp_ctof(stk[0]));
+    stk++;
+    NEXT(1);
+
+  CASE(FLOATCMP)
+  {
+    // The old ordered compare; unordered operands compare as "less".
+    float lhs = sp_ctof(stk[0]);
+    float rhs = sp_ctof(stk[1]);
+    if (rhs > lhs)
+      pri = -1;
+    else if (rhs == lhs)
+      pri = 0;
+    else
+      pri = 1;
+    stk += 2;
+    NEXT(1);
+  }
+
+  // NaN operands make every relational compare false, and only != true.
+  CASE(FLOAT_GT)
+    pri = (sp_ctof(stk[0]) > sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_GE)
+    pri = (sp_ctof(stk[0]) >= sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_LT)
+    pri = (sp_ctof(stk[0]) < sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_LE)
+    pri = (sp_ctof(stk[0]) <= sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_EQ)
+    pri = (sp_ctof(stk[0]) == sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_NE)
+    pri = (sp_ctof(stk[0]) != sp_ctof(stk[1]));
+    stk += 2;
+    NEXT(1);
+
+  CASE(FLOAT_NOT)
+  {
+    float val = sp_ctof(stk[0]);
+    pri = (val == 0.0f || val != val);
+    stk++;
+    NEXT(1);
+  }
+
+  CASE(STACK)
+    stk = reinterpret_cast<cell_t *>(reinterpret_cast<uint8_t *>(stk) + pc[1]);
+    if (pc[1] > 0) {
+      // Check if the stack went beyond the stack top - usually a compiler error.
+      if (reinterpret_cast<uint8_t *>(stk) >= dat + cx->HeapSize())
+        THROW(SP_ERROR_STACKMIN);
+    } else {
+      // Check if the stack is going to collide with the heap.
+      if (reinterpret_cast<uint8_t *>(stk) < dat + *st.hp + STACK_MARGIN)
+        THROW(SP_ERROR_STACKLOW);
+    }
+    NEXT(2);
+
+  CASE(HEAP)
+    alt = *st.hp;
+    *st.hp += cell_t(pc[1]);
+    if (pc[1] < 0) {
+      if (ucell_t(*st.hp) < cx->DataSize())
+        THROW(SP_ERROR_HEAPMIN);
+    } else {
+      if (dat + *st.hp + STACK_MARGIN > reinterpret_cast<uint8_t *>(stk))
+        THROW(SP_ERROR_HEAPLOW);
+    }
+    NEXT(2);
+
+  CASE(JUMP)
+    JUMP_TO(pc[1]);
+
+  CASE(JZER)
+    if (!pri)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JNZ)
+    if (pri)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JEQ)
+    if (pri == alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JNEQ)
+    if (pri != alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JSLESS)
+    if (pri < alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JSLEQ)
+    if (pri <= alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JSGRTR)
+    if (pri > alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(JSGEQ)
+    if (pri >= alt)
+      JUMP_TO(pc[1]);
+    NEXT(2);
+
+  CASE(TRACKER_PUSH_C)
+    // The operand was predecoded into bytes.
+    if ((err = cx->pushTracker(ucell_t(pc[1]))) != SP_ERROR_NONE)
+      THROW(err);
+    NEXT(2);
+
+  CASE(TRACKER_POP_SETHEAP)
+    if ((err = cx->popTrackerAndSetHeap()) != SP_ERROR_NONE)
+      THROW(err);
+    NEXT(1);
+
+  CASE(BREAK)
+    NEXT(1);
+
+  CASE(HALT)
+    pri = cell_t(pc[1]);
+    if (pri)
+      THROW(pri);
+    NEXT(2);
+
+  CASE(BOUNDS)
+    if (ucell_t(pri) > ucell_t(pc[1]))
+      THROW(SP_ERROR_ARRAY_BOUNDS);
+    NEXT(2);
+
+  CASE(GENARRAY)
+    if ((err = cx->generateArray(cell_t(pc[1]), stk, false)) != SP_ERROR_NONE)
+      THROW(err);
+    stk += pc[1] - 1;
+    NEXT(2);
+
+  CASE(GENARRAY_Z)
+    if ((err = cx->generateArray(cell_t(pc[1]), stk, true)) != SP_ERROR_NONE)
+      THROW(err);
+    stk += pc[1] - 1;
+    NEXT(2);
+
+  CASE(CALL)
+  {
+    // First time through this call site: predecode the callee if needed, and
+    // patch the site so later calls go straight to it.
+    cell_t offset = cell_t(pc[1]);
+    InterpretedFunction *callee = st.rt->GetInterpretedFunctionByOffset(offset);
+    if (!callee && (callee = PredecodeFunction(st.rt, offset, &err)) == nullptr)
+      THROW(err);
+    pc[0] = Handler(OP_CALL_DIRECT);
+    pc[1] = intptr_t(callee);
+  }
+  // Fall through.
+  CASE(CALL_DIRECT)
+  {
+    InterpretedFunction *callee = reinterpret_cast<InterpretedFunction *>(pc[1]);
+    if (st.tiering) {
+      if (CompiledFunction *code = TierUpIfHot(st.rt, callee)) {
+        // Patch the site so later calls go straight to the JIT.
+        pc[0] = Handler(OP_CALL_JIT);
+        pc[1] = intptr_t(code);
+        DISPATCH();
+      }
+    }
+
+    InterpFrame *frame = frames.push();
+    if (!frame)
+      THROW(SP_ERROR_OUT_OF_MEMORY);
+    fp = EnterFrame(frame, callee, fp, pc);
+    fn = callee;
+    pc = fn->GetEntry();
+    frm = nullptr;
+    DISPATCH();
+  }
+
+  CASE(CALL_JIT)
+  {
+    // There is no way back down: JIT code that calls an uncompiled function
+    // goes through a compile thunk, so tiering up spreads to callees.
+    CompiledFunction *code = reinterpret_cast<CompiledFunction *>(pc[1]);
+    if (!InvokeCompiled(st, code, fp, pc, &stk, &pri))
+      goto unwind;
+    NEXT(2);
+  }
+
+  CASE(SYSREQ_C)
+  {
+    NativeEntry *native = reinterpret_cast<NativeEntry *>(pc[1]);
+    if (!InvokeNative(st, native, fp, pc, stk, &pri))
+      goto unwind;
+    NEXT(2);
+  }
+
+  CASE(SYSREQ_N)
+  {
+    NativeEntry *native = reinterpret_cast<NativeEntry *>(pc[1]);
+
+    // Store the number of parameters on the stack.
+    *--stk = cell_t(pc[2]);
+    if (!InvokeNative(st, native, fp, pc, stk, &pri))
+      goto unwind;
+    stk += pc[2] + 1;
+    NEXT(3);
+  }
+
+  CASE(SWITCH)
+  {
+    // The operand points at the predecoded CASETBL, which is laid out as:
+    //   [handler, ncases, default, (value, target) * ncases]
+    const intptr_t *tbl = reinterpret_cast<const intptr_t *>(pc[1]);
+    const intptr_t *cases = tbl + 3;
+    intptr_t target = tbl[2];
+    for (intptr_t i = 0; i < tbl[1]; i++) {
+      if (cases[i * 2] == pri) {
+        target = cases[i * 2 + 1];
+        break;
+      }
+    }
+    pc = reinterpret_cast<intptr_t *>(target);
+    DISPATCH();
+  }
+
+  CASE(CASETBL)
+    NEXT(3 + pc[1] * 2);
+
+  CASE(NOP)
+    NEXT(1);
+
+#if defined(SP_INTERP_THREADED)
+ op_invalid:
+#else
+  default:
+#endif
+    THROW(SP_ERROR_INVALID_INSTRUCTION);
+
+#if !defined(SP_INTERP_THREADED)
+  }
+#endif
+
+ report_error:
+  {
+    FrameLayout exit;
+    EnterExitFrame(st, &exit, ExitFrameType::Helper, 0, fp, pc);
+    st.env->ReportError(err);
+  }
+
+ unwind:
+  *stkp = stk;
+  return false;
+
+#undef PUSH_N
+#undef JUMP_TO
+#undef CHECK_ADDRESS
+#undef FRM
+#undef DAT
+#undef THROW
+#undef NEXT
+#undef DISPATCH
+#undef CASE
+}
+
+int
+sp::Interpret(PluginContext *cx, InterpretedFunction *fn, cell_t *result)
+{
+  Environment *env = Environment::get();
+
+  // Must be in an invoke frame.
+  assert(env->top() && env->top()->cx() == cx);
+
+  InterpState st;
+  st.env = env;
+  st.cx = cx;
+  st.rt = cx->runtime();
+  st.dat = cx->memory();
+  st.sp = cx->addressOfSp();
+  st.hp = cx->addressOfHp();
+  st.frm = cx->addressOfFrm();
+  st.tiering = env->IsTieringEnabled();
+
+  FrameLayout entry;
+  entry.function_id = 0;
+  entry.frame_type = intptr_t(FrameType::Entry);
+  entry.prev_fp = nullptr;
+  entry.return_address = nullptr;
+
+  cell_t *stk = reinterpret_cast<cell_t *>(st.dat + *st.sp);
+  cell_t rval;
+  if (Execute(st, fn, reinterpret_cast<intptr_t *>(&entry.prev_fp), nullptr, &stk, &rval))
+    *result = rval;
+  *st.sp = cell_t(reinterpret_cast<uint8_t *>(stk) - st.dat);
+
+  return env->getPendingExceptionCode();
+}
+
+namespace {
+
+class Predecoder
+{
+ public:
+  Predecoder(PluginRuntime *rt, cell_t pcode_offs);
+
+  InterpretedFunction *decode(int *errp);
+
+ private:
+  int decodeOp(size_t index);
+  int target(cell_t offset, intptr_t *out);
+
+ private:
+  PluginRuntime *rt_;
+  cell_t pcode_start_;
+  const cell_t *code_start_;
+  const cell_t *code_end_;
+  FunctionAnalysis analysis_;
+  AutoPtr<FixedArray<intptr_t>> code_;
+};
+
+} // anonymous namespace
+
+Predecoder::Predecoder(PluginRuntime *rt, cell_t pcode_offs)
+ : rt_(rt),
+   pcode_start_(pcode_offs),
+   code_start_(reinterpret_cast<const cell_t *>(rt->code().bytes + pcode_offs)),
+   code_end_(reinterpret_cast<const cell_t *>(rt->code().bytes + rt->code().length)),
+   analysis_(rt, pcode_offs)
+{
+}
+
+InterpretedFunction *
+Predecoder::decode(int *errp)
+{
+  if (pcode_start_ % sizeof(cell_t) != 0 ||
+      ucell_t(pcode_start_) >= rt_->code().length ||
+      *code_start_ != OP_PROC)
+  {
+    *errp = SP_ERROR_INVALID_INSTRUCTION;
+    return nullptr;
+  }
+
+  if ((*errp = analysis_.analyze()) != SP_ERROR_NONE)
+    return nullptr;
+
+  code_ = new FixedArray<intptr_t>(analysis_.ncells());
+  for (size_t i = 0; i < analysis_.ncells(); i++) {
+    if (!analysis_.isOpStart(i))
+      continue;
+    if ((*errp = decodeOp(i)) != SP_ERROR_NONE)
+      return nullptr;
+  }
+
+  return new InterpretedFunction(pcode_start_, code_.take());
+}
+
+int
+Predecoder::target(cell_t offset, intptr_t *out)
+{
+  // Jumps must land on an instruction inside this function, and never on
+  // its PROC.
+  size_t index;
+  if (!analysis_.findOp(offset, &index))
+    return SP_ERROR_INSTRUCTION_PARAM;
+
+  *out = intptr_t(&code_->at(index));
+  return SP_ERROR_NONE;
+}
+
+int
+Predecoder::decodeOp(size_t index)
+{
+  const cell_t *cip = code_start_ + index;
+  intptr_t *slots = &code_->at(index);
+  OPCODE op = OPCODE(*cip);
+
+  size_t count;
+  FunctionAnalysis::OperandCount(cip, code_end_, &count);
+
+  slots[0] = Handler(op);
+  for (size_t i = 1; i <= count; i++)
+    slots[i] = intptr_t(cip[i]);
+
+  switch (op) {
+    case OP_JUMP:
+    case OP_JZER:
+    case OP_JNZ:
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ:
+      return target(cip[1], &slots[1]);
+
+    case OP_CALL:
+    {
+      // If this offset looks crappy, i.e. not aligned or out of bounds, we
+      // just abort.
+      cell_t offset = cip[1];
+      if (offset % sizeof(cell_t) != 0 || ucell_t(offset) >= rt_->code().length)
+        return SP_ERROR_INSTRUCTION_PARAM;
+
+      if (InterpretedFunction *callee = rt_->GetInterpretedFunctionByOffset(offset)) {
+        slots[0] = Handler(OP_CALL_DIRECT);
+        slots[1] = intptr_t(callee);
+      }
+      return SP_ERROR_NONE;
+    }
+
+    case OP_SYSREQ_C:
+    case OP_SYSREQ_N:
+    {
+      uint32_t native_index = cip[1];
+      if (native_index >= rt_->image()->NumNatives())
+        return SP_ERROR_INSTRUCTION_PARAM;
+
+      NativeEntry *native = rt_->NativeAt(native_index);
+      slots[1] = intptr_t(native);
+
+      if (op == OP_SYSREQ_N &&
+          native->status == SP_NATIVE_BOUND &&
+          !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)))
+      {
+        // The replacement opcodes consume their arguments straight off the
+        // stack, and never read the operand slots, so those become NOPs.
+        uint32_t replacement = rt_->GetNativeReplacement(native_index);
+        if (replacement != OP_NOP) {
+          slots[0] = Handler(replacement);
+          slots[1] = Handler(OP_NOP);
+          slots[2] = Handler(OP_NOP);
+        }
+      }
+      return SP_ERROR_NONE;
+    }
+
+    case OP_SWITCH:
+      // The analysis has checked that this names a case table.
+      return target(cip[1], &slots[1]);
+
+    case OP_CASETBL:
+    {
+      ucell_t ncases = cip[1];
+      if (int err = target(cip[2], &slots[2]))
+        return err;
+      for (ucell_t i = 0; i < ncases; i++) {
+        if (int err = target(cip[4 + i * 2], &slots[4 + i * 2]))
+          return err;
+      }
+      return SP_ERROR_NONE;
+    }
+
+    case OP_LODB_I:
+      if (cip[1] == 1)
+        slots[1] = 0xff;
+      else if (cip[1] == 2)
+        slots[1] = 0xffff;
+      else
+        slots[1] = -1;
+      return SP_ERROR_NONE;
+
+    case OP_TRACKER_PUSH_C:
+      slots[1] = intptr_t(ucell_t(cip[1]) * sizeof(cell_t));
+      return SP_ERROR_NONE;
+
+    default:
+      return SP_ERROR_NONE;
+  }
+}
+
+InterpretedFunction *
+sp::PredecodeFunction(PluginRuntime *rt, cell_t pcode_offs, int *err)
+{
+#if defined(SP_INTERP_THREADED)
+  if (!sDispatchTableReady) {
+    InterpState st = InterpState();
+    Execute(st, nullptr, nullptr, nullptr, nullptr, nullptr);
+  }
+#endif
+
+  Predecoder pd(rt, pcode_offs);
+  InterpretedFunction *fun = pd.decode(err);
+  if (!fun)
+    return nullptr;
+
+  rt->AddInterpretedFunction(fun);
+  return fun;
+}
+
+CompiledFunction *
+sp::TierUpIfHot(PluginRuntime *rt, InterpretedFunction *fn)
+{
+  if (fn->compiled_)
+    return fn->compiled_;
+
+  Environment *env = Environment::get();
+  if (!env->IsTieringEnabled() || fn->tier_up_failed_)
+    return nullptr;
+
+  uint32_t calls = env->tier_up_calls();
+  uint32_t backedges = env->tier_up_backedges();
+  if (!(calls && fn->calls_ >= calls) && !(backedges && fn->backedges_ >= backedges))
+    return nullptr;
+
+  // The runtime links the compiled function back to us when it is added.
+  int err = SP_ERROR_NONE;
+  if (!CompileFunction(rt, fn->GetCodeOffset(), &err)) {
+    fn->tier_up_failed_ = true;
+    return nullptr;
+  }
+  assert(fn->compiled_);
+  return fn->compiled_;
+}
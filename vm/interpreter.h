@@ -0,0 +1,111 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_interpreter_h_
+#define _include_sourcepawn_vm_interpreter_h_
+
+#include <sp_vm_types.h>
+#include <am-fixedarray.h>
+#include <am-utility.h>
+
+namespace sp {
+
+using namespace ke;
+
+class PluginRuntime;
+class PluginContext;
+class CompiledFunction;
+
+// A function that has been predecoded for the interpreter.
+//
+// The threaded code has exactly one slot for every cell of pcode, so an
+// instruction and its operands live at the same index they had in the
+// original function. Opcodes are replaced with handler addresses (or handler
+// numbers, if the compiler does not support computed goto), and operands are
+// replaced with their decoded form: jump targets become slot pointers,
+// native indexes become NativeEntry pointers, and so on. Because the layout
+// is parallel, the cip of any slot is trivial to recover.
+class InterpretedFunction
+{
+ public:
+  InterpretedFunction(cell_t pcode_offs, FixedArray<intptr_t> *code);
+  ~InterpretedFunction();
+
+ public:
+  intptr_t *GetEntry() const {
+    return code_->buffer();
+  }
+  cell_t GetCodeOffset() const {
+    return code_offset_;
+  }
+  size_t GetCodeSize() const {
+    return code_->length() * sizeof(intptr_t);
+  }
+
+  ucell_t FindCipByPc(void *pc);
+
+  // Tiered execution counters. Calls are counted on every entry, and
+  // backedges on every backward jump.
+  uint32_t calls() const {
+    return calls_;
+  }
+  uint32_t backedges() const {
+    return backedges_;
+  }
+  void OnCall() {
+    calls_++;
+  }
+  void OnBackedge() {
+    backedges_++;
+  }
+
+  // The JIT-compiled version of this function, if one exists.
+  CompiledFunction *compiled() const {
+    return compiled_;
+  }
+  void setCompiled(CompiledFunction *fn) {
+    compiled_ = fn;
+  }
+
+ private:
+  friend CompiledFunction *TierUpIfHot(PluginRuntime *rt, InterpretedFunction *fn);
+
+  cell_t code_offset_;
+  AutoPtr<FixedArray<intptr_t>> code_;
+  uint32_t calls_;
+  uint32_t backedges_;
+  CompiledFunction *compiled_;
+  bool tier_up_failed_;
+};
+
+// Predecode the function at the given pcode offset, and register it with the
+// runtime.
+InterpretedFunction *
+PredecodeFunction(PluginRuntime *rt, cell_t pcode_offs, int *err);
+
+// If the function has been compiled, return its compiled form. Otherwise, if
+// tiered execution is enabled and the function's counters have reached the
+// environment's thresholds, compile it. Returns null if the function should
+// keep running in the interpreter; a failed compilation is not an error, the
+// function simply stays interpreted.
+CompiledFunction *
+TierUpIfHot(PluginRuntime *rt, InterpretedFunction *fn);
+
+// Run a predecoded function. The context must already be inside an
+// InvokeFrame, and its arguments must already be pushed. Like
+// Environment::Invoke, the pending exception code is returned.
+int
+Interpret(PluginContext *cx, InterpretedFunction *fn, cell_t *result);
+
+}
+
+#endif // _include_sourcepawn_vm_interpreter_h_
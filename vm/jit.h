@@ -0,0 +1,27 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+// 
+// Copyright (C) 2006-2015 AlliedModders LLC
+// 
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_jit_h_
+#define _include_sourcepawn_vm_jit_h_
+
+// Select the JIT backend for the architecture we're compiling for.
+#if defined(__x86_64__) || defined(_M_X64)
+# define SP_JIT_ARCH_NAME "x64"
+# include "x64/jit_x64.h"
+# include "x64/frames-x64.h"
+#else
+# define SP_JIT_ARCH_NAME "x86"
+# include "x86/jit_x86.h"
+# include "x86/frames-x86.h"
+#endif
+
+#endif // _include_sourcepawn_vm_jit_h_
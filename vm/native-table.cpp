@@ -0,0 +1,49 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include "native-table.h"
+
+using namespace sp;
+using namespace SourcePawn;
+
+NativeTable::NativeTable()
+{
+  map_.init(256);
+}
+
+bool
+NativeTable::AddNatives(const sp_nativeinfo_t *natives, size_t count)
+{
+  for (size_t i = 0; i < count && natives[i].name; i++) {
+    NativeMap::Insert p = map_.findForAdd(natives[i].name);
+    if (p.found())
+      continue;
+    if (!map_.add(p, natives[i].name, natives[i].func))
+      return false;
+  }
+  return true;
+}
+
+SPVM_NATIVE_FUNC
+NativeTable::FindNative(const char *name)
+{
+  NativeMap::Result r = map_.find(name);
+  if (!r.found())
+    return nullptr;
+  return r->value;
+}
+
+size_t
+NativeTable::NumNatives()
+{
+  return map_.elements();
+}
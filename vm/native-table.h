@@ -0,0 +1,50 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_native_table_h_
+#define _include_sourcepawn_vm_native_table_h_
+
+#include <string.h>
+#include <sp_vm_api.h>
+#include <am-hashmap.h>
+
+namespace sp {
+
+using namespace SourcePawn;
+
+class NativeTable : public INativeTable
+{
+ public:
+  NativeTable();
+
+  bool AddNatives(const sp_nativeinfo_t *natives, size_t count) KE_OVERRIDE;
+  SPVM_NATIVE_FUNC FindNative(const char *name) KE_OVERRIDE;
+  size_t NumNatives() KE_OVERRIDE;
+
+ private:
+  // Names are owned by the host.
+  struct NamePolicy {
+    static inline uint32_t hash(const char *key) {
+      return ke::HashCharSequence(key, strlen(key));
+    }
+    static inline bool matches(const char *a, const char *b) {
+      return strcmp(a, b) == 0;
+    }
+  };
+  typedef ke::HashMap<const char *, SPVM_NATIVE_FUNC, NamePolicy> NativeMap;
+
+  NativeMap map_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_native_table_h_
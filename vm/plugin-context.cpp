@@ -16,10 +16,12 @@
 #include <limits.h>
 #include <sp_vm_api.h>
 #include "plugin-context.h"
+#include "context-memory.h"
 #include "watchdog_timer.h"
-#include "x86/jit_x86.h"
+#include "jit.h"
 #include "environment.h"
 #include "compiled-function.h"
+#include "interpreter.h"
 
 using namespace sp;
 using namespace SourcePawn;
@@ -33,6 +35,7 @@ PluginContext::PluginContext(PluginRuntime *pRuntime)
  : env_(Environment::get()),
    m_pRuntime(pRuntime),
    memory_(nullptr),
+   mapped_length_(0),
    data_size_(m_pRuntime->data().length),
    mem_size_(m_pRuntime->image()->HeapSize()),
    m_pNullVec(nullptr),
@@ -51,26 +54,50 @@ PluginContext::PluginContext(PluginRuntime *pRuntime)
   hp_ = data_size_;
   sp_ = mem_size_ - sizeof(cell_t);
   frm_ = sp_;
-
-  tracker_.pBase = (ucell_t *)malloc(1024);
-  tracker_.pCur = tracker_.pBase;
-  tracker_.size = 1024 / sizeof(cell_t);
 }
 
 PluginContext::~PluginContext()
 {
-  free(tracker_.pBase);
-  delete[] memory_;
+  if (mapped_length_)
+    FreeContextMemory(memory_, mapped_length_);
+  else
+    delete[] memory_;
 }
 
 bool
 PluginContext::Initialize()
 {
-  memory_ = new uint8_t[mem_size_];
-  if (!memory_)
-    return false;
-  memset(memory_ + data_size_, 0, mem_size_ - data_size_);
-  memcpy(memory_, m_pRuntime->data().bytes, data_size_);
+  // The tracker gets one entry per cell of heap and stack. Every non-empty
+  // allocation takes at least one cell, so it fills up only after the heap
+  // would have. Like the heap, its pages are only committed once they are
+  // used, so a large heap costs address space rather than memory.
+  size_t tracker_entries = (mem_size_ - data_size_) / sizeof(cell_t);
+  size_t memory_length = mem_size_ + tracker_entries * sizeof(cell_t);
+
+  // Mapped memory starts out zeroed, and the heap and stack are only
+  // committed as they are used.
+  if (SharedData *shared = m_pRuntime->shared_data()) {
+    if ((memory_ = shared->Map(memory_length)) != nullptr)
+      mapped_length_ = memory_length;
+  }
+  if (!memory_) {
+    if ((memory_ = AllocateContextMemory(memory_length)) != nullptr) {
+      mapped_length_ = memory_length;
+      memcpy(memory_, m_pRuntime->data().bytes, data_size_);
+    }
+  }
+  if (!memory_) {
+    memory_ = new uint8_t[memory_length];
+    if (!memory_)
+      return false;
+    memset(memory_ + data_size_, 0, mem_size_ - data_size_);
+    memcpy(memory_, m_pRuntime->data().bytes, data_size_);
+  }
+
+  // The tracker is outside of [0, mem_size_), so plugins cannot address it.
+  tracker_.pBase = reinterpret_cast<ucell_t *>(memory_ + mem_size_);
+  tracker_.pCur = tracker_.pBase;
+  tracker_.pLimit = tracker_.pBase + tracker_entries;
 
   /* Initialize the null references */
   uint32_t index;
@@ -541,16 +568,23 @@ PluginContext::Invoke(funcid_t fnid, const cell_t *params, unsigned int num_para
     return false;
   }
 
+  // Yuck. We have to do this for compatibility, otherwise something like
+  // ForwardSys or any sort of multi-callback-fire code would die. Forwards
+  // that want to avoid this should use IPluginForward instead.
+  env_->clearPendingException();
+
+  return invokeFunction(cfun, params, num_params, result);
+}
+
+bool
+PluginContext::invokeFunction(ScriptedInvoker *cfun, const cell_t *params, unsigned int num_params,
+                              cell_t *result)
+{
   if ((cell_t)(hp_ + 16*sizeof(cell_t)) > (cell_t)(sp_ - (sizeof(cell_t) * (num_params + 1)))) {
     ReportErrorNumber(SP_ERROR_STACKLOW);
     return false;
   }
 
-  // Yuck. We have to do this for compatibility, otherwise something like
-  // ForwardSys or any sort of multi-callback-fire code would die. Later,
-  // we'll expose an Invoke() or something that doesn't do this.
-  env_->clearPendingException();
-
   cell_t ignore_result;
   if (result == NULL)
     result = &ignore_result;
@@ -558,44 +592,71 @@ PluginContext::Invoke(funcid_t fnid, const cell_t *params, unsigned int num_para
   /* We got this far.  It's time to start profiling. */
   EnterProfileScope scriptScope("SourcePawn", cfun->FullName());
 
+  /* Pick up anything that has been compiled in the background. */
+  m_pRuntime->LinkBackgroundFunctions();
+
   /* See if we have to compile the callee. */
   CompiledFunction *fn = nullptr;
+  InterpretedFunction *ifn = nullptr;
   if (env_->IsJitEnabled()) {
     /* We might not have to - check pcode offset. */
     if ((fn = cfun->cachedCompiledFunction()) == nullptr) {
       fn = m_pRuntime->GetJittedFunctionByOffset(cfun->Public()->code_offs);
-      if (!fn) {
+      if (!fn && !env_->IsTieringEnabled()) {
         int err = SP_ERROR_NONE;
         if ((fn = CompileFunction(m_pRuntime, cfun->Public()->code_offs, &err)) == NULL) {
           ReportErrorNumber(err);
           return false;
         }
       }
-      cfun->setCachedCompiledFunction(fn);
+      if (fn)
+        cfun->setCachedCompiledFunction(fn);
     }
-  } else {
-    ReportError("JIT is not enabled!");
-    return false;
+  }
+  if (!fn) {
+    /* The interpreter predecodes functions on first use instead. */
+    ifn = m_pRuntime->GetInterpretedFunctionByOffset(cfun->Public()->code_offs);
+    if (!ifn) {
+      int err = SP_ERROR_NONE;
+      if ((ifn = PredecodeFunction(m_pRuntime, cfun->Public()->code_offs, &err)) == NULL) {
+        ReportErrorNumber(err);
+        return false;
+      }
+    }
+
+    /* With tiered execution, hot functions graduate to the JIT. */
+    if (env_->IsTieringEnabled() && (fn = TierUpIfHot(m_pRuntime, ifn)) != nullptr)
+      cfun->setCachedCompiledFunction(fn);
   }
 
   /* Save our previous state. */
   cell_t save_sp = sp_;
   cell_t save_hp = hp_;
 
+  /* Compiled calls push their own parameters, if they can. */
+  EntryTrampolineFn entry = fn ? cfun->entryTrampoline(fn, num_params) : nullptr;
+
   /* Push parameters */
-  sp_ -= sizeof(cell_t) * (num_params + 1);
-  cell_t *sp = (cell_t *)(memory_ + sp_);
+  if (!entry) {
+    sp_ -= sizeof(cell_t) * (num_params + 1);
+    cell_t *sp = (cell_t *)(memory_ + sp_);
 
-  sp[0] = num_params;
-  for (unsigned int i = 0; i < num_params; i++)
-    sp[i + 1] = params[i];
+    sp[0] = num_params;
+    for (unsigned int i = 0; i < num_params; i++)
+      sp[i + 1] = params[i];
+  }
 
   // Enter the execution engine.
   int ir;
   {
-    InvokeFrame ivkframe(this, fn->GetCodeOffset()); 
+    InvokeFrame ivkframe(this, cfun->Public()->code_offs);
     Environment *env = env_;
-    ir = env->Invoke(m_pRuntime, fn, result);
+    if (entry)
+      ir = env->Invoke(m_pRuntime, entry, params, result);
+    else if (fn)
+      ir = env->Invoke(m_pRuntime, fn, result);
+    else
+      ir = Interpret(this, ifn, result);
   }
 
   if (ir == SP_ERROR_NONE) {
@@ -674,13 +735,10 @@ PluginContext::ClearLastNativeError()
 int
 PluginContext::popTrackerAndSetHeap()
 {
-  assert(tracker_.pCur > tracker_.pBase);
-
-  tracker_.pCur--;
-  if (tracker_.pCur < tracker_.pBase)
+  if (tracker_.pCur <= tracker_.pBase)
     return SP_ERROR_TRACKER_BOUNDS;
 
-  ucell_t amt = *tracker_.pCur;
+  ucell_t amt = *--tracker_.pCur;
   if (amt > (hp_ - data_size_))
     return SP_ERROR_HEAPMIN;
 
@@ -691,95 +749,41 @@ PluginContext::popTrackerAndSetHeap()
 int
 PluginContext::pushTracker(uint32_t amount)
 {
-  if ((size_t)(tracker_.pCur - tracker_.pBase) >= tracker_.size)
+  if (tracker_.pCur >= tracker_.pLimit)
     return SP_ERROR_TRACKER_BOUNDS;
 
-  if (tracker_.pCur + 1 - (tracker_.pBase + tracker_.size) == 0) {
-    size_t disp = tracker_.size - 1;
-    tracker_.size *= 2;
-    tracker_.pBase = (ucell_t *)realloc(tracker_.pBase, tracker_.size * sizeof(cell_t));
-
-    if (!tracker_.pBase)
-      return SP_ERROR_TRACKER_BOUNDS;
-
-    tracker_.pCur = tracker_.pBase + disp;
-  }
-
   *tracker_.pCur++ = amount;
   return SP_ERROR_NONE;
 }
 
-struct array_creation_t
-{
-  const cell_t *dim_list;     /* Dimension sizes */
-  cell_t dim_count;           /* Number of dimensions */
-  cell_t *data_offs;          /* Current offset AFTER the indirection vectors (data) */
-  cell_t *base;               /* array base */
-};
-
+// Multi-dimensional arrays are laid out one level at a time: the outermost
+// vector, then every vector of the next level in order, and so on, with the
+// data last. Each entry holds the byte offset from itself to the vector (or
+// data row) it points at.
+//
+// A level with |count| entries is followed directly by the next level, so
+// the first entry's offset is |count| cells, and each entry after it points
+// one row further along while being one cell further in, so the offset goes
+// up by the next dimension's size minus one.
+//
+// |dims| is in stack order, innermost dimension first. Returns the number of
+// cells written, which is where the data starts.
 static cell_t
-GenerateInnerArrayIndirectionVectors(array_creation_t *ar, int dim, cell_t cur_offs)
-{
-  cell_t write_offs = cur_offs;
-  cell_t *data_offs = ar->data_offs;
-
-  cur_offs += ar->dim_list[dim];
-
-  // Dimension n-x where x > 2 will have sub-vectors.  
-  // Otherwise, we just need to reference the data section.
-  if (ar->dim_count > 2 && dim < ar->dim_count - 2) {
-    // For each index at this dimension, write offstes to our sub-vectors.
-    // After we write one sub-vector, we generate its sub-vectors recursively.
-    // At the end, we're given the next offset we can use.
-    for (int i = 0; i < ar->dim_list[dim]; i++) {
-      ar->base[write_offs] = (cur_offs - write_offs) * sizeof(cell_t);
-      write_offs++;
-      cur_offs = GenerateInnerArrayIndirectionVectors(ar, dim + 1, cur_offs);
-    }
-  } else {
-    // In this section, there are no sub-vectors, we need to write offsets 
-    // to the data.  This is separate so the data stays in one big chunk.
-    // The data offset will increment by the size of the last dimension, 
-    // because that is where the data is finally computed as. 
-    for (int i = 0; i < ar->dim_list[dim]; i++) {
-      ar->base[write_offs] = (*data_offs - write_offs) * sizeof(cell_t);
-      write_offs++;
-      *data_offs = *data_offs + ar->dim_list[dim + 1];
+GenerateArrayIndirectionVectors(cell_t *base, const cell_t *dims, uint32_t dimcount)
+{
+  cell_t *entry = base;
+  uint32_t count = 1;
+  for (uint32_t level = dimcount - 1; level > 0; level--) {
+    count *= uint32_t(dims[level]);
+
+    cell_t offset = count * sizeof(cell_t);
+    cell_t step = (dims[level - 1] - 1) * sizeof(cell_t);
+    for (uint32_t i = 0; i < count; i++) {
+      *entry++ = offset;
+      offset += step;
     }
   }
-
-  return cur_offs;
-}
-
-static cell_t
-calc_indirection(const array_creation_t *ar, cell_t dim)
-{
-  cell_t size = ar->dim_list[dim];
-  if (dim < ar->dim_count - 2)
-    size += ar->dim_list[dim] * calc_indirection(ar, dim + 1);
-  return size;
-}
-
-static cell_t
-GenerateArrayIndirectionVectors(cell_t *arraybase, cell_t dims[], cell_t _dimcount, bool autozero)
-{
-  array_creation_t ar;
-  cell_t data_offs;
-
-  /* Reverse the dimensions */
-  cell_t dim_list[sDIMEN_MAX];
-  int cur_dim = 0;
-  for (int i = _dimcount - 1; i >= 0; i--)
-    dim_list[cur_dim++] = dims[i];
-  
-  ar.base = arraybase;
-  ar.dim_list = dim_list;
-  ar.dim_count = _dimcount;
-  ar.data_offs = &data_offs;
-
-  data_offs = calc_indirection(&ar, 0);
-  GenerateInnerArrayIndirectionVectors(&ar, 0, 0);
-  return data_offs;
+  return entry - base;
 }
 
 int
@@ -811,19 +815,18 @@ PluginContext::generateFullArray(uint32_t argc, cell_t *argv, int autozero)
     return SP_ERROR_ARRAY_TOO_BIG;
 
   uint32_t new_hp = hp_ + bytes;
-  cell_t *dat_hp = reinterpret_cast<cell_t *>(memory_ + new_hp);
 
   // argv, coincidentally, is STK.
-  if (dat_hp >= argv - STACK_MARGIN)
+  if (bytes >= uintptr_t(argv - STACK_MARGIN) - uintptr_t(memory_ + hp_))
     return SP_ERROR_HEAPLOW;
 
   if (int err = pushTracker(bytes))
     return err;
 
   cell_t *base = reinterpret_cast<cell_t *>(memory_ + hp_);
-  cell_t offs = GenerateArrayIndirectionVectors(base, argv, argc, !!autozero);
-  assert(size_t(offs) == cells);
-  (void)offs;
+  cell_t data_offs = GenerateArrayIndirectionVectors(base, argv, argc);
+  if (autozero)
+    memset(base + data_offs, 0, (cells - data_offs) * sizeof(cell_t));
 
   argv[argc - 1] = hp_;
   hp_ = new_hp;
@@ -835,21 +838,22 @@ PluginContext::generateArray(cell_t dims, cell_t *stk, bool autozero)
 {
   if (dims == 1) {
     uint32_t size = *stk;
-    if (size == 0 || !ke::IsUint32MultiplySafe(size, 4))
+    if (!ke::IsUint32MultiplySafe(size, 4))
       return SP_ERROR_ARRAY_TOO_BIG;
-    *stk = hp_;
 
+    // Compare against the space left, so a large size can't wrap hp_.
     uint32_t bytes = size * 4;
+    if (bytes >= uintptr_t(stk) - uintptr_t(memory_ + hp_))
+      return SP_ERROR_HEAPLOW;
 
+    *stk = hp_;
     hp_ += bytes;
-    if (uintptr_t(memory_ + hp_) >= uintptr_t(stk))
-      return SP_ERROR_HEAPLOW;
 
     if (int err = pushTracker(bytes))
       return err;
 
     if (autozero)
-      memset(memory_ + hp_, 0, bytes);
+      memset(memory_ + *stk, 0, bytes);
 
     return SP_ERROR_NONE;
   }
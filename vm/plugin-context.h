@@ -19,16 +19,19 @@
 
 namespace sp {
 
+// Amounts of local HEA growth, so they can be popped in order. This lives in
+// a fixed region just past the end of the plugin's memory, so that JIT code
+// can push and pop it inline.
 struct HeapTracker
 {
   HeapTracker()
-   : size(0),
-     pBase(nullptr),
-     pCur(nullptr)
+   : pBase(nullptr),
+     pCur(nullptr),
+     pLimit(nullptr)
   {}
-  size_t size; 
-  ucell_t *pBase; 
+  ucell_t *pBase;
   ucell_t *pCur;
+  ucell_t *pLimit;
 };
 
 static const size_t SP_MAX_RETURN_STACK = 1024;
@@ -100,6 +103,12 @@ class PluginContext : public IPluginContext
 
   bool Invoke(funcid_t fnid, const cell_t *params, unsigned int num_params, cell_t *result);
 
+  // Invoke a public function of this context, without the checks that only
+  // need to happen once per entry from the host. The caller must check that
+  // the plugin is runnable and that no exception is pending.
+  bool invokeFunction(ScriptedInvoker *cfun, const cell_t *params, unsigned int num_params,
+                      cell_t *result);
+
   size_t HeapSize() const {
     return mem_size_;
   }
@@ -119,6 +128,15 @@ class PluginContext : public IPluginContext
   static inline size_t offsetOfTracker() {
     return offsetof(PluginContext, tracker_);
   }
+  static inline size_t offsetOfTrackerBase() {
+    return offsetOfTracker() + offsetof(HeapTracker, pBase);
+  }
+  static inline size_t offsetOfTrackerCur() {
+    return offsetOfTracker() + offsetof(HeapTracker, pCur);
+  }
+  static inline size_t offsetOfTrackerLimit() {
+    return offsetOfTracker() + offsetof(HeapTracker, pLimit);
+  }
   static inline size_t offsetOfSp() {
     return offsetof(PluginContext, sp_);
   }
@@ -128,6 +146,12 @@ class PluginContext : public IPluginContext
   static inline size_t offsetOfMemory() {
     return offsetof(PluginContext, memory_);
   }
+  static inline size_t offsetOfHp() {
+    return offsetof(PluginContext, hp_);
+  }
+  static inline size_t offsetOfFrm() {
+    return offsetof(PluginContext, frm_);
+  }
 
   int32_t *addressOfSp() {
     return &sp_;
@@ -138,6 +162,12 @@ class PluginContext : public IPluginContext
   cell_t *addressOfHp() {
     return &hp_;
   }
+  ucell_t **addressOfTrackerCur() {
+    return &tracker_.pCur;
+  }
+  const HeapTracker &tracker() const {
+    return tracker_;
+  }
 
   cell_t frm() const {
     return frm_;
@@ -169,6 +199,7 @@ class PluginContext : public IPluginContext
   Environment *env_;
   PluginRuntime *m_pRuntime;
   uint8_t *memory_;
+  size_t mapped_length_;  // Non-zero if memory_ was mapped, not allocated with new[].
   uint32_t data_size_;
   uint32_t mem_size_;
 
@@ -0,0 +1,207 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include "plugin-loader.h"
+#include "api.h"
+#include "plugin-runtime.h"
+#include "smx-v1-image.h"
+
+using namespace sp;
+
+SmxV1Image *
+sp::LoadPluginImage(const char *file, bool map, char *error, size_t maxlength)
+{
+  FILE *fp = fopen(file, "rb");
+
+  if (!fp) {
+    UTIL_Format(error, maxlength, "file not found");
+    return nullptr;
+  }
+
+  ke::AutoPtr<SmxV1Image> image(new SmxV1Image(fp, map));
+  fclose(fp);
+
+  if (!image->validate()) {
+    const char *errorMessage = image->errorMessage();
+    if (!errorMessage)
+      errorMessage = "file parse error";
+    UTIL_Format(error, maxlength, "%s", errorMessage);
+    return nullptr;
+  }
+
+  return image.take();
+}
+
+PluginRuntime *
+sp::CreatePluginRuntime(SmxV1Image *image, const char *file, char *error, size_t maxlength)
+{
+  PluginRuntime *pRuntime = new PluginRuntime(image);
+  if (!pRuntime->Initialize()) {
+    delete pRuntime;
+
+    UTIL_Format(error, maxlength, "out of memory");
+    return nullptr;
+  }
+
+  size_t len = strlen(file);
+  for (size_t i = len - 1; i < len; i--) {
+    if (file[i] == '/' 
+# if defined WIN32
+      || file[i] == '\\'
+# endif
+    )
+    {
+      pRuntime->SetNames(file, &file[i + 1]);
+      break;
+    }
+  }
+
+  if (!pRuntime->Name())
+    pRuntime->SetNames(file, file);
+
+  return pRuntime;
+}
+
+PluginLoader::PluginLoader(const char * const *files, size_t count, bool map)
+ : map_(map),
+   count_(count),
+   files_(new File[count]),
+   next_file_(0),
+   cancelled_(false)
+{
+  for (size_t i = 0; i < count_; i++) {
+    files_[i].path = files[i];
+    files_[i].state = State::Pending;
+    files_[i].image = nullptr;
+  }
+}
+
+PluginLoader::~PluginLoader()
+{
+  {
+    ke::AutoLock lock(&cv_);
+    cancelled_ = true;
+  }
+
+  for (size_t i = 0; i < threads_.length(); i++) {
+    threads_[i]->Join();
+    delete threads_[i];
+  }
+  for (size_t i = 0; i < count_; i++)
+    delete files_[i].image;
+}
+
+void
+PluginLoader::Start(size_t nthreads)
+{
+  if (count_ < nthreads)
+    nthreads = count_;
+
+  // If no thread starts, every file is loaded by FinishLoading().
+  for (size_t i = 0; i < nthreads; i++) {
+    ke::Thread *thread = new ke::Thread(this, "SP Loader");
+    if (!thread->Succeeded()) {
+      delete thread;
+      break;
+    }
+    threads_.append(thread);
+  }
+}
+
+size_t
+PluginLoader::GetFileCount()
+{
+  return count_;
+}
+
+const char *
+PluginLoader::GetFilePath(size_t index)
+{
+  if (index >= count_)
+    return nullptr;
+  return files_[index].path.chars();
+}
+
+void
+PluginLoader::load(File *file)
+{
+  char error[255];
+  file->image = LoadPluginImage(file->path.chars(), map_, error, sizeof(error));
+  if (!file->image)
+    file->error = error;
+}
+
+void
+PluginLoader::Run()
+{
+  for (;;) {
+    File *file;
+    {
+      ke::AutoLock lock(&cv_);
+      while (next_file_ < count_ && files_[next_file_].state != State::Pending)
+        next_file_++;
+      if (cancelled_ || next_file_ >= count_)
+        return;
+      file = &files_[next_file_++];
+      file->state = State::Loading;
+    }
+
+    load(file);
+
+    ke::AutoLock lock(&cv_);
+    file->state = State::Loaded;
+    cv_.NotifyAll();
+  }
+}
+
+IPluginRuntime *
+PluginLoader::FinishLoading(size_t index, char *error, size_t maxlength)
+{
+  if (index >= count_) {
+    UTIL_Format(error, maxlength, "invalid file index");
+    return nullptr;
+  }
+
+  File *file = &files_[index];
+  bool claimed = false;
+  {
+    ke::AutoLock lock(&cv_);
+    if (file->state == State::Finished) {
+      UTIL_Format(error, maxlength, "file already finished");
+      return nullptr;
+    }
+    if (file->state == State::Pending) {
+      file->state = State::Loading;
+      claimed = true;
+    } else {
+      while (file->state != State::Loaded)
+        cv_.Wait();
+    }
+  }
+
+  if (claimed)
+    load(file);
+
+  {
+    ke::AutoLock lock(&cv_);
+    file->state = State::Finished;
+  }
+
+  SmxV1Image *image = file->image;
+  file->image = nullptr;
+  if (!image) {
+    UTIL_Format(error, maxlength, "%s", file->error.chars());
+    return nullptr;
+  }
+  return CreatePluginRuntime(image, file->path.chars(), error, maxlength);
+}
@@ -0,0 +1,90 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_plugin_loader_h_
+#define _include_sourcepawn_vm_plugin_loader_h_
+
+#include <sp_vm_api.h>
+#include <am-string.h>
+#include <am-utility.h>
+#include <am-vector.h>
+#include <am-thread-utils.h>
+
+namespace sp {
+
+using namespace SourcePawn;
+
+class PluginRuntime;
+class SmxV1Image;
+
+// Reads and validates a plugin file. This touches no shared state, so it can
+// run on any thread. Returns null and formats an error on failure.
+SmxV1Image *LoadPluginImage(const char *file, bool map, char *error, size_t maxlength);
+
+// Creates a runtime from a validated image, taking ownership of the image.
+// This registers the runtime with the environment, so it must run on the
+// main thread.
+PluginRuntime *CreatePluginRuntime(SmxV1Image *image, const char *file,
+                                   char *error, size_t maxlength);
+
+// Loads plugin images on worker threads. Workers take files in order; if the
+// main thread asks for one that no worker has started, it loads that file
+// itself rather than waiting.
+class PluginLoader
+ : public IPluginLoader,
+   public ke::IRunnable
+{
+ public:
+  PluginLoader(const char * const *files, size_t count, bool map);
+  ~PluginLoader();
+
+  void Start(size_t nthreads);
+
+  size_t GetFileCount() KE_OVERRIDE;
+  const char *GetFilePath(size_t index) KE_OVERRIDE;
+  IPluginRuntime *FinishLoading(size_t index, char *error, size_t maxlength) KE_OVERRIDE;
+
+  // ke::IRunnable
+  void Run() KE_OVERRIDE;
+
+ private:
+  enum class State {
+    Pending,
+    Loading,
+    Loaded,
+    Finished
+  };
+
+  struct File {
+    ke::AString path;
+    State state;
+    SmxV1Image *image;
+    ke::AString error;
+  };
+
+  void load(File *file);
+
+ private:
+  bool map_;
+  size_t count_;
+  ke::AutoArray<File> files_;
+  ke::Vector<ke::Thread *> threads_;
+
+  // Protects the state of each file, and the fields below.
+  ke::ConditionVariable cv_;
+  size_t next_file_;
+  bool cancelled_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_plugin_loader_h_
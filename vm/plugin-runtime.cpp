@@ -15,11 +15,14 @@
 #include <string.h>
 #include <assert.h>
 #include "plugin-runtime.h"
-#include "x86/jit_x86.h"
+#include "background-compiler.h"
+#include "code-cache.h"
+#include "jit.h"
 #include "plugin-context.h"
 #include "environment.h"
 
 #include "md5/md5.h"
+#include "native-table.h"
 
 using namespace sp;
 using namespace SourcePawn;
@@ -41,6 +44,13 @@ PluginRuntime::PluginRuntime(LegacyImage *image)
 
 PluginRuntime::~PluginRuntime()
 {
+  // Background compile threads take the lock below, so they must be stopped
+  // before we grab it.
+  background_ = nullptr;
+
+  if (code_cache_)
+    code_cache_->Save();
+
   // The watchdog thread takes the global JIT lock while it patches all
   // runtimes. It is not enough to ensure that the unlinking of the runtime is
   // protected; we cannot delete functions or code while the watchdog might be
@@ -52,8 +62,15 @@ PluginRuntime::~PluginRuntime()
   for (uint32_t i = 0; i < image_->NumPublics(); i++)
     delete entrypoints_[i];
 
+  for (uint32_t i = 0; i < image_->NumNatives(); i++) {
+    if (natives_[i].is_linked)
+      Environment::get()->APIv1()->FreePageMemory((void *)natives_[i].legacy_fn);
+  }
+
   for (size_t i = 0; i < m_JitFunctions.length(); i++)
     delete m_JitFunctions[i];
+  for (size_t i = 0; i < interp_functions_.length(); i++)
+    delete interp_functions_[i];
 }
 
 bool
@@ -88,14 +105,39 @@ PluginRuntime::Initialize()
     return false;
   memset(entrypoints_, 0, sizeof(ScriptedInvoker *) * image_->NumPublics());
 
+  // If this fails, the context copies the data as usual.
+  Environment *env = Environment::get();
+  if (env->IsSharedDataEnabled())
+    shared_data_ = SharedData::Acquire(this);
+
   context_ = new PluginContext(this);
   if (!context_->Initialize())
     return false;
 
-  SetupFloatNativeRemapping();
+  SetupNativeReplacements();
 
   if (!function_map_.init(32))
     return false;
+  if (!interp_function_map_.init(32))
+    return false;
+
+  if (env->IsJitEnabled() && env->code_cache_dir()[0]) {
+    if (const char *build_id = CodeCacheBuildId()) {
+      code_cache_ = new CodeCache(this, env->code_cache_dir(), build_id);
+      code_cache_->Load();
+    }
+  }
+
+  // Tiered execution wants to compile only hot functions, so it does not
+  // get along with compiling everything up front.
+  if (env->background_compile_threads() && env->IsJitEnabled() && !env->IsTieringEnabled()) {
+    background_ = new BackgroundCompiler(this);
+    if (!background_->Initialize())
+      background_ = nullptr;
+  }
+
+  if (!ResolveFunctionKeys())
+    return false;
 
   return true;
 }
@@ -127,30 +169,80 @@ static const NativeMapping sNativeMap[] = {
   { NULL,             0 },
 };
 
+// Number of arguments each intrinsic takes.
+static const uint32_t sIntrinsicArgs[SP_INTRINSICS_TOTAL] = {
+  0, // SP_INTRINSIC_NONE
+  1, // SP_INTRINSIC_ABS
+  2, // SP_INTRINSIC_MIN
+  2, // SP_INTRINSIC_MAX
+  3, // SP_INTRINSIC_CLAMP
+  2, // SP_INTRINSIC_BIT_TEST
+  1, // SP_INTRINSIC_BIT_COUNT
+  3, // SP_INTRINSIC_VECTOR_ADD
+  3, // SP_INTRINSIC_VECTOR_SUB
+  2, // SP_INTRINSIC_VECTOR_DOT
+  2, // SP_INTRINSIC_VECTOR_LENGTH
+  1, // SP_INTRINSIC_STRLEN
+};
+
 void
-PluginRuntime::SetupFloatNativeRemapping()
+PluginRuntime::SetupNativeReplacements()
 {
-  float_table_ = new floattbl_t[image_->NumNatives()];
+  Environment *env = Environment::get();
+
+  replacements_ = new NativeReplacement[image_->NumNatives()];
   for (size_t i = 0; i < image_->NumNatives(); i++) {
     const char *name = image_->GetNative(i);
     const NativeMapping *iter = sNativeMap;
     while (iter->name) {
       if (strcmp(name, iter->name) == 0) {
-        float_table_[i].found = true;
-        float_table_[i].index = iter->opcode;
+        replacements_[i].opcode = iter->opcode;
         break;
       }
       iter++;
     }
+    if (!iter->name)
+      replacements_[i].intrinsic = env->FindNativeIntrinsic(name);
   }
 }
 
 unsigned
 PluginRuntime::GetNativeReplacement(size_t index)
 {
-  if (!float_table_[index].found)
+  if (!replacements_[index].opcode)
     return OP_NOP;
-  return float_table_[index].index;
+  return replacements_[index].opcode;
+}
+
+SP_INTRINSIC
+PluginRuntime::GetNativeIntrinsic(size_t index, uint32_t nparams)
+{
+  SP_INTRINSIC intrinsic = replacements_[index].intrinsic;
+  if (intrinsic == SP_INTRINSIC_NONE || sIntrinsicArgs[intrinsic] != nparams)
+    return SP_INTRINSIC_NONE;
+  return intrinsic;
+}
+
+// Summarize the parts of a native's binding, other than its address, that
+// compiled code depends on: its intrinsic, its fast signature, and whether it
+// is linked to a function or marked as a leaf.
+uint32_t
+PluginRuntime::GetNativeBindingKey(size_t index)
+{
+  const NativeEntry &native = natives_[index];
+  uint32_t key = uint32_t(replacements_[index].intrinsic);
+  if (native.fast.func) {
+    key |= 1 << 8;
+    key |= native.fast.ret << 9;
+    key |= native.fast.nargs << 10;
+    for (uint32_t i = 0; i < native.fast.nargs; i++)
+      key |= native.fast.args[i] << (13 + i * 2);
+  }
+  if (native.is_linked)
+    key |= 1 << 21;
+  if (native.flags & SP_NTVFLAG_LEAF)
+    key |= 1 << 22;
+  return key;
 }
 
 void
@@ -172,6 +264,10 @@ PluginRuntime::AddJittedFunction(CompiledFunction *fn)
 
     function_map_.add(p, pcode_offset, fn);
   }
+
+  // If the function was running in the interpreter, let it tier up.
+  if (InterpretedFunction *ifn = GetInterpretedFunctionByOffset(pcode_offset))
+    ifn->setCompiled(fn);
 }
 
 CompiledFunction *
@@ -183,6 +279,44 @@ PluginRuntime::GetJittedFunctionByOffset(cell_t pcode_offset)
   return r->value;
 }
 
+void
+PluginRuntime::AddInterpretedFunction(InterpretedFunction *fn)
+{
+  interp_functions_.append(fn);
+
+  ucell_t pcode_offset = fn->GetCodeOffset();
+  {
+    InterpFunctionMap::Insert p = interp_function_map_.findForAdd(pcode_offset);
+    assert(!p.found());
+
+    interp_function_map_.add(p, pcode_offset, fn);
+  }
+
+  // With tiered execution, the JIT may have compiled this function first.
+  fn->setCompiled(GetJittedFunctionByOffset(pcode_offset));
+}
+
+void
+PluginRuntime::LinkBackgroundFunctions()
+{
+  if (background_ && background_->Link()) {
+    background_ = nullptr;
+
+    // Everything has been compiled, so this is a good time to save.
+    if (code_cache_)
+      code_cache_->Save();
+  }
+}
+
+InterpretedFunction *
+PluginRuntime::GetInterpretedFunctionByOffset(cell_t pcode_offset)
+{
+  InterpFunctionMap::Result r = interp_function_map_.find(pcode_offset);
+  if (!r.found())
+    return nullptr;
+  return r->value;
+}
+
 int
 PluginRuntime::FindNativeByName(const char *name, uint32_t *index)
 {
@@ -204,10 +338,28 @@ PluginRuntime::GetNativeByIndex(uint32_t index, sp_native_t **native)
 
 int
 PluginRuntime::UpdateNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, uint32_t flags, void *data)
+{
+  return UpdateFastNativeBinding(index, pfn, nullptr, flags, data);
+}
+
+int
+PluginRuntime::UpdateFastNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn,
+                                       const sp_fastnative_t *fast, uint32_t flags, void *data)
 {
   if (index >= image_->NumNatives())
     return SP_ERROR_INDEX;
 
+  if (fast) {
+    if (!pfn || !fast->func || fast->nargs > SP_FASTNATIVE_MAX_ARGS)
+      return SP_ERROR_PARAM;
+    if (fast->ret != SP_FASTARG_CELL && fast->ret != SP_FASTARG_FLOAT)
+      return SP_ERROR_PARAM;
+    for (uint32_t i = 0; i < fast->nargs; i++) {
+      if (fast->args[i] > SP_FASTARG_REF)
+        return SP_ERROR_PARAM;
+    }
+  }
+
   NativeEntry* native = &natives_[index];
 
   // The native must either be unbound, or it must be ephemeral or optional.
@@ -219,12 +371,97 @@ PluginRuntime::UpdateNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, uint32_
     return SP_ERROR_PARAM;
   }
 
+  if (native->is_linked) {
+    Environment::get()->APIv1()->FreePageMemory((void *)native->legacy_fn);
+    native->is_linked = false;
+    native->linked = nullptr;
+  }
+
   native->legacy_fn = pfn;
   native->status = pfn
                    ? SP_NATIVE_BOUND
                    : SP_NATIVE_UNBOUND;
   native->flags = flags;
   native->user = data;
+  if (fast)
+    native->fast = *fast;
+  else
+    native->fast.func = nullptr;
+  return SP_ERROR_NONE;
+}
+
+int
+PluginRuntime::LinkNativeToFunction(uint32_t index, IPluginFunction *target, uint32_t flags)
+{
+  if (!target || !(target->GetFunctionID() & 1))
+    return SP_ERROR_PARAM;
+
+  // Calling the function can throw, and uses both plugins' heaps.
+  if (flags & SP_NTVFLAG_LEAF)
+    return SP_ERROR_PARAM;
+
+  // The interpreter, and the JIT for ephemeral natives, still call through
+  // legacy_fn. The stub passes the entry rather than the function, so the
+  // link can be cut if the function's plugin goes away.
+  SPVM_NATIVE_FUNC stub =
+    Environment::get()->stubs()->CreateFakeNativeStub(InvokeLinkedNative, &natives_[index]);
+  if (!stub)
+    return SP_ERROR_OUT_OF_MEMORY;
+
+  if (int err = UpdateFastNativeBinding(index, stub, nullptr, flags, nullptr)) {
+    Environment::get()->APIv1()->FreePageMemory((void *)stub);
+    return err;
+  }
+
+  natives_[index].is_linked = true;
+  natives_[index].linked = static_cast<ScriptedInvoker *>(target);
+  return SP_ERROR_NONE;
+}
+
+// Called with the environment lock held, when |target| is being destroyed.
+// Compiled code may have the stub's target baked in, so the binding itself
+// stays; the native throws from now on.
+void
+PluginRuntime::UnlinkNatives(PluginRuntime *target)
+{
+  PluginContext *cx = target->GetBaseContext();
+  for (uint32_t i = 0; i < image_->NumNatives(); i++) {
+    NativeEntry *native = &natives_[i];
+    if (native->linked && native->linked->context() == cx)
+      native->linked = nullptr;
+  }
+}
+
+int
+PluginRuntime::BindNatives(INativeTable *table, uint32_t flags, uint32_t *unbound,
+                           uint32_t maxunbound, uint32_t *numunbound)
+{
+  if (!table)
+    return SP_ERROR_PARAM;
+
+  uint32_t missing = 0;
+  for (uint32_t i = 0; i < image_->NumNatives(); i++) {
+    NativeEntry *native = &natives_[i];
+    if (native->status == SP_NATIVE_BOUND)
+      continue;
+
+    SPVM_NATIVE_FUNC fn = table->FindNative(image_->GetNative(i));
+    if (!fn) {
+      if (unbound && missing < maxunbound)
+        unbound[missing] = i;
+      missing++;
+      continue;
+    }
+
+    native->legacy_fn = fn;
+    native->status = SP_NATIVE_BOUND;
+    native->flags = flags;
+    native->user = nullptr;
+    native->fast.func = nullptr;
+  }
+
+  if (numunbound)
+    *numunbound = missing;
   return SP_ERROR_NONE;
 }
 
@@ -393,6 +630,52 @@ PluginRuntime::GetFunctionByName(const char *public_name)
   return GetPublicFunction(index);
 }
 
+bool
+PluginRuntime::ResolveFunctionKeys()
+{
+  Environment *env = Environment::get();
+  size_t first = functions_by_key_.length();
+  size_t count = env->NumFunctionKeys();
+  if (first >= count)
+    return true;
+
+  if (!functions_by_key_.resize(count))
+    return false;
+
+  // At load time, walk the publics once and hash each name, rather than
+  // searching the publics for every interned name.
+  if (!first) {
+    for (size_t i = 0; i < image_->NumPublics(); i++) {
+      sp_public_t *pub;
+      GetPublicByIndex(i, &pub);
+
+      uint32_t key;
+      if (env->FindFunctionKey(pub->name, &key))
+        functions_by_key_[key] = GetPublicFunction(i);
+    }
+    return true;
+  }
+
+  for (size_t key = first; key < count; key++) {
+    size_t index;
+    if (image_->FindPublic(env->GetFunctionKeyName(key), &index))
+      functions_by_key_[key] = GetPublicFunction(index);
+  }
+  return true;
+}
+
+IPluginFunction *
+PluginRuntime::GetFunctionByKey(uint32_t key)
+{
+  if (key >= functions_by_key_.length()) {
+    if (key >= Environment::get()->NumFunctionKeys())
+      return NULL;
+    if (!ResolveFunctionKeys())
+      return NULL;
+  }
+  return functions_by_key_[key];
+}
+
 bool
 PluginRuntime::IsDebugging()
 {
@@ -19,29 +19,52 @@
 #include <am-inlinelist.h>
 #include <am-hashmap.h>
 #include "compiled-function.h"
+#include "interpreter.h"
 #include "scripted-invoker.h"
 #include "legacy-image.h"
+#include "shared-data.h"
 
 namespace sp {
 
 class PluginContext;
+class BackgroundCompiler;
+class CodeCache;
 
-struct floattbl_t
+// How calls to a native may be replaced: with an opcode that takes the
+// native's arguments straight off the stack, or with an intrinsic that the
+// host registered for it.
+struct NativeReplacement
 {
-  floattbl_t() {
-    found = false;
-    index = 0;
-  }
-  bool found;
-  unsigned int index;
+  NativeReplacement()
+   : opcode(0),
+     intrinsic(SP_INTRINSIC_NONE)
+  {}
+  unsigned opcode;
+  SP_INTRINSIC intrinsic;
 };
 
 struct NativeEntry : public sp_native_t
 {
   NativeEntry()
-   : legacy_fn(nullptr)
-  {}
+   : legacy_fn(nullptr),
+     is_linked(false),
+     linked(nullptr)
+  {
+    fast.func = nullptr;
+    fast.ret = SP_FASTARG_CELL;
+    fast.nargs = 0;
+  }
   SPVM_NATIVE_FUNC legacy_fn;
+
+  // If fast.func is set, the JIT may call it instead of legacy_fn.
+  sp_fastnative_t fast;
+
+  // If set, the native was bound with LinkNativeToFunction(), and legacy_fn
+  // is a stub that calls InvokeLinkedNative() with this entry, owned by the
+  // runtime. |linked| is the public function to call; it is cleared if the
+  // function's plugin is unloaded, and the native then throws.
+  bool is_linked;
+  ScriptedInvoker *linked;
 };
 
 /* Jit wants fast access to this so we expose things as public */
@@ -71,6 +94,7 @@ class PluginRuntime
   virtual uint32_t GetPubVarsNum();
   virtual IPluginFunction *GetFunctionByName(const char *public_name);
   virtual IPluginFunction *GetFunctionById(funcid_t func_id);
+  IPluginFunction *GetFunctionByKey(uint32_t key) override;
   virtual IPluginContext *GetDefaultContext();
   virtual int ApplyCompilationOptions(ICompilation *co);
   virtual void SetPauseState(bool paused);
@@ -80,10 +104,24 @@ class PluginRuntime
   virtual unsigned char *GetDataHash();
   CompiledFunction *GetJittedFunctionByOffset(cell_t pcode_offset);
   void AddJittedFunction(CompiledFunction *fn);
+  InterpretedFunction *GetInterpretedFunctionByOffset(cell_t pcode_offset);
+  void AddInterpretedFunction(InterpretedFunction *fn);
+  void LinkBackgroundFunctions();
+  CodeCache *code_cache() const {
+    return code_cache_;
+  }
   void SetNames(const char *fullname, const char *name);
   unsigned GetNativeReplacement(size_t index);
+  SP_INTRINSIC GetNativeIntrinsic(size_t index, uint32_t nparams);
+  uint32_t GetNativeBindingKey(size_t index);
   ScriptedInvoker *GetPublicFunction(size_t index);
   int UpdateNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, uint32_t flags, void *data) override;
+  int UpdateFastNativeBinding(uint32_t index, SPVM_NATIVE_FUNC pfn, const sp_fastnative_t *fast,
+                              uint32_t flags, void *data) override;
+  int LinkNativeToFunction(uint32_t index, IPluginFunction *target, uint32_t flags) override;
+  int BindNatives(INativeTable *table, uint32_t flags, uint32_t *unbound, uint32_t maxunbound,
+                  uint32_t *numunbound) override;
+  void UnlinkNatives(PluginRuntime *target);
   const sp_native_t *GetNative(uint32_t index) override;
   int LookupLine(ucell_t addr, uint32_t *line) override;
   int LookupFunction(ucell_t addr, const char **name) override;
@@ -121,14 +159,18 @@ class PluginRuntime
   LegacyImage *image() const {
     return image_;
   }
+  SharedData *shared_data() const {
+    return shared_data_;
+  }
 
  private:
-  void SetupFloatNativeRemapping();
+  void SetupNativeReplacements();
+  bool ResolveFunctionKeys();
 
  private:
   ke::AutoPtr<sp::LegacyImage> image_;
   ke::AutoArray<uint8_t> aligned_code_;
-  ke::AutoArray<floattbl_t> float_table_;
+  ke::AutoArray<NativeReplacement> replacements_;
   ke::AString name_;
   ke::AString full_name_;
   Code code_;
@@ -137,6 +179,11 @@ class PluginRuntime
   ke::AutoArray<sp_public_t> publics_;
   ke::AutoArray<sp_pubvar_t> pubvars_;
   ke::AutoArray<ScriptedInvoker *> entrypoints_;
+
+  // Public functions indexed by interned name key, or null where the plugin
+  // has no public by that name. Covers every key interned before the plugin
+  // loaded; later keys are filled in on first use.
+  ke::Vector<ScriptedInvoker *> functions_by_key_;
   ke::AutoPtr<PluginContext> context_;
 
   struct FunctionMapPolicy {
@@ -152,6 +199,15 @@ class PluginRuntime
   FunctionMap function_map_;
   ke::Vector<CompiledFunction *> m_JitFunctions;
 
+  typedef ke::HashMap<ucell_t, InterpretedFunction *, FunctionMapPolicy> InterpFunctionMap;
+
+  InterpFunctionMap interp_function_map_;
+  ke::Vector<InterpretedFunction *> interp_functions_;
+
+  ke::AutoPtr<BackgroundCompiler> background_;
+  ke::AutoPtr<CodeCache> code_cache_;
+  ke::Ref<SharedData> shared_data_;
+
   // Pause state.
   bool paused_;
 
@@ -0,0 +1,1190 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include "range-analysis.h"
+#include "function-analysis.h"
+#include "opcodes.h"
+#include "plugin-context.h"
+#include "plugin-runtime.h"
+
+using namespace sp;
+
+static const int64_t kMinCell = -int64_t(0x80000000);
+static const int64_t kMaxCell = 0x7fffffff;
+
+// Functions that take more sweeps than this to settle keep all their checks.
+static const size_t kMaxSweeps = 32;
+
+// Once a loop's entry state has grown this many times, any range that is
+// still growing is widened to the next limit, so loops settle quickly. After
+// a few more times it is widened all the way.
+static const uint32_t kWidenAfter = 2;
+static const uint32_t kWidenFullyAfter = 4;
+
+// Constants the function compares against are the usual loop limits; at most
+// this many are kept as stopping points for widening.
+static const size_t kMaxLimits = 16;
+
+RangeAnalysis::RangeAnalysis(PluginRuntime *rt, const FunctionAnalysis &analysis)
+ : analysis_(analysis),
+   data_size_(rt->GetBaseContext()->DataSize())
+{
+}
+
+void
+RangeAnalysis::analyze()
+{
+  // Keep one entry state for each basic block.
+  size_t ncells = analysis_.ncells();
+  state_index_ = new uint32_t[ncells];
+  states_ = new State[analysis_.nblocks()];
+
+  size_t nstates = 0;
+  for (size_t i = 0; i < ncells; i++) {
+    if (analysis_.isBlockStart(i)) {
+      state_index_[i] = nstates;
+      states_[nstates].reached = false;
+      nstates++;
+    }
+
+    // A loop that runs while i < n leaves its body with i <= n, so constants
+    // that are compared against make good limits.
+    if (!analysis_.isOpStart(i))
+      continue;
+    const cell_t *cip = analysis_.start() + i;
+    int64_t value;
+    size_t next;
+    switch (*cip) {
+      case OP_CONST_PRI:
+      case OP_CONST_ALT:
+        value = cip[1];
+        next = i + 2;
+        break;
+      case OP_ZERO_PRI:
+      case OP_ZERO_ALT:
+        value = 0;
+        next = i + 1;
+        break;
+      default:
+        continue;
+    }
+    if (next >= ncells)
+      continue;
+    switch (analysis_.start()[next]) {
+      case OP_JEQ:
+      case OP_JNEQ:
+      case OP_JSLESS:
+      case OP_JSLEQ:
+      case OP_JSGRTR:
+      case OP_JSGEQ:
+        addLimit(value - 1);
+        addLimit(value);
+        addLimit(value + 1);
+        break;
+    }
+  }
+
+  for (size_t i = 0; i < kMaxSweeps; i++) {
+    if (sweep(false))
+      continue;
+
+    // The states have settled. One more sweep records which checks they
+    // prove redundant.
+    redundant_ = new bool[ncells];
+    memset(redundant_, 0, ncells * sizeof(bool));
+    sweep(true);
+    break;
+  }
+
+  states_ = nullptr;
+  state_index_ = nullptr;
+}
+
+bool
+RangeAnalysis::sweep(bool record)
+{
+  bool changed = false;
+
+  // Nothing is known on entry.
+  State state;
+  state.reached = true;
+  state.ncells = 0;
+  state.nchecked = 0;
+  state.pri = unknown(state, 0, 0);
+  state.alt = unknown(state, 0, 1);
+
+  for (const cell_t *cip = analysis_.start() + 1; cip < analysis_.end();) {
+    size_t index = cip - analysis_.start();
+    if (analysis_.isBlockStart(index)) {
+      if (state.reached && joinInto(index, state, false))
+        changed = true;
+      state = states_[state_index_[index]];
+    }
+
+    size_t count;
+    FunctionAnalysis::OperandCount(cip, analysis_.end(), &count);
+    if (state.reached)
+      execute(state, cip, index, record, &changed);
+    cip += count + 1;
+  }
+  return changed;
+}
+
+void
+RangeAnalysis::execute(State &state, const cell_t *cip, size_t index, bool record,
+                       bool *changed)
+{
+  size_t target;
+  switch (*cip) {
+    case OP_JUMP:
+      if (analysis_.findOp(cip[1], &target) && joinInto(target, state, target <= index))
+        *changed = true;
+      state.reached = false;
+      break;
+
+    case OP_JZER:
+    case OP_JNZ:
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ:
+    {
+      State taken = state;
+      if (branch(taken, *cip, true) && analysis_.findOp(cip[1], &target) &&
+          joinInto(target, taken, target <= index))
+      {
+        *changed = true;
+      }
+      if (!branch(state, *cip, false))
+        state.reached = false;
+      break;
+    }
+
+    case OP_SWITCH:
+    {
+      size_t table;
+      if (analysis_.findOp(cip[1], &table)) {
+        const cell_t *tbl = analysis_.start() + table;
+        ucell_t ncases = tbl[1];
+        if (analysis_.findOp(tbl[2], &target) && joinInto(target, state, target <= index))
+          *changed = true;
+        for (ucell_t i = 0; i < ncases; i++) {
+          if (!analysis_.findOp(tbl[4 + i * 2], &target))
+            continue;
+          if (joinInto(target, state, target <= index))
+            *changed = true;
+        }
+      }
+      state.reached = false;
+      break;
+    }
+
+    case OP_CASETBL:
+    case OP_RETN:
+    case OP_HALT:
+      state.reached = false;
+      break;
+
+    default:
+      step(state, cip, index, record);
+      break;
+  }
+}
+
+// Narrow |a| and |b| given that a < b, or a <= b. Returns false if that
+// cannot be true.
+static bool
+NarrowLess(int64_t *alo, int64_t *ahi, int64_t *blo, int64_t *bhi, bool or_equal)
+{
+  int64_t gap = or_equal ? 0 : 1;
+  if (*ahi > *bhi - gap)
+    *ahi = *bhi - gap;
+  if (*blo < *alo + gap)
+    *blo = *alo + gap;
+  return *alo <= *ahi && *blo <= *bhi;
+}
+
+// Narrow the state for one edge of a conditional jump. Returns false if the
+// edge can never be taken.
+bool
+RangeAnalysis::branch(State &state, cell_t op, bool taken)
+{
+  Value &pri = state.pri;
+  Value &alt = state.alt;
+
+  bool ok = true;
+  switch (op) {
+    case OP_JZER:
+    case OP_JNZ:
+    {
+      if (pri.kind != ValueKind::Int)
+        return true;
+      bool zero = (op == OP_JZER) == taken;
+      if (zero) {
+        if (pri.lo > 0 || pri.hi < 0)
+          return false;
+        pri.lo = pri.hi = 0;
+      } else {
+        if (pri.lo == 0)
+          pri.lo = 1;
+        if (pri.hi == 0)
+          pri.hi = -1;
+        ok = pri.lo <= pri.hi;
+      }
+      break;
+    }
+
+    case OP_JEQ:
+    case OP_JNEQ:
+    {
+      if (pri.kind != ValueKind::Int || alt.kind != ValueKind::Int)
+        return true;
+      bool equal = (op == OP_JEQ) == taken;
+      if (equal) {
+        pri.lo = alt.lo = (pri.lo > alt.lo) ? pri.lo : alt.lo;
+        pri.hi = alt.hi = (pri.hi < alt.hi) ? pri.hi : alt.hi;
+        ok = pri.lo <= pri.hi;
+      } else if (alt.lo == alt.hi) {
+        if (pri.lo == alt.lo)
+          pri.lo++;
+        if (pri.hi == alt.lo)
+          pri.hi--;
+        ok = pri.lo <= pri.hi;
+      }
+      break;
+    }
+
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ:
+    {
+      if (pri.kind != ValueKind::Int || alt.kind != ValueKind::Int)
+        return true;
+
+      // Each of these, or its negation, is one of pri < alt, pri <= alt,
+      // alt < pri or alt <= pri.
+      bool pri_first, or_equal;
+      switch (op) {
+        case OP_JSLESS:
+          pri_first = taken;
+          or_equal = !taken;
+          break;
+        case OP_JSLEQ:
+          pri_first = taken;
+          or_equal = taken;
+          break;
+        case OP_JSGRTR:
+          pri_first = !taken;
+          or_equal = !taken;
+          break;
+        default:
+          pri_first = !taken;
+          or_equal = taken;
+          break;
+      }
+      if (pri_first)
+        ok = NarrowLess(&pri.lo, &pri.hi, &alt.lo, &alt.hi, or_equal);
+      else
+        ok = NarrowLess(&alt.lo, &alt.hi, &pri.lo, &pri.hi, or_equal);
+      break;
+    }
+
+    default:
+      return true;
+  }
+
+  if (!ok)
+    return false;
+  refineCell(state, pri);
+  refineCell(state, alt);
+  return true;
+}
+
+void
+RangeAnalysis::step(State &state, const cell_t *cip, size_t index, bool record)
+{
+  Value &pri = state.pri;
+  Value &alt = state.alt;
+
+  // How far below frm the top of the stack is, if known.
+  int32_t depth = analysis_.stackDepth(index);
+
+  cell_t op = *cip;
+  switch (op) {
+    case OP_MOVE_PRI:
+      pri = alt;
+      break;
+
+    case OP_MOVE_ALT:
+      alt = pri;
+      break;
+
+    case OP_XCHG:
+    {
+      Value temp = pri;
+      pri = alt;
+      alt = temp;
+      break;
+    }
+
+    case OP_ZERO_PRI:
+      pri = fresh(state, index, 0, IntRange(0, 0));
+      break;
+
+    case OP_ZERO_ALT:
+      alt = fresh(state, index, 1, IntRange(0, 0));
+      break;
+
+    case OP_CONST_PRI:
+      pri = fresh(state, index, 0, IntRange(cip[1], cip[1]));
+      break;
+
+    case OP_CONST_ALT:
+      alt = fresh(state, index, 1, IntRange(cip[1], cip[1]));
+      break;
+
+    case OP_ADDR_PRI:
+      pri = fresh(state, index, 0, FrameRange(cip[1], cip[1]));
+      break;
+
+    case OP_ADDR_ALT:
+      alt = fresh(state, index, 1, FrameRange(cip[1], cip[1]));
+      break;
+
+    case OP_LOAD_PRI:
+      pri = unknown(state, index, 0);
+      break;
+
+    case OP_LOAD_ALT:
+      alt = unknown(state, index, 1);
+      break;
+
+    case OP_LOAD_BOTH:
+      pri = unknown(state, index, 0);
+      alt = unknown(state, index, 1);
+      break;
+
+    case OP_LOAD_S_PRI:
+      pri = loadCell(state, cip[1], index, 0);
+      break;
+
+    case OP_LOAD_S_ALT:
+      alt = loadCell(state, cip[1], index, 1);
+      break;
+
+    case OP_LOAD_S_BOTH:
+      pri = loadCell(state, cip[1], index, 0);
+      alt = loadCell(state, cip[2], index, 1);
+      break;
+
+    case OP_LREF_S_PRI:
+      pri = unknown(state, index, 0);
+      break;
+
+    case OP_LREF_S_ALT:
+      alt = unknown(state, index, 1);
+      break;
+
+    case OP_STOR_PRI:
+    case OP_STOR_ALT:
+    case OP_ZERO:
+    case OP_INC:
+    case OP_DEC:
+    case OP_CONST:
+      writeGlobal(state, cip[1]);
+      break;
+
+    case OP_STOR_S_PRI:
+    case OP_STOR_S_ALT:
+    {
+      Value &reg = (op == OP_STOR_S_PRI) ? pri : alt;
+      setCell(state, cip[1], reg);
+      reg.has_source = true;
+      reg.source = cip[1];
+      break;
+    }
+
+    case OP_ZERO_S:
+      setCell(state, cip[1], fresh(state, index, 2, IntRange(0, 0)));
+      break;
+
+    case OP_CONST_S:
+      setCell(state, cip[1], fresh(state, index, 2, IntRange(cip[2], cip[2])));
+      break;
+
+    case OP_INC_S:
+    case OP_DEC_S:
+    {
+      Value cell = loadCell(state, cip[1], index, 2);
+      Value one = IntRange(op == OP_INC_S ? 1 : -1, op == OP_INC_S ? 1 : -1);
+      setCell(state, cip[1], fresh(state, index, 2, Add(cell, one)));
+      break;
+    }
+
+    case OP_SREF_S_PRI:
+    case OP_SREF_S_ALT:
+    {
+      Value addr = loadCell(state, cip[1], index, 2);
+      writeMemory(state, addr, sizeof(cell_t));
+      break;
+    }
+
+    case OP_PUSH_PRI:
+      push(state, pri, &depth);
+      break;
+
+    case OP_PUSH_ALT:
+      push(state, alt, &depth);
+      break;
+
+    case OP_PUSH_C:
+    case OP_PUSH2_C:
+    case OP_PUSH3_C:
+    case OP_PUSH4_C:
+    case OP_PUSH5_C:
+    case OP_PUSH_ADR:
+    case OP_PUSH2_ADR:
+    case OP_PUSH3_ADR:
+    case OP_PUSH4_ADR:
+    case OP_PUSH5_ADR:
+    case OP_PUSH_S:
+    case OP_PUSH2_S:
+    case OP_PUSH3_S:
+    case OP_PUSH4_S:
+    case OP_PUSH5_S:
+    case OP_PUSH:
+    case OP_PUSH2:
+    case OP_PUSH3:
+    case OP_PUSH4:
+    case OP_PUSH5:
+    {
+      size_t count;
+      FunctionAnalysis::OperandCount(cip, analysis_.end(), &count);
+      for (size_t i = 0; i < count; i++) {
+        cell_t operand = cip[1 + i];
+        uint32_t slot = 2 + i;
+        Value value;
+        if (op == OP_PUSH_C || (op >= OP_PUSH2_C && op <= OP_PUSH5_C && (op - OP_PUSH2_C) % 4 == 0))
+          value = fresh(state, index, slot, IntRange(operand, operand));
+        else if (op == OP_PUSH_ADR || (op >= OP_PUSH2_ADR && (op - OP_PUSH2_ADR) % 4 == 0))
+          value = fresh(state, index, slot, FrameRange(operand, operand));
+        else if (op == OP_PUSH_S || (op >= OP_PUSH2_S && (op - OP_PUSH2_S) % 4 == 0))
+          value = loadCell(state, operand, index, slot);
+        else
+          value = unknown(state, index, slot);
+        push(state, value, &depth);
+      }
+      break;
+    }
+
+    case OP_POP_PRI:
+    case OP_POP_ALT:
+    {
+      Value &reg = (op == OP_POP_PRI) ? pri : alt;
+      if (depth >= 0)
+        reg = loadCell(state, -depth, index, op == OP_POP_PRI ? 0 : 1);
+      else
+        reg = unknown(state, index, op == OP_POP_PRI ? 0 : 1);
+
+      // Raising the stack pointer can make a checked address invalid.
+      state.nchecked = 0;
+      popCells(state, depth, sizeof(cell_t));
+      break;
+    }
+
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT:
+    {
+      Value &reg = (op == OP_SWAP_PRI) ? pri : alt;
+      if (depth < 0) {
+        clobberAllCells(state);
+        reg = unknown(state, index, op == OP_SWAP_PRI ? 0 : 1);
+        break;
+      }
+      Value top = loadCell(state, -depth, index, 2);
+      setCell(state, -depth, reg);
+      top.has_source = false;
+      reg = top;
+      break;
+    }
+
+    case OP_STACK:
+      if (cip[1] > 0) {
+        state.nchecked = 0;
+        popCells(state, depth, cip[1]);
+      } else if (depth >= 0) {
+        // Newly allocated cells hold whatever was there before.
+        clobberCells(state, -int64_t(depth) + cip[1], -int64_t(depth));
+      } else {
+        clobberAllCells(state);
+      }
+      break;
+
+    case OP_HEAP:
+      // The heap pointer moves, so checked addresses may no longer be valid.
+      alt = unknown(state, index, 1);
+      state.nchecked = 0;
+      break;
+
+    case OP_ADD:
+      pri = fresh(state, index, 0, Add(pri, alt));
+      break;
+
+    case OP_ADD_C:
+      pri = fresh(state, index, 0, Add(pri, IntRange(cip[1], cip[1])));
+      break;
+
+    case OP_SUB:
+      pri = fresh(state, index, 0, Add(pri, Scale(alt, -1)));
+      break;
+
+    case OP_SUB_ALT:
+      pri = fresh(state, index, 0, Add(alt, Scale(pri, -1)));
+      break;
+
+    case OP_INC_PRI:
+    case OP_DEC_PRI:
+      pri = fresh(state, index, 0, Add(pri, IntRange(op == OP_INC_PRI ? 1 : -1,
+                                                     op == OP_INC_PRI ? 1 : -1)));
+      break;
+
+    case OP_INC_ALT:
+    case OP_DEC_ALT:
+      alt = fresh(state, index, 1, Add(alt, IntRange(op == OP_INC_ALT ? 1 : -1,
+                                                     op == OP_INC_ALT ? 1 : -1)));
+      break;
+
+    case OP_NEG:
+      pri = fresh(state, index, 0, Scale(pri, -1));
+      break;
+
+    case OP_SMUL_C:
+      pri = fresh(state, index, 0, Scale(pri, cip[1]));
+      break;
+
+    case OP_SMUL:
+      if (alt.kind == ValueKind::Int && alt.lo == alt.hi)
+        pri = fresh(state, index, 0, Scale(pri, alt.lo));
+      else if (pri.kind == ValueKind::Int && pri.lo == pri.hi)
+        pri = fresh(state, index, 0, Scale(alt, pri.lo));
+      else
+        pri = unknown(state, index, 0);
+      break;
+
+    case OP_SHL_C_PRI:
+    case OP_SHL_C_ALT:
+    {
+      Value &reg = (op == OP_SHL_C_PRI) ? pri : alt;
+      cell_t shift = cip[1];
+      if (shift >= 0 && shift < 31)
+        reg = fresh(state, index, op == OP_SHL_C_PRI ? 0 : 1, Scale(reg, int64_t(1) << shift));
+      else
+        reg = unknown(state, index, op == OP_SHL_C_PRI ? 0 : 1);
+      break;
+    }
+
+    case OP_SHR_C_PRI:
+    case OP_SHR_C_ALT:
+    {
+      // A logical shift.
+      Value &reg = (op == OP_SHR_C_PRI) ? pri : alt;
+      uint32_t slot = (op == OP_SHR_C_PRI) ? 0 : 1;
+      cell_t shift = cip[1];
+      if (reg.kind == ValueKind::Int && reg.lo >= 0 && shift >= 0 && shift < 32)
+        reg = fresh(state, index, slot, IntRange(reg.lo >> shift, reg.hi >> shift));
+      else if (shift > 0 && shift < 32)
+        reg = fresh(state, index, slot, IntRange(0, int64_t(0xffffffff) >> shift));
+      else
+        reg = unknown(state, index, slot);
+      break;
+    }
+
+    case OP_AND:
+    {
+      // Masking with a non-negative value gives a value no larger than it.
+      int64_t hi = -1;
+      if (pri.kind == ValueKind::Int && pri.lo >= 0)
+        hi = pri.hi;
+      if (alt.kind == ValueKind::Int && alt.lo >= 0 && (hi < 0 || alt.hi < hi))
+        hi = alt.hi;
+      if (hi >= 0)
+        pri = fresh(state, index, 0, IntRange(0, hi));
+      else
+        pri = unknown(state, index, 0);
+      break;
+    }
+
+    case OP_NOT:
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ:
+    case OP_EQ_C_PRI:
+    case OP_EQ_C_ALT:
+      pri = fresh(state, index, 0, IntRange(0, 1));
+      break;
+
+    case OP_INVERT:
+    case OP_XOR:
+    case OP_OR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SSHR:
+    case OP_STRADJUST_PRI:
+      pri = unknown(state, index, 0);
+      break;
+
+    case OP_SDIV:
+    case OP_SDIV_ALT:
+    {
+      // The quotient goes in pri and the remainder in alt. For a
+      // non-negative dividend and positive divisor, both are bounded.
+      Value dividend = (op == OP_SDIV) ? pri : alt;
+      Value divisor = (op == OP_SDIV) ? alt : pri;
+      if (dividend.kind == ValueKind::Int && dividend.lo >= 0 &&
+          divisor.kind == ValueKind::Int && divisor.lo >= 1)
+      {
+        int64_t rem = (dividend.hi < divisor.hi - 1) ? dividend.hi : divisor.hi - 1;
+        pri = fresh(state, index, 0, IntRange(0, dividend.hi));
+        alt = fresh(state, index, 1, IntRange(0, rem));
+      } else {
+        pri = unknown(state, index, 0);
+        alt = unknown(state, index, 1);
+      }
+      break;
+    }
+
+    case OP_IDXADDR:
+      pri = fresh(state, index, 0, Add(alt, Scale(pri, sizeof(cell_t))));
+      break;
+
+    case OP_IDXADDR_B:
+    {
+      cell_t shift = cip[1];
+      if (shift >= 0 && shift < 31)
+        pri = fresh(state, index, 0, Add(alt, Scale(pri, int64_t(1) << shift)));
+      else
+        pri = unknown(state, index, 0);
+      break;
+    }
+
+    case OP_BOUNDS:
+    {
+      // The check is unsigned: it fails if pri > bound.
+      cell_t bound = cip[1];
+      if (bound < 0 || pri.kind != ValueKind::Int)
+        break;
+      if (record && pri.lo >= 0 && pri.hi <= bound)
+        redundant_[index] = true;
+
+      // After the check, pri is a valid index.
+      if (pri.lo < 0)
+        pri.lo = 0;
+      if (pri.hi > bound)
+        pri.hi = bound;
+      if (pri.lo > pri.hi) {
+        state.reached = false;
+        break;
+      }
+      refineCell(state, pri);
+      break;
+    }
+
+    case OP_LIDX:
+      pri = unknown(state, index, 0);
+      break;
+
+    case OP_LIDX_B:
+    {
+      cell_t shift = cip[1];
+      Value addr = (shift >= 0 && shift < 31)
+                   ? Add(alt, Scale(pri, int64_t(1) << shift))
+                   : IntRange(kMinCell, kMaxCell);
+      if (record && checkAddress(state, addr, index))
+        redundant_[index] = true;
+      pri = unknown(state, index, 0);
+      break;
+    }
+
+    case OP_LOAD_I:
+    case OP_LODB_I:
+    {
+      if (record && checkAddress(state, pri, index))
+        redundant_[index] = true;
+      markChecked(state, pri);
+
+      cell_t width = (op == OP_LODB_I) ? cip[1] : sizeof(cell_t);
+      if (width == 1)
+        pri = fresh(state, index, 0, IntRange(0, 0xff));
+      else if (width == 2)
+        pri = fresh(state, index, 0, IntRange(0, 0xffff));
+      else
+        pri = unknown(state, index, 0);
+      break;
+    }
+
+    case OP_STOR_I:
+    case OP_STRB_I:
+    {
+      if (record && checkAddress(state, alt, index))
+        redundant_[index] = true;
+      markChecked(state, alt);
+
+      cell_t width = (op == OP_STRB_I) ? cip[1] : sizeof(cell_t);
+      writeMemory(state, alt, (width == 1 || width == 2) ? width : sizeof(cell_t));
+      break;
+    }
+
+    case OP_INC_I:
+    case OP_DEC_I:
+      writeMemory(state, pri, sizeof(cell_t));
+      break;
+
+    case OP_MOVS:
+    case OP_FILL:
+      writeMemory(state, alt, ucell_t(cip[1]));
+      pri = unknown(state, index, 0);
+      alt = unknown(state, index, 1);
+      break;
+
+    case OP_BREAK:
+    case OP_NOP:
+      break;
+
+    // Calls, natives, and anything else not modeled above.
+    default:
+      forgetAll(state, index);
+      break;
+  }
+}
+
+RangeAnalysis::Value
+RangeAnalysis::IntRange(int64_t lo, int64_t hi)
+{
+  Value value;
+  value.kind = ValueKind::Int;
+  value.has_source = false;
+  value.source = 0;
+  value.id = 0;
+
+  // Anything that may have wrapped around could be any value.
+  if (lo < kMinCell || hi > kMaxCell || lo > hi) {
+    lo = kMinCell;
+    hi = kMaxCell;
+  }
+  value.lo = lo;
+  value.hi = hi;
+  return value;
+}
+
+RangeAnalysis::Value
+RangeAnalysis::FrameRange(int64_t lo, int64_t hi)
+{
+  if (lo < kMinCell || hi > kMaxCell || lo > hi)
+    return IntRange(kMinCell, kMaxCell);
+
+  Value value = IntRange(lo, hi);
+  value.kind = ValueKind::Frame;
+  return value;
+}
+
+RangeAnalysis::Value
+RangeAnalysis::Add(const Value &a, const Value &b)
+{
+  if (a.kind == ValueKind::Int && b.kind == ValueKind::Int)
+    return IntRange(a.lo + b.lo, a.hi + b.hi);
+  if (a.kind == ValueKind::Frame && b.kind == ValueKind::Int)
+    return FrameRange(a.lo + b.lo, a.hi + b.hi);
+  if (a.kind == ValueKind::Int && b.kind == ValueKind::Frame)
+    return FrameRange(a.lo + b.lo, a.hi + b.hi);
+  return IntRange(kMinCell, kMaxCell);
+}
+
+RangeAnalysis::Value
+RangeAnalysis::Scale(const Value &a, int64_t factor)
+{
+  if (a.kind != ValueKind::Int)
+    return IntRange(kMinCell, kMaxCell);
+  if (factor >= 0)
+    return IntRange(a.lo * factor, a.hi * factor);
+  return IntRange(a.hi * factor, a.lo * factor);
+}
+
+RangeAnalysis::Value
+RangeAnalysis::Join(const Value &a, const Value &b)
+{
+  if (a.kind != b.kind)
+    return IntRange(kMinCell, kMaxCell);
+
+  Value value = a;
+  value.lo = (a.lo < b.lo) ? a.lo : b.lo;
+  value.hi = (a.hi > b.hi) ? a.hi : b.hi;
+  if (a.id != b.id)
+    value.id = 0;
+  if (!a.has_source || !b.has_source || a.source != b.source)
+    value.has_source = false;
+  return value;
+}
+
+void
+RangeAnalysis::addLimit(int64_t value)
+{
+  if (value < kMinCell || value > kMaxCell)
+    return;
+
+  size_t pos = 0;
+  while (pos < limits_.length() && limits_[pos] < value)
+    pos++;
+  if (pos < limits_.length() && limits_[pos] == value)
+    return;
+  if (limits_.length() < kMaxLimits)
+    limits_.insert(pos, value);
+}
+
+RangeAnalysis::Value
+RangeAnalysis::Widen(const Value &old, const Value &now, bool fully) const
+{
+  // Limits only make sense for plain integers.
+  size_t nlimits = (now.kind == ValueKind::Int && !fully) ? limits_.length() : 0;
+
+  Value value = now;
+  if (now.lo < old.lo) {
+    value.lo = kMinCell;
+    for (size_t i = nlimits; i > 0; i--) {
+      if (limits_[i - 1] <= now.lo) {
+        value.lo = limits_[i - 1];
+        break;
+      }
+    }
+  }
+  if (now.hi > old.hi) {
+    value.hi = kMaxCell;
+    for (size_t i = 0; i < nlimits; i++) {
+      if (limits_[i] >= now.hi) {
+        value.hi = limits_[i];
+        break;
+      }
+    }
+  }
+  return value;
+}
+
+bool
+RangeAnalysis::Same(const Value &a, const Value &b)
+{
+  return a.kind == b.kind &&
+         a.lo == b.lo &&
+         a.hi == b.hi &&
+         a.id == b.id &&
+         a.has_source == b.has_source &&
+         (!a.has_source || a.source == b.source);
+}
+
+bool
+RangeAnalysis::Same(const State &a, const State &b)
+{
+  if (a.reached != b.reached || !Same(a.pri, b.pri) || !Same(a.alt, b.alt))
+    return false;
+  if (a.ncells != b.ncells || a.nchecked != b.nchecked)
+    return false;
+  for (size_t i = 0; i < a.ncells; i++) {
+    if (a.cells[i].offset != b.cells[i].offset || !Same(a.cells[i].value, b.cells[i].value))
+      return false;
+  }
+  for (size_t i = 0; i < a.nchecked; i++) {
+    if (a.checked[i] != b.checked[i])
+      return false;
+  }
+  return true;
+}
+
+// Merge |state| into the entry state of the block at |index|. Returns true if
+// the entry state changed. Every loop has a backward jump, so widening at
+// their targets is enough for the analysis to finish.
+bool
+RangeAnalysis::joinInto(size_t index, const State &state, bool backward)
+{
+  State &entry = states_[state_index_[index]];
+  if (!entry.reached) {
+    entry = state;
+    entry.grown = 0;
+    return true;
+  }
+
+  State joined;
+  joined.reached = true;
+  joined.grown = entry.grown;
+  joined.pri = Join(entry.pri, state.pri);
+  joined.alt = Join(entry.alt, state.alt);
+
+  joined.ncells = 0;
+  for (size_t i = 0; i < entry.ncells; i++) {
+    for (size_t j = 0; j < state.ncells; j++) {
+      if (entry.cells[i].offset != state.cells[j].offset)
+        continue;
+      CellFact &cell = joined.cells[joined.ncells++];
+      cell.offset = entry.cells[i].offset;
+      cell.value = Join(entry.cells[i].value, state.cells[j].value);
+      break;
+    }
+  }
+
+  joined.nchecked = 0;
+  for (size_t i = 0; i < entry.nchecked; i++) {
+    for (size_t j = 0; j < state.nchecked; j++) {
+      if (entry.checked[i] == state.checked[j]) {
+        joined.checked[joined.nchecked++] = entry.checked[i];
+        break;
+      }
+    }
+  }
+
+  if (backward && entry.grown >= kWidenAfter) {
+    bool fully = entry.grown >= kWidenFullyAfter;
+    joined.pri = Widen(entry.pri, joined.pri, fully);
+    joined.alt = Widen(entry.alt, joined.alt, fully);
+    for (size_t i = 0; i < joined.ncells; i++) {
+      for (size_t j = 0; j < entry.ncells; j++) {
+        if (entry.cells[j].offset == joined.cells[i].offset) {
+          joined.cells[i].value = Widen(entry.cells[j].value, joined.cells[i].value, fully);
+          break;
+        }
+      }
+    }
+  }
+
+  if (Same(entry, joined))
+    return false;
+  entry = joined;
+  entry.grown++;
+  return true;
+}
+
+// Give a newly computed value an identity. Each instruction has a few slots
+// for the values it computes, so ids are the same on every sweep.
+RangeAnalysis::Value
+RangeAnalysis::fresh(State &state, size_t index, uint32_t slot, const Value &value)
+{
+  Value result = value;
+  result.id = uint32_t(index) * 8 + slot + 1;
+  result.has_source = false;
+  define(state, result.id);
+  return result;
+}
+
+RangeAnalysis::Value
+RangeAnalysis::unknown(State &state, size_t index, uint32_t slot)
+{
+  return fresh(state, index, slot, IntRange(kMinCell, kMaxCell));
+}
+
+// In a loop, an instruction computes a new value under the same id each time
+// around. Whatever still holds the old value loses its identity.
+void
+RangeAnalysis::define(State &state, uint32_t id)
+{
+  if (state.pri.id == id)
+    state.pri.id = 0;
+  if (state.alt.id == id)
+    state.alt.id = 0;
+  for (size_t i = 0; i < state.ncells; i++) {
+    if (state.cells[i].value.id == id)
+      state.cells[i].value.id = 0;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < state.nchecked; i++) {
+    if (state.checked[i] != id)
+      state.checked[kept++] = state.checked[i];
+  }
+  state.nchecked = kept;
+}
+
+void
+RangeAnalysis::push(State &state, const Value &value, int32_t *depth)
+{
+  if (*depth < 0) {
+    clobberAllCells(state);
+    return;
+  }
+
+  *depth += sizeof(cell_t);
+  setCell(state, -*depth, value);
+}
+
+RangeAnalysis::Value
+RangeAnalysis::loadCell(State &state, int32_t offset, size_t index, uint32_t slot)
+{
+  Value value;
+  bool found = false;
+  for (size_t i = 0; i < state.ncells; i++) {
+    if (state.cells[i].offset == offset) {
+      value = state.cells[i].value;
+      found = true;
+      break;
+    }
+  }
+  if (!found)
+    value = unknown(state, index, slot);
+
+  value.has_source = true;
+  value.source = offset;
+  return value;
+}
+
+void
+RangeAnalysis::setCell(State &state, int32_t offset, const Value &value)
+{
+  clobberCells(state, offset, int64_t(offset) + sizeof(cell_t));
+  if (state.ncells == kMaxCells)
+    return;
+
+  CellFact &cell = state.cells[state.ncells++];
+  cell.offset = offset;
+  cell.value = value;
+  cell.value.has_source = false;
+}
+
+// |value| was narrowed by a branch or a check. If it came from a stack cell,
+// narrow what is known about the cell too.
+void
+RangeAnalysis::refineCell(State &state, const Value &value)
+{
+  if (!value.has_source)
+    return;
+
+  Value narrowed = value;
+  narrowed.has_source = false;
+  for (size_t i = 0; i < state.ncells; i++) {
+    if (state.cells[i].offset == value.source) {
+      state.cells[i].value = narrowed;
+      return;
+    }
+  }
+  if (state.ncells == kMaxCells)
+    return;
+
+  CellFact &cell = state.cells[state.ncells++];
+  cell.offset = value.source;
+  cell.value = narrowed;
+}
+
+// Forget everything about stack cells overlapping frm+[lo, hi).
+void
+RangeAnalysis::clobberCells(State &state, int64_t lo, int64_t hi)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i < state.ncells; i++) {
+    int64_t offset = state.cells[i].offset;
+    if (offset < hi && offset + int64_t(sizeof(cell_t)) > lo)
+      continue;
+    state.cells[kept++] = state.cells[i];
+  }
+  state.ncells = kept;
+
+  Value *regs[] = { &state.pri, &state.alt };
+  for (size_t i = 0; i < 2; i++) {
+    int64_t offset = regs[i]->source;
+    if (regs[i]->has_source && offset < hi && offset + int64_t(sizeof(cell_t)) > lo)
+      regs[i]->has_source = false;
+  }
+}
+
+// The stack pointer rose by |amount| bytes from |depth| below frm. Cells
+// below the new top of the stack are gone: the JIT may never have written
+// them to memory, and a later allocation must not see what they held.
+void
+RangeAnalysis::popCells(State &state, int32_t depth, int64_t amount)
+{
+  if (depth < 0) {
+    clobberAllCells(state);
+    return;
+  }
+  clobberCells(state, kMinCell, -int64_t(depth) + amount);
+}
+
+void
+RangeAnalysis::clobberAllCells(State &state)
+{
+  state.ncells = 0;
+  state.pri.has_source = false;
+  state.alt.has_source = false;
+}
+
+void
+RangeAnalysis::writeGlobal(State &state, cell_t offset)
+{
+  // A store inside the data section cannot reach the stack.
+  if (offset < 0 || int64_t(offset) + int64_t(sizeof(cell_t)) > int64_t(data_size_))
+    clobberAllCells(state);
+}
+
+void
+RangeAnalysis::writeMemory(State &state, const Value &addr, int64_t width)
+{
+  if (addr.kind == ValueKind::Frame) {
+    clobberCells(state, addr.lo, addr.hi + width);
+    return;
+  }
+  if (addr.lo >= 0 && addr.hi + width <= int64_t(data_size_))
+    return;
+  clobberAllCells(state);
+}
+
+// Returns true if the address check on |addr| always passes. The check fails
+// if the address is beyond the end of memory, or between the heap and the
+// stack.
+bool
+RangeAnalysis::checkAddress(State &state, const Value &addr, size_t index)
+{
+  for (size_t i = 0; addr.id && i < state.nchecked; i++) {
+    if (state.checked[i] == addr.id)
+      return true;
+  }
+
+  // The data section is always below the heap.
+  if (addr.kind == ValueKind::Int)
+    return addr.lo >= 0 && addr.hi < int64_t(data_size_);
+
+  // Cells from the stack pointer up to frm are on the stack.
+  int32_t depth = analysis_.stackDepth(index);
+  return depth >= 0 && addr.lo >= -int64_t(depth) && addr.hi < 0;
+}
+
+// |addr| passed a check, so it stays valid until the heap or stack pointer
+// moves back.
+void
+RangeAnalysis::markChecked(State &state, const Value &addr)
+{
+  if (!addr.id || state.nchecked == kMaxChecked)
+    return;
+  for (size_t i = 0; i < state.nchecked; i++) {
+    if (state.checked[i] == addr.id)
+      return;
+  }
+  state.checked[state.nchecked++] = addr.id;
+}
+
+void
+RangeAnalysis::forgetAll(State &state, size_t index)
+{
+  clobberAllCells(state);
+  state.nchecked = 0;
+  state.pri = unknown(state, index, 0);
+  state.alt = unknown(state, index, 1);
+}
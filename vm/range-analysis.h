@@ -0,0 +1,131 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_range_analysis_h_
+#define _include_sourcepawn_vm_range_analysis_h_
+
+#include <sp_vm_types.h>
+#include <am-utility.h>
+#include <am-vector.h>
+
+namespace sp {
+
+class PluginRuntime;
+class FunctionAnalysis;
+
+// A dataflow pass over one function that finds checks the JIT can leave out
+// because they can never fail: OP_BOUNDS, and the address checks made by
+// LOAD.I, STOR.I, LODB.I, STRB.I and LIDX.B.
+//
+// It tracks the range of values that pri, alt, and a handful of stack cells
+// may hold, including addresses in the current frame, and which addresses
+// have already passed a check. Branches on signed compares narrow these
+// ranges, so a loop counter tested against an array's size is known to be a
+// valid index inside the loop. Anything the pass does not model - calls,
+// natives, and stores through unknown addresses - forgets what it knew, so
+// when in doubt a check is kept.
+class RangeAnalysis
+{
+ public:
+  RangeAnalysis(PluginRuntime *rt, const FunctionAnalysis &analysis);
+
+  // Must be called after FunctionAnalysis::analyzeStackDepths().
+  void analyze();
+
+  // True if the check made by the instruction at |index| always passes.
+  bool isCheckRedundant(size_t index) const {
+    return redundant_ && redundant_[index];
+  }
+
+ private:
+  enum class ValueKind : uint8_t {
+    // A cell; the range is of its signed value.
+    Int,
+    // An address in the current frame; the range is of its offset from frm.
+    Frame
+  };
+
+  struct Value {
+    ValueKind kind;
+    // Set if the stack cell at frm+|source| is known to hold the same value.
+    bool has_source;
+    int32_t source;
+    // Copies of a value share its id, which is used to remember that it has
+    // passed an address check. Zero if it has no identity.
+    uint32_t id;
+    int64_t lo;
+    int64_t hi;
+  };
+
+  struct CellFact {
+    int32_t offset;
+    Value value;
+  };
+
+  static const size_t kMaxCells = 24;
+  static const size_t kMaxChecked = 8;
+
+  struct State {
+    bool reached;
+    uint32_t grown;
+    Value pri;
+    Value alt;
+    size_t ncells;
+    CellFact cells[kMaxCells];
+    size_t nchecked;
+    uint32_t checked[kMaxChecked];
+  };
+
+  static Value IntRange(int64_t lo, int64_t hi);
+  static Value FrameRange(int64_t lo, int64_t hi);
+  static Value Add(const Value &a, const Value &b);
+  static Value Scale(const Value &a, int64_t factor);
+  static Value Join(const Value &a, const Value &b);
+  Value Widen(const Value &old, const Value &now, bool fully) const;
+  static bool Same(const Value &a, const Value &b);
+  static bool Same(const State &a, const State &b);
+
+  void addLimit(int64_t value);
+  bool sweep(bool record);
+  void execute(State &state, const cell_t *cip, size_t index, bool record, bool *changed);
+  void step(State &state, const cell_t *cip, size_t index, bool record);
+  bool branch(State &state, cell_t op, bool taken);
+  bool joinInto(size_t index, const State &state, bool backward);
+
+  Value fresh(State &state, size_t index, uint32_t slot, const Value &value);
+  Value unknown(State &state, size_t index, uint32_t slot);
+  void define(State &state, uint32_t id);
+  void push(State &state, const Value &value, int32_t *depth);
+  Value loadCell(State &state, int32_t offset, size_t index, uint32_t slot);
+  void setCell(State &state, int32_t offset, const Value &value);
+  void refineCell(State &state, const Value &value);
+  void clobberCells(State &state, int64_t lo, int64_t hi);
+  void popCells(State &state, int32_t depth, int64_t amount);
+  void clobberAllCells(State &state);
+  void writeGlobal(State &state, cell_t offset);
+  void writeMemory(State &state, const Value &addr, int64_t width);
+  bool checkAddress(State &state, const Value &addr, size_t index);
+  void markChecked(State &state, const Value &addr);
+  void forgetAll(State &state, size_t index);
+
+ private:
+  const FunctionAnalysis &analysis_;
+  uint32_t data_size_;
+  ke::AutoArray<State> states_;
+  ke::AutoArray<uint32_t> state_index_;
+  ke::AutoArray<bool> redundant_;
+  ke::Vector<int64_t> limits_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_range_analysis_h_
@@ -0,0 +1,190 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include "scripted-forward.h"
+#include "environment.h"
+#include "plugin-context.h"
+#include "plugin-runtime.h"
+#include "watchdog_timer.h"
+
+using namespace sp;
+using namespace SourcePawn;
+
+ScriptedForward::ScriptedForward(SP_FORWARD_TYPE type, cell_t stop_value)
+ : type_(type),
+   stop_value_(stop_value)
+{
+}
+
+int
+ScriptedForward::PushCell(cell_t cell)
+{
+  return params_.pushCell(cell);
+}
+
+int
+ScriptedForward::PushCellByRef(cell_t *cell, int flags)
+{
+  return PushArray(cell, 1, flags);
+}
+
+int
+ScriptedForward::PushFloat(float number)
+{
+  cell_t val = *(cell_t *)&number;
+
+  return PushCell(val);
+}
+
+int
+ScriptedForward::PushFloatByRef(float *number, int flags)
+{
+  return PushCellByRef((cell_t *)number, flags);
+}
+
+int
+ScriptedForward::PushArray(cell_t *inarray, unsigned int cells, int copyback)
+{
+  return params_.pushArray(inarray, cells, copyback);
+}
+
+int
+ScriptedForward::PushString(const char *string)
+{
+  return params_.pushString(string, SM_PARAM_STRING_COPY, 0, strlen(string) + 1);
+}
+
+int
+ScriptedForward::PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags)
+{
+  return params_.pushString(buffer, sz_flags, cp_flags, length);
+}
+
+void
+ScriptedForward::Cancel()
+{
+  params_.cancel();
+}
+
+int
+ScriptedForward::AddFunction(IPluginRuntime *runtime, funcid_t funcid)
+{
+  if (!(funcid & 1))
+    return SP_ERROR_PARAM;
+
+  IPluginFunction *fn = runtime->GetFunctionById(funcid);
+  if (!fn)
+    return SP_ERROR_NOT_FOUND;
+
+  if (!functions_.append(static_cast<ScriptedInvoker *>(fn)))
+    return SP_ERROR_OUT_OF_MEMORY;
+  return SP_ERROR_NONE;
+}
+
+bool
+ScriptedForward::RemoveFunction(IPluginRuntime *runtime, funcid_t funcid)
+{
+  for (size_t i = 0; i < functions_.length(); i++) {
+    ScriptedInvoker *fn = functions_[i];
+    if (fn->GetParentRuntime() == runtime && fn->GetFunctionID() == funcid) {
+      functions_.remove(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+ScriptedForward::RemoveRuntime(IPluginRuntime *runtime)
+{
+  for (size_t i = 0; i < functions_.length(); i++) {
+    if (functions_[i]->GetParentRuntime() == runtime)
+      functions_.remove(i--);
+  }
+}
+
+size_t
+ScriptedForward::GetFunctionCount()
+{
+  return functions_.length();
+}
+
+int
+ScriptedForward::Execute(cell_t *result)
+{
+  Environment *env = Environment::get();
+  env->clearPendingException();
+
+  EnterProfileScope profileScope("SourcePawn", "EnterJIT");
+
+  // Errors are caught per function, so that one failing plugin does not
+  // stop the rest of the forward.
+  ExceptionHandler eh(env->APIv2());
+
+  if (int err = params_.error()) {
+    Cancel();
+    env->ReportError(err);
+    return err;
+  }
+
+  // This is for re-entrancy!
+  cell_t params[SP_MAX_EXEC_PARAMS];
+  ParamInfo info[SP_MAX_EXEC_PARAMS];
+  unsigned int narrays;
+  unsigned int numparams = params_.take(params, info, &narrays);
+
+  if (!env->watchdog()->HandleInterrupt()) {
+    env->ReportError(SP_ERROR_TIMEOUT);
+    return SP_ERROR_TIMEOUT;
+  }
+
+  int first_error = SP_ERROR_NONE;
+  bool called = false;
+  cell_t combined = 0;
+
+  for (size_t i = 0; i < functions_.length(); i++) {
+    ScriptedInvoker *fn = functions_[i];
+    if (!fn->IsRunnable())
+      continue;
+
+    // Each plugin gets its own copy of the arrays and strings, and sees
+    // anything copied back by the ones before it. Marshaling replaces the
+    // same entries in params each time.
+    PluginContext *cx = fn->context();
+    cell_t rval = 0;
+    cell_t block;
+    if (!narrays || MarshalParams(cx, info, numparams, params, &block)) {
+      bool ok = cx->invokeFunction(fn, params, numparams, &rval);
+      if (narrays)
+        UnmarshalParams(cx, info, numparams, block, ok);
+    }
+
+    if (env->hasPendingException()) {
+      if (first_error == SP_ERROR_NONE)
+        first_error = env->getPendingExceptionCode();
+      env->clearPendingException();
+      continue;
+    }
+
+    if (type_ == SP_FORWARD_LAST || !called || rval > combined)
+      combined = rval;
+    called = true;
+
+    if (type_ == SP_FORWARD_STOP && rval >= stop_value_)
+      break;
+  }
+
+  if (result)
+    *result = combined;
+  return first_error;
+}
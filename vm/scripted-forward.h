@@ -0,0 +1,57 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_scripted_forward_h_
+#define _include_sourcepawn_vm_scripted_forward_h_
+
+#include <sp_vm_api.h>
+#include <am-vector.h>
+#include "scripted-invoker.h"
+
+namespace sp {
+
+using namespace SourcePawn;
+
+// Calls a list of public functions, possibly in many plugins, with one set of
+// pushed parameters. The checks and bookkeeping that PluginContext::Invoke()
+// repeats for every call from the host - the watchdog, clearing exceptions,
+// and the entry profile scope - happen once per Execute().
+class ScriptedForward : public IPluginForward
+{
+ public:
+  ScriptedForward(SP_FORWARD_TYPE type, cell_t stop_value);
+
+ public:
+  int PushCell(cell_t cell) KE_OVERRIDE;
+  int PushCellByRef(cell_t *cell, int flags) KE_OVERRIDE;
+  int PushFloat(float number) KE_OVERRIDE;
+  int PushFloatByRef(float *number, int flags) KE_OVERRIDE;
+  int PushArray(cell_t *inarray, unsigned int cells, int copyback) KE_OVERRIDE;
+  int PushString(const char *string) KE_OVERRIDE;
+  int PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags) KE_OVERRIDE;
+  void Cancel() KE_OVERRIDE;
+  int AddFunction(IPluginRuntime *runtime, funcid_t funcid) KE_OVERRIDE;
+  bool RemoveFunction(IPluginRuntime *runtime, funcid_t funcid) KE_OVERRIDE;
+  void RemoveRuntime(IPluginRuntime *runtime) KE_OVERRIDE;
+  size_t GetFunctionCount() KE_OVERRIDE;
+  int Execute(cell_t *result) KE_OVERRIDE;
+
+ private:
+  SP_FORWARD_TYPE type_;
+  cell_t stop_value_;
+  PushedParams params_;
+  ke::Vector<ScriptedInvoker *> functions_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_scripted_forward_h_
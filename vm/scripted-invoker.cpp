@@ -11,6 +11,7 @@
 // SourcePawn. If not, see http://www.gnu.org/licenses/.
 //
 
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include "scripted-invoker.h"
@@ -25,13 +26,230 @@
 using namespace sp;
 using namespace SourcePawn;
 
+int
+PushedParams::pushCell(cell_t cell)
+{
+  if (count_ >= SP_MAX_EXEC_PARAMS)
+    return setError(SP_ERROR_PARAMS_MAX);
+
+  info_[count_].marked = false;
+  values_[count_] = cell;
+  count_++;
+
+  return SP_ERROR_NONE;
+}
+
+int
+PushedParams::pushArray(cell_t *inarray, unsigned int cells, int copyback)
+{
+  if (count_ >= SP_MAX_EXEC_PARAMS)
+    return setError(SP_ERROR_PARAMS_MAX);
+
+  ParamInfo *info = &info_[count_];
+
+  info->flags = inarray ? copyback : 0;
+  info->marked = true;
+  info->size = cells;
+  info->str.is_sz = false;
+  info->orig_addr = inarray;
+
+  count_++;
+  narrays_++;
+
+  return SP_ERROR_NONE;
+}
+
+int
+PushedParams::pushString(const char *string, int sz_flags, int cp_flags, size_t len)
+{
+  if (count_ >= SP_MAX_EXEC_PARAMS)
+    return setError(SP_ERROR_PARAMS_MAX);
+
+  ParamInfo *info = &info_[count_];
+
+  info->marked = true;
+  info->orig_addr = (cell_t *)string;
+  info->flags = cp_flags;
+  info->size = len;
+  info->str.sz_flags = sz_flags;
+  info->str.is_sz = true;
+
+  count_++;
+  narrays_++;
+
+  return SP_ERROR_NONE;
+}
+
+void
+PushedParams::cancel()
+{
+  if (!count_)
+    return;
+
+  error_ = SP_ERROR_NONE;
+  count_ = 0;
+  narrays_ = 0;
+}
+
+unsigned int
+PushedParams::take(cell_t *values, ParamInfo *info, unsigned int *narrays)
+{
+  unsigned int count = count_;
+  memcpy(values, values_, count * sizeof(cell_t));
+  if (narrays_)
+    memcpy(info, info_, count * sizeof(ParamInfo));
+  *narrays = narrays_;
+  count_ = 0;
+  narrays_ = 0;
+  return count;
+}
+
+int
+PushedParams::setError(int err)
+{
+  error_ = err;
+
+  return err;
+}
+
+bool
+sp::MarshalParams(PluginContext *cx, ParamInfo *info, unsigned int count, cell_t *params,
+                  cell_t *block)
+{
+  Environment *env = Environment::get();
+
+  /* Find how much space every array and string needs */
+  size_t cells = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    if (!info[i].marked)
+      continue;
+    if (info[i].str.is_sz)
+      cells += (info[i].size + sizeof(cell_t) - 1) / sizeof(cell_t);
+    else
+      cells += info[i].size;
+  }
+  if (cells > INT_MAX / sizeof(cell_t)) {
+    env->ReportError(SP_ERROR_HEAPLOW);
+    return false;
+  }
+
+  /* Allocate them all at once */
+  cell_t local_addr;
+  cell_t *phys_addr;
+  if (int err = cx->HeapAlloc(cells, &local_addr, &phys_addr)) {
+    env->ReportError(err);
+    return false;
+  }
+  *block = local_addr;
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (!info[i].marked)
+      continue;
+
+    info[i].local_addr = local_addr;
+    info[i].phys_addr = phys_addr;
+
+    size_t ncells;
+    if (!info[i].str.is_sz) {
+      ncells = info[i].size;
+
+      /* Copy the original array, if any */
+      if (info[i].orig_addr)
+        memcpy(info[i].phys_addr, info[i].orig_addr, sizeof(cell_t) * info[i].size);
+    } else {
+      /* Calculate cells required for the string */
+      ncells = (info[i].size + sizeof(cell_t) - 1) / sizeof(cell_t);
+
+      /* Copy original string if necessary */
+      if ((info[i].str.sz_flags & SM_PARAM_STRING_COPY) && (info[i].orig_addr != NULL))
+      {
+        /* Cut off UTF-8 properly */
+        if (info[i].str.sz_flags & SM_PARAM_STRING_UTF8) {
+          cx->StringToLocalUTF8(
+            info[i].local_addr,
+            info[i].size,
+            (const char *)info[i].orig_addr,
+            NULL);
+        }
+        /* Copy a binary blob */
+        else if (info[i].str.sz_flags & SM_PARAM_STRING_BINARY)
+        {
+          memmove(info[i].phys_addr, info[i].orig_addr, info[i].size);
+        }
+        /* Copy ASCII characters */
+        else
+        {
+          cx->StringToLocal(
+            info[i].local_addr,
+            info[i].size,
+            (const char *)info[i].orig_addr);
+        }
+      }
+    }
+
+    /* Update the pushed parameter with the byref local address */
+    params[i] = local_addr;
+
+    local_addr += ncells * sizeof(cell_t);
+    phys_addr += ncells;
+  }
+
+  return true;
+}
+
+void
+sp::UnmarshalParams(PluginContext *cx, ParamInfo *info, unsigned int count, cell_t block,
+                    bool copyback)
+{
+  for (unsigned int i = 0; copyback && i < count; i++) {
+    if (!info[i].marked || !(info[i].flags & SM_PARAM_COPYBACK) || !info[i].orig_addr)
+      continue;
+
+    if (info[i].str.is_sz) {
+      memcpy(info[i].orig_addr, info[i].phys_addr, info[i].size);
+    } else {
+      if (info[i].size == 1) {
+        *info[i].orig_addr = *(info[i].phys_addr);
+      } else {
+        memcpy(info[i].orig_addr,
+            info[i].phys_addr,
+            info[i].size * sizeof(cell_t));
+      }
+    }
+  }
+
+  if (int err = cx->HeapPop(block))
+    Environment::get()->ReportError(err);
+}
+
+cell_t
+sp::InvokeLinkedNative(IPluginContext *cx, const cell_t *params, void *data)
+{
+  ScriptedInvoker *fn = reinterpret_cast<NativeEntry *>(data)->linked;
+  if (!fn) {
+    // The function's plugin was unloaded.
+    Environment::get()->ReportError(SP_ERROR_INVALID_NATIVE);
+    return 0;
+  }
+  if (!fn->IsRunnable()) {
+    Environment::get()->ReportError(SP_ERROR_NOT_RUNNABLE);
+    return 0;
+  }
+
+  // The caller's exit frame and the callee's invoke frame keep the stack
+  // walkable across both plugins. An error is left pending for the caller.
+  cell_t result = 0;
+  fn->context()->invokeFunction(fn, &params[1], params[0], &result);
+  return result;
+}
+
 ScriptedInvoker::ScriptedInvoker(PluginRuntime *runtime, funcid_t id, uint32_t pub_id)
  : env_(Environment::get()),
    context_(runtime->GetBaseContext()),
-   m_curparam(0),
-   m_errorstate(SP_ERROR_NONE),
    m_FnId(id),
-   cc_function_(nullptr)
+   cc_function_(nullptr),
+   entry_function_(nullptr),
+   entry_argc_(0)
 {
   runtime->GetPublicByIndex(pub_id, &public_);
 
@@ -68,6 +286,19 @@ ScriptedInvoker::CallFunction2(IPluginContext *pContext, const cell_t *params, u
   return SP_ERROR_ABORTED;
 }
 
+EntryTrampolineFn
+ScriptedInvoker::entryTrampoline(CompiledFunction *fn, unsigned int argc)
+{
+  if (!entry_function_) {
+    entry_trampoline_ = env_->stubs()->CompileEntryTrampoline(fn->GetEntryAddress(), argc);
+    entry_function_ = fn;
+    entry_argc_ = argc;
+  }
+  if (fn != entry_function_ || argc != entry_argc_)
+    return nullptr;
+  return (EntryTrampolineFn)entry_trampoline_.address();
+}
+
 IPluginContext *
 ScriptedInvoker::GetParentContext()
 {
@@ -76,14 +307,7 @@ ScriptedInvoker::GetParentContext()
 
 int ScriptedInvoker::PushCell(cell_t cell)
 {
-  if (m_curparam >= SP_MAX_EXEC_PARAMS)
-    return SetError(SP_ERROR_PARAMS_MAX);
-
-  m_info[m_curparam].marked = false;
-  m_params[m_curparam] = cell;
-  m_curparam++;
-
-  return SP_ERROR_NONE;
+  return params_.pushCell(cell);
 }
 
 int
@@ -109,64 +333,25 @@ ScriptedInvoker::PushFloatByRef(float *number, int flags)
 int
 ScriptedInvoker::PushArray(cell_t *inarray, unsigned int cells, int copyback)
 {
-  if (m_curparam >= SP_MAX_EXEC_PARAMS)
-  {
-    return SetError(SP_ERROR_PARAMS_MAX);
-  }
-
-  ParamInfo *info = &m_info[m_curparam];
-
-  info->flags = inarray ? copyback : 0;
-  info->marked = true;
-  info->size = cells;
-  info->str.is_sz = false;
-  info->orig_addr = inarray;
-
-  m_curparam++;
-
-  return SP_ERROR_NONE;
+  return params_.pushArray(inarray, cells, copyback);
 }
 
 int
 ScriptedInvoker::PushString(const char *string)
 {
-  return _PushString(string, SM_PARAM_STRING_COPY, 0, strlen(string)+1);
+  return params_.pushString(string, SM_PARAM_STRING_COPY, 0, strlen(string)+1);
 }
 
 int
 ScriptedInvoker::PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags)
 {
-  return _PushString(buffer, sz_flags, cp_flags, length);
-}
-
-int
-ScriptedInvoker::_PushString(const char *string, int sz_flags, int cp_flags, size_t len)
-{
-  if (m_curparam >= SP_MAX_EXEC_PARAMS)
-    return SetError(SP_ERROR_PARAMS_MAX);
-
-  ParamInfo *info = &m_info[m_curparam];
-
-  info->marked = true;
-  info->orig_addr = (cell_t *)string;
-  info->flags = cp_flags;
-  info->size = len;
-  info->str.sz_flags = sz_flags;
-  info->str.is_sz = true;
-
-  m_curparam++;
-
-  return SP_ERROR_NONE;
+  return params_.pushString(buffer, sz_flags, cp_flags, length);
 }
 
 void
 ScriptedInvoker::Cancel()
 {
-  if (!m_curparam)
-    return;
-
-  m_errorstate = SP_ERROR_NONE;
-  m_curparam = 0;
+  params_.cancel();
 }
 
 int
@@ -203,7 +388,7 @@ ScriptedInvoker::Invoke(cell_t *result)
     env_->ReportError(SP_ERROR_NOT_RUNNABLE);
     return false;
   }
-  if (int err = m_errorstate) {
+  if (int err = params_.error()) {
     Cancel();
     env_->ReportError(err);
     return false;
@@ -212,115 +397,22 @@ ScriptedInvoker::Invoke(cell_t *result)
   //This is for re-entrancy!
   cell_t temp_params[SP_MAX_EXEC_PARAMS];
   ParamInfo temp_info[SP_MAX_EXEC_PARAMS];
-  unsigned int numparams = m_curparam;
-  unsigned int i;
+  unsigned int narrays;
+  unsigned int numparams = params_.take(temp_params, temp_info, &narrays);
 
-  if (numparams)
-  {
-    //Save the info locally, then reset it for re-entrant calls.
-    memcpy(temp_info, m_info, numparams * sizeof(ParamInfo));
-  }
-  m_curparam = 0;
-
-  /* Browse the parameters and build arrays */
-  bool ok = true;
-  for (i=0; i<numparams; i++) {
-    /* Is this marked as an array? */
-    if (temp_info[i].marked) {
-      if (!temp_info[i].str.is_sz) {
-        /* Allocate a normal/generic array */
-        int err = context_->HeapAlloc(
-          temp_info[i].size, 
-          &(temp_info[i].local_addr),
-          &(temp_info[i].phys_addr));
-        if (err != SP_ERROR_NONE) {
-          env_->ReportError(err);
-          ok = false;
-          break;
-        }
-        if (temp_info[i].orig_addr)
-        {
-          memcpy(temp_info[i].phys_addr, temp_info[i].orig_addr, sizeof(cell_t) * temp_info[i].size);
-        }
-      } else {
-        /* Calculate cells required for the string */
-        size_t cells = (temp_info[i].size + sizeof(cell_t) - 1) / sizeof(cell_t);
-
-        /* Allocate the buffer */
-        int err = context_->HeapAlloc(
-          cells,
-          &(temp_info[i].local_addr),
-          &(temp_info[i].phys_addr));
-        if (err != SP_ERROR_NONE) {
-          env_->ReportError(err);
-          ok = false;
-          break;
-        }
+  /* Cells are passed as they are */
+  if (!narrays)
+    return context_->Invoke(m_FnId, temp_params, numparams, result);
 
-        /* Copy original string if necessary */
-        if ((temp_info[i].str.sz_flags & SM_PARAM_STRING_COPY) && (temp_info[i].orig_addr != NULL))
-        {
-          /* Cut off UTF-8 properly */
-          if (temp_info[i].str.sz_flags & SM_PARAM_STRING_UTF8) {
-            context_->StringToLocalUTF8(
-              temp_info[i].local_addr, 
-              temp_info[i].size, 
-              (const char *)temp_info[i].orig_addr,
-              NULL);
-          }
-          /* Copy a binary blob */
-          else if (temp_info[i].str.sz_flags & SM_PARAM_STRING_BINARY)
-          {
-            memmove(temp_info[i].phys_addr, temp_info[i].orig_addr, temp_info[i].size);
-          }
-          /* Copy ASCII characters */
-          else
-          {
-            context_->StringToLocal(
-              temp_info[i].local_addr,
-              temp_info[i].size,
-              (const char *)temp_info[i].orig_addr);
-          }
-        }
-      } /* End array/string calculation */
-      /* Update the pushed parameter with the byref local address */
-      temp_params[i] = temp_info[i].local_addr;
-    } else {
-      /* Just copy the value normally */
-      temp_params[i] = m_params[i];
-    }
-  }
+  /* Build arrays and strings */
+  cell_t block;
+  if (!MarshalParams(context_, temp_info, numparams, temp_params, &block))
+    return false;
 
-  /* Make the call if we can */
-  if (ok)
-    ok = context_->Invoke(m_FnId, temp_params, numparams, result);
+  /* Make the call */
+  bool ok = context_->Invoke(m_FnId, temp_params, numparams, result);
 
-  /* i should be equal to the last valid parameter + 1 */
-  bool docopies = ok;
-  while (i--) {
-    if (!temp_info[i].marked)
-      continue;
-
-    if (docopies && (temp_info[i].flags & SM_PARAM_COPYBACK)) {
-      if (temp_info[i].orig_addr) {
-        if (temp_info[i].str.is_sz) {
-          memcpy(temp_info[i].orig_addr, temp_info[i].phys_addr, temp_info[i].size);
-        
-        } else {
-          if (temp_info[i].size == 1) {
-            *temp_info[i].orig_addr = *(temp_info[i].phys_addr);
-          } else {
-            memcpy(temp_info[i].orig_addr, 
-                temp_info[i].phys_addr, 
-                temp_info[i].size * sizeof(cell_t));
-          }
-        }
-      }
-    }
-
-    if (int err = context_->HeapPop(temp_info[i].local_addr))
-      env_->ReportError(err);
-  }
+  UnmarshalParams(context_, temp_info, numparams, block, ok);
 
   return !env_->hasPendingException();
 }
@@ -344,11 +436,3 @@ ScriptedInvoker::GetFunctionID()
   return m_FnId;
 }
 
-int
-ScriptedInvoker::SetError(int err)
-{
-  m_errorstate = err;
-
-  return err;
-}
-
@@ -15,6 +15,7 @@
 
 #include <sp_vm_api.h>
 #include <am-utility.h>
+#include "code-stubs.h"
 
 namespace sp {
 
@@ -38,6 +39,58 @@ struct ParamInfo
   } str;
 };
 
+// Parameters pushed through ICallable, held until the call is made.
+class PushedParams
+{
+ public:
+  PushedParams()
+   : count_(0),
+     narrays_(0),
+     error_(SP_ERROR_NONE)
+  {}
+
+  int pushCell(cell_t cell);
+  int pushArray(cell_t *inarray, unsigned int cells, int copyback);
+  int pushString(const char *string, int sz_flags, int cp_flags, size_t len);
+  void cancel();
+
+  // Move the parameters out, leaving this empty for re-entrant calls.
+  // Returns the number of parameters, and sets *narrays to the number of
+  // arrays and strings. If there are none, info is not touched.
+  unsigned int take(cell_t *values, ParamInfo *info, unsigned int *narrays);
+
+  int error() const {
+    return error_;
+  }
+
+ private:
+  int setError(int err);
+
+ private:
+  cell_t values_[SP_MAX_EXEC_PARAMS];
+  ParamInfo info_[SP_MAX_EXEC_PARAMS];
+  unsigned int count_;
+  unsigned int narrays_;
+  int error_;
+};
+
+// Copy arrays and strings onto a context's heap, all in one block. On entry,
+// params holds the pushed values; arrays and strings are replaced with their
+// local addresses. Returns false if an error was reported. Otherwise, *block
+// must be passed to UnmarshalParams() after the call.
+bool MarshalParams(PluginContext *cx, ParamInfo *info, unsigned int count, cell_t *params,
+                   cell_t *block);
+
+// Perform any copy-backs, if the call succeeded, and free the block that
+// MarshalParams() allocated.
+void UnmarshalParams(PluginContext *cx, ParamInfo *info, unsigned int count, cell_t block,
+                     bool copyback);
+
+// Native callback for natives bound with LinkNativeToFunction(). |data| is
+// the caller's NativeEntry, whose linked function is called with the native's
+// arguments.
+cell_t InvokeLinkedNative(IPluginContext *cx, const cell_t *params, void *data);
+
 class ScriptedInvoker : public IPluginFunction
 {
  public:
@@ -73,6 +126,9 @@ class ScriptedInvoker : public IPluginFunction
   sp_public_t *Public() const {
     return public_;
   }
+  PluginContext *context() const {
+    return context_;
+  }
 
   CompiledFunction *cachedCompiledFunction() const {
     return cc_function_;
@@ -81,22 +137,23 @@ class ScriptedInvoker : public IPluginFunction
     cc_function_ = fn;
   }
 
- private:
-  int _PushString(const char *string, int sz_flags, int cp_flags, size_t len);
-  int SetError(int err);
+  // Returns a trampoline that calls |fn| with |argc| parameters, or null if
+  // one could not be made. Only the first arity seen gets a trampoline;
+  // publics are almost always called with the same number of arguments.
+  EntryTrampolineFn entryTrampoline(CompiledFunction *fn, unsigned int argc);
 
  private:
   Environment *env_;
   PluginRuntime *m_pRuntime;
   PluginContext *context_;
-  cell_t m_params[SP_MAX_EXEC_PARAMS];
-  ParamInfo m_info[SP_MAX_EXEC_PARAMS];
-  unsigned int m_curparam;
-  int m_errorstate;
+  PushedParams params_;
   funcid_t m_FnId;
   ke::AutoArray<char> full_name_;
   sp_public_t *public_;
   CompiledFunction *cc_function_;
+  CodeChunk entry_trampoline_;
+  CompiledFunction *entry_function_;
+  unsigned int entry_argc_;
 };
 
 } // namespace sp
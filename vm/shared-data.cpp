@@ -0,0 +1,137 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <assert.h>
+#include <string.h>
+#if defined(__linux__)
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/memfd.h>
+#endif
+#include <am-utility.h>
+#include "shared-data.h"
+#include "context-memory.h"
+#include "environment.h"
+#include "plugin-runtime.h"
+
+using namespace sp;
+
+#if defined(__NR_memfd_create)
+static int
+CreateDataFile(const uint8_t *bytes, size_t length)
+{
+  int fd = syscall(__NR_memfd_create, "sourcepawn-data", MFD_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  // Pad out to a whole page, so the tail of the last page reads as zeroes.
+  if (ftruncate(fd, ke::Align(length, GetPageSize())) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  size_t written = 0;
+  while (written < length) {
+    ssize_t rv = pwrite(fd, bytes + written, length - written, written);
+    if (rv <= 0) {
+      close(fd);
+      return -1;
+    }
+    written += rv;
+  }
+  return fd;
+}
+#endif
+
+SharedData::SharedData(int fd, const uint8_t *view, size_t length)
+ : fd_(fd),
+   view_(view),
+   length_(length)
+{
+}
+
+SharedData::~SharedData()
+{
+  Environment::get()->DeregisterSharedData(this);
+#if defined(__NR_memfd_create)
+  if (length_)
+    munmap(const_cast<uint8_t *>(view_), length_);
+  close(fd_);
+#endif
+}
+
+bool
+SharedData::Matches(const uint8_t *bytes, size_t length) const
+{
+  return length == length_ && memcmp(view_, bytes, length) == 0;
+}
+
+ke::PassRef<SharedData>
+SharedData::Acquire(PluginRuntime *rt)
+{
+#if defined(__NR_memfd_create)
+  const uint8_t *bytes = rt->data().bytes;
+  size_t length = rt->data().length;
+
+  Environment *env = Environment::get();
+  if (SharedData *data = env->FindSharedData(bytes, length))
+    return data;
+
+  int fd = CreateDataFile(bytes, length);
+  if (fd == -1)
+    return nullptr;
+
+  // The view shares its pages with every mapping of the file, so comparing
+  // against it costs no extra memory.
+  void *view = nullptr;
+  if (length) {
+    view = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+      close(fd);
+      return nullptr;
+    }
+  }
+
+  SharedData *data = new SharedData(fd, reinterpret_cast<const uint8_t *>(view), length);
+  env->RegisterSharedData(data);
+  return data;
+#else
+  return nullptr;
+#endif
+}
+
+uint8_t *
+SharedData::Map(size_t length)
+{
+#if defined(__NR_memfd_create)
+  assert(length >= length_);
+
+  uint8_t *memory = AllocateContextMemory(length);
+  if (!memory)
+    return nullptr;
+
+  // The file is padded to a whole page, and so is the mapping, so this
+  // stays inside it.
+  if (length_) {
+    size_t data_bytes = ke::Align(length_, GetPageSize());
+    void *data = mmap(memory, data_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd_, 0);
+    if (data == MAP_FAILED) {
+      FreeContextMemory(memory, length);
+      return nullptr;
+    }
+  }
+  return memory;
+#else
+  return nullptr;
+#endif
+}
@@ -0,0 +1,60 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_vm_shared_data_h_
+#define _include_sourcepawn_vm_shared_data_h_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <am-refcounting.h>
+
+namespace sp {
+
+class PluginRuntime;
+
+// The initial contents of a data section, kept in an anonymous in-memory
+// file. Instead of copying the data, each context maps the file copy-on-write,
+// so runtimes loaded from identical data share every page that none of them
+// writes to.
+//
+// The environment keeps one per distinct data section, for as long as some
+// runtime holds a reference. Mappings keep the file alive on their own, so a
+// context's memory outlives the SharedData it came from.
+class SharedData : public ke::Refcounted<SharedData>
+{
+ public:
+  ~SharedData();
+
+  // Finds or creates the shared copy of a runtime's data section. Returns
+  // null where in-memory files are unsupported, or on failure.
+  static ke::PassRef<SharedData> Acquire(PluginRuntime *rt);
+
+  // Allocates |length| bytes of context memory, as AllocateContextMemory()
+  // does, where the start is a private copy-on-write view of the data. The
+  // result is freed with FreeContextMemory(). Returns null on failure.
+  uint8_t *Map(size_t length);
+
+  // Returns true if this holds exactly the given data.
+  bool Matches(const uint8_t *bytes, size_t length) const;
+
+ private:
+  SharedData(int fd, const uint8_t *view, size_t length);
+
+ private:
+  int fd_;
+  const uint8_t *view_;  // Read-only view of the file, for Matches().
+  size_t length_;
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_vm_shared_data_h_
@@ -13,7 +13,11 @@
 #include <sp_vm_api.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
 #include <am-cxx.h>
+#include <am-vector.h>
 #include "dll_exports.h"
 #include "environment.h"
 #include "stack-frames.h"
@@ -24,6 +28,10 @@ using namespace SourcePawn;
 
 Environment *sEnv;
 
+// Plugins named after the first one on the command line. The first plugin's
+// unbound natives are linked to their public functions of the same name.
+static Vector<IPluginRuntime *> sLibraries;
+
 static void
 DumpStack(IFrameIterator &iter)
 {
@@ -80,6 +88,15 @@ static cell_t PrintNum(IPluginContext *cx, const cell_t *params)
   return printf("%d\n", params[1]);
 }
 
+static cell_t FastPrintNum(cell_t num)
+{
+  return printf("%d\n", num);
+}
+
+static const sp_fastnative_t sFastPrintNum = {
+  (void *)FastPrintNum, SP_FASTARG_CELL, 1, { SP_FASTARG_CELL }
+};
+
 static cell_t PrintNums(IPluginContext *cx, const cell_t *params)
 {
   for (size_t i = 1; i <= size_t(params[0]); i++) {
@@ -100,14 +117,15 @@ static cell_t DoNothing(IPluginContext *cx, const cell_t *params)
   return 1;
 }
 
-static void BindNative(IPluginRuntime *rt, const char *name, SPVM_NATIVE_FUNC fn)
+static void BindFastNative(IPluginRuntime *rt, const char *name, SPVM_NATIVE_FUNC fn,
+                           const sp_fastnative_t &fast)
 {
   int err;
   uint32_t index;
   if ((err = rt->FindNativeByName(name, &index)) != SP_ERROR_NONE)
     return;
 
-  rt->UpdateNativeBinding(index, fn, 0, nullptr);
+  rt->UpdateFastNativeBinding(index, fn, &fast, 0, nullptr);
 }
 
 static cell_t PrintFloat(IPluginContext *cx, const cell_t *params)
@@ -115,6 +133,89 @@ static cell_t PrintFloat(IPluginContext *cx, const cell_t *params)
   return printf("%f\n", sp_ctof(params[1]));
 }
 
+static cell_t FastPrintFloat(float f)
+{
+  return printf("%f\n", f);
+}
+
+static const sp_fastnative_t sFastPrintFloat = {
+  (void *)FastPrintFloat, SP_FASTARG_CELL, 1, { SP_FASTARG_FLOAT }
+};
+
+// Fast natives with each kind of argument. The ordinary versions are used by
+// the interpreter, and must compute the same thing.
+static float FastMix(float a, cell_t b, float c, cell_t *array)
+{
+  return a * float(b) + c * float(array[0]);
+}
+
+static cell_t Mix(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *array;
+  cx->LocalToPhysAddr(params[4], &array);
+  return sp_ftoc(FastMix(sp_ctof(params[1]), params[2], sp_ctof(params[3]), array));
+}
+
+static const sp_fastnative_t sFastMix = {
+  (void *)FastMix, SP_FASTARG_FLOAT, 4,
+  { SP_FASTARG_FLOAT, SP_FASTARG_CELL, SP_FASTARG_FLOAT, SP_FASTARG_REF }
+};
+
+static cell_t FastSwap(cell_t *a, cell_t *b)
+{
+  cell_t temp = *a;
+  *a = *b;
+  *b = temp;
+  return *a - *b;
+}
+
+static cell_t Swap(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *a, *b;
+  cx->LocalToPhysAddr(params[1], &a);
+  cx->LocalToPhysAddr(params[2], &b);
+  return FastSwap(a, b);
+}
+
+static const sp_fastnative_t sFastSwap = {
+  (void *)FastSwap, SP_FASTARG_CELL, 2, { SP_FASTARG_REF, SP_FASTARG_REF }
+};
+
+static cell_t FastAnswer()
+{
+  return 42;
+}
+
+static cell_t Answer(IPluginContext *cx, const cell_t *params)
+{
+  return FastAnswer();
+}
+
+static const sp_fastnative_t sFastAnswer = {
+  (void *)FastAnswer, SP_FASTARG_CELL, 0, { }
+};
+
+static cell_t FastSum2(cell_t *a, cell_t *b)
+{
+  return *a + *b;
+}
+
+// Variadic; only two-argument calls can use the fast version.
+static cell_t Sum(IPluginContext *cx, const cell_t *params)
+{
+  cell_t sum = 0;
+  for (size_t i = 1; i <= size_t(params[0]); i++) {
+    cell_t *addr;
+    cx->LocalToPhysAddr(params[i], &addr);
+    sum += *addr;
+  }
+  return sum;
+}
+
+static const sp_fastnative_t sFastSum2 = {
+  (void *)FastSum2, SP_FASTARG_CELL, 2, { SP_FASTARG_REF, SP_FASTARG_REF }
+};
+
 static cell_t DoExecute(IPluginContext *cx, const cell_t *params)
 {
   int32_t ok = 0;
@@ -139,6 +240,81 @@ static cell_t DoInvoke(IPluginContext *cx, const cell_t *params)
   return 1;
 }
 
+// Calls a function with one parameter of each kind the invoker marshals,
+// and prints what was copied back.
+static cell_t Marshal(IPluginContext *cx, const cell_t *params)
+{
+  IPluginFunction *fn = cx->GetFunctionById(params[1]);
+  if (!fn)
+    return cx->ThrowNativeError("Invalid function id %x", params[1]);
+
+  cell_t array[4] = { 1, 2, 3, 4 };
+  cell_t input[2] = { 100, 200 };
+  char buffer[16] = "abc";
+  cell_t ref = 5;
+  float fref = 1.25f;
+
+  fn->PushCell(7);
+  fn->PushFloat(2.5f);
+  fn->PushArray(array, 4, SM_PARAM_COPYBACK);
+  fn->PushArray(input, 2, 0);
+  fn->PushString("hello");
+  fn->PushStringEx(buffer, sizeof(buffer), SM_PARAM_STRING_COPY | SM_PARAM_STRING_UTF8,
+                   SM_PARAM_COPYBACK);
+  fn->PushCellByRef(&ref);
+  fn->PushFloatByRef(&fref);
+
+  int err;
+  cell_t result = 0;
+  if ((err = fn->Execute(&result)) != SP_ERROR_NONE)
+    fprintf(stdout, "Call failed: %s\n", sEnv->APIv2()->GetErrorString(err));
+
+  fprintf(stdout, "result=%d array=%d,%d,%d,%d input=%d,%d buffer=%s ref=%d fref=%f\n",
+          result, array[0], array[1], array[2], array[3], input[0], input[1], buffer, ref,
+          fref);
+  return result;
+}
+
+// Calls a function with the cells 1, 2, ... count.
+static cell_t CallCells(IPluginContext *cx, const cell_t *params)
+{
+  IPluginFunction *fn = cx->GetFunctionById(params[1]);
+  if (!fn)
+    return cx->ThrowNativeError("Invalid function id %x", params[1]);
+
+  for (cell_t i = 1; i <= params[2]; i++)
+    fn->PushCell(i);
+
+  int err;
+  cell_t result = 0;
+  if ((err = fn->Execute(&result)) != SP_ERROR_NONE)
+    fprintf(stdout, "Call failed: %s\n", sEnv->APIv2()->GetErrorString(err));
+  return result;
+}
+
+static cell_t TierInfo(IPluginContext *cx, const cell_t *params)
+{
+  IPluginFunction *fn = cx->GetFunctionById(params[1]);
+  if (!fn)
+    return cx->ThrowNativeError("Invalid function id %x", params[1]);
+
+  FunctionTierInfo info;
+  if (!sEnv->APIv2()->GetFunctionTierInfo(fn, &info))
+    return cx->ThrowNativeError("No tier info for function id %x", params[1]);
+
+  cell_t *calls, *backedges;
+  cx->LocalToPhysAddr(params[2], &calls);
+  cx->LocalToPhysAddr(params[3], &backedges);
+  *calls = info.calls;
+  *backedges = info.backedges;
+  return info.compiled;
+}
+
+static cell_t NowMs(IPluginContext *cx, const cell_t *params)
+{
+  return cell_t(uint64_t(clock()) * 1000 / CLOCKS_PER_SEC);
+}
+
 static cell_t DumpStackTrace(IPluginContext *cx, const cell_t *params)
 {
   FrameIterator iter;
@@ -152,24 +328,450 @@ static cell_t ReportError(IPluginContext* cx, const cell_t *params)
   return 0;
 }
 
-static int Execute(const char *file)
+// Every plugin the shell has loaded: the libraries, then the calling plugin.
+static size_t PluginCount()
+{
+  return sLibraries.length() + 1;
+}
+
+static IPluginRuntime *PluginAt(IPluginContext *cx, size_t index)
+{
+  return index < sLibraries.length() ? sLibraries[index] : cx->GetRuntime();
+}
+
+// Calls a public function, by its interned name, in each plugin that has it.
+static cell_t CallPublic(IPluginContext *cx, const cell_t *params)
+{
+  char *name;
+  cx->LocalToString(params[1], &name);
+
+  int err;
+  uint32_t key;
+  if ((err = sEnv->APIv2()->InternFunctionName(name, &key)) != SP_ERROR_NONE)
+    return cx->ThrowNativeErrorEx(err, "Could not intern %s", name);
+
+  cell_t calls = 0;
+  for (size_t i = 0; i < PluginCount(); i++) {
+    IPluginFunction *fn = PluginAt(cx, i)->GetFunctionByKey(key);
+    if (!fn)
+      continue;
+    fn->PushCell(params[2]);
+    if (fn->Execute(nullptr) == SP_ERROR_NONE)
+      calls++;
+  }
+  return calls;
+}
+
+// Calls a public function through a forward, in each plugin that has it,
+// with a cell, an array that is copied back, and the function's name.
+static cell_t Fire(IPluginContext *cx, const cell_t *params)
+{
+  char *name;
+  cx->LocalToString(params[1], &name);
+
+  int err;
+  uint32_t key;
+  if ((err = sEnv->APIv2()->InternFunctionName(name, &key)) != SP_ERROR_NONE)
+    return cx->ThrowNativeErrorEx(err, "Could not intern %s", name);
+
+  AutoPtr<IPluginForward> forward(
+    sEnv->APIv2()->CreateForward(SP_FORWARD_TYPE(params[2]), params[3]));
+  if (!forward)
+    return cx->ThrowNativeError("Invalid forward type %d", params[2]);
+
+  for (size_t i = 0; i < PluginCount(); i++) {
+    IPluginRuntime *rt = PluginAt(cx, i);
+    if (IPluginFunction *fn = rt->GetFunctionByKey(key))
+      forward->AddFunction(rt, fn->GetFunctionID());
+  }
+
+  cell_t *array;
+  cx->LocalToPhysAddr(params[5], &array);
+  forward->PushCell(params[4]);
+  forward->PushArray(array, params[6], SM_PARAM_COPYBACK);
+  forward->PushString(name);
+
+  cell_t result;
+  if ((err = forward->Execute(&result)) != SP_ERROR_NONE)
+    fprintf(stdout, "Forward failed: %s\n", sEnv->APIv2()->GetErrorString(err));
+  return result;
+}
+
+// Natives the JIT replaces with intrinsics; see RegisterIntrinsics(). Each
+// must compute exactly what its intrinsic is documented to.
+static cell_t Abs(IPluginContext *cx, const cell_t *params)
+{
+  return params[1] < 0 ? cell_t(0u - uint32_t(params[1])) : params[1];
+}
+
+static cell_t Min(IPluginContext *cx, const cell_t *params)
+{
+  return params[1] <= params[2] ? params[1] : params[2];
+}
+
+static cell_t Max(IPluginContext *cx, const cell_t *params)
+{
+  return params[1] >= params[2] ? params[1] : params[2];
+}
+
+static cell_t Clamp(IPluginContext *cx, const cell_t *params)
+{
+  if (params[1] < params[2])
+    return params[2];
+  if (params[1] > params[3])
+    return params[3];
+  return params[1];
+}
+
+static cell_t BitTest(IPluginContext *cx, const cell_t *params)
+{
+  return (uint32_t(params[1]) >> (params[2] & 31)) & 1;
+}
+
+static cell_t BitCount(IPluginContext *cx, const cell_t *params)
+{
+  uint32_t value = uint32_t(params[1]);
+  cell_t count = 0;
+  for (; value; value &= value - 1)
+    count++;
+  return count;
+}
+
+static bool ReadVectors(IPluginContext *cx, const cell_t *params, size_t count, cell_t **vecs)
+{
+  for (size_t i = 0; i < count; i++) {
+    int err;
+    if ((err = cx->LocalToPhysAddr(params[i + 1], &vecs[i])) != SP_ERROR_NONE) {
+      cx->ReportErrorNumber(err);
+      return false;
+    }
+  }
+  return true;
+}
+
+static cell_t AddVectors(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *vecs[3];
+  if (!ReadVectors(cx, params, 3, vecs))
+    return 0;
+  for (size_t i = 0; i < 3; i++)
+    vecs[2][i] = sp_ftoc(sp_ctof(vecs[0][i]) + sp_ctof(vecs[1][i]));
+  return 0;
+}
+
+static cell_t SubtractVectors(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *vecs[3];
+  if (!ReadVectors(cx, params, 3, vecs))
+    return 0;
+  for (size_t i = 0; i < 3; i++)
+    vecs[2][i] = sp_ftoc(sp_ctof(vecs[0][i]) - sp_ctof(vecs[1][i]));
+  return 0;
+}
+
+static cell_t GetVectorDotProduct(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *vecs[2];
+  if (!ReadVectors(cx, params, 2, vecs))
+    return 0;
+  float dot = 0.0f;
+  for (size_t i = 0; i < 3; i++)
+    dot += sp_ctof(vecs[0][i]) * sp_ctof(vecs[1][i]);
+  return sp_ftoc(dot);
+}
+
+static cell_t GetVectorLength(IPluginContext *cx, const cell_t *params)
+{
+  cell_t *vec;
+  if (!ReadVectors(cx, params, 1, &vec))
+    return 0;
+  float length = 0.0f;
+  for (size_t i = 0; i < 3; i++)
+    length += sp_ctof(vec[i]) * sp_ctof(vec[i]);
+  return sp_ftoc(params[2] ? length : sqrtf(length));
+}
+
+static cell_t Strlen(IPluginContext *cx, const cell_t *params)
+{
+  int err;
+  char *str;
+  if ((err = cx->LocalToString(params[1], &str)) != SP_ERROR_NONE) {
+    cx->ReportErrorNumber(err);
+    return 0;
+  }
+  return cell_t(strlen(str));
+}
+
+static cell_t UnloadLibraries(IPluginContext *cx, const cell_t *params)
+{
+  for (size_t i = 0; i < sLibraries.length(); i++)
+    delete sLibraries[i];
+  sLibraries.clear();
+  return 0;
+}
+
+// Float natives, matching the semantics of the opcodes the VM replaces them
+// with, so tests print the same thing whether or not they were replaced.
+static cell_t FloatCtor(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(float(params[1]));
+}
+
+static cell_t FloatAdd(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(sp_ctof(params[1]) + sp_ctof(params[2]));
+}
+
+static cell_t FloatSub(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(sp_ctof(params[1]) - sp_ctof(params[2]));
+}
+
+static cell_t FloatMul(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(sp_ctof(params[1]) * sp_ctof(params[2]));
+}
+
+static cell_t FloatDiv(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(sp_ctof(params[1]) / sp_ctof(params[2]));
+}
+
+static cell_t FloatAbs(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ftoc(fabsf(sp_ctof(params[1])));
+}
+
+static cell_t FloatCompare(IPluginContext *cx, const cell_t *params)
+{
+  float a = sp_ctof(params[1]);
+  float b = sp_ctof(params[2]);
+  if (a > b)
+    return 1;
+  if (a < b)
+    return -1;
+  return 0;
+}
+
+static cell_t RoundToZero(IPluginContext *cx, const cell_t *params)
+{
+  return cell_t(sp_ctof(params[1]));
+}
+
+static cell_t RoundToCeil(IPluginContext *cx, const cell_t *params)
+{
+  return cell_t(ceilf(sp_ctof(params[1])));
+}
+
+static cell_t RoundToFloor(IPluginContext *cx, const cell_t *params)
+{
+  return cell_t(floorf(sp_ctof(params[1])));
+}
+
+static cell_t RoundToNearest(IPluginContext *cx, const cell_t *params)
+{
+  return cell_t(lrintf(sp_ctof(params[1])));
+}
+
+static cell_t FloatGt(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) > sp_ctof(params[2]);
+}
+
+static cell_t FloatGe(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) >= sp_ctof(params[2]);
+}
+
+static cell_t FloatLt(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) < sp_ctof(params[2]);
+}
+
+static cell_t FloatLe(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) <= sp_ctof(params[2]);
+}
+
+static cell_t FloatEq(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) == sp_ctof(params[2]);
+}
+
+static cell_t FloatNe(IPluginContext *cx, const cell_t *params)
+{
+  return sp_ctof(params[1]) != sp_ctof(params[2]);
+}
+
+static cell_t FloatNot(IPluginContext *cx, const cell_t *params)
+{
+  return !sp_ctof(params[1]);
+}
+
+static const sp_nativeinfo_t sShellNatives[] = {
+  {"print", Print},
+  {"printnums", PrintNums},
+  {"execute", DoExecute},
+  {"invoke", DoInvoke},
+  {"marshal", Marshal},
+  {"call_cells", CallCells},
+  {"tier_info", TierInfo},
+  {"report_error", ReportError},
+  {"unload_libraries", UnloadLibraries},
+  {"call_public", CallPublic},
+  {"fire", Fire},
+  {"AddVectors", AddVectors},
+  {"SubtractVectors", SubtractVectors},
+  {"GetVectorDotProduct", GetVectorDotProduct},
+  {"GetVectorLength", GetVectorLength},
+  {"strlen", Strlen},
+};
+
+static const sp_nativeinfo_t sLeafNatives[] = {
+  {"donothing", DoNothing},
+  {"now_ms", NowMs},
+  {"dump_stack_trace", DumpStackTrace},
+  {"Abs", Abs},
+  {"Min", Min},
+  {"Max", Max},
+  {"Clamp", Clamp},
+  {"BitTest", BitTest},
+  {"BitCount", BitCount},
+  {"float", FloatCtor},
+  {"FloatAdd", FloatAdd},
+  {"FloatSub", FloatSub},
+  {"FloatMul", FloatMul},
+  {"FloatDiv", FloatDiv},
+  {"FloatAbs", FloatAbs},
+  {"FloatCompare", FloatCompare},
+  {"RoundToZero", RoundToZero},
+  {"RoundToCeil", RoundToCeil},
+  {"RoundToFloor", RoundToFloor},
+  {"RoundToNearest", RoundToNearest},
+  {"__FLOAT_GT__", FloatGt},
+  {"__FLOAT_GE__", FloatGe},
+  {"__FLOAT_LT__", FloatLt},
+  {"__FLOAT_LE__", FloatLe},
+  {"__FLOAT_EQ__", FloatEq},
+  {"__FLOAT_NE__", FloatNe},
+  {"__FLOAT_NOT__", FloatNot},
+};
+
+static INativeTable *sShellTable;
+static INativeTable *sLeafTable;
+
+static bool CreateNativeTables()
+{
+  sShellTable = sEnv->APIv2()->CreateNativeTable();
+  sLeafTable = sEnv->APIv2()->CreateNativeTable();
+  if (!sShellTable || !sLeafTable)
+    return false;
+  return sShellTable->AddNatives(sShellNatives, sizeof(sShellNatives) / sizeof(sShellNatives[0])) &&
+         sLeafTable->AddNatives(sLeafNatives, sizeof(sLeafNatives) / sizeof(sLeafNatives[0]));
+}
+
+// Binds the shell's natives, and stores the indices of any that are left.
+static bool BindShellNatives(IPluginRuntime *rt, Vector<uint32_t> *unbound)
+{
+  BindFastNative(rt, "printnum", PrintNum, sFastPrintNum);
+  BindFastNative(rt, "printfloat", PrintFloat, sFastPrintFloat);
+  BindFastNative(rt, "fast_mix", Mix, sFastMix);
+  BindFastNative(rt, "fast_swap", Swap, sFastSwap);
+  BindFastNative(rt, "fast_answer", Answer, sFastAnswer);
+  BindFastNative(rt, "fast_sum", Sum, sFastSum2);
+
+  if (rt->BindNatives(sLeafTable, SP_NTVFLAG_LEAF, nullptr, 0, nullptr) != SP_ERROR_NONE)
+    return false;
+
+  uint32_t count;
+  if (!unbound->resize(rt->GetNativesNum()))
+    return false;
+  if (rt->BindNatives(sShellTable, 0, unbound->buffer(), unbound->length(), &count) !=
+      SP_ERROR_NONE)
+  {
+    return false;
+  }
+  return unbound->resize(count);
+}
+
+// Links natives the shell does not provide to library functions of the same
+// name, and reports any that are still missing.
+static void LinkLibraryNatives(IPluginRuntime *rt, const Vector<uint32_t> &unbound)
+{
+  for (size_t i = 0; i < unbound.length(); i++) {
+    const sp_native_t *native = rt->GetNative(unbound[i]);
+
+    bool linked = false;
+    for (size_t j = 0; j < sLibraries.length() && !linked; j++) {
+      if (IPluginFunction *fn = sLibraries[j]->GetFunctionByName(native->name))
+        linked = rt->LinkNativeToFunction(unbound[i], fn, 0) == SP_ERROR_NONE;
+    }
+    if (!linked)
+      fprintf(stdout, "Native %s is not provided\n", native->name);
+  }
+}
+
+static void RegisterIntrinsics()
+{
+  ISourcePawnEngine2 *api = sEnv->APIv2();
+  api->RegisterNativeIntrinsic("Abs", SP_INTRINSIC_ABS);
+  api->RegisterNativeIntrinsic("Min", SP_INTRINSIC_MIN);
+  api->RegisterNativeIntrinsic("Max", SP_INTRINSIC_MAX);
+  api->RegisterNativeIntrinsic("Clamp", SP_INTRINSIC_CLAMP);
+  api->RegisterNativeIntrinsic("BitTest", SP_INTRINSIC_BIT_TEST);
+  api->RegisterNativeIntrinsic("BitCount", SP_INTRINSIC_BIT_COUNT);
+  api->RegisterNativeIntrinsic("AddVectors", SP_INTRINSIC_VECTOR_ADD);
+  api->RegisterNativeIntrinsic("SubtractVectors", SP_INTRINSIC_VECTOR_SUB);
+  api->RegisterNativeIntrinsic("GetVectorDotProduct", SP_INTRINSIC_VECTOR_DOT);
+  api->RegisterNativeIntrinsic("GetVectorLength", SP_INTRINSIC_VECTOR_LENGTH);
+  api->RegisterNativeIntrinsic("strlen", SP_INTRINSIC_STRLEN);
+}
+
+// Loads a plugin, through the loader if there is one.
+static IPluginRuntime *LoadPlugin(IPluginLoader *loader, size_t index, const char *file)
 {
   char error[255];
-  AutoPtr<IPluginRuntime> rt(sEnv->APIv2()->LoadBinaryFromFile(file, error, sizeof(error)));
+  IPluginRuntime *rt = loader
+                       ? loader->FinishLoading(index, error, sizeof(error))
+                       : sEnv->APIv2()->LoadBinaryFromFile(file, error, sizeof(error));
   if (!rt) {
     fprintf(stderr, "Could not load plugin: %s\n", error);
-    return 1;
+    return nullptr;
+  }
+  return rt;
+}
+
+// Runs the first file's main function, after loading the rest as libraries.
+// If LOAD_THREADS is set, every file is loaded on that many threads up front.
+static int Execute(char **files, int nfiles)
+{
+  const char *threads = getenv("LOAD_THREADS");
+  AutoPtr<IPluginLoader> loader(
+    threads ? sEnv->APIv2()->LoadBinariesFromFiles(files, nfiles, atoi(threads)) : nullptr);
+
+  for (int i = 1; i < nfiles; i++) {
+    IPluginRuntime *lib = LoadPlugin(loader, i, files[i]);
+    if (!lib)
+      return 1;
+    sLibraries.append(lib);
+
+    Vector<uint32_t> unbound;
+    if (!BindShellNatives(lib, &unbound)) {
+      fprintf(stderr, "Could not bind natives\n");
+      return 1;
+    }
   }
 
-  BindNative(rt, "print", Print);
-  BindNative(rt, "printnum", PrintNum);
-  BindNative(rt, "printnums", PrintNums);
-  BindNative(rt, "printfloat", PrintFloat);
-  BindNative(rt, "donothing", DoNothing);
-  BindNative(rt, "execute", DoExecute);
-  BindNative(rt, "invoke", DoInvoke);
-  BindNative(rt, "dump_stack_trace", DumpStackTrace);
-  BindNative(rt, "report_error", ReportError);
+  AutoPtr<IPluginRuntime> rt(LoadPlugin(loader, 0, files[0]));
+  if (!rt)
+    return 1;
+
+  Vector<uint32_t> unbound;
+  if (!BindShellNatives(rt, &unbound)) {
+    fprintf(stderr, "Could not bind natives\n");
+    return 1;
+  }
+  LinkLibraryNatives(rt, unbound);
 
   IPluginFunction *fun = rt->GetFunctionByName("main");
   if (!fun)
@@ -191,8 +793,8 @@ static int Execute(const char *file)
 
 int main(int argc, char **argv)
 {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: <file>\n");
+  if (argc < 2) {
+    fprintf(stderr, "Usage: <file> [library files...]\n");
     return 1;
   }
 
@@ -203,12 +805,33 @@ int main(int argc, char **argv)
 
   if (getenv("DISABLE_JIT"))
     sEnv->SetJitEnabled(false);
+  if (getenv("TIER_CALLS") || getenv("TIER_BACKEDGES")) {
+    const char *calls = getenv("TIER_CALLS");
+    const char *backedges = getenv("TIER_BACKEDGES");
+    sEnv->SetTieringThresholds(calls ? atoi(calls) : 0, backedges ? atoi(backedges) : 0);
+  }
+  if (const char *threads = getenv("BACKGROUND_JIT"))
+    sEnv->SetBackgroundCompileThreads(atoi(threads));
+  if (const char *dir = getenv("CODE_CACHE"))
+    sEnv->SetCodeCacheDirectory(dir);
+  if (getenv("MAP_FILES"))
+    sEnv->SetFileMappingEnabled(true);
+  if (getenv("SHARE_DATA"))
+    sEnv->SetSharedDataEnabled(true);
+  RegisterIntrinsics();
 
   ShellDebugListener debug;
   sEnv->SetDebugger(&debug);
   sEnv->InstallWatchdogTimer(5000);
 
-  int errcode = Execute(argv[1]);
+  int errcode = 1;
+  if (CreateNativeTables())
+    errcode = Execute(&argv[1], argc - 1);
+  else
+    fprintf(stderr, "Could not create native tables\n");
+  UnloadLibraries(nullptr, nullptr);
+  delete sShellTable;
+  delete sLeafTable;
 
   sEnv->SetDebugger(NULL);
   sEnv->Shutdown();
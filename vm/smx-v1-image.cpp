@@ -7,14 +7,27 @@
 // provided with this file, you can obtain it here:
 //   http://www.gnu.org/licenses/gpl.html
 //
+#include <sp_vm_types.h>
 #include "smx-v1-image.h"
 #include "zlib/zlib.h"
 
 using namespace ke;
 using namespace sp;
 
-SmxV1Image::SmxV1Image(FILE *fp)
- : FileReader(fp),
+// Only uncompressed images are mapped. A compressed image is decoded into
+// memory of its own, so mapping the file would not save anything.
+static bool
+IsUncompressedImage(FILE *fp)
+{
+  sp_file_hdr_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1)
+    return false;
+  return hdr.magic == SmxConsts::FILE_MAGIC &&
+         hdr.compression == SmxConsts::FILE_COMPRESSION_NONE;
+}
+
+SmxV1Image::SmxV1Image(FILE *fp, bool map)
+ : FileReader(fp, map && IsUncompressedImage(fp)),
    hdr_(nullptr),
    header_strings_(nullptr),
    names_section_(nullptr),
@@ -26,6 +39,90 @@ SmxV1Image::SmxV1Image(FILE *fp)
 {
 }
 
+static inline bool
+ReadLz4Length(const uint8_t **ipp, const uint8_t *iend, size_t *length)
+{
+  const uint8_t *ip = *ipp;
+  uint8_t byte;
+  do {
+    if (ip >= iend)
+      return false;
+    byte = *ip++;
+    *length += byte;
+  } while (byte == 255);
+  *ipp = ip;
+  return true;
+}
+
+// Decodes a single LZ4 block, as written by spcomp for FILE_COMPRESSION_LZ4,
+// straight into the image buffer. Every read and write is bounds checked, and
+// the block must fill |dest| exactly.
+static bool
+DecodeLz4(const uint8_t *src, size_t srclen, uint8_t *dest, size_t destlen)
+{
+  const uint8_t *ip = src;
+  const uint8_t *iend = src + srclen;
+  uint8_t *op = dest;
+  uint8_t *oend = dest + destlen;
+
+  for (;;) {
+    if (ip >= iend)
+      return false;
+    uint8_t token = *ip++;
+
+    size_t length = token >> 4;
+    if (length == 15 && !ReadLz4Length(&ip, iend, &length))
+      return false;
+    if (length > size_t(iend - ip) || length > size_t(oend - op))
+      return false;
+
+    // Most runs are short. Away from the ends of the buffers, copy a fixed
+    // 16 bytes, which is a couple of instructions rather than a call; the
+    // excess is overwritten by what follows.
+    if (length <= 16 && iend - ip >= 16 && oend - op >= 16)
+      memcpy(op, ip, 16);
+    else
+      memcpy(op, ip, length);
+    ip += length;
+    op += length;
+
+    // The last sequence has no match.
+    if (ip == iend)
+      return op == oend;
+
+    if (iend - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (!offset || offset > size_t(op - dest))
+      return false;
+
+    length = token & 0xf;
+    if (length == 15 && !ReadLz4Length(&ip, iend, &length))
+      return false;
+    length += 4;
+    if (length > size_t(oend - op))
+      return false;
+
+    // A match may overlap its own output, to repeat a short pattern. Since
+    // everything from |ref| to |op| is then a whole number of repeats, each
+    // copy can take all of it, doubling the copy size every time.
+    const uint8_t *ref = op - offset;
+    uint8_t *match_end = op + length;
+    if (offset >= 16 && length <= 32 && oend - op >= 32) {
+      memcpy(op, ref, 16);
+      memcpy(op + 16, ref + 16, 16);
+      op = match_end;
+      continue;
+    }
+    while (op < match_end) {
+      size_t n = ke::Min(size_t(op - ref), size_t(match_end - op));
+      memcpy(op, ref, n);
+      op += n;
+    }
+  }
+}
+
 // Validating SMX v1 scripts is fairly expensive. We reserve real validation
 // for v2.
 bool
@@ -49,6 +146,7 @@ SmxV1Image::validate()
 
   switch (hdr_->compression) {
     case SmxConsts::FILE_COMPRESSION_GZ:
+    case SmxConsts::FILE_COMPRESSION_LZ4:
     {
       // The start of the compression cannot be larger than the file.
       if (hdr_->dataoffs > length_)
@@ -63,30 +161,42 @@ SmxV1Image::validate()
       if (hdr_->imagesize < hdr_->dataoffs)
         return error("illegal image size");
 
-      // Allocate the uncompressed image buffer.
+      // The compressed region must be within the file.
+      if (hdr_->disksize < hdr_->dataoffs || hdr_->disksize > length_)
+        return error("illegal compressed region");
+
+      // Allocate the uncompressed image buffer. The image is decoded where
+      // PluginRuntime will use it, so it starts far enough in for the code
+      // section to be cell-aligned, and the code is never copied again.
       uint32_t compressedSize = hdr_->disksize - hdr_->dataoffs;
-      AutoArray<uint8_t> uncompressed(new uint8_t[hdr_->imagesize]);
+      size_t shift = codeAlignmentShift();
+      AutoArray<uint8_t> uncompressed(new uint8_t[hdr_->imagesize + shift]);
       if (!uncompressed)
         return error("out of memory");
+      uint8_t *image = (uint8_t *)uncompressed + shift;
 
       // Decompress.
       const uint8_t *src = buffer() + hdr_->dataoffs;
-      uint8_t *dest = (uint8_t *)uncompressed + hdr_->dataoffs;
+      uint8_t *dest = image + hdr_->dataoffs;
       uLongf destlen = hdr_->imagesize - hdr_->dataoffs;
-      int rv = uncompress(
-        (Bytef *)dest,
-        &destlen,
-        src,
-        compressedSize);
-      if (rv != Z_OK)
-        return error("could not decode compressed region");
+      if (hdr_->compression == SmxConsts::FILE_COMPRESSION_LZ4) {
+        if (!DecodeLz4(src, compressedSize, dest, destlen))
+          return error("could not decode compressed region");
+      } else {
+        int rv = uncompress(
+          (Bytef *)dest,
+          &destlen,
+          src,
+          compressedSize);
+        if (rv != Z_OK)
+          return error("could not decode compressed region");
+      }
 
       // Copy the initial uncompressed region back in.
-      memcpy((uint8_t *)uncompressed, buffer(), hdr_->dataoffs);
+      memcpy(image, buffer(), hdr_->dataoffs);
 
-      // Replace the original buffer.
-      length_ = hdr_->imagesize;
-      buffer_ = uncompressed.take();
+      // Replace the original buffer. If the file was mapped, this unmaps it.
+      setBuffer(uncompressed, hdr_->imagesize, shift);
       hdr_ = (sp_file_hdr_t *)buffer();
       break;
     }
@@ -167,6 +277,33 @@ SmxV1Image::validate()
   return true;
 }
 
+// spcomp aligns sections, but older compilers did not. The section table is
+// outside the compressed region, so the code section's offset is known before
+// decoding. It has not been validated yet, so anything unexpected just leaves
+// the image where it is, and PluginRuntime copies the code instead.
+size_t
+SmxV1Image::codeAlignmentShift() const
+{
+  if (hdr_->stringtab >= hdr_->dataoffs)
+    return 0;
+  if (hdr_->sections > (hdr_->dataoffs - sizeof(sp_file_hdr_t)) / sizeof(sp_file_section_t))
+    return 0;
+
+  const char *strings = reinterpret_cast<const char *>(buffer() + hdr_->stringtab);
+  size_t strings_length = hdr_->dataoffs - hdr_->stringtab;
+  const sp_file_section_t *sections =
+    reinterpret_cast<const sp_file_section_t *>(buffer() + sizeof(sp_file_hdr_t));
+  for (size_t i = 0; i < hdr_->sections; i++) {
+    if (sections[i].nameoffs >= strings_length)
+      continue;
+    if (strncmp(strings + sections[i].nameoffs, ".code", strings_length - sections[i].nameoffs) != 0)
+      continue;
+    uint32_t misalignment = sections[i].dataoffs % sizeof(cell_t);
+    return misalignment ? sizeof(cell_t) - misalignment : 0;
+  }
+  return 0;
+}
+
 const SmxV1Image::Section *
 SmxV1Image::findSection(const char *name)
 {
@@ -304,9 +441,18 @@ SmxV1Image::validateNatives()
     reinterpret_cast<const sp_file_natives_t *>(buffer() + section->dataoffs);
   size_t length = section->size / sizeof(sp_file_natives_t);
 
+  if (!native_map_.init(32))
+    return error("out of memory");
+
   for (size_t i = 0; i < length; i++) {
     if (!validateName(natives[i].name))
       return error("invalid pubvar name");
+
+    // Keep the first of any duplicates, as the linear search did.
+    const char *name = names_ + natives[i].name;
+    NativeMap::Insert p = native_map_.findForAdd(name);
+    if (!p.found() && !native_map_.add(p, name, i))
+      return error("out of memory");
   }
 
   natives_ = List<sp_file_natives_t>(natives, length);
@@ -433,15 +579,12 @@ SmxV1Image::GetNative(size_t index) const
 bool
 SmxV1Image::FindNative(const char *name, size_t *indexp) const
 {
-  for (size_t i = 0; i < natives_.length(); i++) {
-    const char *candidate = names_ + natives_[i].name;
-    if (strcmp(candidate, name) == 0) {
-      if (indexp)
-        *indexp = i;
-      return true;
-    }
-  }
-  return false;
+  NativeMap::Result r = native_map_.find(name);
+  if (!r.found())
+    return false;
+  if (indexp)
+    *indexp = r->value;
+  return true;
 }
 
 size_t
@@ -16,6 +16,7 @@
 #include <am-utility.h>
 #include <am-string.h>
 #include <am-vector.h>
+#include <am-hashmap.h>
 #include "file-utils.h"
 #include "legacy-image.h"
 
@@ -26,7 +27,7 @@ class SmxV1Image
     public LegacyImage
 {
  public:
-  SmxV1Image(FILE *fp);
+  SmxV1Image(FILE *fp, bool map);
 
   // This must be called to initialize the reader.
   bool validate();
@@ -161,6 +162,7 @@ class SmxV1Image
     error_ = msg;
     return false;
   }
+  size_t codeAlignmentShift() const;
   bool validateName(size_t offset);
   bool validateSection(const Section *section);
   bool validateCode();
@@ -189,6 +191,19 @@ class SmxV1Image
   List<sp_file_natives_t> natives_;
   List<sp_file_pubvars_t> pubvars_;
 
+  // Native names, which point into the image, mapped to their indexes.
+  // Lookups do not change the map, so FindNative() can stay const.
+  struct NamePolicy {
+    static inline uint32_t hash(const char *key) {
+      return ke::HashCharSequence(key, strlen(key));
+    }
+    static inline bool matches(const char *a, const char *b) {
+      return strcmp(a, b) == 0;
+    }
+  };
+  typedef ke::HashMap<const char *, size_t, NamePolicy> NativeMap;
+  mutable NativeMap native_map_;
+
   const Section *debug_names_section_;
   const char *debug_names_;
   const sp_fdbg_info_t *debug_info_;
@@ -14,18 +14,20 @@
 #include "plugin-runtime.h"
 #include "plugin-context.h"
 #include "stack-frames.h"
-#include "x86/frames-x86.h"
+#include "jit.h"
 #include "compiled-function.h"
+#include "interpreter.h"
 
 using namespace ke;
 using namespace sp;
 using namespace SourcePawn;
 
-InvokeFrame::InvokeFrame(PluginContext *cx, ucell_t entry_cip)
+InvokeFrame::InvokeFrame(PluginContext *cx, ucell_t entry_cip, bool tier_up)
  : prev_(Environment::get()->top()),
    cx_(cx),
    prev_exit_fp_(Environment::get()->exit_fp()),
-   entry_cip_(0)
+   entry_cip_(0),
+   tier_up_(tier_up)
 {
   Environment::get()->enterInvoke(this);
 }
@@ -78,6 +80,18 @@ FrameIterator::Next()
   pc_ = cur_frame_->return_address;
   cip_ = kInvalidCip;
   cur_frame_ = FrameLayout::FromFp(cur_frame_->prev_fp);
+
+  // A tiered-up call from the interpreter goes through an entry frame and a
+  // helper exit frame. Neither is a call the plugin made, so step over both
+  // to the interpreted caller, and number frames the same in every tier.
+  if (cur_frame_->frame_type == FrameType::Entry && ivk_->tier_up()) {
+    intptr_t* exit_fp = ivk_->prev_exit_fp();
+    ivk_ = ivk_->prev();
+    assert(ivk_);
+    nextInvokeFrame(exit_fp);
+    pc_ = cur_frame_->return_address;
+    cur_frame_ = FrameLayout::FromFp(cur_frame_->prev_fp);
+  }
 }
 
 void
@@ -89,13 +103,28 @@ FrameIterator::Reset()
 cell_t
 FrameIterator::function_cip() const
 {
-  assert(cur_frame_->frame_type == FrameType::Scripted);
+  assert(cur_frame_->frame_type == FrameType::Scripted ||
+         cur_frame_->frame_type == FrameType::Interpreted);
   return cur_frame_->function_id;
 }
 
 cell_t
 FrameIterator::findCip() const
 {
+  if (cur_frame_->frame_type == FrameType::Interpreted) {
+    InterpretedFunction *fn = runtime_->GetInterpretedFunctionByOffset(function_cip());
+    if (!fn)
+      return 0;
+
+    if (cip_ == kInvalidCip) {
+      if (pc_)
+        cip_ = fn->FindCipByPc(pc_);
+      else
+        cip_ = function_cip();
+    }
+    return cip_;
+  }
+
   CompiledFunction *fn = runtime_->GetJittedFunctionByOffset(function_cip());
   if (!fn)
     return 0;
@@ -167,7 +196,8 @@ FrameIterator::IsNativeFrame() const
 bool
 FrameIterator::IsScriptedFrame() const
 {
-  return cur_frame_->frame_type == FrameType::Scripted;
+  return cur_frame_->frame_type == FrameType::Scripted ||
+         cur_frame_->frame_type == FrameType::Interpreted;
 }
 
 bool
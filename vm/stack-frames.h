@@ -30,7 +30,8 @@ enum class FrameType : intptr_t
   None,
   Entry,
   Scripted,
-  Exit
+  Exit,
+  Interpreted
 };
 KE_DEFINE_ENUM_COMPARATORS(FrameType, intptr_t);
 
@@ -62,7 +63,7 @@ static inline uintptr_t GetExitFramePayload(uintptr_t stack_val)
 class InvokeFrame
 {
  public:
-  InvokeFrame(PluginContext *cx, ucell_t cip);
+  InvokeFrame(PluginContext *cx, ucell_t cip, bool tier_up = false);
   ~InvokeFrame();
 
   InvokeFrame *prev() const {
@@ -79,11 +80,18 @@ class InvokeFrame
     return entry_cip_;
   }
 
+  // True if the interpreter entered the JIT here to call a tiered-up
+  // function, rather than the embedder or a native calling into the VM.
+  bool tier_up() const {
+    return tier_up_;
+  }
+
  private:
   InvokeFrame *prev_;
   PluginContext *cx_;
   intptr_t* prev_exit_fp_;
   ucell_t entry_cip_;
+  bool tier_up_;
 };
 
 class FrameIterator : public SourcePawn::IFrameIterator
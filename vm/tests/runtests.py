@@ -0,0 +1,161 @@
+# vim: set ts=4 sw=4 tw=99 et:
+import os, sys
+import argparse
+import shutil
+import struct
+import subprocess
+import tempfile
+
+# Every test runs once in each of these modes, and must print the same thing
+# in all of them.
+Modes = [
+    ('jit', {}),
+    ('interp', {'DISABLE_JIT': '1'}),
+    ('tier', {'TIER_CALLS': '2', 'TIER_BACKEDGES': '100'}),
+    ('background', {'BACKGROUND_JIT': '2'}),
+]
+
+# A test may start with comment lines that change how it runs:
+#
+#   // modes: jit interp        Only run in these modes.
+#   // arch: x64                Only run if spshell is built for one of these
+#                               architectures (x86 or x64).
+#   // env: NAME=VALUE ...      Extra environment variables for spshell.
+#   // spcomp: -z2 ...          Extra arguments for spcomp.
+#   // args: extra.sp ...       Extra plugins to compile, and to pass to
+#                               spshell after the test's own plugin.
+#
+# Expected output is in <test>.out, or in <test>.<mode>.out for a mode whose
+# output differs.
+def read_directives(path):
+    directives = {}
+    with open(path) as fp:
+        for line in fp:
+            line = line.strip()
+            if not line.startswith('//'):
+                break
+            line = line[2:].strip()
+            key, sep, value = line.partition(':')
+            if sep and key in ['modes', 'arch', 'env', 'spcomp', 'args']:
+                directives[key] = value.split()
+    return directives
+
+# Read the target architecture from spshell's executable header.
+def shell_arch(path):
+    with open(path, 'rb') as fp:
+        header = fp.read(4096)
+    if header[:4] == b'\x7fELF':
+        return 'x64' if header[4:5] == b'\x02' else 'x86'
+    if header[:2] == b'MZ':
+        pe = struct.unpack_from('<I', header, 0x3c)[0]
+        machine = struct.unpack_from('<H', header, pe + 4)[0]
+        return 'x64' if machine == 0x8664 else 'x86'
+    if header[:4] == b'\xcf\xfa\xed\xfe':
+        return 'x64'
+    return 'x86'
+
+def compile_plugin(args, testdir, outdir, name, flags):
+    smx_path = os.path.join(outdir, name + '.smx')
+    # Compile from the test folder, so stack traces show bare file names.
+    argv = [os.path.abspath(args.spcomp)] + flags + [
+        name + '.sp',
+        '-o' + smx_path,
+    ]
+    p = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=testdir)
+    stdout, stderr = p.communicate()
+    if not os.path.exists(smx_path):
+        return None, stdout.decode('utf-8') + stderr.decode('utf-8')
+    return smx_path, None
+
+def run_test(args, testdir, outdir, test):
+    directives = read_directives(os.path.join(testdir, test + '.sp'))
+    if args.arch not in directives.get('arch', [args.arch]):
+        print('Test {0} ... skipped on {1}'.format(test, args.arch))
+        return True
+    flags = directives.get('spcomp', [])
+
+    plugins = []
+    for name in [test] + [os.path.splitext(arg)[0] for arg in directives.get('args', [])]:
+        smx_path, error = compile_plugin(args, testdir, outdir, name, flags)
+        if not smx_path:
+            print('Test {0} ... FAIL'.format(test))
+            sys.stderr.write('Could not compile {0}:\n'.format(name))
+            sys.stderr.write(error)
+            return False
+        plugins.append(smx_path)
+
+    env = os.environ.copy()
+    for pair in directives.get('env', []):
+        key, _, value = pair.partition('=')
+        env[key] = value.replace('{outdir}', outdir)
+
+    ok = True
+    modes = directives.get('modes', [mode for mode, _ in Modes])
+    for mode, mode_env in Modes:
+        if mode not in modes:
+            continue
+
+        expected_path = os.path.join(testdir, '{0}.{1}.out'.format(test, mode))
+        if not os.path.exists(expected_path):
+            expected_path = os.path.join(testdir, test + '.out')
+        with open(expected_path) as fp:
+            expected = fp.read()
+
+        run_env = env.copy()
+        run_env.update(mode_env)
+        argv = [os.path.abspath(args.spshell)] + plugins
+        p = subprocess.Popen(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=run_env)
+        stdout, stderr = p.communicate()
+        stdout = stdout.decode('utf-8')
+        stderr = stderr.decode('utf-8')
+
+        if stdout == expected and p.returncode >= 0:
+            print('Test {0} ({1}) ... OK'.format(test, mode))
+            continue
+
+        ok = False
+        print('Test {0} ({1}) ... FAIL'.format(test, mode))
+        sys.stderr.write('FAILED! Exit code {0}. Expected stdout:\n'.format(p.returncode))
+        sys.stderr.write(expected)
+        sys.stderr.write('Got stdout:\n')
+        sys.stderr.write(stdout)
+        sys.stderr.write('Got stderr:\n')
+        sys.stderr.write(stderr)
+    return ok
+
+def run_tests(args):
+    testdir = os.path.dirname(os.path.abspath(__file__))
+
+    # Plugins that are only loaded by other tests have no expected output.
+    tests = []
+    for filename in sorted(os.listdir(testdir)):
+        base, ext = os.path.splitext(filename)
+        if ext == '.sp' and os.path.exists(os.path.join(testdir, base + '.out')):
+            tests += [base]
+
+    outdir = tempfile.mkdtemp()
+    try:
+        failed = False
+        for test in tests:
+            if args.test and test not in args.test:
+                continue
+            if not run_test(args, testdir, outdir, test):
+                failed = True
+    finally:
+        shutil.rmtree(outdir)
+
+    if failed:
+        sys.stderr.write('One or more tests failed!\n')
+        sys.exit(1)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('spcomp', type=str, help='Path to spcomp')
+    parser.add_argument('spshell', type=str, help='Path to spshell')
+    parser.add_argument('test', type=str, nargs='*', help='Only run these tests')
+    args = parser.parse_args()
+    args.arch = shell_arch(args.spshell)
+    run_tests(args)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,1222 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_assembler_x64_h__
+#define _include_sourcepawn_assembler_x64_h__
+
+#include <assembler.h>
+#include <am-vector.h>
+#include <string.h>
+
+struct Register
+{
+  const char *name() const {
+    static const char *names[] = {
+      "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+      "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[code];
+  }
+
+  int code;
+
+  // The three bits encoded in a ModRM or SIB byte. The fourth bit goes in
+  // the REX prefix.
+  uint8_t low3() const {
+    return uint8_t(code & 7);
+  }
+  uint8_t high1() const {
+    return uint8_t(code >> 3);
+  }
+
+  bool operator == (const Register &other) const {
+    return code == other.code;
+  }
+  bool operator != (const Register &other) const {
+    return code != other.code;
+  }
+};
+
+// x64 still has the x87 FPU, and we still use it for a few rounding modes
+// that SSE (without SSE4.1) cannot express.
+struct FpuRegister
+{
+  const char *name() const {
+    static const char *names[] = {
+      "st0", "st1", "st2", "st3", "st4", "st5", "st6", "st7"
+    };
+    return names[code];
+  }
+
+  int code;
+
+  bool operator == (const FpuRegister &other) const {
+    return code == other.code;
+  }
+  bool operator != (const FpuRegister &other) const {
+    return code != other.code;
+  }
+};
+
+struct FloatRegister
+{
+  const char *name() const {
+    static const char *names[] = {
+      "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+      "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+    };
+    return names[code];
+  }
+
+  int code;
+
+  uint8_t low3() const {
+    return uint8_t(code & 7);
+  }
+  uint8_t high1() const {
+    return uint8_t(code >> 3);
+  }
+
+  bool operator == (const FloatRegister &other) const {
+    return code == other.code;
+  }
+  bool operator != (const FloatRegister &other) const {
+    return code != other.code;
+  }
+};
+
+struct CPUFeatures
+{
+  CPUFeatures()
+  {
+    memset(this, 0, sizeof(*this));
+  }
+
+  bool fpu;
+  bool mmx;
+  bool sse;
+  bool sse2;
+  bool sse3;
+  bool ssse3;
+  bool sse4_1;
+  bool sse4_2;
+  bool avx;
+  bool avx2;
+};
+
+const Register rax = { 0 };
+const Register rcx = { 1 };
+const Register rdx = { 2 };
+const Register rbx = { 3 };
+const Register rsp = { 4 };
+const Register rbp = { 5 };
+const Register rsi = { 6 };
+const Register rdi = { 7 };
+const Register r8 = { 8 };
+const Register r9 = { 9 };
+const Register r10 = { 10 };
+const Register r11 = { 11 };
+const Register r12 = { 12 };
+const Register r13 = { 13 };
+const Register r14 = { 14 };
+const Register r15 = { 15 };
+
+// Byte registers. Note that codes 4-7 mean spl/bpl/sil/dil whenever a REX
+// prefix is present, so we never use ah/ch/dh/bh.
+const Register r8_al = { 0 };
+const Register r8_cl = { 1 };
+const Register r8_dl = { 2 };
+const Register r8_bl = { 3 };
+
+const FpuRegister st0 = { 0 };
+const FpuRegister st1 = { 1 };
+const FpuRegister st2 = { 2 };
+const FpuRegister st3 = { 3 };
+const FpuRegister st4 = { 4 };
+const FpuRegister st5 = { 5 };
+const FpuRegister st6 = { 6 };
+const FpuRegister st7 = { 7 };
+
+const FloatRegister xmm0 = { 0 };
+const FloatRegister xmm1 = { 1 };
+const FloatRegister xmm2 = { 2 };
+const FloatRegister xmm3 = { 3 };
+const FloatRegister xmm4 = { 4 };
+const FloatRegister xmm5 = { 5 };
+const FloatRegister xmm6 = { 6 };
+const FloatRegister xmm7 = { 7 };
+
+// Calling convention details for calls into C++. Windows passes the first
+// four arguments in rcx/rdx/r8/r9 and requires the caller to reserve 32
+// bytes of "home" space for them; everyone else uses the System V ABI.
+#if defined(_WIN64)
+const Register ArgReg0 = rcx;
+const Register ArgReg1 = rdx;
+const Register ArgReg2 = r8;
+const Register ArgReg3 = r9;
+static const int32_t kShadowSpace = 32;
+#else
+const Register ArgReg0 = rdi;
+const Register ArgReg1 = rsi;
+const Register ArgReg2 = rdx;
+const Register ArgReg3 = rcx;
+static const int32_t kShadowSpace = 0;
+#endif
+
+// r11 is volatile in both ABIs and is never used to pass arguments, so the
+// assembler reserves it for far calls, far jumps and address loads.
+const Register ScratchReg = r11;
+
+static const uint8_t kModeDisp0 = 0;
+static const uint8_t kModeDisp8 = 1;
+static const uint8_t kModeDisp32 = 2;
+static const uint8_t kModeReg = 3;
+static const uint8_t kNoIndex = 4;
+static const uint8_t kSIB = 4;
+static const uint8_t kRIP = 5;
+
+static const uint8_t kRexW = 0x8;
+static const uint8_t kRexR = 0x4;
+static const uint8_t kRexX = 0x2;
+static const uint8_t kRexB = 0x1;
+
+enum ConditionCode {
+  overflow,
+  no_overflow,
+  below,
+  not_below,
+  equal,
+  not_equal,
+  not_above,
+  above,
+  negative,
+  not_negative,
+  even_parity,
+  odd_parity,
+  less,
+  not_less,
+  not_greater,
+  greater,
+
+  zero = equal,
+  not_zero = not_equal,
+  less_equal = not_greater,
+  below_equal = not_above,
+  greater_equal = not_less,
+  above_equal = not_below,
+  parity = even_parity,
+  not_parity = odd_parity
+};
+
+enum Scale {
+  NoScale,
+  ScaleTwo,
+  ScaleFour,
+  ScaleEight,
+  ScalePointer = ScaleEight
+};
+
+struct Operand
+{
+  friend class AssemblerX64;
+
+ public:
+  Operand(Register reg, int32_t disp) {
+    rex_ = reg.high1() ? kRexB : 0;
+    if (reg.low3() == kSIB) {
+      // rsp and r12 can only be encoded as a base through a SIB byte.
+      if (disp == 0)
+        sib_disp0(NoScale, kNoIndex, reg.low3());
+      else if (disp >= SCHAR_MIN && disp <= SCHAR_MAX)
+        sib_disp8(NoScale, kNoIndex, reg.low3(), disp);
+      else
+        sib_disp32(NoScale, kNoIndex, reg.low3(), disp);
+    } else if (disp == 0 && reg.low3() != kRIP) {
+      // note, [rbp+0] and [r13+0] are rip-relative, so they need a disp8.
+      modrm_disp0(reg.low3());
+    } else if (disp >= SCHAR_MIN && disp <= SCHAR_MAX) {
+      modrm_disp8(reg.low3(), disp);
+    } else {
+      modrm_disp32(reg.low3(), disp);
+    }
+  }
+
+  Operand(Register base, Register index, Scale scale, int32_t disp = 0) {
+    assert(index != rsp);
+    rex_ = (base.high1() ? kRexB : 0) | (index.high1() ? kRexX : 0);
+    if (disp == 0 && base.low3() != kRIP)
+      sib_disp0(scale, index.low3(), base.low3());
+    else if (disp >= SCHAR_MIN && disp <= SCHAR_MAX)
+      sib_disp8(scale, index.low3(), base.low3(), disp);
+    else
+      sib_disp32(scale, index.low3(), base.low3(), disp);
+  }
+
+  bool isRegister() const {
+    return mode() == kModeReg;
+  }
+  bool isRegister(Register r) const {
+    return mode() == kModeReg && rm() == r.low3() && !!(rex_ & kRexB) == !!r.high1();
+  }
+  int registerCode() const {
+    return rm() | ((rex_ & kRexB) ? 8 : 0);
+  }
+
+  uint8_t rex() const {
+    return rex_;
+  }
+  uint8_t getByte(size_t index) const {
+    assert(index < length());
+    return bytes_[index];
+  }
+
+  size_t length() const {
+    size_t sib = (mode() != kModeReg && rm() == kSIB);
+    if (mode() == kModeDisp32)
+      return 5 + sib;
+    if (mode() == kModeDisp8)
+      return 2 + sib;
+    return 1 + sib;
+  }
+
+ private:
+  explicit Operand(Register reg) {
+    rex_ = reg.high1() ? kRexB : 0;
+    modrm(kModeReg, reg.low3());
+  }
+
+  void modrm(uint8_t mode, uint8_t rm) {
+    assert(mode <= 3);
+    assert(rm <= 7);
+    bytes_[0] = (mode << 6) | rm;
+  }
+  void modrm_disp0(uint8_t rm) {
+    modrm(kModeDisp0, rm);
+  }
+  void modrm_disp8(uint8_t rm, int8_t disp) {
+    modrm(kModeDisp8, rm);
+    bytes_[1] = disp;
+  }
+  void modrm_disp32(uint8_t rm, int32_t disp) {
+    modrm(kModeDisp32, rm);
+    memcpy(bytes_ + 1, &disp, sizeof(disp));
+  }
+  void sib(uint8_t mode, Scale scale, uint8_t index, uint8_t base) {
+    modrm(mode, kSIB);
+
+    assert(scale <= 3);
+    assert(index <= 7);
+    assert(base <= 7);
+    bytes_[1] = (uint8_t(scale) << 6) | (index << 3) | base;
+  }
+  void sib_disp0(Scale scale, uint8_t index, uint8_t base) {
+    sib(kModeDisp0, scale, index, base);
+  }
+  void sib_disp8(Scale scale, uint8_t index, uint8_t base, int8_t disp) {
+    sib(kModeDisp8, scale, index, base);
+    bytes_[2] = disp;
+  }
+  void sib_disp32(Scale scale, uint8_t index, uint8_t base, int32_t disp) {
+    sib(kModeDisp32, scale, index, base);
+    memcpy(bytes_ + 2, &disp, sizeof(disp));
+  }
+
+ private:
+  uint8_t rm() const {
+    return bytes_[0] & 7;
+  }
+  uint8_t mode() const {
+    return bytes_[0] >> 6;
+  }
+
+ private:
+  uint8_t rex_;
+  uint8_t bytes_[6];
+};
+
+// Instructions suffixed with "l" operate on 32-bit values (cells), and those
+// suffixed with "q" operate on 64-bit values (pointers). Note that any 32-bit
+// write to a register zero-extends into the upper half, which the JIT relies
+// on when using cell registers as indexes.
+class AssemblerX64 : public Assembler
+{
+ private:
+  // List of processor features; to be used, this must be filled in at
+  // startup.
+  static CPUFeatures X64Features;
+
+ public:
+  static void SetFeatures(const CPUFeatures &features) {
+    X64Features = features;
+  }
+  static const CPUFeatures &Features() {
+    return X64Features;
+  }
+
+  void movl(Register dest, Register src) {
+    emit1(0, 0x89, src.code, dest.code);
+  }
+  void movl(Register dest, const Operand &src) {
+    emit1(0, 0x8b, dest.code, src);
+  }
+  void movl(const Operand &dest, Register src) {
+    emit1(0, 0x89, src.code, dest);
+  }
+  void movl(Register dest, int32_t imm) {
+    ensureSpace();
+    rex(0, 0, dest.code);
+    *pos_++ = 0xb8 + dest.low3();
+    writeInt32(imm);
+  }
+  void movl(const Operand &dest, int32_t imm) {
+    if (dest.isRegister()) {
+      movl(Register { dest.registerCode() }, imm);
+      return;
+    }
+    emit1(0, 0xc7, 0, dest);
+    writeInt32(imm);
+  }
+  void movq(Register dest, Register src) {
+    emit1(kRexW, 0x89, src.code, dest.code);
+  }
+  void movq(Register dest, const Operand &src) {
+    emit1(kRexW, 0x8b, dest.code, src);
+  }
+  void movq(const Operand &dest, Register src) {
+    emit1(kRexW, 0x89, src.code, dest);
+  }
+  void movq(const Operand &dest, int32_t imm) {
+    emit1(kRexW, 0xc7, 0, dest);
+    writeInt32(imm);
+  }
+
+  // Load an arbitrary 64-bit constant, using the shortest encoding.
+  void movq(Register dest, intptr_t imm) {
+    if (imm >= 0 && imm <= intptr_t(UINT_MAX)) {
+      movl(dest, int32_t(uint32_t(imm)));
+    } else if (imm >= INT_MIN && imm <= INT_MAX) {
+      emit1(kRexW, 0xc7, 0, dest.code);
+      writeInt32(int32_t(imm));
+    } else {
+      movabsq(dest, imm);
+    }
+  }
+
+  // Always emits the full 10-byte form, so the immediate can be patched.
+  void movabsq(Register dest, intptr_t imm) {
+    ensureSpace();
+    rex(kRexW, 0, dest.code);
+    *pos_++ = 0xb8 + dest.low3();
+    write<int64_t>(imm);
+  }
+
+  // Load an external address. This always uses the 10-byte form, and is
+  // noted in externalRefs().
+  void movq(Register dest, ExternalAddress address) {
+    movabsq(dest, intptr_t(address.value()));
+    ExternalRef ref;
+    ref.offset = pc();
+    ref.reloc = address.reloc();
+    if (!external_refs_.append(ref))
+      outOfMemory_ = true;
+  }
+
+  // Load the absolute address of a label in this code stream. This is
+  // relocated by emitToExecutableMemory(). While assembling, the first four
+  // bytes of the immediate are a normal rel32 label link.
+  void movabsq(Register dest, Label *target) {
+    ensureSpace();
+    rex(kRexW, 0, dest.code);
+    *pos_++ = 0xb8 + dest.low3();
+    emitJumpTarget(target);
+    writeInt32(0);
+    if (!local_refs_.append(pc()))
+      outOfMemory_ = true;
+  }
+
+  void movw(const Operand &dest, Register src) {
+    ensureSpace();
+    *pos_++ = 0x66;
+    emit1(0, 0x89, src.code, dest);
+  }
+  void movw(Register dest, const Operand &src) {
+    ensureSpace();
+    *pos_++ = 0x66;
+    emit1(0, 0x8b, dest.code, src);
+  }
+  void movb(const Operand &dest, Register src) {
+    assert(src.code < 4);
+    emit1(0, 0x88, src.code, dest);
+  }
+  void movb(Register dest, const Operand &src) {
+    assert(dest.code < 4);
+    emit1(0, 0x8a, dest.code, src);
+  }
+  void movzxb(Register dest, const Operand &src) {
+    emit2(0, 0x0f, 0xb6, dest.code, src);
+  }
+  void movzxb(Register dest, const Register src) {
+    assert(src.code < 4);
+    emit2(0, 0x0f, 0xb6, dest.code, src.code);
+  }
+  void movzxw(Register dest, const Operand &src) {
+    emit2(0, 0x0f, 0xb7, dest.code, src);
+  }
+  void movzxw(Register dest, const Register src) {
+    emit2(0, 0x0f, 0xb7, dest.code, src.code);
+  }
+
+  // Sign-extend a 32-bit value into a 64-bit register (movsxd).
+  void movslq(Register dest, const Operand &src) {
+    emit1(kRexW, 0x63, dest.code, src);
+  }
+  void movslq(Register dest, Register src) {
+    emit1(kRexW, 0x63, dest.code, src.code);
+  }
+
+  void lea(Register dest, const Operand &src) {
+    emit1(0, 0x8d, dest.code, src);
+  }
+  void leaq(Register dest, const Operand &src) {
+    emit1(kRexW, 0x8d, dest.code, src);
+  }
+
+  // Load the address of a label with a rip-relative lea. The disp32 is the
+  // last field of the instruction, so it can be linked like a jump.
+  void leaq(Register dest, Label *target) {
+    ensureSpace();
+    rex(kRexW, dest.code, 0);
+    *pos_++ = 0x8d;
+    *pos_++ = (kModeDisp0 << 6) | (dest.low3() << 3) | kRIP;
+    emitJumpTarget(target);
+  }
+
+  void xchgl(Register dest, Register src) {
+    if (src == rax && dest != rax) {
+      ensureSpace();
+      rex(0, 0, dest.code);
+      *pos_++ = 0x90 + dest.low3();
+    } else if (dest == rax && src != rax) {
+      ensureSpace();
+      rex(0, 0, src.code);
+      *pos_++ = 0x90 + src.low3();
+    } else {
+      emit1(0, 0x87, src.code, dest.code);
+    }
+  }
+
+  void shll_cl(Register dest) {
+    shift_cl(dest, 4);
+  }
+  void shll(Register dest, uint8_t imm) {
+    shift_imm(Operand(dest), 4, imm);
+  }
+  void shll(const Operand &dest, uint8_t imm) {
+    shift_imm(dest, 4, imm);
+  }
+  void shrl_cl(Register dest) {
+    shift_cl(dest, 5);
+  }
+  void shrl(Register dest, uint8_t imm) {
+    shift_imm(Operand(dest), 5, imm);
+  }
+  void shrl(const Operand &dest, uint8_t imm) {
+    shift_imm(dest, 5, imm);
+  }
+  void sarl_cl(Register dest) {
+    shift_cl(dest, 7);
+  }
+  void sarl(Register dest, uint8_t imm) {
+    shift_imm(Operand(dest), 7, imm);
+  }
+  void sarl(const Operand &dest, uint8_t imm) {
+    shift_imm(dest, 7, imm);
+  }
+
+  void cmpl(Register left, int32_t imm) {
+    alu_imm(0, 7, imm, Operand(left));
+  }
+  void cmpl(const Operand &left, int32_t imm) {
+    alu_imm(0, 7, imm, left);
+  }
+  void cmpl(Register left, Register right) {
+    emit1(0, 0x39, right.code, left.code);
+  }
+  void cmpl(const Operand &left, Register right) {
+    emit1(0, 0x39, right.code, left);
+  }
+  void cmpl(Register left, const Operand &right) {
+    emit1(0, 0x3b, left.code, right);
+  }
+  void cmpq(Register left, int32_t imm) {
+    alu_imm(kRexW, 7, imm, Operand(left));
+  }
+  void cmpq(Register left, Register right) {
+    emit1(kRexW, 0x39, right.code, left.code);
+  }
+  void cmpq(Register left, const Operand &right) {
+    emit1(kRexW, 0x3b, left.code, right);
+  }
+  void andl(Register dest, int32_t imm) {
+    alu_imm(0, 4, imm, Operand(dest));
+  }
+  void andl(const Operand &dest, int32_t imm) {
+    alu_imm(0, 4, imm, dest);
+  }
+  void andl(Register dest, Register src) {
+    emit1(0, 0x21, src.code, dest.code);
+  }
+  void andl(const Operand &dest, Register src) {
+    emit1(0, 0x21, src.code, dest);
+  }
+  void andl(Register dest, const Operand &src) {
+    emit1(0, 0x23, dest.code, src);
+  }
+  void andq(Register dest, int32_t imm) {
+    alu_imm(kRexW, 4, imm, Operand(dest));
+  }
+  void orl(Register dest, Register src) {
+    emit1(0, 0x09, src.code, dest.code);
+  }
+  void orl(const Operand &dest, Register src) {
+    emit1(0, 0x09, src.code, dest);
+  }
+  void orl(Register dest, const Operand &src) {
+    emit1(0, 0x0b, dest.code, src);
+  }
+  void xorl(Register dest, Register src) {
+    emit1(0, 0x31, src.code, dest.code);
+  }
+  void xorl(const Operand &dest, Register src) {
+    emit1(0, 0x31, src.code, dest);
+  }
+  void xorl(Register dest, const Operand &src) {
+    emit1(0, 0x33, dest.code, src);
+  }
+
+  void subl(Register dest, Register src) {
+    emit1(0, 0x29, src.code, dest.code);
+  }
+  void subl(const Operand &dest, Register src) {
+    emit1(0, 0x29, src.code, dest);
+  }
+  void subl(Register dest, const Operand &src) {
+    emit1(0, 0x2b, dest.code, src);
+  }
+  void subl(Register dest, int32_t imm) {
+    alu_imm(0, 5, imm, Operand(dest));
+  }
+  void subl(const Operand &dest, int32_t imm) {
+    alu_imm(0, 5, imm, dest);
+  }
+  void subq(Register dest, Register src) {
+    emit1(kRexW, 0x29, src.code, dest.code);
+  }
+  void subq(Register dest, int32_t imm) {
+    alu_imm(kRexW, 5, imm, Operand(dest));
+  }
+  void addl(Register dest, Register src) {
+    emit1(0, 0x01, src.code, dest.code);
+  }
+  void addl(const Operand &dest, Register src) {
+    emit1(0, 0x01, src.code, dest);
+  }
+  void addl(Register dest, const Operand &src) {
+    emit1(0, 0x03, dest.code, src);
+  }
+  void addl(Register dest, int32_t imm) {
+    alu_imm(0, 0, imm, Operand(dest));
+  }
+  void addl(const Operand &dest, int32_t imm) {
+    alu_imm(0, 0, imm, dest);
+  }
+  void addq(Register dest, Register src) {
+    emit1(kRexW, 0x01, src.code, dest.code);
+  }
+  void addq(Register dest, int32_t imm) {
+    alu_imm(kRexW, 0, imm, Operand(dest));
+  }
+
+  void imull(Register dest, const Operand &src) {
+    emit2(0, 0x0f, 0xaf, dest.code, src);
+  }
+  void imull(Register dest, Register src) {
+    emit2(0, 0x0f, 0xaf, dest.code, src.code);
+  }
+  void imull(Register dest, const Operand &src, int32_t imm) {
+    if (imm >= SCHAR_MIN && imm <= SCHAR_MAX) {
+      emit1(0, 0x6b, dest.code, src);
+      *pos_++ = imm;
+    } else {
+      emit1(0, 0x69, dest.code, src);
+      writeInt32(imm);
+    }
+  }
+  void imull(Register dest, Register src, int32_t imm) {
+    imull(dest, Operand(src), imm);
+  }
+
+  void testl(const Operand &op1, Register op2) {
+    emit1(0, 0x85, op2.code, op1);
+  }
+  void testl(Register op1, Register op2) {
+    emit1(0, 0x85, op2.code, op1.code);
+  }
+  void testq(Register op1, Register op2) {
+    emit1(kRexW, 0x85, op2.code, op1.code);
+  }
+  void set(ConditionCode cc, const Operand &dest) {
+    emit2(0, 0x0f, 0x90 + uint8_t(cc), 0, dest);
+  }
+  void set(ConditionCode cc, Register dest) {
+    assert(dest.code < 4);
+    emit2(0, 0x0f, 0x90 + uint8_t(cc), 0, dest.code);
+  }
+  void negl(Register srcdest) {
+    emit1(0, 0xf7, 3, srcdest.code);
+  }
+  void negl(const Operand &srcdest) {
+    emit1(0, 0xf7, 3, srcdest);
+  }
+  void notl(Register srcdest) {
+    emit1(0, 0xf7, 2, srcdest.code);
+  }
+  void notl(const Operand &srcdest) {
+    emit1(0, 0xf7, 2, srcdest);
+  }
+  void idivl(Register dividend) {
+    emit1(0, 0xf7, 7, dividend.code);
+  }
+  void idivl(const Operand &dividend) {
+    emit1(0, 0xf7, 7, dividend);
+  }
+
+  void ret() {
+    emit1(0xc3);
+  }
+  void cld() {
+    emit1(0xfc);
+  }
+  void push(Register reg) {
+    ensureSpace();
+    rex(0, 0, reg.code);
+    *pos_++ = 0x50 + reg.low3();
+  }
+  void push(const Operand &src) {
+    if (src.isRegister())
+      push(Register { src.registerCode() });
+    else
+      emit1(0, 0xff, 6, src);
+  }
+  // Note: the immediate is sign-extended to 64 bits.
+  void push(int32_t imm) {
+    emit1(0x68);
+    writeInt32(imm);
+  }
+  void pop(Register reg) {
+    ensureSpace();
+    rex(0, 0, reg.code);
+    *pos_++ = 0x58 + reg.low3();
+  }
+  void pop(const Operand &src) {
+    if (src.isRegister())
+      pop(Register { src.registerCode() });
+    else
+      emit1(0, 0x8f, 0, src);
+  }
+
+  void rep_movsb() {
+    emit2(0xf3, 0xa4);
+  }
+  void rep_movsd() {
+    emit2(0xf3, 0xa5);
+  }
+  void rep_stosd() {
+    emit2(0xf3, 0xab);
+  }
+  void rep_stosq() {
+    ensureSpace();
+    *pos_++ = 0xf3;
+    *pos_++ = 0x48;
+    *pos_++ = 0xab;
+  }
+  void breakpoint() {
+    emit1(0xcc);
+  }
+
+  void leave() {
+    emit1(0xc9);
+  }
+
+  void fld32(const Operand &src) {
+    emit1(0, 0xd9, 0, src);
+  }
+  void fild32(const Operand &src) {
+    emit1(0, 0xdb, 0, src);
+  }
+  void fistp32(const Operand &dest) {
+    emit1(0, 0xdb, 3, dest);
+  }
+  void fadd32(const Operand &src) {
+    emit1(0, 0xd8, 0, src);
+  }
+  void fsub32(const Operand &src) {
+    emit1(0, 0xd8, 4, src);
+  }
+  void fmul32(const Operand &src) {
+    emit1(0, 0xd8, 1, src);
+  }
+  void fdiv32(const Operand &src) {
+    emit1(0, 0xd8, 6, src);
+  }
+  void fstp32(const Operand &dest) {
+    emit1(0, 0xd9, 3, dest);
+  }
+  void fstp(FpuRegister src) {
+    emit2(0xdd, 0xd8 + src.code);
+  }
+  void fldcw(const Operand &src) {
+    emit1(0, 0xd9, 5, src);
+  }
+  void fstcw(const Operand &dest) {
+    ensureSpace();
+    *pos_++ = 0x9b;
+    emit1(0, 0xd9, 7, dest);
+  }
+  void fsubr32(const Operand &src) {
+    emit1(0, 0xd8, 5, src);
+  }
+  void fldz() {
+    emit2(0xd9, 0xee);
+  }
+
+  // Compare st0 with stN.
+  void fucomip(FpuRegister other) {
+    emit2(0xdf, 0xe8 + other.code);
+  }
+
+  // At least one argument of these forms must be st0.
+  void fadd32(FpuRegister dest, FpuRegister src) {
+    assert(dest == st0 || src == st0);
+    if (dest == st0)
+      emit2(0xd8, 0xc0 + src.code);
+    else
+      emit2(0xdc, 0xc0 + dest.code);
+  }
+
+  void jmp32(Label *dest) {
+    emit1(0xe9);
+    emitJumpTarget(dest);
+  }
+  void jmp(Label *dest) {
+    int8_t d8;
+    if (canEmitSmallJump(dest, &d8)) {
+      emit2(0xeb, d8);
+    } else {
+      emit1(0xe9);
+      emitJumpTarget(dest);
+    }
+  }
+  void jmp(Register target) {
+    emit1(0, 0xff, 4, target.code);
+  }
+  void jmp(const Operand &target) {
+    emit1(0, 0xff, 4, target);
+  }
+  void j32(ConditionCode cc, Label *dest) {
+    emit2(0x0f, 0x80 + uint8_t(cc));
+    emitJumpTarget(dest);
+  }
+  void j(ConditionCode cc, Label *dest) {
+    int8_t d8;
+    if (canEmitSmallJump(dest, &d8)) {
+      emit2(0x70 + uint8_t(cc), d8);
+    } else {
+      emit2(0x0f, 0x80 + uint8_t(cc));
+      emitJumpTarget(dest);
+    }
+  }
+  void call(Label *dest) {
+    emit1(0xe8);
+    emitJumpTarget(dest);
+  }
+  void bind(Label *target) {
+    if (outOfMemory()) {
+      // If we ran out of memory, the code stream is potentially invalid and
+      // we cannot use the embedded linked list.
+      target->bind(pc());
+      return;
+    }
+
+    assert(!target->bound());
+    uint32_t status = target->status();
+    while (Label::More(status)) {
+      // Grab the offset. It should be at least a 1byte op + rel32.
+      uint32_t offset = Label::ToOffset(status);
+      assert(offset >= 5);
+
+      // Grab the delta from target to pc.
+      ptrdiff_t delta = pos_ - (buffer() + offset);
+      assert(delta >= INT_MIN && delta <= INT_MAX);
+
+      int32_t *p = reinterpret_cast<int32_t *>(buffer() + offset - 4);
+      status = *p;
+      *p = delta;
+    }
+    target->bind(pc());
+  }
+
+  // Emit a 32-bit entry for a jump table. The entry holds the distance from
+  // the end of the entry to the target label.
+  void emit_relative_address(Label *address) {
+    ensureSpace();
+    emitJumpTarget(address);
+  }
+
+  void call(Register target) {
+    emit1(0, 0xff, 2, target.code);
+  }
+  void call(const Operand &target) {
+    emit1(0, 0xff, 2, target);
+  }
+
+  // There is no guarantee that generated code lives within 2GB of the
+  // target, so external calls and jumps always go through ScratchReg.
+  // Calls have a fixed layout so their targets can be patched later; see
+  // PatchCallTarget().
+  void call(ExternalAddress address) {
+    movq(ScratchReg, address);
+    call(ScratchReg);
+  }
+  void callAbsolute(Label *target) {
+    movabsq(ScratchReg, target);
+    call(ScratchReg);
+  }
+  void jmp(ExternalAddress address) {
+    movq(ScratchReg, address);
+    jmp(ScratchReg);
+  }
+
+  void cpuid() {
+    emit2(0x0f, 0xa2);
+  }
+
+  // SSE and SSE2 are part of the x86-64 baseline, so unlike the x86
+  // assembler these are always available.
+  void movss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x10, dest.code, src);
+  }
+  void movss(const Operand &dest, FloatRegister src) {
+    emit3(0xf3, 0, 0x0f, 0x11, src.code, dest);
+  }
+  void cvttss2si(Register dest, Register src) {
+    emit3(0xf3, 0, 0x0f, 0x2c, dest.code, src.code);
+  }
+  void cvttss2si(Register dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x2c, dest.code, src);
+  }
+  void cvtss2si(Register dest, Register src) {
+    emit3(0xf3, 0, 0x0f, 0x2d, dest.code, src.code);
+  }
+  void cvtss2si(Register dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x2d, dest.code, src);
+  }
+  void cvtsi2ss(FloatRegister dest, Register src) {
+    emit3(0xf3, 0, 0x0f, 0x2a, dest.code, src.code);
+  }
+  void cvtsi2ss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x2a, dest.code, src);
+  }
+  void addss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x58, dest.code, src);
+  }
+  void addss(FloatRegister dest, FloatRegister src) {
+    emit3(0xf3, 0, 0x0f, 0x58, dest.code, src.code);
+  }
+  void subss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x5c, dest.code, src);
+  }
+  void mulss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x59, dest.code, src);
+  }
+  void sqrtss(FloatRegister dest, FloatRegister src) {
+    emit3(0xf3, 0, 0x0f, 0x51, dest.code, src.code);
+  }
+  void divss(FloatRegister dest, const Operand &src) {
+    emit3(0xf3, 0, 0x0f, 0x5e, dest.code, src);
+  }
+  void xorps(FloatRegister dest, FloatRegister src) {
+    emit2(0, 0x0f, 0x57, dest.code, src.code);
+  }
+  void ucomiss(FloatRegister left, FloatRegister right) {
+    emit2(0, 0x0f, 0x2e, left.code, right.code);
+  }
+  void ucomiss(const Operand &left, FloatRegister right) {
+    emit2(0, 0x0f, 0x2e, right.code, left);
+  }
+  void movd(Register dest, FloatRegister src) {
+    emit3(0x66, 0, 0x0f, 0x7e, src.code, dest.code);
+  }
+  void movd(FloatRegister dest, const Operand &src) {
+    emit3(0x66, 0, 0x0f, 0x6e, dest.code, src);
+  }
+
+  // Retarget a call emitted by call(ExternalAddress) or callAbsolute(),
+  // given its return address. The layout is:
+  //   mov r11, imm64   (10 bytes)
+  //   call r11         (3 bytes)
+  static const size_t kCallTargetOffset = 3 + sizeof(intptr_t);
+
+  static void PatchCallTarget(uint8_t *return_address, void *target) {
+    memcpy(return_address - kCallTargetOffset, &target, sizeof(target));
+  }
+
+  void emitToExecutableMemory(void *code) {
+    assert(!outOfMemory());
+
+    uint8_t *base = reinterpret_cast<uint8_t *>(code);
+    memcpy(base, buffer(), length());
+    RelocateLocalRefs(base, local_refs_.buffer(), local_refs_.length());
+  }
+
+  // Relocate everything emitted as an abs64 with an internal offset, once
+  // the code has been copied to |base|. While assembling, the low half holds
+  // a rel32 from its own end (so the Label machinery can link it) and the
+  // high half is zero.
+  static void RelocateLocalRefs(uint8_t *base, const uint32_t *refs, size_t nrefs) {
+    for (size_t i = 0; i < nrefs; i++) {
+      uint8_t *field = base + refs[i] - sizeof(intptr_t);
+      int32_t delta;
+      memcpy(&delta, field, sizeof(delta));
+      uint8_t *address = field + sizeof(int32_t) + delta;
+      memcpy(field, &address, sizeof(address));
+    }
+  }
+
+  // Patch an address noted in externalRefs(), once the code has been copied
+  // to |base|.
+  static void PatchExternalRef(uint8_t *base, const ExternalRef &ref, void *address) {
+    memcpy(base + ref.offset - sizeof(intptr_t), &address, sizeof(address));
+  }
+
+  // The code as assembled, before emitToExecutableMemory() relocates it.
+  const uint8_t *assembledCode() const {
+    return buffer();
+  }
+  const ke::Vector<uint32_t> &localRefs() const {
+    return local_refs_;
+  }
+  const ke::Vector<ExternalRef> &externalRefs() const {
+    return external_refs_;
+  }
+
+  void align(uint32_t bytes) {
+    int32_t delta = (pc() & ~(bytes - 1)) + bytes - pc();
+    for (int32_t i = 0; i < delta; i++)
+      emit1(0xcc);
+  }
+
+  static void GenerateFeatureDetection(AssemblerX64 &masm) {
+    masm.push(rbp);
+    masm.movq(rbp, rsp);
+    masm.push(rbx);
+
+    // cpuid clobbers eax, ebx, ecx, and edx, which overlap with argument
+    // registers in both ABIs.
+    masm.movq(r8, ArgReg2);
+    masm.movq(r10, ArgReg1);
+    masm.movq(r9, ArgReg0);
+    {
+      // Get ECX, EDX feature bits at the first CPUID level.
+      masm.movl(rax, 1);
+      masm.cpuid();
+      masm.movl(Operand(r9, 0), rcx);
+      masm.movl(Operand(r10, 0), rdx);
+    }
+
+    // Zero out bits we're not guaranteed to get.
+    masm.movl(Operand(r8, 0), 0);
+
+    Label skip_level_7;
+    {
+      // Get EBX feature bits at 7th CPUID level.
+      masm.movl(rax, 0);
+      masm.cpuid();
+      masm.cmpl(rax, 7);
+      masm.j(below, &skip_level_7);
+      masm.movl(rax, 7);
+      masm.movl(rcx, 0);
+      masm.cpuid();
+      masm.movl(Operand(r8, 0), rbx);
+    }
+    masm.bind(&skip_level_7);
+
+    masm.pop(rbx);
+    masm.pop(rbp);
+    masm.ret();
+  }
+
+  static void RunFeatureDetection(void *code) {
+    typedef void (*fn_t)(int *reg_ecx, int *reg_edx, int *reg_ebx);
+
+    int reg_ecx, reg_edx, reg_ebx;
+    ((fn_t)code)(&reg_ecx, &reg_edx, &reg_ebx);
+
+    CPUFeatures features;
+    features.fpu = !!(reg_edx & (1 << 0));
+    features.mmx = !!(reg_edx & (1 << 23));
+    features.sse = !!(reg_edx & (1 << 25));
+    features.sse2 = !!(reg_edx & (1 << 26));
+    features.sse3 = !!(reg_ecx & (1 << 0));
+    features.ssse3 = !!(reg_ecx & (1 << 9));
+    features.sse4_1 = !!(reg_ecx & (1 << 19));
+    features.sse4_2 = !!(reg_ecx & (1 << 20));
+    features.avx = !!(reg_ecx & (1 << 28));
+    features.avx2 = !!(reg_ebx & (1 << 5));
+    SetFeatures(features);
+  }
+
+ private:
+  bool canEmitSmallJump(Label *dest, int8_t *deltap) {
+    if (!dest->bound())
+      return false;
+
+    // All small jumps are assumed to be 2 bytes.
+    ptrdiff_t delta = ptrdiff_t(dest->offset()) - (position() + 2);
+    if (delta < SCHAR_MIN || delta > SCHAR_MAX)
+      return false;
+    *deltap = delta;
+    return true;
+  }
+  void emitJumpTarget(Label *dest) {
+    if (dest->bound()) {
+      ptrdiff_t delta = ptrdiff_t(dest->offset()) - (position() + 4);
+      assert(delta >= INT_MIN && delta <= INT_MAX);
+      writeInt32(delta);
+    } else {
+      writeUint32(dest->addPending(position() + 4));
+    }
+  }
+
+  // Emit a REX prefix if any of its bits are needed.
+  void rex(uint8_t w, uint8_t reg, uint8_t rm) {
+    uint8_t bits = w | ((reg >> 3) ? kRexR : 0) | ((rm >> 3) ? kRexB : 0);
+    if (bits)
+      *pos_++ = 0x40 | bits;
+  }
+  void rex(uint8_t w, uint8_t reg, const Operand &operand) {
+    uint8_t bits = w | ((reg >> 3) ? kRexR : 0) | operand.rex();
+    if (bits)
+      *pos_++ = 0x40 | bits;
+  }
+
+  void emit(uint8_t reg, const Operand &operand) {
+    *pos_++ = operand.getByte(0) | ((reg & 7) << 3);
+    size_t length = operand.length();
+    for (size_t i = 1; i < length; i++)
+      *pos_++ = operand.getByte(i);
+  }
+  void emitModRM(uint8_t reg, uint8_t opreg) {
+    *pos_++ = (kModeReg << 6) | ((reg & 7) << 3) | (opreg & 7);
+  }
+
+  void emit1(uint8_t opcode) {
+    ensureSpace();
+    *pos_++ = opcode;
+  }
+  void emit1(uint8_t w, uint8_t opcode, uint8_t reg, uint8_t opreg) {
+    ensureSpace();
+    assert(reg <= 15);
+    assert(opreg <= 15);
+    rex(w, reg, opreg);
+    *pos_++ = opcode;
+    emitModRM(reg, opreg);
+  }
+  void emit1(uint8_t w, uint8_t opcode, uint8_t reg, const Operand &operand) {
+    ensureSpace();
+    assert(reg <= 15);
+    rex(w, reg, operand);
+    *pos_++ = opcode;
+    emit(reg, operand);
+  }
+
+  void emit2(uint8_t prefix, uint8_t opcode) {
+    ensureSpace();
+    *pos_++ = prefix;
+    *pos_++ = opcode;
+  }
+  void emit2(uint8_t w, uint8_t prefix, uint8_t opcode, uint8_t reg, uint8_t opreg) {
+    ensureSpace();
+    rex(w, reg, opreg);
+    *pos_++ = prefix;
+    *pos_++ = opcode;
+    emitModRM(reg, opreg);
+  }
+  void emit2(uint8_t w, uint8_t prefix, uint8_t opcode, uint8_t reg, const Operand &operand) {
+    ensureSpace();
+    rex(w, reg, operand);
+    *pos_++ = prefix;
+    *pos_++ = opcode;
+    emit(reg, operand);
+  }
+
+  // Mandatory prefixes (66, F2, F3) must come before REX.
+  void emit3(uint8_t prefix1, uint8_t w, uint8_t prefix2, uint8_t opcode, uint8_t reg, uint8_t opreg) {
+    ensureSpace();
+    *pos_++ = prefix1;
+    rex(w, reg, opreg);
+    *pos_++ = prefix2;
+    *pos_++ = opcode;
+    emitModRM(reg, opreg);
+  }
+  void emit3(uint8_t prefix1, uint8_t w, uint8_t prefix2, uint8_t opcode, uint8_t reg, const Operand &operand) {
+    ensureSpace();
+    *pos_++ = prefix1;
+    rex(w, reg, operand);
+    *pos_++ = prefix2;
+    *pos_++ = opcode;
+    emit(reg, operand);
+  }
+
+  void shift_cl(Register reg, uint8_t r) {
+    emit1(0, 0xd3, r, reg.code);
+  }
+  void shift_imm(const Operand &operand, uint8_t r, int32_t imm) {
+    if (imm == 1) {
+      emit1(0, 0xd1, r, operand);
+    } else {
+      emit1(0, 0xc1, r, operand);
+      *pos_++ = imm & 0x1F;
+    }
+  }
+  void alu_imm(uint8_t w, uint8_t r, int32_t imm, const Operand &operand) {
+    if (imm >= SCHAR_MIN && imm <= SCHAR_MAX) {
+      emit1(w, 0x83, r, operand);
+      *pos_++ = uint8_t(imm & 0xff);
+    } else if (operand.isRegister(rax)) {
+      ensureSpace();
+      if (w)
+        *pos_++ = 0x40 | w;
+      *pos_++ = 0x05 | (r << 3);
+      writeInt32(imm);
+    } else {
+      emit1(w, 0x81, r, operand);
+      writeInt32(imm);
+    }
+  }
+
+ private:
+  ke::Vector<uint32_t> local_refs_;
+  ke::Vector<ExternalRef> external_refs_;
+};
+
+#endif // _include_sourcepawn_assembler_x64_h__
@@ -0,0 +1,157 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+// 
+// Copyright (C) 2006-2015 AlliedModders LLC
+// 
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <sp_vm_api.h>
+#include "code-stubs.h"
+#include "x64-utils.h"
+#include "jit_x64.h"
+#include "environment.h"
+
+using namespace sp;
+using namespace SourcePawn;
+
+#define __ masm.
+
+bool
+CodeStubs::InitializeFeatureDetection()
+{
+  MacroAssemblerX64 masm;
+  MacroAssemblerX64::GenerateFeatureDetection(masm);
+  CodeChunk code = LinkCode(env_, masm);
+  if (!code.address())
+    return false;
+  MacroAssemblerX64::RunFeatureDetection(code.address());
+  return true;
+}
+
+static const int32_t kFpOffsetToSavedRegs = -2 * 8 - 6 * 8;
+static const int32_t kRvalOffset = kFpOffsetToSavedRegs - 8;
+
+// The invoke stub and entry trampolines share one frame layout, since the
+// return stub unwinds through it when a plugin throws.
+static void
+GenerateEntryPrologue(MacroAssemblerX64 &masm)
+{
+  __ enterFrame(FrameType::Entry, 0);
+
+  // Save everything the JIT uses that is non-volatile in either ABI. rsi and
+  // rdi are only non-volatile on Windows, but saving them keeps the frame
+  // layout identical everywhere.
+  __ push(rbx);
+  __ push(r12);
+  __ push(r14);
+  __ push(r15);
+  __ push(rsi);
+  __ push(rdi);
+
+  // Save rval, then pad so the stack is 16-byte aligned at the call.
+  __ push(ArgReg2);
+  __ subq(rsp, 8);
+
+  // r12 = cx
+  __ movq(cxt, ArgReg0);
+
+  // Set up run-time registers.
+  __ movq(dat, Operand(cxt, PluginContext::offsetOfMemory()));
+  __ movl(stk, Operand(cxt, PluginContext::offsetOfSp()));
+  __ addq(stk, dat);
+}
+
+static void
+GenerateEntryEpilogue(MacroAssemblerX64 &masm, Label *ret)
+{
+  // Store the rval.
+  __ movq(rcx, Operand(rbp, kRvalOffset));
+  __ movl(Operand(rcx, 0), pri);
+
+  // Store latest stk. If we have an error code, we'll jump directly to here,
+  // so eax will already be set.
+  __ bind(ret);
+  __ subq(stk, dat);
+  __ movl(Operand(cxt, PluginContext::offsetOfSp()), stk);
+
+  // Restore stack.
+  __ leaq(rsp, Operand(rbp, kFpOffsetToSavedRegs));
+
+  // Restore registers and gtfo.
+  __ pop(rdi);
+  __ pop(rsi);
+  __ pop(r15);
+  __ pop(r14);
+  __ pop(r12);
+  __ pop(rbx);
+  __ leaveFrame();
+  __ ret();
+}
+
+bool
+CodeStubs::CompileInvokeStub()
+{
+  MacroAssemblerX64 masm;
+  GenerateEntryPrologue(masm);
+  __ movq(frm, stk);
+
+  // Call into plugin.
+  __ call(ArgReg1);
+
+  Label ret;
+  GenerateEntryEpilogue(masm, &ret);
+
+  // The universal emergency return will jump to here.
+  Label error;
+  __ bind(&error);
+  __ jmp(&ret);
+
+  invoke_stub_ = LinkCode(env_, masm);
+  if (!invoke_stub_.address())
+    return false;
+
+  return_stub_ = reinterpret_cast<uint8_t *>(invoke_stub_.address()) + error.offset();
+  return true;
+}
+
+CodeChunk
+CodeStubs::CompileEntryTrampoline(void *code, unsigned int argc)
+{
+  MacroAssemblerX64 masm;
+  GenerateEntryPrologue(masm);
+
+  // Push argc and the parameters, copying straight from the caller's array.
+  // The caller has already checked that they fit.
+  __ subq(stk, int32_t((argc + 1) * sizeof(cell_t)));
+  __ movl(Operand(stk, 0), int32_t(argc));
+  for (unsigned int i = 0; i < argc; i++) {
+    __ movl(rax, Operand(ArgReg1, i * sizeof(cell_t)));
+    __ movl(Operand(stk, (i + 1) * sizeof(cell_t)), rax);
+  }
+  __ movq(frm, stk);
+
+  __ call(ExternalAddress(code));
+
+  Label ret;
+  GenerateEntryEpilogue(masm, &ret);
+
+  return LinkCode(env_, masm);
+}
+
+SPVM_NATIVE_FUNC
+CodeStubs::CreateFakeNativeStub(SPVM_FAKENATIVE_FUNC callback, void *pData)
+{
+  AssemblerX64 masm;
+
+  // The context and params are already in place, so we only need to add
+  // pData as the third argument and tail-call the callback.
+  __ movq(ArgReg2, intptr_t(pData));
+  __ jmp(ExternalAddress((void *)callback));
+
+  return (SPVM_NATIVE_FUNC)LinkCodeToLegacyPtr(env_, masm);
+}
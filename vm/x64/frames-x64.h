@@ -0,0 +1,51 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_jit_frames_x64_h_
+#define _include_sourcepawn_jit_frames_x64_h_
+
+#include <sp_vm_types.h>
+
+namespace sp {
+
+using namespace SourcePawn;
+
+class PluginContext;
+
+// We create x64 stack frames like:
+//   [return address]
+//   [prev_rbp]
+//       ^--- rbp is captured here.
+//   [frame_type]
+//   [function_id]
+//
+// This is the same layout as x86, except every slot is 8 bytes. Since the
+// frame is exactly four slots, rsp stays 16-byte aligned within a frame as
+// long as it was aligned at the call.
+struct FrameLayout
+{
+  intptr_t function_id;
+  intptr_t frame_type;
+  intptr_t* prev_fp;
+  void* return_address;
+
+  // This is -offsetof(FrameLayout, prev_rbp).
+  static const intptr_t kOffsetFromFp = -2;
+
+  static inline FrameLayout* FromFp(intptr_t *fp) {
+    return reinterpret_cast<FrameLayout*>(fp + kOffsetFromFp);
+  }
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_jit_frames_x64_h_
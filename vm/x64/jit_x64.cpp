@@ -0,0 +1,2600 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "jit_x64.h"
+#include "plugin-runtime.h"
+#include "plugin-context.h"
+#include "watchdog_timer.h"
+#include "environment.h"
+#include "code-stubs.h"
+#include "code-cache.h"
+#include "x64-utils.h"
+#include "frames-x64.h"
+
+using namespace sp;
+
+#if defined USE_UNGEN_OPCODES
+#include "ungen_opcodes.h"
+#endif
+
+#define __ masm.
+
+static inline ConditionCode
+OpToCondition(OPCODE op)
+{
+  switch (op) {
+   case OP_EQ:
+   case OP_JEQ:
+    return equal;
+   case OP_NEQ:
+   case OP_JNEQ:
+    return not_equal;
+   case OP_SLESS:
+   case OP_JSLESS:
+    return less;
+   case OP_SLEQ:
+   case OP_JSLEQ:
+    return less_equal;
+   case OP_SGRTR:
+   case OP_JSGRTR:
+    return greater;
+   case OP_SGEQ:
+   case OP_JSGEQ:
+    return greater_equal;
+   default:
+    assert(false);
+    return negative;
+  }
+}
+
+static void *HelperAddress(JitHelper helper);
+
+static void *
+ResolveReloc(PluginRuntime *rt, uint32_t reloc)
+{
+  uint32_t payload = RelocPayloadOf(reloc);
+  switch (RelocKindOf(reloc)) {
+    case RelocKind::Helper:
+      if (payload > uint32_t(JitHelper::InvokeLinkedNative))
+        return nullptr;
+      return HelperAddress(JitHelper(payload));
+    case RelocKind::Runtime:
+      return rt;
+    case RelocKind::NativeFunction:
+      if (payload >= rt->image()->NumNatives())
+        return nullptr;
+      return (void *)rt->NativeAt(payload)->legacy_fn;
+    case RelocKind::NativeSlot:
+      if (payload >= rt->image()->NumNatives())
+        return nullptr;
+      return &rt->NativeAt(payload)->legacy_fn;
+    case RelocKind::FastNative:
+      if (payload >= rt->image()->NumNatives())
+        return nullptr;
+      return rt->NativeAt(payload)->fast.func;
+    case RelocKind::LinkedFunction:
+      if (payload >= rt->image()->NumNatives())
+        return nullptr;
+      return rt->NativeAt(payload);
+    default:
+      return nullptr;
+  }
+}
+
+// Copy a function out of the code cache and fix it up for this process.
+// Returns null if the cached code made assumptions that no longer hold.
+static CompiledFunction *
+LoadCachedFunction(PluginRuntime *rt, const CachedFunction *cached)
+{
+  for (size_t i = 0; i < cached->natives.length; i++) {
+    const AssumedNative &assumed = cached->natives[i];
+    NativeEntry *native = rt->NativeAt(assumed.index);
+    if (native->status != SP_NATIVE_BOUND ||
+        (native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)) ||
+        rt->GetNativeBindingKey(assumed.index) != assumed.binding)
+    {
+      return nullptr;
+    }
+  }
+
+  ke::Vector<void *> addresses;
+  for (size_t i = 0; i < cached->external_refs.length; i++) {
+    void *address = ResolveReloc(rt, cached->external_refs[i].reloc);
+    if (!address || !addresses.append(address))
+      return nullptr;
+  }
+
+  CodeChunk code = Environment::get()->AllocateCode(cached->code.length);
+  if (!code.address())
+    return nullptr;
+
+  uint8_t *base = reinterpret_cast<uint8_t *>(code.address());
+  memcpy(base, cached->code.elements, cached->code.length);
+  MacroAssemblerX64::RelocateLocalRefs(base, cached->local_refs.elements,
+                                       cached->local_refs.length);
+  for (size_t i = 0; i < cached->external_refs.length; i++)
+    MacroAssemblerX64::PatchExternalRef(base, cached->external_refs[i], addresses[i]);
+
+  AutoPtr<FixedArray<LoopEdge>> edges(new FixedArray<LoopEdge>(cached->edges.length));
+  memcpy(edges->buffer(), cached->edges.elements, cached->edges.length * sizeof(LoopEdge));
+
+  AutoPtr<FixedArray<CipMapEntry>> cipmap(new FixedArray<CipMapEntry>(cached->cip_map.length));
+  memcpy(cipmap->buffer(), cached->cip_map.elements, cached->cip_map.length * sizeof(CipMapEntry));
+
+  return new CompiledFunction(code, cached->pcode_offset, edges.take(), cipmap.take());
+}
+
+CompiledFunction *
+sp::CompileFunction(PluginRuntime *prt, cell_t pcode_offs, int *err)
+{
+  CompiledFunction *fun = nullptr;
+  if (CodeCache *cache = prt->code_cache()) {
+    if (const CachedFunction *cached = cache->Find(pcode_offs))
+      fun = LoadCachedFunction(prt, cached);
+  }
+  if (!fun) {
+    Compiler cc(prt, pcode_offs, false);
+    fun = cc.emit(err);
+    if (!fun)
+      return NULL;
+  }
+
+  // Grab the lock before linking code in, since the watchdog timer will look
+  // at this list on another thread.
+  ke::AutoLock lock(Environment::get()->lock());
+
+  prt->AddJittedFunction(fun);
+  return fun;
+}
+
+static int
+CompileFromThunk(PluginRuntime *runtime, cell_t pcode_offs, void **addrp, uint8_t *pc)
+{
+  // If the watchdog timer has declared a timeout, we must process it now,
+  // and possibly refuse to compile, since otherwise we will compile a
+  // function that is not patched for timeouts.
+  if (!Environment::get()->watchdog()->HandleInterrupt())
+    return SP_ERROR_TIMEOUT;
+
+  // The function may be waiting to be linked in from a background compile.
+  runtime->LinkBackgroundFunctions();
+
+  CompiledFunction *fn = runtime->GetJittedFunctionByOffset(pcode_offs);
+  if (!fn) {
+    int err;
+    fn = CompileFunction(runtime, pcode_offs, &err);
+    if (!fn)
+      return err;
+  }
+
+#if defined JIT_SPEW
+  Environment::get()->debugger()->OnDebugSpew(
+      "Patching thunk to %s::%s\n",
+      runtime->Name(),
+      runtime->image()->LookupFunction(pcode_offs));
+#endif
+
+  *addrp = fn->GetEntryAddress();
+
+  PatchCallThunk(pc, fn);
+  return SP_ERROR_NONE;
+}
+
+void
+sp::PatchCallThunk(uint8_t *pc, CompiledFunction *fn)
+{
+  /* Right now, we always keep the code RWE */
+  MacroAssemblerX64::PatchCallTarget(pc, fn->GetEntryAddress());
+}
+
+// Any rebuild of the JIT may change what it emits, or which helpers it
+// calls, so cached code is only reused by the exact build that wrote it.
+const char *
+sp::CodeCacheBuildId()
+{
+  return "x64 " __DATE__ " " __TIME__;
+}
+
+Compiler::Compiler(PluginRuntime *rt, cell_t pcode_offs, bool off_thread)
+  : env_(Environment::get()),
+    rt_(rt),
+    context_(rt->GetBaseContext()),
+    image_(rt_->image()),
+    error_(SP_ERROR_NONE),
+    pcode_start_(pcode_offs),
+    code_start_(reinterpret_cast<const cell_t *>(rt_->code().bytes + pcode_start_)),
+    cip_(code_start_),
+    code_end_(reinterpret_cast<const cell_t *>(rt_->code().bytes + rt_->code().length)),
+    analysis_(rt, pcode_offs),
+    ranges_(rt, analysis_),
+    jump_map_(nullptr),
+    off_thread_(off_thread),
+    ncached_(0),
+    stack_depth_(0)
+{
+}
+
+Compiler::~Compiler()
+{
+  delete [] jump_map_;
+}
+
+CompiledFunction *
+Compiler::emit(int *errp)
+{
+  if (!assemble(errp))
+    return NULL;
+  return link(errp);
+}
+
+bool
+Compiler::assemble(int *errp)
+{
+  if (cip_ >= code_end_ || *cip_ != OP_PROC) {
+    *errp = SP_ERROR_INVALID_INSTRUCTION;
+    return false;
+  }
+
+#if defined JIT_SPEW
+  Environment::get()->debugger()->OnDebugSpew(
+      "Compiling function %s::%s\n",
+      rt_->Name(),
+      rt_->image()->LookupFunction(pcode_start_));
+
+  SpewOpcode(rt_, code_start_, cip_);
+#endif
+
+  // Find the extent of the function and its jump targets first, so labels
+  // are only needed for this function rather than the whole code section.
+  if ((*errp = analysis_.analyze()) != SP_ERROR_NONE)
+    return false;
+  analysis_.analyzeStackDepths();
+  ranges_.analyze();
+  jump_map_ = new Label[analysis_.ncells()];
+
+  // PROC can throw, so errors are reported at the start of the function.
+  op_cip_ = cip_;
+  cip_++;
+  if (!emitOp(OP_PROC)) {
+      *errp = (error_ == SP_ERROR_NONE) ? SP_ERROR_OUT_OF_MEMORY : error_;
+      return false;
+  }
+
+  while (cip_ < analysis_.end()) {
+#if defined JIT_SPEW
+    SpewOpcode(rt_, code_start_, cip_);
+#endif
+
+    // Bind a label for each instruction that is jumped to. Every path into
+    // it must agree on what is cached, so nothing is.
+    size_t index = cip_ - code_start_;
+    if (analysis_.isJumpTarget(index)) {
+      flushStackCache();
+      __ bind(&jump_map_[index]);
+    }
+    stack_depth_ = analysis_.stackDepth(index);
+
+    // Save the start of the opcode for emitCipMap().
+    op_cip_ = cip_;
+
+    OPCODE op = (OPCODE)readCell();
+    if (!emitOp(op) || error_ != SP_ERROR_NONE) {
+      *errp = (error_ == SP_ERROR_NONE) ? SP_ERROR_OUT_OF_MEMORY : error_;
+      return false;
+    }
+  }
+
+  emitCallThunks();
+
+  // For each backward jump, emit a little thunk so we can exit from a timeout.
+  // Track the offset of where the thunk is, so the watchdog timer can patch it.
+  for (size_t i = 0; i < backward_jumps_.length(); i++) {
+    BackwardJump &jump = backward_jumps_[i];
+    jump.timeout_offset = masm.pc();
+    __ call(&throw_timeout_);
+    emitCipMapping(jump.cip);
+  }
+
+  // This has to come last.
+  emitErrorPaths();
+  return true;
+}
+
+CompiledFunction *
+Compiler::link(int *errp)
+{
+  CodeChunk code = LinkCode(env_, masm);
+  if (!code.address()) {
+    *errp = SP_ERROR_OUT_OF_MEMORY;
+    return NULL;
+  }
+
+  AutoPtr<FixedArray<LoopEdge>> edges(
+    new FixedArray<LoopEdge>(backward_jumps_.length()));
+  for (size_t i = 0; i < backward_jumps_.length(); i++) {
+    const BackwardJump &jump = backward_jumps_[i];
+    edges->at(i).offset = jump.pc;
+    edges->at(i).disp32 = int32_t(jump.timeout_offset) - int32_t(jump.pc);
+  }
+
+  AutoPtr<FixedArray<CipMapEntry>> cipmap(
+    new FixedArray<CipMapEntry>(cip_map_.length()));
+  memcpy(cipmap->buffer(), cip_map_.buffer(), cip_map_.length() * sizeof(CipMapEntry));
+
+  if (CodeCache *cache = rt_->code_cache())
+    addToCodeCache(cache);
+
+  return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take());
+}
+
+void
+Compiler::addToCodeCache(CodeCache *cache)
+{
+  CodeCacheEntry entry;
+  entry.pcode_offset = pcode_start_;
+
+  // Code that embeds an address the cache does not know about cannot be
+  // reused.
+  const ke::Vector<ExternalRef> &external_refs = masm.externalRefs();
+  for (size_t i = 0; i < external_refs.length(); i++) {
+    if (RelocKindOf(external_refs[i].reloc) == RelocKind::None)
+      return;
+  }
+
+  if (!entry.code.resize(masm.length()))
+    return;
+  memcpy(entry.code.buffer(), masm.assembledCode(), masm.length());
+
+  for (size_t i = 0; i < masm.localRefs().length(); i++)
+    entry.local_refs.append(masm.localRefs()[i]);
+
+  // External addresses are meaningless to another process, so they are
+  // cleared rather than written out.
+  for (size_t i = 0; i < external_refs.length(); i++) {
+    entry.external_refs.append(external_refs[i]);
+    MacroAssemblerX64::PatchExternalRef(entry.code.buffer(), external_refs[i], nullptr);
+  }
+
+  for (size_t i = 0; i < backward_jumps_.length(); i++) {
+    const BackwardJump &jump = backward_jumps_[i];
+    LoopEdge edge;
+    edge.offset = jump.pc;
+    edge.disp32 = int32_t(jump.timeout_offset) - int32_t(jump.pc);
+    entry.edges.append(edge);
+  }
+
+  for (size_t i = 0; i < cip_map_.length(); i++)
+    entry.cip_map.append(cip_map_[i]);
+  for (size_t i = 0; i < assumed_natives_.length(); i++) {
+    AssumedNative native;
+    native.index = assumed_natives_[i];
+    native.binding = rt_->GetNativeBindingKey(native.index);
+    entry.natives.append(native);
+  }
+
+  cache->Add(entry);
+}
+
+// No exit frame - error code is returned directly.
+static int
+InvokeGenerateFullArray(PluginContext *cx, uint32_t argc, cell_t *argv, int autozero)
+{
+  return cx->generateFullArray(argc, argv, autozero);
+}
+
+// Exit frame is a JitExitFrameForHelper.
+static void
+InvokeReportError(int err)
+{
+  Environment::get()->ReportError(err);
+}
+
+// Exit frame is a JitExitFrameForHelper. This is a special function since we
+// have to notify the watchdog timer that we're unblocked.
+static void
+InvokeReportTimeout()
+{
+  Environment::get()->watchdog()->NotifyTimeoutReceived();
+  InvokeReportError(SP_ERROR_TIMEOUT);
+}
+
+// Find the |rbp| associated with the entry frame. We use this to drop out of
+// the entire scripted call stack. This walks the raw frame chain, because
+// FrameIterator steps over the entry frames of tier-up calls.
+static void *
+find_entry_fp()
+{
+  intptr_t *fp = Environment::get()->exit_fp();
+  while (FrameLayout::FromFp(fp)->frame_type != FrameType::Entry)
+    fp = FrameLayout::FromFp(fp)->prev_fp;
+
+  assert(fp);
+  return fp;
+}
+
+static float kRoundToCeil = -0.5f;
+
+static void *
+HelperAddress(JitHelper helper)
+{
+  Environment *env = Environment::get();
+  switch (helper) {
+    case JitHelper::ExitFrame:
+      return env->addressOfExit();
+    case JitHelper::ExceptionCode:
+      return env->addressOfExceptionCode();
+    case JitHelper::ReturnStub:
+      return env->stubs()->ReturnStub();
+    case JitHelper::GenerateFullArray:
+      return (void *)InvokeGenerateFullArray;
+    case JitHelper::CompileFromThunk:
+      return (void *)CompileFromThunk;
+    case JitHelper::ReportError:
+      return (void *)InvokeReportError;
+    case JitHelper::ReportTimeout:
+      return (void *)InvokeReportTimeout;
+    case JitHelper::FindEntryFp:
+      return (void *)find_entry_fp;
+    case JitHelper::RoundToCeil:
+      return &kRoundToCeil;
+    case JitHelper::InvokeLinkedNative:
+      return (void *)InvokeLinkedNative;
+  }
+  return nullptr;
+}
+
+// Every helper address goes through here, so that the code cache can find
+// it again in another process.
+static ExternalAddress
+Helper(JitHelper helper)
+{
+  return ExternalAddress(HelperAddress(helper), MakeReloc(helper));
+}
+
+bool
+Compiler::emitOp(OPCODE op)
+{
+  if (ncached_ && !CanUseStackCache(op))
+    flushStackCache();
+
+  switch (op) {
+    case OP_MOVE_PRI:
+      __ movl(pri, alt);
+      break;
+
+    case OP_MOVE_ALT:
+      __ movl(alt, pri);
+      break;
+
+    case OP_XCHG:
+      __ xchgl(pri, alt);
+      break;
+
+    case OP_ZERO:
+    {
+      cell_t offset = readCell();
+      __ movl(globalCell(offset), 0);
+      break;
+    }
+
+    case OP_ZERO_S:
+    {
+      cell_t offset = readCell();
+      __ movl(frameCell(offset), 0);
+      break;
+    }
+
+    case OP_PUSH_PRI:
+    case OP_PUSH_ALT:
+    {
+      Register reg = (op == OP_PUSH_PRI) ? pri : alt;
+      __ movl(cacheCell(), reg);
+      break;
+    }
+
+    case OP_PUSH_C:
+    case OP_PUSH2_C:
+    case OP_PUSH3_C:
+    case OP_PUSH4_C:
+    case OP_PUSH5_C:
+    {
+      int n = 1;
+      if (op >= OP_PUSH2_C)
+        n = ((op - OP_PUSH2_C) / 4) + 2;
+
+      for (int i = 0; i < n; i++)
+        cacheConstant(readCell());
+      break;
+    }
+
+    case OP_PUSH_ADR:
+    case OP_PUSH2_ADR:
+    case OP_PUSH3_ADR:
+    case OP_PUSH4_ADR:
+    case OP_PUSH5_ADR:
+    {
+      int n = 1;
+      if (op >= OP_PUSH2_ADR)
+        n = ((op - OP_PUSH2_ADR) / 4) + 2;
+
+      // Compute a local address for FRM in a scratch register, since frm
+      // itself is an absolute address.
+      __ movq(ScratchReg, frm);
+      __ subq(ScratchReg, dat);
+      for (int i = 0; i < n; i++) {
+        cell_t offset = readCell();
+        __ lea(cacheCell(), Operand(ScratchReg, offset));
+      }
+      break;
+    }
+
+    case OP_PUSH_S:
+    case OP_PUSH2_S:
+    case OP_PUSH3_S:
+    case OP_PUSH4_S:
+    case OP_PUSH5_S:
+    {
+      int n = 1;
+      if (op >= OP_PUSH2_S)
+        n = ((op - OP_PUSH2_S) / 4) + 2;
+
+      for (int i = 0; i < n; i++) {
+        Operand src = frameCell(readCell());
+        __ movl(cacheCell(), src);
+      }
+      break;
+    }
+
+    case OP_PUSH:
+    case OP_PUSH2:
+    case OP_PUSH3:
+    case OP_PUSH4:
+    case OP_PUSH5:
+    {
+      int n = 1;
+      if (op >= OP_PUSH2)
+        n = ((op - OP_PUSH2) / 4) + 2;
+
+      for (int i = 0; i < n; i++) {
+        Operand src = globalCell(readCell());
+        __ movl(cacheCell(), src);
+      }
+      break;
+    }
+
+    case OP_ZERO_PRI:
+      __ xorl(pri, pri);
+      break;
+
+    case OP_ZERO_ALT:
+      __ xorl(alt, alt);
+      break;
+
+    case OP_ADD:
+      __ addl(pri, alt);
+      break;
+
+    case OP_SUB:
+      __ subl(pri, alt);
+      break;
+
+    case OP_SUB_ALT:
+      __ movl(tmp, alt);
+      __ subl(tmp, pri);
+      __ movl(pri, tmp);
+      break;
+
+    case OP_PROC:
+      __ enterFrame(FrameType::Scripted, pcode_start_);
+
+      // Push the old frame onto the stack.
+      __ movl(tmp, frmAddr());
+      __ movl(Operand(stk, -4), tmp);
+      __ subq(stk, 8);    // extra unused slot for non-existant CIP
+
+      // Get and store the new frame.
+      __ movq(tmp, stk);
+      __ movq(frm, stk);
+      __ subq(tmp, dat);
+      __ movl(frmAddr(), tmp);
+
+      // Calls only push, so check here that recursion has not run the stack
+      // into the heap.
+      __ movl(tmp, hpAddr());
+      __ leaq(tmp, Operand(dat, tmp, NoScale, STACK_MARGIN));
+      __ cmpq(stk, tmp);
+      jumpOnError(below, SP_ERROR_STACKLOW);
+      break;
+
+    case OP_IDXADDR_B:
+    {
+      cell_t val = readCell();
+      __ shll(pri, val);
+      __ addl(pri, alt);
+      break;
+    }
+
+    case OP_SHL:
+      __ movl(rcx, alt);
+      __ shll_cl(pri);
+      break;
+
+    case OP_SHR:
+      __ movl(rcx, alt);
+      __ shrl_cl(pri);
+      break;
+
+    case OP_SSHR:
+      __ movl(rcx, alt);
+      __ sarl_cl(pri);
+      break;
+
+    case OP_SHL_C_PRI:
+    case OP_SHL_C_ALT:
+    {
+      Register reg = (op == OP_SHL_C_PRI) ? pri : alt;
+      cell_t val = readCell();
+      __ shll(reg, val);
+      break;
+    }
+
+    case OP_SHR_C_PRI:
+    case OP_SHR_C_ALT:
+    {
+      Register reg = (op == OP_SHR_C_PRI) ? pri : alt;
+      cell_t val = readCell();
+      __ shrl(reg, val);
+      break;
+    }
+
+    case OP_SMUL:
+      __ imull(pri, alt);
+      break;
+
+    case OP_NOT:
+      __ testl(rax, rax);
+      __ movl(rax, 0);
+      __ set(zero, r8_al);
+      break;
+
+    case OP_NEG:
+      __ negl(rax);
+      break;
+
+    case OP_XOR:
+      __ xorl(pri, alt);
+      break;
+
+    case OP_OR:
+      __ orl(pri, alt);
+      break;
+
+    case OP_AND:
+      __ andl(pri, alt);
+      break;
+
+    case OP_INVERT:
+      __ notl(pri);
+      break;
+
+    case OP_ADD_C:
+    {
+      cell_t val = readCell();
+      __ addl(pri, val);
+      break;
+    }
+
+    case OP_SMUL_C:
+    {
+      cell_t val = readCell();
+      __ imull(pri, pri, val);
+      break;
+    }
+
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ:
+    {
+      ConditionCode cc = OpToCondition(op);
+      __ cmpl(pri, alt);
+      __ movl(pri, 0);
+      __ set(cc, r8_al);
+      break;
+    }
+
+    case OP_EQ_C_PRI:
+    case OP_EQ_C_ALT:
+    {
+      Register reg = (op == OP_EQ_C_PRI) ? pri : alt;
+      cell_t val = readCell();
+      __ cmpl(reg, val);
+      __ movl(pri, 0);
+      __ set(equal, r8_al);
+      break;
+    }
+
+    case OP_INC_PRI:
+    case OP_INC_ALT:
+    {
+      Register reg = (op == OP_INC_PRI) ? pri : alt;
+      __ addl(reg, 1);
+      break;
+    }
+
+    case OP_INC:
+    case OP_INC_S:
+    {
+      cell_t offset = readCell();
+      __ addl((op == OP_INC) ? globalCell(offset) : frameCell(offset), 1);
+      break;
+    }
+
+    case OP_INC_I:
+      __ addl(Operand(dat, pri, NoScale), 1);
+      break;
+
+    case OP_DEC_PRI:
+    case OP_DEC_ALT:
+    {
+      Register reg = (op == OP_DEC_PRI) ? pri : alt;
+      __ subl(reg, 1);
+      break;
+    }
+
+    case OP_DEC:
+    case OP_DEC_S:
+    {
+      cell_t offset = readCell();
+      __ subl((op == OP_DEC) ? globalCell(offset) : frameCell(offset), 1);
+      break;
+    }
+
+    case OP_DEC_I:
+      __ subl(Operand(dat, pri, NoScale), 1);
+      break;
+
+    case OP_LOAD_PRI:
+    case OP_LOAD_ALT:
+    {
+      Register reg = (op == OP_LOAD_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(reg, globalCell(offset));
+      break;
+    }
+
+    case OP_LOAD_BOTH:
+    {
+      Operand src1 = globalCell(readCell());
+      Operand src2 = globalCell(readCell());
+      __ movl(pri, src1);
+      __ movl(alt, src2);
+      break;
+    }
+
+    case OP_LOAD_S_PRI:
+    case OP_LOAD_S_ALT:
+    {
+      Register reg = (op == OP_LOAD_S_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(reg, frameCell(offset));
+      break;
+    }
+
+    case OP_LOAD_S_BOTH:
+    {
+      Operand src1 = frameCell(readCell());
+      Operand src2 = frameCell(readCell());
+      __ movl(pri, src1);
+      __ movl(alt, src2);
+      break;
+    }
+
+    case OP_LREF_S_PRI:
+    case OP_LREF_S_ALT:
+    {
+      Register reg = (op == OP_LREF_S_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(reg, Operand(frm, offset));
+      __ movl(reg, Operand(dat, reg, NoScale));
+      break;
+    }
+
+    case OP_CONST_PRI:
+    case OP_CONST_ALT:
+    {
+      Register reg = (op == OP_CONST_PRI) ? pri : alt;
+      cell_t val = readCell();
+      __ movl(reg, val);
+
+      // This is how the compiler pushes a constant, such as each dimension
+      // of a new array. Cache it as a constant, so that the instructions
+      // consuming it can see its value.
+      OPCODE push_op = (op == OP_CONST_PRI) ? OP_PUSH_PRI : OP_PUSH_ALT;
+      if (cip_ < analysis_.end() && *cip_ == push_op &&
+          !analysis_.isJumpTarget(cip_ - code_start_))
+      {
+        cip_++;
+        cacheConstant(val);
+      }
+      break;
+    }
+
+    case OP_ADDR_PRI:
+    case OP_ADDR_ALT:
+    {
+      Register reg = (op == OP_ADDR_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(reg, frmAddr());
+      __ addl(reg, offset);
+      break;
+    }
+
+    case OP_STOR_PRI:
+    case OP_STOR_ALT:
+    {
+      Register reg = (op == OP_STOR_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(globalCell(offset), reg);
+      break;
+    }
+
+    case OP_STOR_S_PRI:
+    case OP_STOR_S_ALT:
+    {
+      Register reg = (op == OP_STOR_S_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(frameCell(offset), reg);
+      break;
+    }
+
+    case OP_IDXADDR:
+      __ lea(pri, Operand(alt, pri, ScaleFour));
+      break;
+
+    case OP_SREF_S_PRI:
+    case OP_SREF_S_ALT:
+    {
+      Register reg = (op == OP_SREF_S_PRI) ? pri : alt;
+      cell_t offset = readCell();
+      __ movl(tmp, Operand(frm, offset));
+      __ movl(Operand(dat, tmp, NoScale), reg);
+      break;
+    }
+
+    case OP_POP_PRI:
+    case OP_POP_ALT:
+    {
+      Register reg = (op == OP_POP_PRI) ? pri : alt;
+      if (ncached_) {
+        popCachedCell(reg);
+        break;
+      }
+      __ movl(reg, Operand(stk, 0));
+      __ addq(stk, 4);
+      break;
+    }
+
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT:
+    {
+      Register reg = (op == OP_SWAP_PRI) ? pri : alt;
+      if (ncached_) {
+        CachedCell &top = cached_cells_[ncached_ - 1];
+        if (top.is_constant) {
+          // Move |reg| into a free register, in place of the constant.
+          Register free = freeCacheRegister();
+          __ movl(free, reg);
+          __ movl(reg, top.value);
+          top.is_constant = false;
+          top.reg = free;
+        } else {
+          __ xchgl(top.reg, reg);
+        }
+        break;
+      }
+      __ movl(tmp, Operand(stk, 0));
+      __ movl(Operand(stk, 0), reg);
+      __ movl(reg, tmp);
+      break;
+    }
+
+    case OP_LIDX:
+      __ lea(pri, Operand(alt, pri, ScaleFour));
+      __ movl(pri, Operand(dat, pri, NoScale));
+      break;
+
+    case OP_LIDX_B:
+    {
+      cell_t val = readCell();
+      if (val >= 0 && val <= 3) {
+        __ lea(pri, Operand(alt, pri, Scale(val)));
+      } else {
+        __ shll(pri, val);
+        __ addl(pri, alt);
+      }
+      emitCheckAddress(pri);
+      __ movl(pri, Operand(dat, pri, NoScale));
+      break;
+    }
+
+    case OP_CONST:
+    case OP_CONST_S:
+    {
+      cell_t offset = readCell();
+      cell_t val = readCell();
+      __ movl((op == OP_CONST) ? globalCell(offset) : frameCell(offset), val);
+      break;
+    }
+
+    case OP_LOAD_I:
+      emitCheckAddress(pri);
+      __ movl(pri, Operand(dat, pri, NoScale));
+      break;
+
+    case OP_STOR_I:
+      emitCheckAddress(alt);
+      __ movl(Operand(dat, alt, NoScale), pri);
+      break;
+
+    case OP_SDIV:
+    case OP_SDIV_ALT:
+    {
+      Register dividend = (op == OP_SDIV) ? pri : alt;
+      Register divisor = (op == OP_SDIV) ? alt : pri;
+
+      // Guard against divide-by-zero.
+      __ testl(divisor, divisor);
+      jumpOnError(zero, SP_ERROR_DIVIDE_BY_ZERO);
+
+      // A more subtle case; -INT_MIN / -1 yields an overflow exception.
+      Label ok;
+      __ cmpl(divisor, -1);
+      __ j(not_equal, &ok);
+      __ cmpl(dividend, int32_t(0x80000000));
+      jumpOnError(equal, SP_ERROR_INTEGER_OVERFLOW);
+      __ bind(&ok);
+
+      // Now we can actually perform the divide.
+      __ movl(tmp, divisor);
+      if (op == OP_SDIV)
+        __ movl(rdx, dividend);
+      else
+        __ movl(rax, dividend);
+      __ sarl(rdx, 31);
+      __ idivl(tmp);
+      break;
+    }
+
+    case OP_LODB_I:
+    {
+      cell_t val = readCell();
+      emitCheckAddress(pri);
+      __ movl(pri, Operand(dat, pri, NoScale));
+      if (val == 1)
+        __ andl(pri, 0xff);
+      else if (val == 2)
+        __ andl(pri, 0xffff);
+      break;
+    }
+
+    case OP_STRB_I:
+    {
+      cell_t val = readCell();
+      emitCheckAddress(alt);
+      if (val == 1)
+        __ movb(Operand(dat, alt, NoScale), pri);
+      else if (val == 2)
+        __ movw(Operand(dat, alt, NoScale), pri);
+      else if (val == 4)
+        __ movl(Operand(dat, alt, NoScale), pri);
+      break;
+    }
+
+    case OP_RETN:
+    {
+      // Restore the old frame pointer.
+      __ movl(frm, Operand(stk, 4));              // get the old frm
+      __ addq(stk, 8);                            // pop stack
+      __ movl(frmAddr(), frm);                    // store back old frm
+      __ addq(frm, dat);                          // relocate
+
+      // Remove parameters.
+      __ movl(tmp, Operand(stk, 0));
+      __ leaq(stk, Operand(stk, tmp, ScaleFour, 4));
+
+      __ leaveFrame();
+      __ ret();
+      break;
+    }
+
+    case OP_MOVS:
+    {
+      cell_t val = readCell();
+      unsigned dwords = val / 4;
+      unsigned bytes = val % 4;
+
+      // rsi and rdi are not pinned, so there is nothing to save.
+      __ cld();
+      __ leaq(rdi, Operand(dat, alt, NoScale));
+      __ leaq(rsi, Operand(dat, pri, NoScale));
+      if (dwords) {
+        __ movl(rcx, dwords);
+        __ rep_movsd();
+      }
+      if (bytes) {
+        __ movl(rcx, bytes);
+        __ rep_movsb();
+      }
+      break;
+    }
+
+    case OP_FILL:
+    {
+      // eax/pri is used implicitly.
+      unsigned dwords = readCell() / 4;
+      __ leaq(rdi, Operand(dat, alt, NoScale));
+      __ movl(rcx, dwords);
+      __ cld();
+      __ rep_stosd();
+      break;
+    }
+
+    case OP_STRADJUST_PRI:
+      __ addl(pri, 4);
+      __ sarl(pri, 2);
+      break;
+
+    case OP_FABS:
+      __ movl(pri, Operand(stk, 0));
+      __ andl(pri, 0x7fffffff);
+      __ addq(stk, 4);
+      break;
+
+    case OP_FLOAT:
+      __ cvtsi2ss(xmm0, Operand(stk, 0));
+      __ movd(pri, xmm0);
+      __ addq(stk, 4);
+      break;
+
+    case OP_FLOATADD:
+    case OP_FLOATSUB:
+    case OP_FLOATMUL:
+    case OP_FLOATDIV:
+      __ movss(xmm0, Operand(stk, 0));
+      if (op == OP_FLOATADD)
+        __ addss(xmm0, Operand(stk, 4));
+      else if (op == OP_FLOATSUB)
+        __ subss(xmm0, Operand(stk, 4));
+      else if (op == OP_FLOATMUL)
+        __ mulss(xmm0, Operand(stk, 4));
+      else if (op == OP_FLOATDIV)
+        __ divss(xmm0, Operand(stk, 4));
+      __ movd(pri, xmm0);
+      __ addq(stk, 8);
+      break;
+
+    case OP_RND_TO_NEAREST:
+      // Assume no one is touching MXCSR.
+      __ cvtss2si(pri, Operand(stk, 0));
+      __ addq(stk, 4);
+      break;
+
+    case OP_RND_TO_CEIL:
+    {
+      // From http://wurstcaptures.untergrund.net/assembler_tricks.html#fastfloorf
+      //
+      // Note: we never pop into pri, since that would leave garbage in its
+      // upper half.
+      __ fld32(Operand(stk, 0));
+      __ fadd32(st0, st0);
+      __ movq(ScratchReg, Helper(JitHelper::RoundToCeil));
+      __ fsubr32(Operand(ScratchReg, 0));
+      __ subq(rsp, 8);
+      __ fistp32(Operand(rsp, 0));
+      __ movl(pri, Operand(rsp, 0));
+      __ addq(rsp, 8);
+      __ sarl(pri, 1);
+      __ negl(pri);
+      __ addq(stk, 4);
+      break;
+    }
+
+    case OP_RND_TO_ZERO:
+      __ cvttss2si(pri, Operand(stk, 0));
+      __ addq(stk, 4);
+      break;
+
+    case OP_RND_TO_FLOOR:
+      __ fld32(Operand(stk, 0));
+      __ subq(rsp, 8);
+      __ fstcw(Operand(rsp, 4));
+      __ movl(Operand(rsp, 0), 0x7ff);
+      __ fldcw(Operand(rsp, 0));
+      __ fistp32(Operand(rsp, 0));
+      __ movl(pri, Operand(rsp, 0));
+      __ fldcw(Operand(rsp, 4));
+      __ addq(rsp, 8);
+      __ addq(stk, 4);
+      break;
+
+    // This is the old float cmp, which returns ordered results. In newly
+    // compiled code it should not be used or generated.
+    //
+    // Note that the checks here are inverted: the test is |rhs OP lhs|.
+    case OP_FLOATCMP:
+    {
+      Label bl, ab, done;
+      __ movss(xmm0, Operand(stk, 4));
+      __ ucomiss(Operand(stk, 0), xmm0);
+      __ j(above, &ab);
+      __ j(below, &bl);
+      __ xorl(pri, pri);
+      __ jmp(&done);
+      __ bind(&ab);
+      __ movl(pri, -1);
+      __ jmp(&done);
+      __ bind(&bl);
+      __ movl(pri, 1);
+      __ bind(&done);
+      __ addq(stk, 8);
+      break;
+    }
+
+    case OP_FLOAT_GT:
+      emitFloatCmp(above);
+      break;
+
+    case OP_FLOAT_GE:
+      emitFloatCmp(above_equal);
+      break;
+
+    case OP_FLOAT_LE:
+      emitFloatCmp(below_equal);
+      break;
+
+    case OP_FLOAT_LT:
+      emitFloatCmp(below);
+      break;
+
+    case OP_FLOAT_EQ:
+      emitFloatCmp(equal);
+      break;
+
+    case OP_FLOAT_NE:
+      emitFloatCmp(not_equal);
+      break;
+
+    case OP_FLOAT_NOT:
+    {
+      __ xorps(xmm0, xmm0);
+      __ ucomiss(Operand(stk, 0), xmm0);
+
+      // See emitFloatCmp() - this is a shorter version.
+      Label done;
+      __ movl(rax, 1);
+      __ j(parity, &done);
+      __ set(zero, r8_al);
+      __ bind(&done);
+
+      __ addq(stk, 4);
+      break;
+    }
+
+    case OP_STACK:
+    {
+      cell_t amount = readCell();
+
+      // Popping cells that were never stored just forgets them.
+      if (amount > 0 && amount % 4 == 0 && size_t(amount / 4) <= ncached_) {
+        ncached_ -= amount / 4;
+        if (stack_depth_ >= 0)
+          stack_depth_ -= amount;
+        break;
+      }
+      flushStackCache();
+
+      __ addq(stk, amount);
+
+      if (amount > 0) {
+        // Check if the stack went beyond the stack top - usually a compiler error.
+        __ leaq(tmp, Operand(dat, context_->HeapSize()));
+        __ cmpq(stk, tmp);
+        jumpOnError(not_below, SP_ERROR_STACKMIN);
+      } else {
+        // Check if the stack is going to collide with the heap.
+        __ movl(tmp, hpAddr());
+        __ leaq(tmp, Operand(dat, tmp, NoScale, STACK_MARGIN));
+        __ cmpq(stk, tmp);
+        jumpOnError(below, SP_ERROR_STACKLOW);
+      }
+      break;
+    }
+
+    case OP_HEAP:
+    {
+      cell_t amount = readCell();
+      __ movl(alt, hpAddr());
+      __ addl(hpAddr(), amount);
+
+      if (amount < 0) {
+        __ cmpl(hpAddr(), context_->DataSize());
+        jumpOnError(below, SP_ERROR_HEAPMIN);
+      } else {
+        __ movl(tmp, hpAddr());
+        __ leaq(tmp, Operand(dat, tmp, NoScale, STACK_MARGIN));
+        __ cmpq(tmp, stk);
+        jumpOnError(above, SP_ERROR_HEAPLOW);
+      }
+      break;
+    }
+
+    case OP_JUMP:
+    {
+      Label *target = labelAt(readCell());
+      if (!target)
+        return false;
+      if (target->bound()) {
+        __ jmp32(target);
+        backward_jumps_.append(BackwardJump(masm.pc(), op_cip_));
+      } else {
+        __ jmp(target);
+      }
+      break;
+    }
+
+    case OP_JZER:
+    case OP_JNZ:
+    {
+      ConditionCode cc = (op == OP_JZER) ? zero : not_zero;
+      Label *target = labelAt(readCell());
+      if (!target)
+        return false;
+      __ testl(pri, pri);
+      if (target->bound()) {
+        __ j32(cc, target);
+        backward_jumps_.append(BackwardJump(masm.pc(), op_cip_));
+      } else {
+        __ j(cc, target);
+      }
+      break;
+    }
+
+    case OP_JEQ:
+    case OP_JNEQ:
+    case OP_JSLESS:
+    case OP_JSLEQ:
+    case OP_JSGRTR:
+    case OP_JSGEQ:
+    {
+      Label *target = labelAt(readCell());
+      if (!target)
+        return false;
+      ConditionCode cc = OpToCondition(op);
+      __ cmpl(pri, alt);
+      if (target->bound()) {
+        __ j32(cc, target);
+        backward_jumps_.append(BackwardJump(masm.pc(), op_cip_));
+      } else {
+        __ j(cc, target);
+      }
+      break;
+    }
+
+    case OP_TRACKER_PUSH_C:
+    {
+      cell_t amount = readCell();
+
+      __ movl(tmp, amount * 4);
+      emitPushTracker(tmp);
+      break;
+    }
+
+    case OP_TRACKER_POP_SETHEAP:
+    {
+      // Same as PluginContext::popTrackerAndSetHeap().
+      __ movq(tmp, trackerCurAddr());
+      __ cmpq(tmp, trackerBaseAddr());
+      jumpOnError(below_equal, SP_ERROR_TRACKER_BOUNDS);
+      __ subq(tmp, sizeof(cell_t));
+      __ movq(trackerCurAddr(), tmp);
+
+      // The amount must not exceed hp - data size, compared unsigned.
+      __ movl(tmp, Operand(tmp, 0));
+      __ movl(ScratchReg, hpAddr());
+      __ subl(ScratchReg, context_->DataSize());
+      __ cmpl(tmp, ScratchReg);
+      jumpOnError(above, SP_ERROR_HEAPMIN);
+      __ subl(hpAddr(), tmp);
+      break;
+    }
+
+    // This opcode is used to note where line breaks occur. We don't support
+    // live debugging, and if we did, we could build this map from the lines
+    // table. So we don't generate any code here.
+    case OP_BREAK:
+      break;
+
+    // This should never be hit.
+    case OP_HALT:
+      __ align(16);
+      __ movl(pri, readCell());
+      __ testl(rax, rax);
+      jumpOnError(not_zero);
+      break;
+
+    case OP_BOUNDS:
+    {
+      cell_t value = readCell();
+      if (ranges_.isCheckRedundant(op_cip_ - code_start_))
+        break;
+      __ cmpl(rax, value);
+      jumpOnError(above, SP_ERROR_ARRAY_BOUNDS);
+      break;
+    }
+
+    case OP_GENARRAY:
+    case OP_GENARRAY_Z:
+      emitGenArray(op == OP_GENARRAY_Z);
+      break;
+
+    case OP_CALL:
+      if (!emitCall())
+        return false;
+      break;
+
+    case OP_SYSREQ_C:
+      if (!emitSysreqC())
+        return false;
+      break;
+
+    case OP_SYSREQ_N:
+      if (!emitSysreqN())
+        return false;
+      break;
+
+    case OP_SWITCH:
+      if (!emitSwitch())
+        return false;
+      break;
+
+    case OP_CASETBL:
+    {
+      size_t ncases = readCell();
+
+      // Two cells per case, and one extra cell for the default address.
+      cip_ += (ncases * 2) + 1;
+      break;
+    }
+
+    case OP_NOP:
+      break;
+
+    default:
+      error_ = SP_ERROR_INVALID_INSTRUCTION;
+      return false;
+  }
+
+  return true;
+}
+
+Label *
+Compiler::labelAt(size_t offset)
+{
+  // The analysis pass has already rejected jumps that are misaligned, or
+  // that do not land on an instruction inside this function.
+  size_t index;
+  if (!analysis_.findOp(offset, &index) || !analysis_.isJumpTarget(index)) {
+    error_ = SP_ERROR_INSTRUCTION_PARAM;
+    return NULL;
+  }
+
+  return &jump_map_[index];
+}
+
+// Registers for the stack cache. Nothing that runs while cells are cached
+// uses these, and they are never live across an instruction that flushes.
+static const Register kStackCacheRegs[] = { r8, r9, r10, rsi };
+
+bool
+Compiler::CanUseStackCache(OPCODE op)
+{
+  // Instructions that do not touch the stack in memory at all, or only
+  // through frameCell() and globalCell(), or that know about the cache.
+  switch (op) {
+    case OP_MOVE_PRI:
+    case OP_MOVE_ALT:
+    case OP_XCHG:
+    case OP_ZERO:
+    case OP_ZERO_S:
+    case OP_PUSH_PRI:
+    case OP_PUSH_ALT:
+    case OP_PUSH_C:
+    case OP_PUSH2_C:
+    case OP_PUSH3_C:
+    case OP_PUSH4_C:
+    case OP_PUSH5_C:
+    case OP_PUSH_ADR:
+    case OP_PUSH2_ADR:
+    case OP_PUSH3_ADR:
+    case OP_PUSH4_ADR:
+    case OP_PUSH5_ADR:
+    case OP_PUSH_S:
+    case OP_PUSH2_S:
+    case OP_PUSH3_S:
+    case OP_PUSH4_S:
+    case OP_PUSH5_S:
+    case OP_PUSH:
+    case OP_PUSH2:
+    case OP_PUSH3:
+    case OP_PUSH4:
+    case OP_PUSH5:
+    case OP_ZERO_PRI:
+    case OP_ZERO_ALT:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SUB_ALT:
+    case OP_IDXADDR_B:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SSHR:
+    case OP_SHL_C_PRI:
+    case OP_SHL_C_ALT:
+    case OP_SHR_C_PRI:
+    case OP_SHR_C_ALT:
+    case OP_SMUL:
+    case OP_NOT:
+    case OP_NEG:
+    case OP_XOR:
+    case OP_OR:
+    case OP_AND:
+    case OP_INVERT:
+    case OP_ADD_C:
+    case OP_SMUL_C:
+    case OP_EQ:
+    case OP_NEQ:
+    case OP_SLESS:
+    case OP_SLEQ:
+    case OP_SGRTR:
+    case OP_SGEQ:
+    case OP_EQ_C_PRI:
+    case OP_EQ_C_ALT:
+    case OP_INC_PRI:
+    case OP_INC_ALT:
+    case OP_INC:
+    case OP_INC_S:
+    case OP_DEC_PRI:
+    case OP_DEC_ALT:
+    case OP_DEC:
+    case OP_DEC_S:
+    case OP_LOAD_PRI:
+    case OP_LOAD_ALT:
+    case OP_LOAD_BOTH:
+    case OP_LOAD_S_PRI:
+    case OP_LOAD_S_ALT:
+    case OP_LOAD_S_BOTH:
+    case OP_CONST_PRI:
+    case OP_CONST_ALT:
+    case OP_ADDR_PRI:
+    case OP_ADDR_ALT:
+    case OP_STOR_PRI:
+    case OP_STOR_ALT:
+    case OP_STOR_S_PRI:
+    case OP_STOR_S_ALT:
+    case OP_IDXADDR:
+    case OP_POP_PRI:
+    case OP_POP_ALT:
+    case OP_SWAP_PRI:
+    case OP_SWAP_ALT:
+    case OP_CONST:
+    case OP_CONST_S:
+    case OP_SDIV:
+    case OP_SDIV_ALT:
+    case OP_STRADJUST_PRI:
+    case OP_STACK:
+    case OP_BOUNDS:
+    case OP_BREAK:
+    case OP_NOP:
+    case OP_GENARRAY:
+    case OP_GENARRAY_Z:
+      return true;
+
+    // Error paths do not need a flush, since they unwind the whole
+    // invocation and the context restores its stack pointer.
+    default:
+      return false;
+  }
+}
+
+void
+Compiler::flushStackCache()
+{
+  if (!ncached_)
+    return;
+
+  for (size_t i = 0; i < ncached_; i++) {
+    const CachedCell &cell = cached_cells_[i];
+    Operand dest(stk, -int32_t((i + 1) * sizeof(cell_t)));
+    if (cell.is_constant)
+      __ movl(dest, cell.value);
+    else
+      __ movl(dest, cell.reg);
+  }
+  __ subq(stk, ncached_ * sizeof(cell_t));
+  ncached_ = 0;
+}
+
+Register
+Compiler::freeCacheRegister()
+{
+  for (size_t i = 0; i < sizeof(kStackCacheRegs) / sizeof(kStackCacheRegs[0]); i++) {
+    Register reg = kStackCacheRegs[i];
+    bool used = false;
+    for (size_t j = 0; j < ncached_; j++) {
+      if (!cached_cells_[j].is_constant && cached_cells_[j].reg == reg) {
+        used = true;
+        break;
+      }
+    }
+    if (!used)
+      return reg;
+  }
+
+  // There is a register for every slot.
+  assert(false);
+  return kStackCacheRegs[0];
+}
+
+// Returns the register to push into.
+Register
+Compiler::cacheCell()
+{
+  if (ncached_ == kMaxCachedCells)
+    flushStackCache();
+
+  CachedCell &cell = cached_cells_[ncached_];
+  cell.is_constant = false;
+  cell.reg = freeCacheRegister();
+  ncached_++;
+  if (stack_depth_ >= 0)
+    stack_depth_ += sizeof(cell_t);
+  return cell.reg;
+}
+
+void
+Compiler::cacheConstant(cell_t value)
+{
+  if (ncached_ == kMaxCachedCells)
+    flushStackCache();
+
+  CachedCell &cell = cached_cells_[ncached_++];
+  cell.is_constant = true;
+  cell.value = value;
+  if (stack_depth_ >= 0)
+    stack_depth_ += sizeof(cell_t);
+}
+
+void
+Compiler::popCachedCell(Register dest)
+{
+  assert(ncached_);
+
+  const CachedCell &cell = cached_cells_[--ncached_];
+  if (cell.is_constant)
+    __ movl(dest, cell.value);
+  else
+    __ movl(dest, cell.reg);
+  if (stack_depth_ >= 0)
+    stack_depth_ -= sizeof(cell_t);
+}
+
+Operand
+Compiler::frameCell(cell_t offset)
+{
+  // Locals below frm may not have been stored yet. Everything further than
+  // |stack_depth_| below frm, minus the cached cells, has been.
+  if (ncached_ && offset < 0) {
+    int32_t stored = stack_depth_ - int32_t(ncached_ * sizeof(cell_t));
+    if (stack_depth_ < 0 || -int64_t(offset) > stored)
+      flushStackCache();
+  }
+  return Operand(frm, offset);
+}
+
+Operand
+Compiler::globalCell(cell_t offset)
+{
+  // The data section never overlaps the stack, but an out-of-range offset
+  // could.
+  if (ncached_ && (offset < 0 || ucell_t(offset) >= context_->DataSize()))
+    flushStackCache();
+  return Operand(dat, offset);
+}
+
+void
+Compiler::emitCheckAddress(Register reg)
+{
+  // Leave out checks that the range analysis proved always pass.
+  if (ranges_.isCheckRedundant(op_cip_ - code_start_))
+    return;
+
+  // Check if we're in memory bounds.
+  __ cmpl(reg, context_->HeapSize());
+  jumpOnError(not_below, SP_ERROR_MEMACCESS);
+
+  // Check if we're in the invalid region between hp and sp.
+  Label done;
+  __ cmpl(reg, hpAddr());
+  __ j(below, &done);
+  __ leaq(tmp, Operand(dat, reg, NoScale));
+  __ cmpq(tmp, stk);
+  jumpOnError(below, SP_ERROR_MEMACCESS);
+  __ bind(&done);
+}
+
+void
+Compiler::emitGenArray(bool autozero)
+{
+  cell_t val = readCell();
+  if (emitConstantGenArray(val, autozero))
+    return;
+
+  flushStackCache();
+
+  if (val == 1)
+  {
+    // flat array; we can generate this without indirection tables.
+    // Note that we can overwrite ALT because technically STACK should be destroying ALT
+    // The checks match PluginContext::generateArray(): the size in bytes must
+    // fit in 32 bits, and must be less than the space left below the stack.
+    __ movl(tmp, Operand(stk, 0));
+    __ cmpl(tmp, int32_t(UINT_MAX / sizeof(cell_t)));
+    jumpOnError(above, SP_ERROR_ARRAY_TOO_BIG);
+    __ movq(alt, stk);
+    __ subq(alt, dat);
+    __ subl(alt, hpAddr());
+    __ shll(tmp, 2);
+    __ cmpl(tmp, alt);
+    jumpOnError(not_below, SP_ERROR_HEAPLOW);
+    __ shrl(tmp, 2);
+
+    __ movl(alt, hpAddr());
+    __ movl(Operand(stk, 0), alt);    // store base of the array into the stack.
+    __ lea(alt, Operand(alt, tmp, ScaleFour));
+    __ movl(hpAddr(), alt);
+
+    __ movl(rdi, tmp);
+    __ shll(rdi, 2);
+    emitPushTracker(rdi);
+
+    if (autozero) {
+      // Note - tmp is rcx and still intact.
+      __ xorl(rax, rax);
+      __ movl(rdi, Operand(stk, 0));
+      __ addq(rdi, dat);
+      __ cld();
+      __ rep_stosd();
+    }
+  } else {
+    __ push(pri);
+    __ subq(rsp, 8);
+
+    // int GenerateArray(cx, vars[], uint32_t, cell_t *, int, unsigned *);
+    __ movl(ArgReg3, autozero ? 1 : 0);
+    __ movq(ArgReg2, stk);
+    __ movl(ArgReg1, val);
+    __ movq(ArgReg0, cxt);
+    __ callWithABI(Helper(JitHelper::GenerateFullArray));
+    __ addq(rsp, 8);
+
+    // restore pri to tmp
+    __ pop(tmp);
+
+    __ testl(rax, rax);
+    jumpOnError(not_zero);
+
+    // Move tmp back to pri, remove pushed args.
+    __ movl(pri, tmp);
+    __ addq(stk, (val - 1) * 4);
+  }
+}
+
+bool
+Compiler::emitCall()
+{
+  cell_t offset = readCell();
+
+  // If this offset looks crappy, i.e. not aligned or out of bounds, we just
+  // abort.
+  if (offset % 4 != 0 || uint32_t(offset) >= rt_->code().length) {
+    error_ = SP_ERROR_INSTRUCTION_PARAM;
+    return false;
+  }
+
+  // Off the main thread, the runtime's function map may be changing under
+  // us, so every call goes through a thunk. Cached code cannot refer to other
+  // functions directly either, since they may not be cached.
+  CompiledFunction *fun = (off_thread_ || rt_->code_cache())
+                          ? nullptr
+                          : rt_->GetJittedFunctionByOffset(offset);
+  if (!fun) {
+    // Need to emit a delayed thunk. This uses the same instruction sequence
+    // as an external call, so the thunk can retarget it.
+    CallThunk *thunk = new CallThunk(offset);
+    __ callAbsolute(&thunk->call);
+    thunk->return_pc = masm.pc();
+    if (!thunks_.append(thunk))
+      return false;
+  } else {
+    // Function is already emitted, we can do a direct call.
+    __ call(ExternalAddress(fun->GetEntryAddress()));
+  }
+
+  // Map the return address to the cip that started this call.
+  emitCipMapping(op_cip_);
+  return true;
+}
+
+void
+Compiler::emitCallThunks()
+{
+  for (size_t i = 0; i < thunks_.length(); i++) {
+    CallThunk *thunk = thunks_[i];
+
+    Label error;
+    __ bind(&thunk->call);
+
+    // Get the return address, since that is the call that we need to patch.
+    __ movq(rax, Operand(rsp, 0));
+
+    // Enter the exit frame. Since we were called from an aligned frame, this
+    // leaves the stack aligned.
+    __ enterExitFrame(ExitFrameType::Helper, 0);
+
+    // Reserve an aligned slot for the entry address.
+    __ subq(rsp, 16);
+
+    // Set arguments. ArgReg3 may alias rcx, so it goes first.
+    __ movq(ArgReg3, rax);
+    __ leaq(ArgReg2, Operand(rsp, 0));
+    __ movl(ArgReg1, thunk->pcode_offset);
+    __ movq(ArgReg0, ExternalAddress(rt_, MakeReloc(RelocKind::Runtime)));
+
+    __ callWithABI(Helper(JitHelper::CompileFromThunk));
+    __ movq(ScratchReg, Operand(rsp, 0));
+    __ leaveExitFrame();
+
+    __ testl(rax, rax);
+    jumpOnError(not_zero);
+
+    __ jmp(ScratchReg);
+  }
+}
+
+cell_t
+Compiler::readCell()
+{
+  if (cip_ >= code_end_) {
+    error_= SP_ERROR_INVALID_INSTRUCTION;
+    return 0;
+  }
+  return *cip_++;
+}
+
+bool
+Compiler::emitSysreqN()
+{
+  uint32_t native_index = readCell();
+
+  if (native_index >= image_->NumNatives()) {
+    error_ = SP_ERROR_INSTRUCTION_PARAM;
+    return false;
+  }
+
+  NativeEntry* native = rt_->NativeAt(native_index);
+  uint32_t nparams = readCell();
+
+  if (native->status == SP_NATIVE_BOUND &&
+      !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)))
+  {
+    uint32_t replacement = rt_->GetNativeReplacement(native_index);
+    if (replacement != OP_NOP) {
+      assumed_natives_.append(native_index);
+      return emitOp((OPCODE)replacement);
+    }
+
+    SP_INTRINSIC intrinsic = rt_->GetNativeIntrinsic(native_index, nparams);
+    if (intrinsic != SP_INTRINSIC_NONE) {
+      assumed_natives_.append(native_index);
+      emitIntrinsic(intrinsic);
+      __ addq(stk, nparams * sizeof(cell_t));
+      return true;
+    }
+
+    if (native->fast.func && native->fast.nargs == nparams) {
+      assumed_natives_.append(native_index);
+      emitFastNativeCall(native_index, native);
+      __ addq(stk, nparams * sizeof(cell_t));
+      return true;
+    }
+  }
+
+  // Store the number of parameters on the stack.
+  __ movl(Operand(stk, -4), nparams);
+  __ subq(stk, 4);
+  if (!emitLegacyNativeCall(native_index, native))
+    return false;
+  __ addq(stk, (nparams + 1) * sizeof(cell_t));
+
+  return true;
+}
+
+static const Register kFastIntArgs[] = { ArgReg0, ArgReg1, ArgReg2, ArgReg3 };
+static const FloatRegister kFastFloatArgs[] = { xmm0, xmm1, xmm2, xmm3 };
+
+// Call a fast native directly, with its arguments in registers. The arguments
+// are on the stack, and are popped by the caller. A fast native cannot fail
+// or re-enter the VM, so there is no exit frame, and only ALT needs saving.
+void
+Compiler::emitFastNativeCall(uint32_t native_index, NativeEntry *native)
+{
+  const sp_fastnative_t &fast = native->fast;
+
+  // Check references before setting anything up, so errors need no cleanup.
+  // pri is about to be overwritten by the return value anyway.
+  for (uint32_t i = 0; i < fast.nargs; i++) {
+    if (fast.args[i] != SP_FASTARG_REF)
+      continue;
+    __ movl(pri, Operand(stk, i * sizeof(cell_t)));
+    emitCheckAddress(pri);
+  }
+
+  // Save ALT. This keeps the stack aligned.
+  __ subq(rsp, 16);
+  __ movq(Operand(rsp, 0), alt);
+
+  // Windows assigns argument registers by position. System V numbers
+  // integer and float registers separately.
+  size_t nints = 0;
+  size_t nfloats = 0;
+  for (uint32_t i = 0; i < fast.nargs; i++) {
+#if defined(_WIN64)
+    nints = nfloats = i;
+#endif
+    Operand arg(stk, i * sizeof(cell_t));
+    switch (fast.args[i]) {
+      case SP_FASTARG_FLOAT:
+        __ movss(kFastFloatArgs[nfloats++], arg);
+        break;
+      case SP_FASTARG_REF:
+        __ movl(kFastIntArgs[nints], arg);
+        __ addq(kFastIntArgs[nints++], dat);
+        break;
+      default:
+        __ movl(kFastIntArgs[nints++], arg);
+        break;
+    }
+  }
+
+  __ callWithABI(ExternalAddress(fast.func, MakeReloc(RelocKind::FastNative, native_index)));
+
+  // Only the low half of rax is defined for a cell return, and pri must
+  // have its upper half clear.
+  if (fast.ret == SP_FASTARG_FLOAT)
+    __ movd(pri, xmm0);
+  else
+    __ movl(pri, rax);
+
+  // Restore ALT.
+  __ movq(alt, Operand(rsp, 0));
+  __ addq(rsp, 16);
+}
+
+static const FloatRegister kVectorRegs[] = { xmm0, xmm1, xmm2 };
+
+// Emit an intrinsic in place of a native call. The arguments are on the
+// stack, and are popped by the caller. ALT must be preserved, as it would be
+// across the call.
+void
+Compiler::emitIntrinsic(SP_INTRINSIC intrinsic)
+{
+  switch (intrinsic) {
+    case SP_INTRINSIC_ABS:
+    {
+      Label done;
+      __ movl(pri, Operand(stk, 0));
+      __ testl(pri, pri);
+      __ j(not_negative, &done);
+      __ negl(pri);
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_MIN:
+    case SP_INTRINSIC_MAX:
+    {
+      Label done;
+      __ movl(pri, Operand(stk, 0));
+      __ cmpl(pri, Operand(stk, 4));
+      __ j(intrinsic == SP_INTRINSIC_MIN ? less_equal : greater_equal, &done);
+      __ movl(pri, Operand(stk, 4));
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_CLAMP:
+    {
+      Label above_min, done;
+      __ movl(pri, Operand(stk, 0));
+      __ cmpl(pri, Operand(stk, 4));
+      __ j(greater_equal, &above_min);
+      __ movl(pri, Operand(stk, 4));
+      __ jmp(&done);
+      __ bind(&above_min);
+      __ cmpl(pri, Operand(stk, 8));
+      __ j(less_equal, &done);
+      __ movl(pri, Operand(stk, 8));
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_BIT_TEST:
+      // Shifts only use the low five bits of cl.
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, 4));
+      __ shrl_cl(pri);
+      __ andl(pri, 1);
+      break;
+
+    case SP_INTRINSIC_BIT_COUNT:
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, pri);
+      __ shrl(tmp, 1);
+      __ andl(tmp, 0x55555555);
+      __ subl(pri, tmp);
+      __ movl(tmp, pri);
+      __ shrl(tmp, 2);
+      __ andl(tmp, 0x33333333);
+      __ andl(pri, 0x33333333);
+      __ addl(pri, tmp);
+      __ movl(tmp, pri);
+      __ shrl(tmp, 4);
+      __ addl(pri, tmp);
+      __ andl(pri, 0x0f0f0f0f);
+      __ imull(pri, pri, 0x01010101);
+      __ shrl(pri, 24);
+      break;
+
+    case SP_INTRINSIC_VECTOR_ADD:
+    case SP_INTRINSIC_VECTOR_SUB:
+      emitCheckVector(0);
+      emitCheckVector(4);
+      emitCheckVector(8);
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, 4));
+      for (int32_t i = 0; i < 3; i++) {
+        __ movss(kVectorRegs[i], Operand(dat, pri, NoScale, i * 4));
+        if (intrinsic == SP_INTRINSIC_VECTOR_ADD)
+          __ addss(kVectorRegs[i], Operand(dat, tmp, NoScale, i * 4));
+        else
+          __ subss(kVectorRegs[i], Operand(dat, tmp, NoScale, i * 4));
+      }
+      __ movl(pri, Operand(stk, 8));
+      for (int32_t i = 0; i < 3; i++)
+        __ movss(Operand(dat, pri, NoScale, i * 4), kVectorRegs[i]);
+      break;
+
+    case SP_INTRINSIC_VECTOR_DOT:
+    case SP_INTRINSIC_VECTOR_LENGTH:
+    {
+      // The length is the square root of the vector's dot product with
+      // itself.
+      int32_t other = (intrinsic == SP_INTRINSIC_VECTOR_DOT) ? 4 : 0;
+      emitCheckVector(0);
+      if (other)
+        emitCheckVector(other);
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, other));
+
+      // Sum the products in the same order as the usual C++ natives.
+      __ movss(xmm0, Operand(dat, pri, NoScale, 0));
+      __ mulss(xmm0, Operand(dat, tmp, NoScale, 0));
+      for (int32_t i = 1; i < 3; i++) {
+        __ movss(xmm1, Operand(dat, pri, NoScale, i * 4));
+        __ mulss(xmm1, Operand(dat, tmp, NoScale, i * 4));
+        __ addss(xmm0, xmm1);
+      }
+      if (intrinsic == SP_INTRINSIC_VECTOR_LENGTH) {
+        Label squared;
+        __ cmpl(Operand(stk, 4), 0);
+        __ j(not_zero, &squared);
+        __ sqrtss(xmm0, xmm0);
+        __ bind(&squared);
+      }
+      __ movd(pri, xmm0);
+      break;
+    }
+
+    case SP_INTRINSIC_STRLEN:
+    {
+      Label loop, done;
+      __ movl(pri, Operand(stk, 0));
+      emitCheckAddress(pri);
+      __ leaq(tmp, Operand(dat, pri, NoScale));
+      __ bind(&loop);
+      __ movzxb(pri, Operand(tmp, 0));
+      __ testl(pri, pri);
+      __ j(zero, &done);
+      __ addq(tmp, 1);
+      __ jmp(&loop);
+      __ bind(&done);
+      __ subq(tmp, dat);
+      __ subl(tmp, Operand(stk, 0));
+      __ movl(pri, tmp);
+      break;
+    }
+
+    default:
+      assert(false);
+      break;
+  }
+}
+
+// Check that all three cells of the vector passed in the argument at
+// |offset| are valid. This clobbers pri.
+void
+Compiler::emitCheckVector(int32_t offset)
+{
+  __ movl(pri, Operand(stk, offset));
+  emitCheckAddress(pri);
+  __ addl(pri, 2 * sizeof(cell_t));
+  emitCheckAddress(pri);
+}
+
+bool
+Compiler::emitSysreqC()
+{
+  uint32_t native_index = readCell();
+
+  if (native_index >= image_->NumNatives()) {
+    error_ = SP_ERROR_INSTRUCTION_PARAM;
+    return false;
+  }
+
+  return emitLegacyNativeCall(native_index, rt_->NativeAt(native_index));
+}
+
+bool
+Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
+{
+  if (native->status == SP_NATIVE_BOUND &&
+      (native->flags & (SP_NTVFLAG_LEAF|SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)) ==
+        SP_NTVFLAG_LEAF)
+  {
+    emitLeafNativeCall(native_index, native);
+    return true;
+  }
+
+  Label return_address;
+  __ enterInlineExitFrame(ExitFrameType::Native, native_index, &return_address);
+
+  // Save ALT and the old heap pointer. This keeps the stack aligned.
+  __ subq(rsp, 16);
+  __ movq(Operand(rsp, 8), alt);
+  __ movl(tmp, hpAddr());
+  __ movl(Operand(rsp, 0), tmp);
+
+  // Check whether the native is bound.
+  bool immutable = native->status == SP_NATIVE_BOUND &&
+                   !(native->flags & (SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL));
+  if (immutable) {
+    assumed_natives_.append(native_index);
+  } else {
+    __ movq(rax, ExternalAddress(&native->legacy_fn,
+                                 MakeReloc(RelocKind::NativeSlot, native_index)));
+    __ movq(rax, Operand(rax, 0));
+    __ testq(rax, rax);
+    jumpOnError(zero, SP_ERROR_INVALID_NATIVE);
+  }
+
+  // The second parameter is the absolute stack address.
+  __ movq(ArgReg1, stk);
+
+  // Relocate our absolute stk to be dat-relative, and update the context's
+  // view.
+  __ subq(stk, dat);
+  __ movl(spAddr(), stk);
+
+  // The first parameter is the context.
+  __ movq(ArgReg0, cxt);
+
+  // Invoke the native. The return address must be bound immediately after
+  // the call, so we cannot use callWithABI().
+  if (kShadowSpace)
+    __ subq(rsp, kShadowSpace);
+  if (immutable && native->is_linked) {
+    // Skip the stub, and pass the native's entry as the third parameter.
+    // ALT is already saved, so it is safe to clobber on SysV.
+    __ movq(ArgReg2, ExternalAddress(native,
+                                     MakeReloc(RelocKind::LinkedFunction, native_index)));
+    __ call(Helper(JitHelper::InvokeLinkedNative));
+  } else if (immutable) {
+    __ call(ExternalAddress((void *)native->legacy_fn,
+                            MakeReloc(RelocKind::NativeFunction, native_index)));
+  } else {
+    __ call(rax);
+  }
+  __ bind(&return_address);
+  // Map the return address to the cip that initiated this call.
+  emitCipMapping(op_cip_);
+  if (kShadowSpace)
+    __ addq(rsp, kShadowSpace);
+
+  // Restore the heap pointer.
+  __ movl(tmp, Operand(rsp, 0));
+  __ movl(hpAddr(), tmp);
+
+  // Restore ALT.
+  __ movq(alt, Operand(rsp, 8));
+
+  // Restore SP.
+  __ addq(stk, dat);
+
+  // Note: no ret, the frame is inline. We add 8 to rsp instead.
+  __ leaveExitFrame();
+  __ addq(rsp, 8);
+
+  // Check for errors. Note we jump directly to the return stub since the
+  // error has already been reported.
+  __ movq(ScratchReg, Helper(JitHelper::ExceptionCode));
+  __ cmpl(Operand(ScratchReg, 0), 0);
+  __ j(not_zero, &return_reported_error_);
+  return true;
+}
+
+// Call a native that has promised not to throw, call into a plugin, or use
+// the heap. It still gets an exit frame, so stack traces taken from inside it
+// work, but the heap pointer is not saved, the context's sp is not updated,
+// and there is no exception check afterward.
+void
+Compiler::emitLeafNativeCall(uint32_t native_index, NativeEntry* native)
+{
+  assumed_natives_.append(native_index);
+
+  Label return_address;
+  __ enterInlineExitFrame(ExitFrameType::Native, native_index, &return_address);
+
+  // Save ALT. This keeps the stack aligned.
+  __ subq(rsp, 16);
+  __ movq(Operand(rsp, 8), alt);
+
+  __ movq(ArgReg1, stk);
+  __ movq(ArgReg0, cxt);
+
+  if (kShadowSpace)
+    __ subq(rsp, kShadowSpace);
+  __ call(ExternalAddress((void *)native->legacy_fn,
+                          MakeReloc(RelocKind::NativeFunction, native_index)));
+  __ bind(&return_address);
+  emitCipMapping(op_cip_);
+  if (kShadowSpace)
+    __ addq(rsp, kShadowSpace);
+
+  __ movq(alt, Operand(rsp, 8));
+
+  __ leaveExitFrame();
+  __ addq(rsp, 8);
+}
+
+bool
+Compiler::emitSwitch()
+{
+  // The analysis pass has checked that this is a case table in this function.
+  cell_t offset = readCell();
+  cell_t *tbl = (cell_t *)((char *)rt_->code().bytes + offset + sizeof(cell_t));
+
+  size_t ncases = *tbl++;
+
+  Label *defaultCase = labelAt(*tbl);
+  if (!defaultCase)
+    return false;
+
+  // Degenerate - 0 cases.
+  if (!ncases) {
+    __ jmp(defaultCase);
+    return true;
+  }
+
+  const CaseEntry *cases = (const CaseEntry *)(tbl + 1);
+
+  // The interpreter takes the first case that matches. The compiler sorts
+  // case tables, but if one is not strictly ascending, test each case in
+  // order like the interpreter does.
+  for (size_t i = 1; i < ncases; i++) {
+    if (cases[i].val <= cases[i - 1].val)
+      return emitCaseChain(cases, ncases, defaultCase);
+  }
+  return emitCaseRange(cases, ncases, defaultCase);
+}
+
+// Runs of at most this many cases are tested one by one.
+static const size_t kMaxCaseChain = 4;
+
+// A run of cases becomes a jump table if at least one in this many slots
+// would be used, and the table is no larger than kMaxCaseTable slots.
+static const int64_t kCaseTableDensity = 3;
+static const int64_t kMaxCaseTable = 4096;
+
+// Emit a search for pri in a sorted run of cases. A dense run becomes a jump
+// table, with the holes going to the default case. Otherwise the run is split
+// in two around its middle value, and each half is lowered the same way, so
+// large sparse switches become a binary search over small compare chains and
+// dense clusters.
+bool
+Compiler::emitCaseRange(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  if (ncases <= kMaxCaseChain)
+    return emitCaseChain(cases, ncases, defaultCase);
+
+  int64_t slots = int64_t(cases[ncases - 1].val) - int64_t(cases[0].val) + 1;
+  if (slots <= kMaxCaseTable && slots <= int64_t(ncases) * kCaseTableDensity)
+    return emitCaseTable(cases, ncases, defaultCase);
+
+  size_t mid = ncases / 2;
+  Label lower;
+  __ cmpl(pri, cases[mid].val);
+  __ j(less, &lower);
+  bool ok = emitCaseRange(cases + mid, ncases - mid, defaultCase);
+  __ bind(&lower);
+  return ok && emitCaseRange(cases, mid, defaultCase);
+}
+
+bool
+Compiler::emitCaseChain(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  for (size_t i = 0; i < ncases; i++) {
+    Label *label = labelAt(cases[i].offset);
+    if (!label)
+      return false;
+    __ cmpl(pri, cases[i].val);
+    __ j(equal, label);
+  }
+  __ jmp(defaultCase);
+  return true;
+}
+
+bool
+Compiler::emitCaseTable(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  // Rebase pri so the first case is 0. Values below it wrap around to large
+  // unsigned numbers, so one compare checks both bounds.
+  cell_t low = cases[0].val;
+  cell_t high = cases[ncases - 1].val;
+  if (low != 0)
+    __ lea(tmp, Operand(pri, cell_t(0u - uint32_t(low))));
+  else
+    __ movl(tmp, pri);
+  __ cmpl(tmp, cell_t(uint32_t(high) - uint32_t(low)));
+  __ j(above, defaultCase);
+
+  // Each entry is a 32-bit displacement from the end of that entry, so the
+  // table needs no relocation.
+  Label table;
+  __ leaq(ScratchReg, &table);
+  __ leaq(ScratchReg, Operand(ScratchReg, tmp, ScaleFour, 4));
+  __ movslq(tmp, Operand(ScratchReg, -4));
+  __ addq(ScratchReg, tmp);
+  __ jmp(ScratchReg);
+
+  __ bind(&table);
+  size_t i = 0;
+  for (int64_t value = low; value <= high; value++) {
+    Label *label = defaultCase;
+    if (cases[i].val == value) {
+      if ((label = labelAt(cases[i].offset)) == nullptr)
+        return false;
+      i++;
+    }
+    __ emit_relative_address(label);
+  }
+  return true;
+}
+
+void
+Compiler::emitFloatCmp(ConditionCode cc)
+{
+  unsigned lhs = 4;
+  unsigned rhs = 0;
+  if (cc == below || cc == below_equal) {
+    // NaN results in ZF=1 PF=1 CF=1
+    //
+    // ja/jae check for ZF,CF=0 and CF=0. If we make all relational compares
+    // look like ja/jae, we'll guarantee all NaN comparisons will fail (which
+    // would not be true for jb/jbe, unless we checked with jp).
+    if (cc == below)
+      cc = above;
+    else
+      cc = above_equal;
+    rhs = 4;
+    lhs = 0;
+  }
+
+  __ movss(xmm0, Operand(stk, rhs));
+  __ ucomiss(Operand(stk, lhs), xmm0);
+
+  // An equal or not-equal needs special handling for the parity bit.
+  if (cc == equal || cc == not_equal) {
+    // If NaN, PF=1, ZF=1, and E/Z tests ZF=1.
+    //
+    // If NaN, PF=1, ZF=1 and NE/NZ tests Z=0. But, we want any != with NaNs
+    // to return true, including NaN != NaN.
+    //
+    // To make checks simpler, we set |eax| to the expected value of a NaN
+    // beforehand. This also clears the top bits of |eax| for setcc.
+    Label done;
+    __ movl(rax, (cc == equal) ? 0 : 1);
+    __ j(parity, &done);
+    __ set(cc, r8_al);
+    __ bind(&done);
+  } else {
+    __ movl(rax, 0);
+    __ set(cc, r8_al);
+  }
+  __ addq(stk, 8);
+}
+
+void
+Compiler::jumpOnError(ConditionCode cc, int err)
+{
+  // Note: we accept 0 for err. In this case we expect the error to be in eax.
+  {
+    ErrorPath path(op_cip_, err);
+    error_paths_.append(path);
+  }
+
+  ErrorPath &path = error_paths_.back();
+  __ j(cc, &path.label);
+}
+
+// Same as PluginContext::generateFullArray(), for when every dimension is a
+// cached constant. The layout of the indirection vectors is worked out here,
+// so each level is stamped with stores of precomputed offsets.
+bool
+Compiler::emitConstantGenArray(uint32_t dimcount, bool autozero)
+{
+  if (dimcount < 2 || dimcount > ncached_)
+    return false;
+
+  // Stack order, innermost dimension first.
+  cell_t dims[kMaxCachedCells];
+  for (uint32_t i = 0; i < dimcount; i++) {
+    const CachedCell &cell = cached_cells_[ncached_ - 1 - i];
+    if (!cell.is_constant || cell.value <= 0)
+      return false;
+    dims[i] = cell.value;
+  }
+
+  // Anything too big is left for generateFullArray() to report.
+  uint64_t cells = dims[0];
+  for (uint32_t i = 1; i < dimcount; i++) {
+    cells = cells * dims[i] + dims[i];
+    if (cells * sizeof(cell_t) > INT_MAX / 2)
+      return false;
+  }
+  int32_t bytes = int32_t(cells * sizeof(cell_t));
+
+  // The dimensions are consumed. Anything cached beneath them has to be
+  // stored, since the heap check below is against stk.
+  ncached_ -= dimcount;
+  if (stack_depth_ >= 0)
+    stack_depth_ -= dimcount * sizeof(cell_t);
+  flushStackCache();
+
+  // alt holds the array's address. The heap check leaves room for the
+  // dimensions, which generateFullArray() would have found on the stack.
+  __ movl(alt, hpAddr());
+  __ leaq(tmp, Operand(dat, alt, NoScale, bytes));
+  __ leaq(rdi, Operand(stk, -int32_t((dimcount + STACK_MARGIN) * sizeof(cell_t))));
+  __ cmpq(tmp, rdi);
+  jumpOnError(not_below, SP_ERROR_HEAPLOW);
+
+  __ movl(rdi, bytes);
+  emitPushTracker(rdi);
+  __ addl(hpAddr(), bytes);
+
+  // Stamp each level. rdi ends up at the start of the data.
+  static const uint32_t kMaxUnrolledStores = 8;
+
+  __ leaq(rdi, Operand(dat, alt, NoScale));
+  uint32_t count = 1;
+  uint32_t data_cells = uint32_t(cells);
+  for (uint32_t level = dimcount - 1; level > 0; level--) {
+    count *= uint32_t(dims[level]);
+    data_cells -= count;
+
+    cell_t offset = count * sizeof(cell_t);
+    cell_t step = (dims[level - 1] - 1) * sizeof(cell_t);
+    if (count <= kMaxUnrolledStores) {
+      for (uint32_t i = 0; i < count; i++)
+        __ movl(Operand(rdi, i * sizeof(cell_t)), offset + i * step);
+      __ addq(rdi, count * sizeof(cell_t));
+    } else {
+      Label loop;
+      __ movl(r11, offset);
+      __ movl(tmp, count);
+      __ bind(&loop);
+      __ movl(Operand(rdi, 0), r11);
+      __ addq(rdi, sizeof(cell_t));
+      __ addl(r11, step);
+      __ subl(tmp, 1);
+      __ j(not_zero, &loop);
+    }
+  }
+
+  // Zero the data eight bytes at a time.
+  if (autozero) {
+    uint32_t qwords = data_cells / 2;
+    if (qwords <= kMaxUnrolledStores) {
+      for (uint32_t i = 0; i < qwords; i++)
+        __ movq(Operand(rdi, i * 8), 0);
+    } else {
+      __ movl(r11, pri);
+      __ xorl(rax, rax);
+      __ movl(tmp, qwords);
+      __ cld();
+      __ rep_stosq();
+      __ movl(pri, r11);
+    }
+    if (data_cells & 1) {
+      int32_t disp = (qwords <= kMaxUnrolledStores) ? qwords * 8 : 0;
+      __ movl(Operand(rdi, disp), 0);
+    }
+  }
+
+  __ movl(cacheCell(), alt);
+  return true;
+}
+
+// Same as PluginContext::pushTracker(). Clobbers r11.
+void
+Compiler::emitPushTracker(Register amount)
+{
+  __ movq(r11, trackerCurAddr());
+  __ cmpq(r11, trackerLimitAddr());
+  jumpOnError(not_below, SP_ERROR_TRACKER_BOUNDS);
+  __ movl(Operand(r11, 0), amount);
+  __ addq(r11, sizeof(cell_t));
+  __ movq(trackerCurAddr(), r11);
+}
+
+void
+Compiler::emitErrorPaths()
+{
+  // For each path that had an error check, bind it to an error routine and
+  // add it to the cip map. What we'll get is something like:
+  //
+  //   cmp dividend, 0
+  //   jz error_thunk_0
+  //
+  // error_thunk_0:
+  //   call integer_overflow
+  //
+  // integer_overflow:
+  //   mov eax, SP_ERROR_DIVIDE_BY_ZERO
+  //   jmp report_error
+  //
+  // report_error:
+  //   create exit frame
+  //   push eax
+  //   call InvokeReportError(int err)
+  //
+  for (size_t i = 0; i < error_paths_.length(); i++) {
+    ErrorPath &path = error_paths_[i];
+
+    // If there's no error code, it should be in eax. Otherwise we'll jump to
+    // a path that sets eax to a hardcoded value.
+    __ bind(&path.label);
+    if (path.err == 0)
+      __ call(&report_error_);
+    else
+      __ call(&throw_error_code_[path.err]);
+
+    emitCipMapping(path.cip);
+  }
+
+  emitThrowPathIfNeeded(SP_ERROR_DIVIDE_BY_ZERO);
+  emitThrowPathIfNeeded(SP_ERROR_STACKLOW);
+  emitThrowPathIfNeeded(SP_ERROR_STACKMIN);
+  emitThrowPathIfNeeded(SP_ERROR_ARRAY_BOUNDS);
+  emitThrowPathIfNeeded(SP_ERROR_MEMACCESS);
+  emitThrowPathIfNeeded(SP_ERROR_HEAPLOW);
+  emitThrowPathIfNeeded(SP_ERROR_HEAPMIN);
+  emitThrowPathIfNeeded(SP_ERROR_ARRAY_TOO_BIG);
+  emitThrowPathIfNeeded(SP_ERROR_TRACKER_BOUNDS);
+  emitThrowPathIfNeeded(SP_ERROR_INTEGER_OVERFLOW);
+  emitThrowPathIfNeeded(SP_ERROR_INVALID_NATIVE);
+
+  Label return_to_invoke;
+
+  if (report_error_.used()) {
+    __ bind(&report_error_);
+
+    // Create the exit frame. We always get here through a call from the opcode
+    // (and always via an out-of-line thunk).
+    __ enterExitFrame(ExitFrameType::Helper, 0);
+
+    // Error checks can be made while the stack is unaligned (for example,
+    // halfway through a native call), so align it here.
+    __ andq(rsp, -16);
+    __ movl(ArgReg0, rax);
+    __ callWithABI(Helper(JitHelper::ReportError));
+    __ leaveExitFrame();
+    __ jmp(&return_to_invoke);
+  }
+
+  // The timeout uses a special stub.
+  if (throw_timeout_.used()) {
+    __ bind(&throw_timeout_);
+
+    // Create the exit frame.
+    __ enterExitFrame(ExitFrameType::Helper, 0);
+
+    // Since the return stub wipes out the stack, we don't need to addq after
+    // the call.
+    __ andq(rsp, -16);
+    __ callWithABI(Helper(JitHelper::ReportTimeout));
+    __ leaveExitFrame();
+    __ jmp(&return_reported_error_);
+  }
+
+  // We get here if we know an exception is already pending.
+  if (return_reported_error_.used()) {
+    __ bind(&return_reported_error_);
+    __ call(&return_to_invoke);
+  }
+
+  if (return_to_invoke.used()) {
+    __ bind(&return_to_invoke);
+
+    // We get here either through an explicit call, or a call that terminated
+    // in a tail-jmp here.
+    __ enterExitFrame(ExitFrameType::Helper, 0);
+
+    // We cannot jump to the return stub just yet. We could be multiple frames
+    // deep, and our |rbp| does not match the initial frame. Find and restore
+    // it now.
+    __ andq(rsp, -16);
+    __ callWithABI(Helper(JitHelper::FindEntryFp));
+    __ leaveExitFrame();
+
+    __ movq(rbp, rax);
+    __ jmp(Helper(JitHelper::ReturnStub));
+  }
+}
+
+void
+Compiler::emitThrowPathIfNeeded(int err)
+{
+  assert(err < SP_MAX_ERROR_CODES);
+
+  if (!throw_error_code_[err].used())
+    return;
+
+  __ bind(&throw_error_code_[err]);
+  __ movl(rax, err);
+  __ jmp(&report_error_);
+}
@@ -0,0 +1,266 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _INCLUDE_SOURCEPAWN_JIT_X64_H_
+#define _INCLUDE_SOURCEPAWN_JIT_X64_H_
+
+#include <sp_vm_types.h>
+#include <sp_vm_api.h>
+#include <am-vector.h>
+#include "plugin-runtime.h"
+#include "plugin-context.h"
+#include "compiled-function.h"
+#include "function-analysis.h"
+#include "range-analysis.h"
+#include "opcodes.h"
+#include "macro-assembler-x64.h"
+
+using namespace SourcePawn;
+
+namespace sp {
+class LegacyImage;
+class Environment;
+class CompiledFunction;
+class CodeCache;
+
+// pri and alt hold cells, so they are only ever written with 32-bit
+// operations. This keeps their upper halves zero, so they can be used
+// directly as indexes off dat. stk, dat, frm, and cxt hold pointers and are
+// all non-volatile, so they survive calls into C++.
+const Register pri = rax;
+const Register alt = rdx;
+const Register stk = rbx;
+const Register dat = r14;
+const Register tmp = rcx;
+const Register frm = r15;
+const Register cxt = r12;
+
+struct ErrorPath
+{
+  SilentLabel label;
+  const cell_t *cip;
+  int err;
+
+  ErrorPath(const cell_t *cip, int err)
+   : cip(cip),
+     err(err)
+  {}
+  ErrorPath()
+  {}
+};
+
+struct BackwardJump {
+  // The pc at the jump instruction (i.e. after it).
+  uint32_t pc;
+  // The cip of the jump.
+  const cell_t *cip;
+  // The offset of the timeout thunk. This is filled in at the end.
+  uint32_t timeout_offset;
+
+  BackwardJump()
+  {}
+  BackwardJump(uint32_t pc, const cell_t *cip)
+   : pc(pc),
+     cip(cip)
+  {}
+};
+
+#define JIT_INLINE_ERRORCHECKS  (1<<0)
+#define JIT_INLINE_NATIVES      (1<<1)
+#define STACK_MARGIN            64      //8 parameters of safety, I guess
+#define JIT_FUNCMAGIC           0x214D4148  //magic function offset
+
+#define JITVARS_PROFILER        2    //profiler
+
+#define sDIMEN_MAX              5    //this must mirror what the compiler has.
+
+struct CallThunk
+{
+  SilentLabel call;
+  cell_t pcode_offset;
+  // The return address of the call, relative to the start of the code.
+  uint32_t return_pc;
+
+  CallThunk(cell_t pcode_offset)
+    : pcode_offset(pcode_offset),
+      return_pc(0)
+  {
+  }
+};
+
+class Compiler
+{
+ public:
+  Compiler(PluginRuntime *rt, cell_t pcode_offs, bool off_thread);
+  ~Compiler();
+
+  sp::CompiledFunction *emit(int *errp);
+
+  // emit() is split in two for background compilation. assemble() may run
+  // on any thread if |off_thread| was set, since it does not look at
+  // anything the main thread can change. link() must run on the main thread.
+  bool assemble(int *errp);
+  sp::CompiledFunction *link(int *errp);
+
+  cell_t pcode_offset() const {
+    return pcode_start_;
+  }
+  // Calls to functions that were not compiled yet.
+  const ke::Vector<CallThunk *> &callThunks() const {
+    return thunks_;
+  }
+
+ private:
+  bool setup(cell_t pcode_offs);
+  void addToCodeCache(CodeCache *cache);
+  bool emitOp(sp::OPCODE op);
+  cell_t readCell();
+
+ private:
+  // An entry in a CASETBL.
+  struct CaseEntry {
+    cell_t val;
+    cell_t offset;
+  };
+
+  Label *labelAt(size_t offset);
+  bool emitCall();
+  bool emitSysreqN();
+  bool emitLegacyNativeCall(uint32_t native_index, NativeEntry* native);
+  void emitLeafNativeCall(uint32_t native_index, NativeEntry* native);
+  bool emitSysreqC();
+  void emitIntrinsic(SP_INTRINSIC intrinsic);
+  void emitFastNativeCall(uint32_t native_index, NativeEntry *native);
+  void emitCheckVector(int32_t offset);
+  bool emitSwitch();
+  bool emitCaseRange(const CaseEntry *cases, size_t ncases, Label *defaultCase);
+  bool emitCaseChain(const CaseEntry *cases, size_t ncases, Label *defaultCase);
+  bool emitCaseTable(const CaseEntry *cases, size_t ncases, Label *defaultCase);
+  void emitGenArray(bool autozero);
+  bool emitConstantGenArray(uint32_t dimcount, bool autozero);
+  void emitCallThunks();
+  void emitCheckAddress(Register reg);
+  void emitErrorPath(Label *dest, int code);
+  void emitErrorPaths();
+  void emitFloatCmp(ConditionCode cc);
+  void jumpOnError(ConditionCode cc, int err = 0);
+  void emitPushTracker(Register amount);
+  void emitThrowPathIfNeeded(int err);
+
+  // Stack cache helpers. Pushes within a basic block are held in registers
+  // (or remembered as constants) instead of being stored, and pops take them
+  // straight back. The stores and the update to stk are only emitted when
+  // flushStackCache() is called: before any instruction that looks at the
+  // stack in memory, calls out, or ends the block.
+  static bool CanUseStackCache(OPCODE op);
+  void flushStackCache();
+  Register freeCacheRegister();
+  Register cacheCell();
+  void cacheConstant(cell_t value);
+  void popCachedCell(Register dest);
+
+  // Return an operand for a frame-relative or global cell, first flushing the
+  // stack cache if the cell could be one of those not stored yet.
+  Operand frameCell(cell_t offset);
+  Operand globalCell(cell_t offset);
+
+  // Generated code is not guaranteed to be within 2GB of the context, so
+  // context fields are addressed relative to |cxt| instead.
+  Operand hpAddr() {
+    return Operand(cxt, PluginContext::offsetOfHp());
+  }
+  Operand frmAddr() {
+    return Operand(cxt, PluginContext::offsetOfFrm());
+  }
+  Operand spAddr() {
+    return Operand(cxt, PluginContext::offsetOfSp());
+  }
+  Operand trackerBaseAddr() {
+    return Operand(cxt, PluginContext::offsetOfTrackerBase());
+  }
+  Operand trackerCurAddr() {
+    return Operand(cxt, PluginContext::offsetOfTrackerCur());
+  }
+  Operand trackerLimitAddr() {
+    return Operand(cxt, PluginContext::offsetOfTrackerLimit());
+  }
+
+  // Map a return address (i.e. an exit point from a function) to its source
+  // cip. This lets us avoid tracking the cip during runtime. These are
+  // sorted by definition since we assemble and emit in forward order.
+  void emitCipMapping(const cell_t *cip) {
+    CipMapEntry entry;
+    entry.cipoffs = uintptr_t(cip) - uintptr_t(code_start_);
+    entry.pcoffs = masm.pc();
+    cip_map_.append(entry);
+  }
+
+ private:
+  MacroAssemblerX64 masm;
+  Environment *env_;
+  PluginRuntime *rt_;
+  PluginContext *context_;
+  LegacyImage *image_;
+  int error_;
+  uint32_t pcode_start_;
+  const cell_t *code_start_;
+  const cell_t *cip_;
+  const cell_t *op_cip_;
+  const cell_t *code_end_;
+  FunctionAnalysis analysis_;
+  RangeAnalysis ranges_;
+  Label *jump_map_;
+  bool off_thread_;
+  ke::Vector<uint32_t> assumed_natives_;
+  ke::Vector<BackwardJump> backward_jumps_;
+  ke::Vector<CipMapEntry> cip_map_;
+
+  // Stack cache, from the bottom up. |stack_depth_| is the number of bytes
+  // between frm and the top of the stack, including cached cells, or
+  // negative if it is not known.
+  struct CachedCell {
+    bool is_constant;
+    Register reg;
+    cell_t value;
+  };
+  static const size_t kMaxCachedCells = 4;
+  CachedCell cached_cells_[kMaxCachedCells];
+  size_t ncached_;
+  int32_t stack_depth_;
+
+  // Errors.
+  ke::Vector<ErrorPath> error_paths_;
+  Label throw_timeout_;
+  Label throw_error_code_[SP_MAX_ERROR_CODES];
+  Label report_error_;
+  Label return_reported_error_;
+
+  ke::Vector<CallThunk *> thunks_; //:TODO: free
+};
+
+CompiledFunction *
+CompileFunction(PluginRuntime *prt, cell_t pcode_offs, int *err);
+
+// Point a call that goes through a thunk directly at its target, given the
+// call's return address.
+void
+PatchCallThunk(uint8_t *pc, CompiledFunction *fn);
+
+// Identifies this build of the JIT to the code cache. Returns null if the
+// JIT's output cannot be cached.
+const char *
+CodeCacheBuildId();
+
+}
+
+#endif //_INCLUDE_SOURCEPAWN_JIT_X64_H_
+
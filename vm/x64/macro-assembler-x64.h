@@ -0,0 +1,71 @@
+// vim: set sts=2 ts=8 sw=2 tw=99 et:
+//
+// Copyright (C) 2006-2015 AlliedModders LLC
+//
+// This file is part of SourcePawn. SourcePawn is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// You should have received a copy of the GNU General Public License along with
+// SourcePawn. If not, see http://www.gnu.org/licenses/.
+//
+#ifndef _include_sourcepawn_macroassembler_x64_h__
+#define _include_sourcepawn_macroassembler_x64_h__
+
+#include <assembler.h>
+#include <am-vector.h>
+#include <string.h>
+#include "assembler-x64.h"
+#include "stack-frames.h"
+#include "environment.h"
+#include "code-cache.h"
+
+namespace sp {
+
+class MacroAssemblerX64 : public AssemblerX64
+{
+ public:
+  void enterFrame(FrameType type, uintptr_t function_id) {
+    push(rbp);
+    movq(rbp, rsp);
+    // Both pushes sign-extend a 32-bit immediate.
+    assert(function_id <= uintptr_t(INT_MAX));
+    push(int32_t(type));
+    push(int32_t(function_id));
+  }
+  void leaveFrame() {
+    leave();
+  }
+  void enterExitFrame(ExitFrameType type, uintptr_t payload) {
+    enterFrame(FrameType::Exit, EncodeExitFrameId(type, payload));
+    movq(ScratchReg, ExternalAddress(Environment::get()->addressOfExit(),
+                                     MakeReloc(JitHelper::ExitFrame)));
+    movq(Operand(ScratchReg, 0), rbp);
+  }
+  void leaveExitFrame() {
+    leaveFrame();
+  }
+
+  // Inline exit frames are not entered via a call; instead they simulate a
+  // call by pushing a return address.
+  void enterInlineExitFrame(ExitFrameType type, uintptr_t payload, Label *return_address) {
+    leaq(ScratchReg, return_address);
+    push(ScratchReg);
+    enterExitFrame(type, payload);
+  }
+
+  // Call a C++ function. The stack must already be 16-byte aligned, and on
+  // Windows this reserves the callee's register home area.
+  void callWithABI(ExternalAddress address) {
+    if (kShadowSpace)
+      subq(rsp, kShadowSpace);
+    call(address);
+    if (kShadowSpace)
+      addq(rsp, kShadowSpace);
+  }
+};
+
+} // namespace sp
+
+#endif // _include_sourcepawn_macroassembler_x64_h__
@@ -766,7 +766,7 @@ class AssemblerX86 : public Assembler
       outOfMemory_ = true;
   }
   void jmp(ExternalAddress address) {
-    assert(sizeof(address) == sizeof(int32_t));
+    assert(sizeof(address.value()) == sizeof(int32_t));
     emit1(0xe9);
     writeInt32(address.value());
     if (!external_refs_.append(pc()))
@@ -784,6 +784,10 @@ class AssemblerX86 : public Assembler
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x10, dest.code, src);
   }
+  void movss(const Operand &dest, FloatRegister src) {
+    assert(Features().sse);
+    emit3(0xf3, 0x0f, 0x11, src.code, dest);
+  }
   void cvttss2si(Register dest, Register src) {
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x2c, dest.code, src.code);
@@ -812,6 +816,10 @@ class AssemblerX86 : public Assembler
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x58, dest.code, src);
   }
+  void addss(FloatRegister dest, FloatRegister src) {
+    assert(Features().sse);
+    emit3(0xf3, 0x0f, 0x58, dest.code, src.code);
+  }
   void subss(FloatRegister dest, const Operand &src) {
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x5c, dest.code, src);
@@ -820,6 +828,10 @@ class AssemblerX86 : public Assembler
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x59, dest.code, src);
   }
+  void sqrtss(FloatRegister dest, FloatRegister src) {
+    assert(Features().sse);
+    emit3(0xf3, 0x0f, 0x51, dest.code, src.code);
+  }
   void divss(FloatRegister dest, const Operand &src) {
     assert(Features().sse);
     emit3(0xf3, 0x0f, 0x5e, dest.code, src);
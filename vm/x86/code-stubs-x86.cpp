@@ -34,50 +34,45 @@ CodeStubs::InitializeFeatureDetection()
 }
 
 
-bool
-CodeStubs::CompileInvokeStub()
+static const intptr_t kContextOffset = 8 + 0 * sizeof(intptr_t);
+static const intptr_t kCodeOffset = 8 + 1 * sizeof(intptr_t);
+static const intptr_t kParamsOffset = 8 + 1 * sizeof(intptr_t);
+static const intptr_t kRvalOffset = 8 + 2 * sizeof(intptr_t);
+static const intptr_t kFpOffsetToPreAlignedSp = -20;
+
+// The invoke stub and entry trampolines share one frame layout, since the
+// return stub unwinds through it when a plugin throws.
+static void
+GenerateEntryPrologue(MacroAssemblerX86 &masm)
 {
-  MacroAssemblerX86 masm;
   __ enterFrame(FrameType::Entry, 0);
 
   __ push(esi);
   __ push(edi);
   __ push(ebx);
 
-  static const intptr_t kContextOffset = 8 + 0 * sizeof(intptr_t);
-  static const intptr_t kCodeOffset = 8 + 1 * sizeof(intptr_t);
-  static const intptr_t kRvalOffset = 8 + 2 * sizeof(intptr_t);
-  static const intptr_t kFpOffsetToPreAlignedSp = -20;
-
   // ebx = cx
   __ movl(ebx, Operand(ebp, kContextOffset));
 
-  // ecx = code
-  __ movl(ecx, Operand(ebp, kCodeOffset));
-
   // eax = cx->memory
   __ movl(eax, Operand(ebx, PluginContext::offsetOfMemory()));
 
-  // Set up run-time registers.
+  // Set up run-time registers, except for frm.
   __ movl(edi, Operand(ebx, PluginContext::offsetOfSp()));
   __ addl(edi, eax);
   __ movl(esi, eax);
-  __ movl(ebx, edi);
-
-  // Align the stack.
-  __ andl(esp, 0xfffffff0);
-
-  // Call into plugin.
-  __ call(ecx);
+}
 
+static void
+GenerateEntryEpilogue(MacroAssemblerX86 &masm, Label *ret)
+{
   // Store the rval.
   __ movl(ecx, Operand(ebp, kRvalOffset));
   __ movl(Operand(ecx, 0), pri);
 
   // Store latest stk. If we have an error code, we'll jump directly to here,
   // so eax will already be set.
-  Label ret;
-  __ bind(&ret);
+  __ bind(ret);
   __ subl(stk, dat);
   __ movl(ecx, Operand(ebp, kContextOffset));
   __ movl(Operand(ecx, PluginContext::offsetOfSp()), stk);
@@ -91,6 +86,26 @@ CodeStubs::CompileInvokeStub()
   __ pop(esi);
   __ leaveFrame();
   __ ret();
+}
+
+bool
+CodeStubs::CompileInvokeStub()
+{
+  MacroAssemblerX86 masm;
+  GenerateEntryPrologue(masm);
+
+  // ecx = code
+  __ movl(ecx, Operand(ebp, kCodeOffset));
+  __ movl(ebx, edi);
+
+  // Align the stack.
+  __ andl(esp, 0xfffffff0);
+
+  // Call into plugin.
+  __ call(ecx);
+
+  Label ret;
+  GenerateEntryEpilogue(masm, &ret);
 
   // The universal emergency return will jump to here.
   Label error;
@@ -105,6 +120,34 @@ CodeStubs::CompileInvokeStub()
   return true;
 }
 
+CodeChunk
+CodeStubs::CompileEntryTrampoline(void *code, unsigned int argc)
+{
+  MacroAssemblerX86 masm;
+  GenerateEntryPrologue(masm);
+
+  // Push argc and the parameters, copying straight from the caller's array.
+  // The caller has already checked that they fit.
+  __ subl(edi, int32_t((argc + 1) * sizeof(cell_t)));
+  __ movl(Operand(edi, 0), int32_t(argc));
+  __ movl(ecx, Operand(ebp, kParamsOffset));
+  for (unsigned int i = 0; i < argc; i++) {
+    __ movl(eax, Operand(ecx, i * sizeof(cell_t)));
+    __ movl(Operand(edi, (i + 1) * sizeof(cell_t)), eax);
+  }
+  __ movl(ebx, edi);
+
+  // Align the stack.
+  __ andl(esp, 0xfffffff0);
+
+  __ call(ExternalAddress(code));
+
+  Label ret;
+  GenerateEntryEpilogue(masm, &ret);
+
+  return LinkCode(env_, masm);
+}
+
 SPVM_NATIVE_FUNC
 CodeStubs::CreateFakeNativeStub(SPVM_FAKENATIVE_FUNC callback, void *pData)
 {
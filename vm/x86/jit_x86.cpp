@@ -80,7 +80,7 @@ OpToCondition(OPCODE op)
 CompiledFunction *
 sp::CompileFunction(PluginRuntime *prt, cell_t pcode_offs, int *err)
 {
-  Compiler cc(prt, pcode_offs);
+  Compiler cc(prt, pcode_offs, false);
   CompiledFunction *fun = cc.emit(err);
   if (!fun)
     return NULL;
@@ -102,6 +102,9 @@ CompileFromThunk(PluginRuntime *runtime, cell_t pcode_offs, void **addrp, char *
   if (!Environment::get()->watchdog()->HandleInterrupt())
     return SP_ERROR_TIMEOUT;
 
+  // The function may be waiting to be linked in from a background compile.
+  runtime->LinkBackgroundFunctions();
+
   CompiledFunction *fn = runtime->GetJittedFunctionByOffset(pcode_offs);
   if (!fn) {
     int err;
@@ -119,12 +122,26 @@ CompileFromThunk(PluginRuntime *runtime, cell_t pcode_offs, void **addrp, char *
 
   *addrp = fn->GetEntryAddress();
 
+  PatchCallThunk(reinterpret_cast<uint8_t *>(pc), fn);
+  return SP_ERROR_NONE;
+}
+
+void
+sp::PatchCallThunk(uint8_t *pc, CompiledFunction *fn)
+{
   /* Right now, we always keep the code RWE */
   *(intptr_t *)(pc - 4) = intptr_t(fn->GetEntryAddress()) - intptr_t(pc);
-  return SP_ERROR_NONE;
 }
 
-Compiler::Compiler(PluginRuntime *rt, cell_t pcode_offs)
+// x86 code embeds the addresses of plugin memory, and calls helpers with
+// relative displacements, so it is not worth caching.
+const char *
+sp::CodeCacheBuildId()
+{
+  return nullptr;
+}
+
+Compiler::Compiler(PluginRuntime *rt, cell_t pcode_offs, bool off_thread)
   : env_(Environment::get()),
     rt_(rt),
     context_(rt->GetBaseContext()),
@@ -133,10 +150,12 @@ Compiler::Compiler(PluginRuntime *rt, cell_t pcode_offs)
     pcode_start_(pcode_offs),
     code_start_(reinterpret_cast<const cell_t *>(rt_->code().bytes + pcode_start_)),
     cip_(code_start_),
-    code_end_(reinterpret_cast<const cell_t *>(rt_->code().bytes + rt_->code().length))
+    code_end_(reinterpret_cast<const cell_t *>(rt_->code().bytes + rt_->code().length)),
+    analysis_(rt, pcode_offs),
+    ranges_(rt, analysis_),
+    jump_map_(nullptr),
+    off_thread_(off_thread)
 {
-  size_t nmaxops = rt_->code().length / sizeof(cell_t) + 1;
-  jump_map_ = new Label[nmaxops];
 }
 
 Compiler::~Compiler()
@@ -146,10 +165,18 @@ Compiler::~Compiler()
 
 CompiledFunction *
 Compiler::emit(int *errp)
+{
+  if (!assemble(errp))
+    return NULL;
+  return link(errp);
+}
+
+bool
+Compiler::assemble(int *errp)
 {
   if (cip_ >= code_end_ || *cip_ != OP_PROC) {
     *errp = SP_ERROR_INVALID_INSTRUCTION;
-    return NULL;
+    return false;
   }
 
 #if defined JIT_SPEW
@@ -161,27 +188,31 @@ Compiler::emit(int *errp)
   SpewOpcode(rt_, code_start_, cip_);
 #endif
 
-  const cell_t *codeseg = reinterpret_cast<const cell_t *>(rt_->code().bytes);
+  // Find the extent of the function and its jump targets first, so labels
+  // are only needed for this function rather than the whole code section.
+  if ((*errp = analysis_.analyze()) != SP_ERROR_NONE)
+    return false;
+  analysis_.analyzeStackDepths();
+  ranges_.analyze();
+  jump_map_ = new Label[analysis_.ncells()];
 
+  // PROC can throw, so errors are reported at the start of the function.
+  op_cip_ = cip_;
   cip_++;
   if (!emitOp(OP_PROC)) {
       *errp = (error_ == SP_ERROR_NONE) ? SP_ERROR_OUT_OF_MEMORY : error_;
-      return NULL;
+      return false;
   }
 
-  while (cip_ < code_end_) {
-    // If we reach the end of this function, or the beginning of a new
-    // procedure, then stop.
-    if (*cip_ == OP_PROC || *cip_ == OP_ENDPROC)
-      break;
-
+  while (cip_ < analysis_.end()) {
 #if defined JIT_SPEW
     SpewOpcode(rt_, code_start_, cip_);
 #endif
 
-    // We assume every instruction is a jump target, so before emitting
-    // an opcode, we bind its corresponding label.
-    __ bind(&jump_map_[cip_ - codeseg]);
+    // Bind a label for each instruction that is jumped to.
+    size_t index = cip_ - code_start_;
+    if (analysis_.isJumpTarget(index))
+      __ bind(&jump_map_[index]);
 
     // Save the start of the opcode for emitCipMap().
     op_cip_ = cip_;
@@ -189,7 +220,7 @@ Compiler::emit(int *errp)
     OPCODE op = (OPCODE)readCell();
     if (!emitOp(op) || error_ != SP_ERROR_NONE) {
       *errp = (error_ == SP_ERROR_NONE) ? SP_ERROR_OUT_OF_MEMORY : error_;
-      return NULL;
+      return false;
     }
   }
 
@@ -206,7 +237,12 @@ Compiler::emit(int *errp)
 
   // This has to come last.
   emitErrorPaths();
+  return true;
+}
 
+CompiledFunction *
+Compiler::link(int *errp)
+{
   CodeChunk code = LinkCode(env_, masm);
   if (!code.address()) {
     *errp = SP_ERROR_OUT_OF_MEMORY;
@@ -228,20 +264,6 @@ Compiler::emit(int *errp)
   return new CompiledFunction(code, pcode_start_, edges.take(), cipmap.take());
 }
 
-// No exit frame - error code is returned directly.
-static int
-InvokePushTracker(PluginContext *cx, uint32_t amount)
-{
-  return cx->pushTracker(amount);
-}
-
-// No exit frame - error code is returned directly.
-static int
-InvokePopTrackerAndSetHeap(PluginContext *cx)
-{
-  return cx->popTrackerAndSetHeap();
-}
-
 // No exit frame - error code is returned directly.
 static int
 InvokeGenerateFullArray(PluginContext *cx, uint32_t argc, cell_t *argv, int autozero)
@@ -266,16 +288,14 @@ InvokeReportTimeout()
 }
 
 // Find the |ebp| associated with the entry frame. We use this to drop out of
-// the entire scripted call stack.
+// the entire scripted call stack. This walks the raw frame chain, because
+// FrameIterator steps over the entry frames of tier-up calls.
 static void *
 find_entry_fp()
 {
-  void *fp = nullptr;
-  for (FrameIterator iter; !iter.Done(); iter.Next()) {
-    if (iter.IsEntryFrame())
-      break;
-    fp = iter.Frame()->prev_fp;
-  }
+  intptr_t *fp = Environment::get()->exit_fp();
+  while (FrameLayout::FromFp(fp)->frame_type != FrameType::Entry)
+    fp = FrameLayout::FromFp(fp)->prev_fp;
 
   assert(fp);
   return fp;
@@ -439,6 +459,13 @@ Compiler::emitOp(OPCODE op)
       __ movl(frm, stk);
       __ subl(tmp, dat);
       __ movl(Operand(frmAddr()), tmp);
+
+      // Calls only push, so check here that recursion has not run the stack
+      // into the heap.
+      __ movl(tmp, Operand(hpAddr()));
+      __ lea(tmp, Operand(dat, tmp, NoScale, STACK_MARGIN));
+      __ cmpl(stk, tmp);
+      jumpOnError(below, SP_ERROR_STACKLOW);
       break;
 
     case OP_IDXADDR_B:
@@ -554,7 +581,7 @@ Compiler::emitOp(OPCODE op)
     case OP_INC_PRI:
     case OP_INC_ALT:
     {
-      Register reg = (OP_INC_PRI) ? pri : alt;
+      Register reg = (op == OP_INC_PRI) ? pri : alt;
       __ addl(reg, 1);
       break;
     }
@@ -1151,36 +1178,34 @@ Compiler::emitOp(OPCODE op)
     {
       cell_t amount = readCell();
 
-      __ push(pri);
-      __ push(alt);
-
-      __ push(amount * 4);
-      __ push(intptr_t(rt_->GetBaseContext()));
-      __ call(ExternalAddress((void *)InvokePushTracker));
-      __ addl(esp, 8);
-      __ testl(eax, eax);
-      jumpOnError(not_zero);
-
-      __ pop(alt);
-      __ pop(pri);
+      // Same as PluginContext::pushTracker(). The tracker never moves, so
+      // its limit is a constant.
+      __ movl(tmp, Operand(trackerCurAddr()));
+      __ cmpl(tmp, intptr_t(context_->tracker().pLimit));
+      jumpOnError(not_below, SP_ERROR_TRACKER_BOUNDS);
+      __ movl(Operand(tmp, 0), amount * 4);
+      __ addl(Operand(trackerCurAddr()), sizeof(cell_t));
       break;
     }
 
     case OP_TRACKER_POP_SETHEAP:
     {
-      // Save registers.
-      __ push(pri);
+      // Same as PluginContext::popTrackerAndSetHeap().
+      __ movl(tmp, Operand(trackerCurAddr()));
+      __ cmpl(tmp, intptr_t(context_->tracker().pBase));
+      jumpOnError(below_equal, SP_ERROR_TRACKER_BOUNDS);
+      __ subl(tmp, sizeof(cell_t));
+      __ movl(Operand(trackerCurAddr()), tmp);
+
+      // The amount must not exceed hp - data size, compared unsigned.
+      __ movl(tmp, Operand(tmp, 0));
       __ push(alt);
-
-      // Get the context pointer and call the sanity checker.
-      __ push(intptr_t(rt_->GetBaseContext()));
-      __ call(ExternalAddress((void *)InvokePopTrackerAndSetHeap));
-      __ addl(esp, 4);
-      __ testl(eax, eax);
-      jumpOnError(not_zero);
-
+      __ movl(alt, Operand(hpAddr()));
+      __ subl(alt, context_->DataSize());
+      __ cmpl(tmp, alt);
       __ pop(alt);
-      __ pop(pri);
+      jumpOnError(above, SP_ERROR_HEAPMIN);
+      __ subl(Operand(hpAddr()), tmp);
       break;
     }
 
@@ -1201,6 +1226,8 @@ Compiler::emitOp(OPCODE op)
     case OP_BOUNDS:
     {
       cell_t value = readCell();
+      if (ranges_.isCheckRedundant(op_cip_ - code_start_))
+        break;
       __ cmpl(eax, value);
       jumpOnError(above, SP_ERROR_ARRAY_BOUNDS);
       break;
@@ -1254,24 +1281,24 @@ Compiler::emitOp(OPCODE op)
 Label *
 Compiler::labelAt(size_t offset)
 {
-  if (offset % 4 != 0 ||
-      offset > rt_->code().length ||
-      offset <= pcode_start_)
-  {
-    // If the jump target is misaligned, or out of pcode bounds, or is an
-    // address out of the function bounds, we abort. Unfortunately we can't
-    // test beyond the end of the function since we don't have a precursor
-    // pass (yet).
+  // The analysis pass has already rejected jumps that are misaligned, or
+  // that do not land on an instruction inside this function.
+  size_t index;
+  if (!analysis_.findOp(offset, &index) || !analysis_.isJumpTarget(index)) {
     error_ = SP_ERROR_INSTRUCTION_PARAM;
     return NULL;
   }
 
-  return &jump_map_[offset / sizeof(cell_t)];
+  return &jump_map_[index];
 }
 
 void
 Compiler::emitCheckAddress(Register reg)
 {
+  // Leave out checks that the range analysis proved always pass.
+  if (ranges_.isCheckRedundant(op_cip_ - code_start_))
+    return;
+
   // Check if we're in memory bounds.
   __ cmpl(reg, context_->HeapSize());
   jumpOnError(not_below, SP_ERROR_MEMACCESS);
@@ -1294,24 +1321,32 @@ Compiler::emitGenArray(bool autozero)
   {
     // flat array; we can generate this without indirection tables.
     // Note that we can overwrite ALT because technically STACK should be destroying ALT
-    __ movl(alt, Operand(hpAddr()));
+    // The checks match PluginContext::generateArray(): the size in bytes must
+    // fit in 32 bits, and must be less than the space left below the stack.
     __ movl(tmp, Operand(stk, 0));
+    __ cmpl(tmp, int32_t(UINT_MAX / sizeof(cell_t)));
+    jumpOnError(above, SP_ERROR_ARRAY_TOO_BIG);
+    __ movl(alt, stk);
+    __ subl(alt, dat);
+    __ subl(alt, Operand(hpAddr()));
+    __ shll(tmp, 2);
+    __ cmpl(tmp, alt);
+    jumpOnError(not_below, SP_ERROR_HEAPLOW);
+    __ shrl(tmp, 2);
+
+    __ movl(alt, Operand(hpAddr()));
     __ movl(Operand(stk, 0), alt);    // store base of the array into the stack.
     __ lea(alt, Operand(alt, tmp, ScaleFour));
     __ movl(Operand(hpAddr()), alt);
-    __ addl(alt, dat);
-    __ cmpl(alt, stk);
-    jumpOnError(not_below, SP_ERROR_HEAPLOW);
 
+    // Push the size in bytes onto the tracker. ALT is free again.
+    __ movl(alt, Operand(trackerCurAddr()));
+    __ cmpl(alt, intptr_t(context_->tracker().pLimit));
+    jumpOnError(not_below, SP_ERROR_TRACKER_BOUNDS);
     __ shll(tmp, 2);
-    __ push(tmp);
-    __ push(intptr_t(rt_->GetBaseContext()));
-    __ call(ExternalAddress((void *)InvokePushTracker));
-    __ addl(esp, 4);
-    __ pop(tmp);
+    __ movl(Operand(alt, 0), tmp);
     __ shrl(tmp, 2);
-    __ testl(eax, eax);
-    jumpOnError(not_zero);
+    __ addl(Operand(trackerCurAddr()), sizeof(cell_t));
 
     if (autozero) {
       // Note - tmp is ecx and still intact.
@@ -1360,11 +1395,14 @@ Compiler::emitCall()
     return false;
   }
 
-  CompiledFunction *fun = rt_->GetJittedFunctionByOffset(offset);
+  // Off the main thread, the runtime's function map may be changing under
+  // us, so every call goes through a thunk.
+  CompiledFunction *fun = off_thread_ ? nullptr : rt_->GetJittedFunctionByOffset(offset);
   if (!fun) {
     // Need to emit a delayed thunk.
     CallThunk *thunk = new CallThunk(offset);
     __ call(&thunk->call);
+    thunk->return_pc = masm.pc();
     if (!thunks_.append(thunk))
       return false;
   } else {
@@ -1447,6 +1485,24 @@ Compiler::emitSysreqN()
     uint32_t replacement = rt_->GetNativeReplacement(native_index);
     if (replacement != OP_NOP)
       return emitOp((OPCODE)replacement);
+
+    SP_INTRINSIC intrinsic = rt_->GetNativeIntrinsic(native_index, nparams);
+    if (intrinsic >= SP_INTRINSIC_VECTOR_ADD && intrinsic <= SP_INTRINSIC_VECTOR_LENGTH &&
+        !MacroAssemblerX86::Features().sse2)
+    {
+      intrinsic = SP_INTRINSIC_NONE;
+    }
+    if (intrinsic != SP_INTRINSIC_NONE) {
+      emitIntrinsic(intrinsic);
+      __ addl(stk, nparams * sizeof(cell_t));
+      return true;
+    }
+
+    if (native->fast.func && native->fast.nargs == nparams) {
+      emitFastNativeCall(native_index, native);
+      __ addl(stk, nparams * sizeof(cell_t));
+      return true;
+    }
   }
 
   // Store the number of parameters on the stack.
@@ -1459,6 +1515,211 @@ Compiler::emitSysreqN()
   return true;
 }
 
+// Call a fast native directly, with its arguments on the C stack. The
+// arguments are on the pawn stack, and are popped by the caller. A fast
+// native cannot fail or re-enter the VM, so there is no exit frame, and only
+// ALT needs saving.
+void
+Compiler::emitFastNativeCall(uint32_t native_index, NativeEntry *native)
+{
+  const sp_fastnative_t &fast = native->fast;
+
+  // Check references before setting anything up, so errors need no cleanup.
+  // pri is about to be overwritten by the return value anyway.
+  for (uint32_t i = 0; i < fast.nargs; i++) {
+    if (fast.args[i] != SP_FASTARG_REF)
+      continue;
+    __ movl(pri, Operand(stk, i * sizeof(cell_t)));
+    emitCheckAddress(pri);
+  }
+
+  // Reserve space for the arguments and ALT, keeping the stack aligned. ALT
+  // goes in the last slot, so the first is free to spill a float return.
+  int32_t frame_size = Align((fast.nargs + 1) * sizeof(intptr_t), 16);
+  __ subl(esp, frame_size);
+  __ movl(Operand(esp, frame_size - sizeof(intptr_t)), alt);
+
+  for (uint32_t i = 0; i < fast.nargs; i++) {
+    __ movl(tmp, Operand(stk, i * sizeof(cell_t)));
+    if (fast.args[i] == SP_FASTARG_REF)
+      __ addl(tmp, dat);
+    __ movl(Operand(esp, i * sizeof(intptr_t)), tmp);
+  }
+
+  __ call(ExternalAddress(fast.func));
+
+  // Floats are returned on the FPU stack.
+  if (fast.ret == SP_FASTARG_FLOAT) {
+    __ fstp32(Operand(esp, 0));
+    __ movl(pri, Operand(esp, 0));
+  }
+
+  // Restore ALT.
+  __ movl(alt, Operand(esp, frame_size - sizeof(intptr_t)));
+  __ addl(esp, frame_size);
+}
+
+static const FloatRegister kVectorRegs[] = { xmm0, xmm1, xmm2 };
+
+// Emit an intrinsic in place of a native call. The arguments are on the
+// stack, and are popped by the caller. ALT must be preserved, as it would be
+// across the call. The vector intrinsics require SSE2.
+void
+Compiler::emitIntrinsic(SP_INTRINSIC intrinsic)
+{
+  switch (intrinsic) {
+    case SP_INTRINSIC_ABS:
+    {
+      Label done;
+      __ movl(pri, Operand(stk, 0));
+      __ testl(pri, pri);
+      __ j(not_negative, &done);
+      __ negl(pri);
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_MIN:
+    case SP_INTRINSIC_MAX:
+    {
+      Label done;
+      __ movl(pri, Operand(stk, 0));
+      __ cmpl(pri, Operand(stk, 4));
+      __ j(intrinsic == SP_INTRINSIC_MIN ? less_equal : greater_equal, &done);
+      __ movl(pri, Operand(stk, 4));
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_CLAMP:
+    {
+      Label above_min, done;
+      __ movl(pri, Operand(stk, 0));
+      __ cmpl(pri, Operand(stk, 4));
+      __ j(greater_equal, &above_min);
+      __ movl(pri, Operand(stk, 4));
+      __ jmp(&done);
+      __ bind(&above_min);
+      __ cmpl(pri, Operand(stk, 8));
+      __ j(less_equal, &done);
+      __ movl(pri, Operand(stk, 8));
+      __ bind(&done);
+      break;
+    }
+
+    case SP_INTRINSIC_BIT_TEST:
+      // Shifts only use the low five bits of cl.
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, 4));
+      __ shrl_cl(pri);
+      __ andl(pri, 1);
+      break;
+
+    case SP_INTRINSIC_BIT_COUNT:
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, pri);
+      __ shrl(tmp, 1);
+      __ andl(tmp, 0x55555555);
+      __ subl(pri, tmp);
+      __ movl(tmp, pri);
+      __ shrl(tmp, 2);
+      __ andl(tmp, 0x33333333);
+      __ andl(pri, 0x33333333);
+      __ addl(pri, tmp);
+      __ movl(tmp, pri);
+      __ shrl(tmp, 4);
+      __ addl(pri, tmp);
+      __ andl(pri, 0x0f0f0f0f);
+      __ imull(pri, pri, 0x01010101);
+      __ shrl(pri, 24);
+      break;
+
+    case SP_INTRINSIC_VECTOR_ADD:
+    case SP_INTRINSIC_VECTOR_SUB:
+      emitCheckVector(0);
+      emitCheckVector(4);
+      emitCheckVector(8);
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, 4));
+      for (int32_t i = 0; i < 3; i++) {
+        __ movss(kVectorRegs[i], Operand(dat, pri, NoScale, i * 4));
+        if (intrinsic == SP_INTRINSIC_VECTOR_ADD)
+          __ addss(kVectorRegs[i], Operand(dat, tmp, NoScale, i * 4));
+        else
+          __ subss(kVectorRegs[i], Operand(dat, tmp, NoScale, i * 4));
+      }
+      __ movl(pri, Operand(stk, 8));
+      for (int32_t i = 0; i < 3; i++)
+        __ movss(Operand(dat, pri, NoScale, i * 4), kVectorRegs[i]);
+      break;
+
+    case SP_INTRINSIC_VECTOR_DOT:
+    case SP_INTRINSIC_VECTOR_LENGTH:
+    {
+      // The length is the square root of the vector's dot product with
+      // itself.
+      int32_t other = (intrinsic == SP_INTRINSIC_VECTOR_DOT) ? 4 : 0;
+      emitCheckVector(0);
+      if (other)
+        emitCheckVector(other);
+      __ movl(pri, Operand(stk, 0));
+      __ movl(tmp, Operand(stk, other));
+
+      // Sum the products in the same order as the usual C++ natives.
+      __ movss(xmm0, Operand(dat, pri, NoScale, 0));
+      __ mulss(xmm0, Operand(dat, tmp, NoScale, 0));
+      for (int32_t i = 1; i < 3; i++) {
+        __ movss(xmm1, Operand(dat, pri, NoScale, i * 4));
+        __ mulss(xmm1, Operand(dat, tmp, NoScale, i * 4));
+        __ addss(xmm0, xmm1);
+      }
+      if (intrinsic == SP_INTRINSIC_VECTOR_LENGTH) {
+        Label squared;
+        __ cmpl(Operand(stk, 4), 0);
+        __ j(not_zero, &squared);
+        __ sqrtss(xmm0, xmm0);
+        __ bind(&squared);
+      }
+      __ movd(pri, xmm0);
+      break;
+    }
+
+    case SP_INTRINSIC_STRLEN:
+    {
+      Label loop, done;
+      __ movl(pri, Operand(stk, 0));
+      emitCheckAddress(pri);
+      __ lea(tmp, Operand(dat, pri, NoScale));
+      __ bind(&loop);
+      __ movzxb(pri, Operand(tmp, 0));
+      __ testl(pri, pri);
+      __ j(zero, &done);
+      __ addl(tmp, 1);
+      __ jmp(&loop);
+      __ bind(&done);
+      __ subl(tmp, dat);
+      __ subl(tmp, Operand(stk, 0));
+      __ movl(pri, tmp);
+      break;
+    }
+
+    default:
+      assert(false);
+      break;
+  }
+}
+
+// Check that all three cells of the vector passed in the argument at
+// |offset| are valid. This clobbers pri.
+void
+Compiler::emitCheckVector(int32_t offset)
+{
+  __ movl(pri, Operand(stk, offset));
+  emitCheckAddress(pri);
+  __ addl(pri, 2 * sizeof(cell_t));
+  emitCheckAddress(pri);
+}
+
 bool
 Compiler::emitSysreqC()
 {
@@ -1475,6 +1736,14 @@ Compiler::emitSysreqC()
 bool
 Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
 {
+  if (native->status == SP_NATIVE_BOUND &&
+      (native->flags & (SP_NTVFLAG_LEAF|SP_NTVFLAG_EPHEMERAL|SP_NTVFLAG_OPTIONAL)) ==
+        SP_NTVFLAG_LEAF)
+  {
+    emitLeafNativeCall(native_index, native);
+    return true;
+  }
+
   DataLabel return_address;
   __ enterInlineExitFrame(ExitFrameType::Native, native_index, &return_address);
 
@@ -1499,7 +1768,14 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
   // Save the old heap pointer.
   __ push(Operand(hpAddr()));
 
-  // Push the last parameter for the C++ function.
+  // Linked natives skip the stub, and take the native's entry as a third
+  // parameter.
+  bool linked = immutable && native->is_linked;
+  if (linked)
+    __ push(intptr_t(native));
+  int32_t nargs = linked ? 3 : 2;
+
+  // Push the second parameter for the C++ function.
   __ push(stk);
 
   // Relocate our absolute stk to be dat-relative, and update the context's
@@ -1511,7 +1787,9 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
   __ push(intptr_t(rt_->GetBaseContext()));
 
   // Invoke the native.
-  if (immutable)
+  if (linked)
+    __ call(ExternalAddress((void *)InvokeLinkedNative));
+  else if (immutable)
     __ call(ExternalAddress((void *)native->legacy_fn));
   else
     __ call(edx);
@@ -1520,11 +1798,11 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
   emitCipMapping(op_cip_);
 
   // Restore the heap pointer.
-  __ movl(edx, Operand(esp, 2 * sizeof(intptr_t)));
+  __ movl(edx, Operand(esp, nargs * sizeof(intptr_t)));
   __ movl(Operand(hpAddr()), edx);
 
   // Restore ALT.
-  __ movl(edx, Operand(esp, 3 * sizeof(intptr_t)));
+  __ movl(edx, Operand(esp, (nargs + 1) * sizeof(intptr_t)));
 
   // Restore SP.
   __ addl(stk, dat);
@@ -1541,20 +1819,39 @@ Compiler::emitLegacyNativeCall(uint32_t native_index, NativeEntry* native)
   return true;
 }
 
+// Call a native that has promised not to throw, call into a plugin, or use
+// the heap. It still gets an exit frame, so stack traces taken from inside it
+// work, but the heap pointer is not saved, the context's sp is not updated,
+// and there is no exception check afterward.
+void
+Compiler::emitLeafNativeCall(uint32_t native_index, NativeEntry* native)
+{
+  DataLabel return_address;
+  __ enterInlineExitFrame(ExitFrameType::Native, native_index, &return_address);
+
+  // Save ALT, and push the parameters.
+  __ push(edx);
+  __ push(stk);
+  __ push(intptr_t(rt_->GetBaseContext()));
+
+  __ call(ExternalAddress((void *)native->legacy_fn));
+  __ bind(&return_address);
+  emitCipMapping(op_cip_);
+
+  // Restore ALT.
+  __ movl(edx, Operand(esp, 2 * sizeof(intptr_t)));
+
+  __ leaveExitFrame();
+  __ addl(esp, 4);
+}
+
 bool
 Compiler::emitSwitch()
 {
+  // The analysis pass has checked that this is a case table in this function.
   cell_t offset = readCell();
-  if (!labelAt(offset))
-    return false;
-
   cell_t *tbl = (cell_t *)((char *)rt_->code().bytes + offset + sizeof(cell_t));
 
-  struct Entry {
-    cell_t val;
-    cell_t offset;
-  };
-
   size_t ncases = *tbl++;
 
   Label *defaultCase = labelAt(*tbl);
@@ -1567,77 +1864,98 @@ Compiler::emitSwitch()
     return true;
   }
 
-  Entry *cases = (Entry *)(tbl + 1);
+  const CaseEntry *cases = (const CaseEntry *)(tbl + 1);
 
-  // Degenerate - 1 case.
-  if (ncases == 1) {
-    Label *maybe = labelAt(cases[0].offset);
-    if (!maybe)
-      return false;
-    __ cmpl(pri, cases[0].val);
-    __ j(equal, maybe);
-    __ jmp(defaultCase);
-    return true;
+  // The interpreter takes the first case that matches. The compiler sorts
+  // case tables, but if one is not strictly ascending, test each case in
+  // order like the interpreter does.
+  for (size_t i = 1; i < ncases; i++) {
+    if (cases[i].val <= cases[i - 1].val)
+      return emitCaseChain(cases, ncases, defaultCase);
   }
+  return emitCaseRange(cases, ncases, defaultCase);
+}
 
-  // We have two or more cases, so let's generate a full switch. Decide
-  // whether we'll make an if chain, or a jump table, based on whether
-  // the numbers are strictly sequential.
-  bool sequential = true;
-  {
-    cell_t first = cases[0].val;
-    cell_t last = first;
-    for (size_t i = 1; i < ncases; i++) {
-      if (cases[i].val != ++last) {
-        sequential = false;
-        break;
-      }
-    }
+// Runs of at most this many cases are tested one by one.
+static const size_t kMaxCaseChain = 4;
+
+// A run of cases becomes a jump table if at least one in this many slots
+// would be used, and the table is no larger than kMaxCaseTable slots.
+static const int64_t kCaseTableDensity = 3;
+static const int64_t kMaxCaseTable = 4096;
+
+// Emit a search for pri in a sorted run of cases. A dense run becomes a jump
+// table, with the holes going to the default case. Otherwise the run is split
+// in two around its middle value, and each half is lowered the same way, so
+// large sparse switches become a binary search over small compare chains and
+// dense clusters.
+bool
+Compiler::emitCaseRange(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  if (ncases <= kMaxCaseChain)
+    return emitCaseChain(cases, ncases, defaultCase);
+
+  int64_t slots = int64_t(cases[ncases - 1].val) - int64_t(cases[0].val) + 1;
+  if (slots <= kMaxCaseTable && slots <= int64_t(ncases) * kCaseTableDensity)
+    return emitCaseTable(cases, ncases, defaultCase);
+
+  size_t mid = ncases / 2;
+  Label lower;
+  __ cmpl(pri, cases[mid].val);
+  __ j(less, &lower);
+  bool ok = emitCaseRange(cases + mid, ncases - mid, defaultCase);
+  __ bind(&lower);
+  return ok && emitCaseRange(cases, mid, defaultCase);
+}
+
+bool
+Compiler::emitCaseChain(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  for (size_t i = 0; i < ncases; i++) {
+    Label *label = labelAt(cases[i].offset);
+    if (!label)
+      return false;
+    __ cmpl(pri, cases[i].val);
+    __ j(equal, label);
   }
+  __ jmp(defaultCase);
+  return true;
+}
 
-  // First check whether the bounds are correct: if (a < LOW || a > HIGH);
-  // this check is valid whether or not we emit a sequential-optimized switch.
+bool
+Compiler::emitCaseTable(const CaseEntry *cases, size_t ncases, Label *defaultCase)
+{
+  // Rebase pri so the first case is 0. Values below it wrap around to large
+  // unsigned numbers, so one compare checks both bounds.
   cell_t low = cases[0].val;
-  if (low != 0) {
-    // negate it so we'll get a lower bound of 0.
-    low = -low;
-    __ lea(tmp, Operand(pri, low));
-  } else {
+  cell_t high = cases[ncases - 1].val;
+  if (low != 0)
+    __ lea(tmp, Operand(pri, cell_t(0u - uint32_t(low))));
+  else
     __ movl(tmp, pri);
-  }
-
-  cell_t high = abs(cases[0].val - cases[ncases - 1].val);
-  __ cmpl(tmp, high);
+  __ cmpl(tmp, cell_t(uint32_t(high) - uint32_t(low)));
   __ j(above, defaultCase);
 
-  if (sequential) {
-    // Optimized table version. The tomfoolery below is because we only have
-    // one free register... it seems unlikely pri or alt will be used given
-    // that we're at the end of a control-flow point, but we'll play it safe.
-    DataLabel table;
-    __ push(eax);
-    __ movl(eax, &table);
-    __ movl(ecx, Operand(eax, ecx, ScaleFour));
-    __ pop(eax);
-    __ jmp(ecx);
-
-    __ bind(&table);
-    for (size_t i = 0; i < ncases; i++) {
-      Label *label = labelAt(cases[i].offset);
-      if (!label)
-        return false;
-      __ emit_absolute_address(label);
-    }
-  } else {
-    // Slower version. Go through each case and generate a check.
-    for (size_t i = 0; i < ncases; i++) {
-      Label *label = labelAt(cases[i].offset);
-      if (!label)
+  // The tomfoolery below is because we only have one free register... it
+  // seems unlikely pri or alt will be used given that we're at the end of a
+  // control-flow point, but we'll play it safe.
+  DataLabel table;
+  __ push(eax);
+  __ movl(eax, &table);
+  __ movl(ecx, Operand(eax, ecx, ScaleFour));
+  __ pop(eax);
+  __ jmp(ecx);
+
+  __ bind(&table);
+  size_t i = 0;
+  for (int64_t value = low; value <= high; value++) {
+    Label *label = defaultCase;
+    if (cases[i].val == value) {
+      if ((label = labelAt(cases[i].offset)) == nullptr)
         return false;
-      __ cmpl(pri, cases[i].val);
-      __ j(equal, label);
+      i++;
     }
-    __ jmp(defaultCase);
+    __ emit_absolute_address(label);
   }
   return true;
 }
@@ -1747,6 +2065,8 @@ Compiler::emitErrorPaths()
   emitThrowPathIfNeeded(SP_ERROR_MEMACCESS);
   emitThrowPathIfNeeded(SP_ERROR_HEAPLOW);
   emitThrowPathIfNeeded(SP_ERROR_HEAPMIN);
+  emitThrowPathIfNeeded(SP_ERROR_ARRAY_TOO_BIG);
+  emitThrowPathIfNeeded(SP_ERROR_TRACKER_BOUNDS);
   emitThrowPathIfNeeded(SP_ERROR_INTEGER_OVERFLOW);
   emitThrowPathIfNeeded(SP_ERROR_INVALID_NATIVE);
 
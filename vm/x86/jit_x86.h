@@ -23,6 +23,8 @@
 #include "plugin-runtime.h"
 #include "plugin-context.h"
 #include "compiled-function.h"
+#include "function-analysis.h"
+#include "range-analysis.h"
 #include "opcodes.h"
 #include "macro-assembler-x86.h"
 
@@ -76,9 +78,12 @@ struct CallThunk
 {
   SilentLabel call;
   cell_t pcode_offset;
+  // The return address of the call, relative to the start of the code.
+  uint32_t return_pc;
 
   CallThunk(cell_t pcode_offset)
-    : pcode_offset(pcode_offset)
+    : pcode_offset(pcode_offset),
+      return_pc(0)
   {
   }
 };
@@ -86,23 +91,50 @@ struct CallThunk
 class Compiler
 {
  public:
-  Compiler(PluginRuntime *rt, cell_t pcode_offs);
+  Compiler(PluginRuntime *rt, cell_t pcode_offs, bool off_thread);
   ~Compiler();
 
   sp::CompiledFunction *emit(int *errp);
 
+  // emit() is split in two for background compilation. assemble() may run
+  // on any thread if |off_thread| was set, since it does not look at
+  // anything the main thread can change. link() must run on the main thread.
+  bool assemble(int *errp);
+  sp::CompiledFunction *link(int *errp);
+
+  cell_t pcode_offset() const {
+    return pcode_start_;
+  }
+  // Calls to functions that were not compiled yet.
+  const ke::Vector<CallThunk *> &callThunks() const {
+    return thunks_;
+  }
+
  private:
   bool setup(cell_t pcode_offs);
   bool emitOp(sp::OPCODE op);
   cell_t readCell();
 
  private:
+  // An entry in a CASETBL.
+  struct CaseEntry {
+    cell_t val;
+    cell_t offset;
+  };
+
   Label *labelAt(size_t offset);
   bool emitCall();
   bool emitSysreqN();
   bool emitLegacyNativeCall(uint32_t native_index, NativeEntry* native);
+  void emitLeafNativeCall(uint32_t native_index, NativeEntry* native);
   bool emitSysreqC();
+  void emitIntrinsic(SP_INTRINSIC intrinsic);
+  void emitFastNativeCall(uint32_t native_index, NativeEntry *native);
+  void emitCheckVector(int32_t offset);
   bool emitSwitch();
+  bool emitCaseRange(const CaseEntry *cases, size_t ncases, Label *defaultCase);
+  bool emitCaseChain(const CaseEntry *cases, size_t ncases, Label *defaultCase);
+  bool emitCaseTable(const CaseEntry *cases, size_t ncases, Label *defaultCase);
   void emitGenArray(bool autozero);
   void emitCallThunks();
   void emitCheckAddress(Register reg);
@@ -121,6 +153,9 @@ class Compiler
   ExternalAddress spAddr() {
     return ExternalAddress(context_->addressOfSp());
   }
+  ExternalAddress trackerCurAddr() {
+    return ExternalAddress(context_->addressOfTrackerCur());
+  }
 
   // Map a return address (i.e. an exit point from a function) to its source
   // cip. This lets us avoid tracking the cip during runtime. These are
@@ -144,7 +179,10 @@ class Compiler
   const cell_t *cip_;
   const cell_t *op_cip_;
   const cell_t *code_end_;
+  FunctionAnalysis analysis_;
+  RangeAnalysis ranges_;
   Label *jump_map_;
+  bool off_thread_;
   ke::Vector<BackwardJump> backward_jumps_;
   ke::Vector<CipMapEntry> cip_map_;
 
@@ -168,6 +206,16 @@ const Register frm = ebx;
 CompiledFunction *
 CompileFunction(PluginRuntime *prt, cell_t pcode_offs, int *err);
 
+// Point a call that goes through a thunk directly at its target, given the
+// call's return address.
+void
+PatchCallThunk(uint8_t *pc, CompiledFunction *fn);
+
+// Identifies this build of the JIT to the code cache. Returns null if the
+// JIT's output cannot be cached.
+const char *
+CodeCacheBuildId();
+
 }
 
 #endif //_INCLUDE_SOURCEPAWN_JIT_X86_H_